@@ -67,6 +67,12 @@ lc_preadv(int fd, struct iovec *iov, int iovcnt, off_t offset) {
     return count;
 }
 
+/* Direct I/O is requested with fcntl(2), which is not passed down */
+static inline bool
+lc_directIO(int flags) {
+    return false;
+}
+
 /* Validate a lock is held */
 static inline void
 lc_lockOwned(pthread_rwlock_t *lock, bool exclusive) {
@@ -33,7 +33,7 @@ lc_insertPagesToFreeList(struct lbcache *lbcache, struct page *first,
     assert(first->p_fprev == NULL);
     assert(last->p_fnext == NULL);
 
-    pthread_mutex_lock(&lbcache->lb_flock);
+    lc_mutexLock(&lbcache->lb_flock, LC_LOCK_FREE);
     if (lbcache->lb_ftail) {
         lbcache->lb_ftail->p_fnext = first;
         first->p_fprev = lbcache->lb_ftail;
@@ -42,7 +42,7 @@ lc_insertPagesToFreeList(struct lbcache *lbcache, struct page *first,
         lbcache->lb_fhead = first;
     }
     lbcache->lb_ftail = last;
-    pthread_mutex_unlock(&lbcache->lb_flock);
+    lc_mutexUnlock(&lbcache->lb_flock, LC_LOCK_FREE);
 }
 
 /* Remove a page from freelist */
@@ -99,9 +99,9 @@ lc_freePage(struct gfs *gfs, struct fs *fs, struct page *page) {
 
     /* Remove the page from free list */
     if (!page->p_nohash) {
-        pthread_mutex_lock(&lbcache->lb_flock);
+        lc_mutexLock(&lbcache->lb_flock, LC_LOCK_FREE);
         lc_removePageFromFreeList(lbcache, page);
-        pthread_mutex_unlock(&lbcache->lb_flock);
+        lc_mutexUnlock(&lbcache->lb_flock, LC_LOCK_FREE);
     }
     assert(page->p_fprev == NULL);
     assert(page->p_fnext == NULL);
@@ -187,14 +187,14 @@ static inline uint32_t
 lc_pcLockHash(struct fs *fs, uint64_t hash) {
     uint32_t lhash = lc_lockHash(fs, hash);
 
-    pthread_mutex_lock(&fs->fs_bcache->lb_pcacheLocks[lhash]);
+    lc_mutexLock(&fs->fs_bcache->lb_pcacheLocks[lhash], LC_LOCK_PCACHE);
     return lhash;
 }
 
 /* Unlock a hash list */
 static inline void
 lc_pcUnLockHash(struct fs *fs, uint32_t lhash) {
-    pthread_mutex_unlock(&fs->fs_bcache->lb_pcacheLocks[lhash]);
+    lc_mutexUnlock(&fs->fs_bcache->lb_pcacheLocks[lhash], LC_LOCK_PCACHE);
 }
 
 /* Return the read cluster block number */
@@ -208,14 +208,14 @@ static inline uint32_t
 lc_lockPageRead(struct fs *fs, uint64_t block) {
     uint32_t lhash = lc_lockHash(fs, lc_clusterBlock(block));
 
-    pthread_mutex_lock(&fs->fs_bcache->lb_pioLocks[lhash]);
+    lc_mutexLock(&fs->fs_bcache->lb_pioLocks[lhash], LC_LOCK_PIO);
     return lhash;
 }
 
 /* Unlock a lock taken during page read */
 static inline void
 lc_unlockPageRead(struct fs *fs, uint32_t lhash) {
-    pthread_mutex_unlock(&fs->fs_bcache->lb_pioLocks[lhash]);
+    lc_mutexUnlock(&fs->fs_bcache->lb_pioLocks[lhash], LC_LOCK_PIO);
 }
 
 /* Remove pages from page cache and free the hash table */
@@ -406,14 +406,14 @@ lc_releaseReadPages(struct gfs *gfs, struct fs *fs, struct page **pages,
 
     /* Move pages to the tail of the freelist */
     if (recycle && !nocache) {
-        pthread_mutex_lock(&lbcache->lb_flock);
+        lc_mutexLock(&lbcache->lb_flock, LC_LOCK_FREE);
         for (i = 0; i < pcount; i++) {
             if (!pages[i]->p_nocache) {
                 lc_removePageFromFreeList(lbcache, pages[i]);
                 lc_insertPageToFreeList(lbcache, pages[i]);
             }
         }
-        pthread_mutex_unlock(&lbcache->lb_flock);
+        lc_mutexUnlock(&lbcache->lb_flock, LC_LOCK_FREE);
     }
     for (i = 0; i < pcount; i++) {
         lc_releasePage(gfs, fs, pages[i], true, nocache);
@@ -600,6 +600,14 @@ retry:
     } else if (hit) {
         __sync_add_and_fetch(&gfs->gfs_phit, 1);
     }
+
+    /* Pages looked up without reading those here are accounted by callers
+     * reading missing pages together, like lc_readFile.
+     */
+    if (read && (data == NULL)) {
+        lc_traceCache(hit && !missed, missed);
+    }
+    lc_probe3(getpage, gindex, block, hit && !missed);
     return page;
 }
 
@@ -653,6 +661,33 @@ lc_getPageNewData(struct fs *fs, uint64_t block, char *data) {
     return page;
 }
 
+/* Lookup a page with valid data in the block cache without instantiating
+ * one.  Page is returned with a reference held.
+ */
+struct page *
+lc_findPage(struct fs *fs, uint64_t block) {
+    int hash = lc_pageBlockHash(fs, block);
+    struct pcache *pcache = fs->fs_bcache->lb_pcache;
+    struct page *page;
+    uint32_t lhash;
+
+    if (pcache[hash].pc_head == NULL) {
+        return NULL;
+    }
+    lhash = lc_pcLockHash(fs, hash);
+    page = pcache[hash].pc_head;
+    while (page && (page->p_block != block)) {
+        page = page->p_cnext;
+    }
+    if (page && page->p_dvalid && page->p_data) {
+        page->p_refCount++;
+    } else {
+        page = NULL;
+    }
+    lc_pcUnLockHash(fs, lhash);
+    return page;
+}
+
 /* Read in a cluster of blocks */
 uint32_t
 lc_readPages(struct gfs *gfs, struct fs *fs, struct page **pages,
@@ -740,6 +775,7 @@ lc_readPages(struct gfs *gfs, struct fs *fs, struct page **pages,
         }
         lc_unlockPageRead(fs, lhash);
     }
+    lc_probe3(readpages, fs->fs_gindex, count, rcount);
     return rcount;
 }
 
@@ -752,6 +788,8 @@ lc_flushPageCluster(struct gfs *gfs, struct fs *fs,
     struct iovec *iovec;
     uint64_t block = 0;
 
+    lc_probe3(flushcluster, fs->fs_gindex, head->p_block, count);
+
     /* Mark superblock dirty before modifying something */
     lc_markSuperDirty(fs);
 
@@ -807,7 +845,7 @@ void
 lc_addPageForWriteBack(struct gfs *gfs, struct fs *fs, struct page *head,
                        struct page *tail, uint64_t pcount) {
     assert(tail->p_dnext == NULL);
-    pthread_mutex_lock(&fs->fs_plock);
+    lc_mutexLock(&fs->fs_plock, LC_LOCK_PAGE);
     if (fs->fs_dpages == NULL) {
         fs->fs_dpages = head;
     } else {
@@ -815,10 +853,10 @@ lc_addPageForWriteBack(struct gfs *gfs, struct fs *fs, struct page *head,
     }
     fs->fs_dpagesLast = tail;
     fs->fs_dpcount += pcount;
-    pthread_mutex_unlock(&fs->fs_plock);
+    lc_mutexUnlock(&fs->fs_plock, LC_LOCK_PAGE);
 
     /* Signal syncer has work to do */
-    if (!fs->fs_readOnly && (fs->fs_dpcount > LC_SYNCER_DIRTY_COUNT)) {
+    if (!fs->fs_readOnly && (fs->fs_dpcount > gfs->gfs_flushCount)) {
         lc_layerChanged(gfs, false, false);
     }
 }
@@ -830,16 +868,42 @@ lc_flushDirtyPages(struct gfs *gfs, struct fs *fs) {
     uint64_t count;
 
     if (fs->fs_dpcount && !fs->fs_removed) {
-        pthread_mutex_lock(&fs->fs_plock);
+        lc_mutexLock(&fs->fs_plock, LC_LOCK_PAGE);
         page = fs->fs_dpages;
         fs->fs_dpages = NULL;
         fs->fs_dpagesLast = NULL;
         count = fs->fs_dpcount;
         fs->fs_dpcount = 0;
-        pthread_mutex_unlock(&fs->fs_plock);
+        if (count) {
+            fs->fs_wcount++;
+        }
+        lc_mutexUnlock(&fs->fs_plock, LC_LOCK_PAGE);
         if (count) {
             lc_flushPageCluster(gfs, fs, page, count);
+            lc_mutexLock(&fs->fs_plock, LC_LOCK_PAGE);
+            assert(fs->fs_wcount > 0);
+            fs->fs_wcount--;
+            if (fs->fs_wcount == 0) {
+                pthread_cond_broadcast(&fs->fs_wcond);
+            }
+            lc_mutexUnlock(&fs->fs_plock, LC_LOCK_PAGE);
+        }
+    }
+}
+
+/* Flush dirty pages of a file system and wait for pages being written by
+ * other threads, so that all pages queued so far are written when this
+ * returns.
+ */
+void
+lc_syncDirtyPages(struct gfs *gfs, struct fs *fs) {
+    lc_flushDirtyPages(gfs, fs);
+    if (fs->fs_wcount) {
+        pthread_mutex_lock(&fs->fs_plock);
+        while (fs->fs_wcount) {
+            pthread_cond_wait(&fs->fs_wcond, &fs->fs_plock);
         }
+        pthread_mutex_unlock(&fs->fs_plock);
     }
 }
 
@@ -849,12 +913,12 @@ lc_invalidateDirtyPages(struct gfs *gfs, struct fs *fs) {
     struct page *page;
 
     if (fs->fs_dpcount) {
-        pthread_mutex_lock(&fs->fs_plock);
+        lc_mutexLock(&fs->fs_plock, LC_LOCK_PAGE);
         page = fs->fs_dpages;
         fs->fs_dpages = NULL;
         fs->fs_dpagesLast = NULL;
         fs->fs_dpcount = 0;
-        pthread_mutex_unlock(&fs->fs_plock);
+        lc_mutexUnlock(&fs->fs_plock, LC_LOCK_PAGE);
         lc_releasePages(gfs, fs, page, true);
     }
 }
@@ -873,11 +937,14 @@ lc_flusher(void *data) {
     interval.tv_nsec = 0;
     while (!gfs->gfs_unmounting) {
         gettimeofday(&now, NULL);
-        interval.tv_sec = now.tv_sec + LC_FLUSH_INTERVAL;
+        interval.tv_sec = now.tv_sec + gfs->gfs_flushInterval;
         pthread_mutex_lock(&gfs->gfs_flock);
         pthread_cond_timedwait(&gfs->gfs_flusherCond, &gfs->gfs_flock,
                                &interval);
         pthread_mutex_unlock(&gfs->gfs_flock);
+
+        /* Adjust limits based on recent activity */
+        lc_tune(gfs);
         rcu_register_thread();
         rcu_read_lock();
 
@@ -899,7 +966,7 @@ lc_flusher(void *data) {
              * created.
              */
             if (!fs->fs_readOnly && fs->fs_pcount &&
-                ((fs->fs_pcount >= LC_MAX_LAYER_DIRTYPAGES) ||
+                ((fs->fs_pcount >= gfs->gfs_flushLimit) ||
                  force || (fs->fs_super->sb_ctime < recent)) &&
                 !(fs->fs_super->sb_flags & LC_SUPER_INIT) &&
                 !lc_tryLock(fs, false)) {
@@ -910,7 +977,7 @@ lc_flusher(void *data) {
                 lc_flushDirtyPages(gfs, fs);
                 lc_unlock(fs);
                 rcu_read_lock();
-            } else if (((fs->fs_dpcount >= LC_SYNCER_DIRTY_COUNT) ||
+            } else if (((fs->fs_dpcount >= gfs->gfs_flushCount) ||
                         (fs->fs_dpcount && force)) &&
                        !lc_tryLock(fs, false)) {
                 rcu_read_unlock();
@@ -972,7 +1039,7 @@ lc_purgeTreePages(struct gfs *gfs, struct fs *fs, uint64_t *blocks,
     }
 
     /* Invalidate pages from the head of the free list */
-    pthread_mutex_lock(&lbcache->lb_flock);
+    lc_mutexLock(&lbcache->lb_flock, LC_LOCK_FREE);
     page = lbcache->lb_fhead;
     while (page && (pcount < LC_PAGE_PURGE_COUNT)) {
         if ((page->p_block != LC_INVALID_BLOCK) &&
@@ -985,7 +1052,7 @@ lc_purgeTreePages(struct gfs *gfs, struct fs *fs, uint64_t *blocks,
         }
         page = page->p_fnext;
     }
-    pthread_mutex_unlock(&lbcache->lb_flock);
+    lc_mutexUnlock(&lbcache->lb_flock, LC_LOCK_FREE);
     while (pcount && !fs->fs_removed) {
         count += lc_invalPage(gfs, fs, blocks[--pcount]);
     }
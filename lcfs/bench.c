@@ -0,0 +1,379 @@
+#include "includes.h"
+
+/* Microbenchmarks for core data structures, run against a file system
+ * formatted on a temporary file without mounting it.  Results are printed as
+ * one JSON object per line.
+ */
+
+/* Default size of the file system image */
+#define LC_BENCH_SIZE       (1024ul * 1024ul * 1024ul)
+
+/* Default number of operations in a benchmark */
+#define LC_BENCH_COUNT      16384
+
+/* Default number of threads used for the block cache benchmark */
+#define LC_BENCH_THREADS    4
+
+/* Number of blocks cached for the block cache benchmark */
+#define LC_BENCH_PAGES      4096
+
+static struct gfs *gfs;
+bool lc_verbose = false;
+
+/* Checksum computed, kept so that the compiler does not skip computing it */
+static uint32_t lc_benchCrc;
+
+/* Return global file system */
+struct gfs *
+getfs() {
+    return gfs;
+}
+
+/* Arguments of threads running the block cache benchmark */
+struct bthread {
+
+    /* Thread running the benchmark */
+    pthread_t bt_thread;
+
+    /* Number of lookups made by the thread */
+    uint64_t bt_count;
+
+    /* Seed for picking blocks */
+    unsigned int bt_seed;
+};
+
+/* Display usage */
+static void
+usage(char *pgm) {
+    fprintf(stderr, "usage: %s [-d <dir>] [-n <count>] [-t <threads>]\n",
+            pgm);
+    fprintf(stderr, "\t-d <dir>     - directory for the file system image "
+            "(default /tmp)\n");
+    fprintf(stderr, "\t-n <count>   - operations in each benchmark "
+            "(default %d)\n", LC_BENCH_COUNT);
+    fprintf(stderr, "\t-t <threads> - threads used for block cache "
+            "(default %d)\n", LC_BENCH_THREADS);
+    exit(EINVAL);
+}
+
+/* Print result of a benchmark */
+static void
+lc_benchReport(const char *name, int threads, uint64_t ops, uint64_t start) {
+    uint64_t elapsed = lc_traceNow() - start;
+
+    if (elapsed == 0) {
+        elapsed = 1;
+    }
+    printf("{\"bench\": \"%s\", \"threads\": %d, \"ops\": %ld, "
+           "\"nsec\": %ld, \"nsec_per_op\": %.1f, \"ops_per_sec\": %.0f}\n",
+           name, threads, ops, elapsed, (double)elapsed / ops,
+           ((double)ops * 1000000000.0) / elapsed);
+    fflush(stdout);
+}
+
+/* Return numbers from 0 to count - 1 in random order */
+static uint64_t *
+lc_benchShuffle(uint64_t count) {
+    uint64_t *order = malloc(sizeof(uint64_t) * count), i, j, tmp;
+
+    assert(order);
+    for (i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    for (i = count - 1; i > 0; i--) {
+        j = random() % (i + 1);
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    return order;
+}
+
+/* Checksum blocks */
+static void
+lc_benchChecksum(uint64_t count) {
+    uint64_t i, start;
+    char *buf;
+
+    lc_mallocBlockAligned(NULL, (void **)&buf, LC_MEMTYPE_GFS);
+    for (i = 0; i < LC_BLOCK_SIZE; i++) {
+        buf[i] = random();
+    }
+    start = lc_traceNow();
+    for (i = 0; i < count; i++) {
+        buf[0] = i;
+        lc_updateCRC(buf, &lc_benchCrc);
+    }
+    lc_benchReport("checksum", 1, count, start);
+    lc_free(NULL, buf, LC_BLOCK_SIZE, LC_MEMTYPE_GFS);
+}
+
+/* Update and look up emap of a file with a block per extent */
+static void
+lc_benchEmap(struct fs *fs, uint64_t count) {
+    uint64_t *order = lc_benchShuffle(count), i, start, block;
+    struct extent *extents = NULL, *extent;
+    struct inode *inode;
+
+    inode = lc_inodeInit(fs, S_IFREG | 0644, 0, 0, 0, LC_ROOT_INODE, NULL);
+
+    /* Leave a gap between blocks so that extents are not merged */
+    start = lc_traceNow();
+    for (i = 0; i < count; i++) {
+        lc_inodeEmapUpdate(gfs, fs, inode, order[i],
+                           LC_START_BLOCK + (order[i] * 2), 1, &extents);
+    }
+    lc_benchReport("emap_update", 1, count, start);
+    assert(extents == NULL);
+    start = lc_traceNow();
+    for (i = 0; i < count; i++) {
+        extent = lc_inodeGetEmap(inode);
+        block = lc_inodeEmapLookup(gfs, inode, order[i], &extent);
+        assert(block == (LC_START_BLOCK + (order[i] * 2)));
+    }
+    lc_benchReport("emap_lookup", 1, count, start);
+    lc_inodeUnlock(inode);
+    free(order);
+}
+
+/* Add, merge and remove extents of a sorted extent list */
+static void
+lc_benchExtents(struct fs *fs, uint64_t count) {
+    uint64_t *order = lc_benchShuffle(count), i, start;
+    struct extent *extents = NULL;
+
+    /* Add every other block, so that extents are not merged */
+    start = lc_traceNow();
+    for (i = 0; i < count; i++) {
+        lc_addExtent(gfs, fs, &extents, LC_START_BLOCK + (order[i] * 2),
+                     0, 1, true);
+    }
+    lc_benchReport("extent_add", 1, count, start);
+
+    /* Fill the gaps, merging extents around */
+    start = lc_traceNow();
+    for (i = 0; i < (count - 1); i++) {
+        lc_addExtent(gfs, fs, &extents, LC_START_BLOCK + (order[i] * 2) + 1,
+                     0, 1, true);
+    }
+    lc_benchReport("extent_merge", 1, count - 1, start);
+
+    /* Remove blocks splitting and trimming extents */
+    start = lc_traceNow();
+    for (i = 0; i < count; i++) {
+        lc_removeExtent(fs, &extents, LC_START_BLOCK + (order[i] * 2), 1);
+    }
+    lc_benchReport("extent_remove", 1, count, start);
+    while (extents) {
+        lc_freeExtent(gfs, fs, extents, &extents, true);
+    }
+    free(order);
+}
+
+/* Add entries to a directory, look those up and read the directory */
+static void
+lc_benchDir(struct fs *fs, uint64_t count) {
+    uint64_t *order = lc_benchShuffle(count), i, start, entries = 0;
+    char name[32], buf[LC_BLOCK_SIZE];
+    struct dirent *dirent;
+    struct inode *dir;
+    struct stat st;
+    size_t csize;
+    int hash;
+    ino_t ino;
+
+    dir = lc_inodeInit(fs, S_IFDIR | 0755, 0, 0, 0, LC_ROOT_INODE, NULL);
+    start = lc_traceNow();
+    for (i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "file%ld", i);
+        lc_dirAdd(dir, LC_ROOT_INODE + 1 + i, S_IFREG, name, strlen(name));
+    }
+    lc_benchReport("dir_add", 1, count, start);
+    start = lc_traceNow();
+    for (i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "file%ld", order[i]);
+        ino = lc_dirLookup(fs, dir, name);
+        assert(ino == (LC_ROOT_INODE + 1 + order[i]));
+    }
+    lc_benchReport("dir_lookup", 1, count, start);
+
+    /* Format entries like readdir does, without replying */
+    memset(&st, 0, sizeof(struct stat));
+    start = lc_traceNow();
+    for (hash = 0; hash < LC_DIRCACHE_SIZE; hash++) {
+        dirent = (dir->i_flags & LC_INODE_DHASHED) ? dir->i_hdirent[hash] :
+                                                     dir->i_dirent;
+        csize = 0;
+        while (dirent) {
+            st.st_ino = dirent->di_ino;
+            st.st_mode = dirent->di_mode;
+            csize += fuse_add_direntry(NULL, &buf[csize],
+                                       sizeof(buf) - csize, dirent->di_name,
+                                       &st, dirent->di_index);
+            if (csize >= (sizeof(buf) - 512)) {
+                csize = 0;
+            }
+            entries++;
+            dirent = dirent->di_next;
+        }
+        if (!(dir->i_flags & LC_INODE_DHASHED)) {
+            break;
+        }
+    }
+    lc_benchReport("dir_readdir", 1, entries, start);
+    assert(entries == count);
+    lc_inodeUnlock(dir);
+    free(order);
+}
+
+/* Look up cached blocks from a thread */
+static void *
+lc_benchPagesThread(void *data) {
+    struct bthread *bt = (struct bthread *)data;
+    struct fs *fs = lc_getGlobalFs(gfs);
+    struct page *page;
+    uint64_t i, block;
+
+    for (i = 0; i < bt->bt_count; i++) {
+        block = LC_START_BLOCK + (rand_r(&bt->bt_seed) % LC_BENCH_PAGES);
+        page = lc_getPage(fs, block, NULL, true);
+        lc_releasePage(gfs, fs, page, true, false);
+    }
+    return NULL;
+}
+
+/* Look up cached blocks from a number of threads */
+static void
+lc_benchPagesRun(uint64_t count, int threads) {
+    struct bthread bt[threads];
+    uint64_t start;
+    int i;
+
+    start = lc_traceNow();
+    for (i = 0; i < threads; i++) {
+        bt[i].bt_count = count;
+        bt[i].bt_seed = i + 1;
+        if (pthread_create(&bt[i].bt_thread, NULL, lc_benchPagesThread,
+                           &bt[i])) {
+            perror("pthread_create");
+            exit(errno);
+        }
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(bt[i].bt_thread, NULL);
+    }
+    lc_benchReport("bcache_get_release", threads, count * threads, start);
+}
+
+/* Look up cached blocks from a single thread and then from multiple threads */
+static void
+lc_benchPages(struct fs *fs, uint64_t count, int threads) {
+    struct page *page;
+    uint64_t i;
+
+    /* Populate the block cache first */
+    for (i = 0; i < LC_BENCH_PAGES; i++) {
+        page = lc_getPage(fs, LC_START_BLOCK + i, NULL, true);
+        lc_releasePage(gfs, fs, page, true, false);
+    }
+    lc_benchPagesRun(count, 1);
+    if (threads > 1) {
+        lc_benchPagesRun(count, threads);
+    }
+}
+
+/* Allocate and free blocks with free space fragmented */
+static void
+lc_benchAlloc(struct fs *fs, uint64_t count) {
+    uint64_t *blocks = malloc(sizeof(uint64_t) * count * 2), i, start;
+
+    /* Fragment free space reserved for the layer by freeing every other
+     * block allocated.
+     */
+    assert(blocks);
+    for (i = 0; i < (count * 2); i++) {
+        blocks[i] = lc_blockAllocExact(fs, 1, true, false);
+    }
+    for (i = 0; i < (count * 2); i += 2) {
+        lc_blockFree(gfs, fs, blocks[i], 1, true, true);
+    }
+    start = lc_traceNow();
+    for (i = 0; i < (count / 2); i++) {
+        blocks[i * 2] = lc_blockAllocExact(fs, 2, true, false);
+    }
+    lc_benchReport("block_alloc_fragmented", 1, count / 2, start);
+    start = lc_traceNow();
+    for (i = 0; i < (count / 2); i++) {
+        lc_blockFree(gfs, fs, blocks[i * 2], 2, true, true);
+    }
+    lc_benchReport("block_free", 1, count / 2, start);
+    start = lc_traceNow();
+    for (i = 0; i < count; i++) {
+        blocks[i * 2] = lc_blockAllocExact(fs, 1, true, false);
+    }
+    lc_benchReport("block_alloc", 1, count, start);
+    free(blocks);
+}
+
+/* Format a file system on a temporary file and run benchmarks */
+int
+main(int argc, char *argv[]) {
+    int i, fd, threads = LC_BENCH_THREADS;
+    uint64_t count = LC_BENCH_COUNT;
+    char *dir = "/tmp", *path;
+    struct fs *fs;
+    size_t size;
+
+    for (i = 1; i < argc; i++) {
+        if ((i + 1) >= argc) {
+            usage(argv[0]);
+        }
+        if (!strcmp(argv[i], "-d")) {
+            dir = argv[++i];
+        } else if (!strcmp(argv[i], "-n")) {
+            count = atoll(argv[++i]);
+        } else if (!strcmp(argv[i], "-t")) {
+            threads = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if ((count < 2) || (threads <= 0)) {
+        usage(argv[0]);
+    }
+    openlog("lcfsbench", LOG_PID, LOG_USER);
+    srandom(count);
+
+    /* Create a sparse image, removed as soon as it is opened */
+    path = alloca(strlen(dir) + 32);
+    sprintf(path, "%s/lcfsbench.XXXXXX", dir);
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(errno);
+    }
+    unlink(path);
+    size = LC_BENCH_SIZE;
+    if (ftruncate(fd, size)) {
+        perror("ftruncate");
+        exit(errno);
+    }
+
+    /* Set up the file system the same way the daemon does */
+    lc_memoryInit(0);
+    gfs = lc_malloc(NULL, sizeof(struct gfs), LC_MEMTYPE_GFS);
+    memset(gfs, 0, sizeof(struct gfs));
+    gfs->gfs_fd = fd;
+    lc_mount(gfs, path, false, size, true);
+    fs = lc_getGlobalFs(gfs);
+
+    lc_benchChecksum(count);
+    lc_benchEmap(fs, count);
+    lc_benchExtents(fs, count);
+    lc_benchDir(fs, count);
+    lc_benchPages(fs, count, threads);
+    lc_benchAlloc(fs, count);
+    close(fd);
+    closelog();
+    return 0;
+}
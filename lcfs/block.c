@@ -11,16 +11,546 @@
 /* Minimum number of blocks attempted to reclaim in one pass */
 #define LC_RECLAIM_BLOCKS   10
 
+/* Smallest and largest reservations made by an allocation cursor */
+#define LC_CURSOR_MIN_RESERVE   1024
+#define LC_CURSOR_MAX_RESERVE   65536
+
+/* Reservations consumed slower than this (seconds) are made smaller */
+#define LC_CURSOR_SLOW          10
+
+/* Allocation cursor used by the thread */
+static __thread int lc_cursorIndex = -1;
+
+/* Next allocation cursor to be assigned to a thread */
+static int lc_cursorNext;
+
+/* Maximum number of extents examined in a size class for a best fit */
+#define LC_SPACE_SCAN       64
+
+/* Return the size class of an extent */
+static inline int
+lc_spaceBin(uint64_t count) {
+    assert(count);
+    return 63 - __builtin_clzll(count);
+}
+
+/* Return the hash list for a block */
+static inline uint64_t
+lc_spaceHash(struct space *space, uint64_t block) {
+    return block & (space->sp_hashSize - 1);
+}
+
+/* Allocate hash lists for the free space index */
+static void
+lc_spaceAllocHash(struct fs *fs, struct space *space, uint64_t size) {
+    size_t hsize = size * sizeof(struct sextent *);
+
+    space->sp_shash = lc_malloc(fs, hsize, LC_MEMTYPE_SPACE);
+    space->sp_ehash = lc_malloc(fs, hsize, LC_MEMTYPE_SPACE);
+    memset(space->sp_shash, 0, hsize);
+    memset(space->sp_ehash, 0, hsize);
+    space->sp_hashSize = size;
+}
+
+/* Free hash lists of the free space index */
+static void
+lc_spaceFreeHash(struct fs *fs, struct space *space) {
+    size_t hsize = space->sp_hashSize * sizeof(struct sextent *);
+
+    lc_free(fs, space->sp_shash, hsize, LC_MEMTYPE_SPACE);
+    lc_free(fs, space->sp_ehash, hsize, LC_MEMTYPE_SPACE);
+    space->sp_shash = NULL;
+    space->sp_ehash = NULL;
+}
+
+/* Return the allocation group of a block */
+static inline uint64_t
+lc_spaceGroup(struct space *space, uint64_t block) {
+    return block >> space->sp_shift;
+}
+
+/* Return the size class list of an extent */
+static inline struct sextent **
+lc_spaceBinList(struct space *space, struct sextent *sextent) {
+    uint64_t group = lc_spaceGroup(space, sextent->se_start);
+
+    assert(group < space->sp_groups);
+    return &space->sp_bins[(group * LC_SPACE_BINS) +
+                           lc_spaceBin(sextent->se_count)];
+}
+
+/* Resize the index for the specified number of allocation groups */
+static void
+lc_spaceResize(struct fs *fs, struct space *space, uint64_t groups) {
+    size_t osize = space->sp_groups * LC_SPACE_BINS * sizeof(struct sextent *);
+    size_t nsize = groups * LC_SPACE_BINS * sizeof(struct sextent *);
+    struct sextent **bins;
+    uint64_t *gblocks;
+
+    assert(groups > space->sp_groups);
+    bins = lc_malloc(fs, nsize, LC_MEMTYPE_SPACE);
+    memset(bins, 0, nsize);
+    gblocks = lc_malloc(fs, groups * sizeof(uint64_t), LC_MEMTYPE_SPACE);
+    memset(gblocks, 0, groups * sizeof(uint64_t));
+    if (space->sp_groups) {
+
+        /* Only heads of the lists are in the array, so those can be copied */
+        memcpy(bins, space->sp_bins, osize);
+        memcpy(gblocks, space->sp_gblocks,
+               space->sp_groups * sizeof(uint64_t));
+        lc_free(fs, space->sp_bins, osize, LC_MEMTYPE_SPACE);
+        lc_free(fs, space->sp_gblocks, space->sp_groups * sizeof(uint64_t),
+                LC_MEMTYPE_SPACE);
+    }
+    space->sp_bins = bins;
+    space->sp_gblocks = gblocks;
+    space->sp_groups = groups;
+}
+
+/* Allocate an empty free space index for a device of the specified size */
+static struct space *
+lc_spaceNew(struct fs *fs, uint64_t tblocks) {
+    struct space *space = lc_malloc(fs, sizeof(struct space),
+                                    LC_MEMTYPE_SPACE);
+    uint64_t shift = LC_GROUP_SHIFT_MIN;
+
+    memset(space, 0, sizeof(struct space));
+
+    /* Make groups bigger on large devices to limit the number of groups */
+    while ((tblocks >> shift) >= LC_GROUP_MAX) {
+        shift++;
+    }
+    space->sp_shift = shift;
+    lc_spaceResize(fs, space, (tblocks >> shift) + 1);
+    lc_spaceAllocHash(fs, space, LC_SPACE_HASH_MIN);
+    return space;
+}
+
+/* Add an extent to its size class and hash lists */
+static void
+lc_spaceLink(struct space *space, struct sextent *sextent) {
+    struct sextent **bin = lc_spaceBinList(space, sextent);
+    uint64_t hash;
+
+    sextent->se_bprev = NULL;
+    sextent->se_bnext = *bin;
+    if (sextent->se_bnext) {
+        sextent->se_bnext->se_bprev = sextent;
+    }
+    *bin = sextent;
+    hash = lc_spaceHash(space, sextent->se_start);
+    sextent->se_snext = space->sp_shash[hash];
+    space->sp_shash[hash] = sextent;
+    hash = lc_spaceHash(space, sextent->se_start + sextent->se_count);
+    sextent->se_enext = space->sp_ehash[hash];
+    space->sp_ehash[hash] = sextent;
+    space->sp_gblocks[lc_spaceGroup(space, sextent->se_start)] +=
+                                                        sextent->se_count;
+    space->sp_count++;
+    space->sp_blocks += sextent->se_count;
+}
+
+/* Take an extent off of its size class and hash lists */
+static void
+lc_spaceUnlink(struct space *space, struct sextent *sextent) {
+    uint64_t group = lc_spaceGroup(space, sextent->se_start);
+    struct sextent **prev;
+
+    if (sextent->se_bprev) {
+        sextent->se_bprev->se_bnext = sextent->se_bnext;
+    } else {
+        prev = lc_spaceBinList(space, sextent);
+        assert(*prev == sextent);
+        *prev = sextent->se_bnext;
+    }
+    if (sextent->se_bnext) {
+        sextent->se_bnext->se_bprev = sextent->se_bprev;
+    }
+    prev = &space->sp_shash[lc_spaceHash(space, sextent->se_start)];
+    while (*prev != sextent) {
+        assert(*prev);
+        prev = &(*prev)->se_snext;
+    }
+    *prev = sextent->se_snext;
+    prev = &space->sp_ehash[lc_spaceHash(space,
+                                         sextent->se_start + sextent->se_count)];
+    while (*prev != sextent) {
+        assert(*prev);
+        prev = &(*prev)->se_enext;
+    }
+    *prev = sextent->se_enext;
+    assert(space->sp_count > 0);
+    assert(space->sp_blocks >= sextent->se_count);
+    assert(space->sp_gblocks[group] >= sextent->se_count);
+    space->sp_gblocks[group] -= sextent->se_count;
+    space->sp_count--;
+    space->sp_blocks -= sextent->se_count;
+}
+
+/* Double the number of hash lists as the index grows */
+static void
+lc_spaceRehash(struct fs *fs, struct space *space) {
+    struct sextent *sextent, *head = NULL;
+    uint64_t count, blocks, i;
+
+    count = space->sp_count;
+    blocks = space->sp_blocks;
+    lc_spaceFreeHash(fs, space);
+    lc_spaceAllocHash(fs, space, space->sp_hashSize * 2);
+
+    /* Collect all extents from size classes and link those again */
+    for (i = 0; i < (space->sp_groups * LC_SPACE_BINS); i++) {
+        while (space->sp_bins[i]) {
+            sextent = space->sp_bins[i];
+            space->sp_bins[i] = sextent->se_bnext;
+            sextent->se_snext = head;
+            head = sextent;
+        }
+    }
+    memset(space->sp_gblocks, 0, space->sp_groups * sizeof(uint64_t));
+    space->sp_count = 0;
+    space->sp_blocks = 0;
+    while (head) {
+        sextent = head;
+        head = sextent->se_snext;
+        lc_spaceLink(space, sextent);
+    }
+    assert(space->sp_count == count);
+    assert(space->sp_blocks == blocks);
+}
+
+/* Lookup an extent starting at the block */
+static struct sextent *
+lc_spaceFindStart(struct space *space, uint64_t block) {
+    struct sextent *sextent = space->sp_shash[lc_spaceHash(space, block)];
+
+    while (sextent && (sextent->se_start != block)) {
+        sextent = sextent->se_snext;
+    }
+    return sextent;
+}
+
+/* Lookup an extent ending at the block */
+static struct sextent *
+lc_spaceFindEnd(struct space *space, uint64_t block) {
+    struct sextent *sextent = space->sp_ehash[lc_spaceHash(space, block)];
+
+    while (sextent && ((sextent->se_start + sextent->se_count) != block)) {
+        sextent = sextent->se_enext;
+    }
+    return sextent;
+}
+
+/* Add free space within an allocation group to the index, merging with
+ * adjacent free extents in the same group.
+ */
+static void
+lc_spaceAddExtent(struct fs *rfs, struct space *space, uint64_t start,
+                  uint64_t count) {
+    uint64_t mask = (1ul << space->sp_shift) - 1;
+    struct sextent *prev = NULL, *next = NULL;
+
+    if (start & mask) {
+        prev = lc_spaceFindEnd(space, start);
+    }
+    if ((start + count) & mask) {
+        next = lc_spaceFindStart(space, start + count);
+    }
+    if (prev) {
+
+        /* Extend the previous extent and absorb the next one if present */
+        lc_spaceUnlink(space, prev);
+        prev->se_count += count;
+        if (next) {
+            lc_spaceUnlink(space, next);
+            prev->se_count += next->se_count;
+            lc_free(rfs, next, sizeof(struct sextent), LC_MEMTYPE_SPACE);
+        }
+        lc_spaceLink(space, prev);
+    } else if (next) {
+
+        /* Extend the next extent backwards */
+        lc_spaceUnlink(space, next);
+        next->se_start = start;
+        next->se_count += count;
+        lc_spaceLink(space, next);
+    } else {
+        next = lc_malloc(rfs, sizeof(struct sextent), LC_MEMTYPE_SPACE);
+        next->se_start = start;
+        next->se_count = count;
+        lc_spaceLink(space, next);
+        if (space->sp_count > (space->sp_hashSize * 2)) {
+            lc_spaceRehash(rfs, space);
+        }
+    }
+}
+
+/* Add free space to the index, splitting it at allocation group boundaries */
+static void
+lc_spaceAdd(struct gfs *gfs, struct space *space, uint64_t start,
+            uint64_t count) {
+    struct fs *rfs = lc_getGlobalFs(gfs);
+    uint64_t group, end, ecount;
+
+    assert(start && count);
+    assert(start != LC_INVALID_BLOCK);
+    assert((start + count) <= gfs->gfs_super->sb_tblocks);
+
+    /* Add groups if the device grew */
+    group = lc_spaceGroup(space, start + count - 1);
+    if (group >= space->sp_groups) {
+        lc_spaceResize(rfs, space, group + 1);
+    }
+    while (count) {
+        end = (lc_spaceGroup(space, start) + 1) << space->sp_shift;
+        ecount = ((start + count) > end) ? (end - start) : count;
+        lc_spaceAddExtent(rfs, space, start, ecount);
+        start += ecount;
+        count -= ecount;
+    }
+}
+
+/* Find the best fitting extent in an allocation group */
+static struct sextent *
+lc_spaceFindGroup(struct space *space, uint64_t group, uint64_t count) {
+    struct sextent *sextent, *best = NULL;
+    struct sextent **bins = &space->sp_bins[group * LC_SPACE_BINS];
+    int i, scan;
+
+    /* Start with the size class of the request.  Extents in that class may
+     * be smaller than the request, while any extent from a bigger class would
+     * do.  Look at a limited number of extents in a class to pick the
+     * smallest one satisfying the request.
+     */
+    for (i = lc_spaceBin(count); (i < LC_SPACE_BINS) && (best == NULL); i++) {
+        sextent = bins[i];
+        scan = 0;
+        while (sextent && (scan < LC_SPACE_SCAN)) {
+            if ((sextent->se_count >= count) &&
+                ((best == NULL) || (sextent->se_count < best->se_count))) {
+                best = sextent;
+                if (best->se_count == count) {
+                    break;
+                }
+            }
+            sextent = sextent->se_bnext;
+            scan++;
+        }
+    }
+    return best;
+}
+
+/* Allocate blocks from the best fitting extent in the index, looking in the
+ * preferred allocation group first and then in the groups following it.
+ */
+static uint64_t
+lc_spaceAlloc(struct gfs *gfs, struct space *space, uint64_t count,
+              uint64_t group) {
+    struct sextent *best = NULL;
+    uint64_t i, g, block;
+
+    if (group >= space->sp_groups) {
+        group = 0;
+    }
+    for (i = 0; (i < space->sp_groups) && (best == NULL); i++) {
+        g = (group + i) % space->sp_groups;
+        if (space->sp_gblocks[g] >= count) {
+            best = lc_spaceFindGroup(space, g, count);
+        }
+    }
+    if (best == NULL) {
+        return LC_INVALID_BLOCK;
+    }
+
+    /* Carve the blocks from the start of the extent */
+    block = best->se_start;
+    lc_spaceUnlink(space, best);
+    if (best->se_count == count) {
+        lc_free(lc_getGlobalFs(gfs), best, sizeof(struct sextent),
+                LC_MEMTYPE_SPACE);
+    } else {
+        best->se_start += count;
+        best->se_count -= count;
+        lc_spaceLink(space, best);
+    }
+    return block;
+}
+
+/* Find the free extent with the lowest start block overlapping the specified
+ * range of blocks within the allocation group of the first block.
+ */
+static struct sextent *
+lc_spaceFindOverlap(struct space *space, uint64_t block, uint64_t end) {
+    uint64_t group = lc_spaceGroup(space, block);
+    struct sextent *sextent, *best = NULL, **bins;
+    int i;
+
+    if (group >= space->sp_groups) {
+        return NULL;
+    }
+    bins = &space->sp_bins[group * LC_SPACE_BINS];
+    for (i = 0; i < LC_SPACE_BINS; i++) {
+        sextent = bins[i];
+        while (sextent) {
+            if ((sextent->se_start < end) &&
+                ((sextent->se_start + sextent->se_count) > block) &&
+                ((best == NULL) || (sextent->se_start < best->se_start))) {
+                best = sextent;
+            }
+            sextent = sextent->se_bnext;
+        }
+    }
+    return best;
+}
+
+/* Remove a range of blocks from a free extent */
+static void
+lc_spaceCarve(struct fs *rfs, struct space *space, struct sextent *sextent,
+              uint64_t start, uint64_t count) {
+    uint64_t end = sextent->se_start + sextent->se_count;
+    struct sextent *next;
+
+    assert(start >= sextent->se_start);
+    assert((start + count) <= end);
+    lc_spaceUnlink(space, sextent);
+
+    /* Keep free blocks past the range in a new extent */
+    if ((start + count) < end) {
+        if (start == sextent->se_start) {
+            sextent->se_start = start + count;
+            sextent->se_count = end - sextent->se_start;
+            lc_spaceLink(space, sextent);
+            return;
+        }
+        next = lc_malloc(rfs, sizeof(struct sextent), LC_MEMTYPE_SPACE);
+        next->se_start = start + count;
+        next->se_count = end - next->se_start;
+        lc_spaceLink(space, next);
+    }
+
+    /* Keep free blocks before the range in the extent */
+    if (start > sextent->se_start) {
+        sextent->se_count = start - sextent->se_start;
+        lc_spaceLink(space, sextent);
+    } else {
+        lc_free(rfs, sextent, sizeof(struct sextent), LC_MEMTYPE_SPACE);
+    }
+}
+
+/* Pick the allocation group with most free space for a new layer.  Groups are
+ * searched starting from a different group each time, so that layers are
+ * spread across groups with similar free space.
+ */
+static uint64_t
+lc_spacePickGroup(struct space *space) {
+    uint64_t i, g, best = space->sp_next % space->sp_groups;
+
+    for (i = 1; i < space->sp_groups; i++) {
+        g = (space->sp_next + i) % space->sp_groups;
+        if (space->sp_gblocks[g] > space->sp_gblocks[best]) {
+            best = g;
+        }
+    }
+    space->sp_next = best + 1;
+    return best;
+}
+
+/* Return the allocation group a layer allocates space from.  A layer stays in
+ * the group of its parent layer, so that layers of an image and containers
+ * using that image are placed together.  Called with gfs_alock held.
+ */
+static uint64_t
+lc_layerGroup(struct gfs *gfs, struct fs *fs) {
+    struct space *space = gfs->gfs_extents;
+    struct fs *pfs = fs->fs_parent;
+
+    if ((fs->fs_group < 0) || (fs->fs_group >= space->sp_groups)) {
+        if (pfs && (pfs->fs_group >= 0) &&
+            (pfs->fs_group < space->sp_groups)) {
+            fs->fs_group = pfs->fs_group;
+        } else {
+            fs->fs_group = lc_spacePickGroup(space);
+        }
+    }
+    return fs->fs_group;
+}
+
+/* Move all extents from one index to another */
+static void
+lc_spaceMove(struct gfs *gfs, struct space *dst, struct space *src) {
+    struct fs *rfs = lc_getGlobalFs(gfs);
+    struct sextent *sextent;
+    uint64_t i;
+
+    for (i = 0; i < (src->sp_groups * LC_SPACE_BINS); i++) {
+        while ((sextent = src->sp_bins[i])) {
+            lc_spaceUnlink(src, sextent);
+            lc_spaceAdd(gfs, dst, sextent->se_start, sextent->se_count);
+            lc_free(rfs, sextent, sizeof(struct sextent), LC_MEMTYPE_SPACE);
+        }
+    }
+    assert(src->sp_count == 0);
+    assert(src->sp_blocks == 0);
+}
+
+/* Free the free space index */
+static void
+lc_spaceFree(struct gfs *gfs, struct space *space) {
+    struct fs *rfs = lc_getGlobalFs(gfs);
+    struct sextent *sextent;
+    uint64_t i;
+
+    for (i = 0; i < (space->sp_groups * LC_SPACE_BINS); i++) {
+        while ((sextent = space->sp_bins[i])) {
+            space->sp_bins[i] = sextent->se_bnext;
+            lc_free(rfs, sextent, sizeof(struct sextent), LC_MEMTYPE_SPACE);
+        }
+    }
+    lc_free(rfs, space->sp_bins,
+            space->sp_groups * LC_SPACE_BINS * sizeof(struct sextent *),
+            LC_MEMTYPE_SPACE);
+    lc_free(rfs, space->sp_gblocks, space->sp_groups * sizeof(uint64_t),
+            LC_MEMTYPE_SPACE);
+    lc_spaceFreeHash(rfs, space);
+    lc_free(rfs, space, sizeof(struct space), LC_MEMTYPE_SPACE);
+}
+
+/* Add all free extents from the index to a sorted list of extents */
+void
+lc_spaceExtents(struct gfs *gfs, struct fs *fs, struct space *space,
+                struct extent **extents) {
+    struct sextent *sextent;
+    uint64_t i;
+
+    for (i = 0; i < (space->sp_groups * LC_SPACE_BINS); i++) {
+        sextent = space->sp_bins[i];
+        while (sextent) {
+            lc_addSpaceExtent(gfs, fs, extents, sextent->se_start,
+                              sextent->se_count, true);
+            sextent = sextent->se_bnext;
+        }
+    }
+}
+
+/* Set up indices for tracking free space */
+static void
+lc_spaceInit(struct gfs *gfs, struct fs *fs) {
+    uint64_t tblocks = gfs->gfs_super->sb_tblocks;
+
+    assert(gfs->gfs_extents == NULL);
+    assert(gfs->gfs_fextents == NULL);
+    gfs->gfs_extents = lc_spaceNew(fs, tblocks);
+    gfs->gfs_fextents = lc_spaceNew(fs, tblocks);
+}
+
 /* Initializes the block allocator */
 void
 lc_blockAllocatorInit(struct gfs *gfs, struct fs *fs) {
-    struct extent *extent;
 
     /* Initialize a space extent covering the whole device */
-    extent = lc_malloc(fs, sizeof(struct extent), LC_MEMTYPE_EXTENT);
-    lc_initExtent(gfs, extent, LC_EXTENT_SPACE, LC_START_BLOCK,
-                  0, gfs->gfs_super->sb_tblocks - LC_START_BLOCK, NULL);
-    gfs->gfs_extents = extent;
+    lc_spaceInit(gfs, fs);
+    lc_spaceAdd(gfs, gfs->gfs_extents, LC_START_BLOCK,
+                gfs->gfs_super->sb_tblocks - LC_START_BLOCK);
     gfs->gfs_blocksReserved = (gfs->gfs_super->sb_tblocks *
                                LC_RESERVED_BLOCKS) / 100ul;
 }
@@ -42,6 +572,75 @@ lc_releaseReservedBlocks(struct gfs *gfs, struct fs *fs) {
     return freed;
 }
 
+/* Return unused blocks reserved by a cursor to the reserved pool of the layer.
+ * Called with the cursor locked.
+ */
+static uint64_t
+lc_releaseCursor(struct gfs *gfs, struct fs *fs, struct acursor *cursor) {
+    uint64_t count = cursor->ac_count, freed;
+
+    if (count == 0) {
+        return 0;
+    }
+    lc_mutexLock(&fs->fs_alock, LC_LOCK_ALLOC);
+
+    /* Unused blocks are not allocated to the layer anymore */
+    if (fs != lc_getGlobalFs(gfs)) {
+        freed = lc_removeExtent(fs, &fs->fs_aextents, cursor->ac_start, count);
+        assert(freed == count);
+        assert(fs->fs_blocks >= count);
+        fs->fs_blocks -= count;
+    }
+    lc_addSpaceExtent(gfs, fs, &fs->fs_extents, cursor->ac_start, count,
+                      false);
+    fs->fs_reservedBlocks += count;
+    lc_mutexUnlock(&fs->fs_alock, LC_LOCK_ALLOC);
+    cursor->ac_start = 0;
+    cursor->ac_count = 0;
+    return count;
+}
+
+/* Release blocks reserved by all allocation cursors of the layer */
+static uint64_t
+lc_releaseCursors(struct gfs *gfs, struct fs *fs) {
+    struct acursor *cursor;
+    uint64_t count = 0;
+    int i;
+
+    if (fs->fs_cursors == NULL) {
+        return 0;
+    }
+    for (i = 0; i < LC_CURSOR_MAX; i++) {
+        cursor = &fs->fs_cursors[i];
+        if (cursor->ac_count) {
+            pthread_mutex_lock(&cursor->ac_lock);
+            count += lc_releaseCursor(gfs, fs, cursor);
+            pthread_mutex_unlock(&cursor->ac_lock);
+        }
+    }
+    return count;
+}
+
+/* Free allocation cursors of a layer */
+void
+lc_freeCursors(struct fs *fs) {
+    struct acursor *cursors = fs->fs_cursors;
+    int i;
+
+    if (cursors == NULL) {
+        return;
+    }
+    for (i = 0; i < LC_CURSOR_MAX; i++) {
+        assert(cursors[i].ac_count == 0);
+#ifdef LC_MUTEX_DESTROY
+        pthread_mutex_destroy(&cursors[i].ac_lock);
+#endif
+    }
+    lc_free(fs, cursors, sizeof(struct acursor) * LC_CURSOR_MAX,
+            LC_MEMTYPE_CURSOR);
+    fs->fs_cursors = NULL;
+}
+
 /* Reclaim reserved space from all layers */
 static uint64_t
 lc_reclaimSpace(struct gfs *gfs) {
@@ -50,7 +649,7 @@ lc_reclaimSpace(struct gfs *gfs) {
     struct fs *fs;
     int i;
 
-    if (gfs->gfs_fextents) {
+    if (gfs->gfs_fextents->sp_count) {
         lc_layerChanged(gfs, false, true);
         queued = true;
     }
@@ -67,12 +666,14 @@ lc_reclaimSpace(struct gfs *gfs) {
             }
 
             /* Release any reserved blocks */
-            if (fs->fs_extents && !lc_tryLock(fs, false)) {
+            if ((fs->fs_extents || fs->fs_cursors) &&
+                !lc_tryLock(fs, false)) {
                 rcu_read_unlock();
+                lc_releaseCursors(gfs, fs);
                 if (fs->fs_extents) {
-                    pthread_mutex_lock(&fs->fs_alock);
+                    lc_mutexLock(&fs->fs_alock, LC_LOCK_ALLOC);
                     count += lc_releaseReservedBlocks(gfs, fs);
-                    pthread_mutex_unlock(&fs->fs_alock);
+                    lc_mutexUnlock(&fs->fs_alock, LC_LOCK_ALLOC);
                 }
                 lc_unlock(fs);
                 rcu_read_lock();
@@ -127,7 +728,24 @@ lc_allocateBlock(struct gfs *gfs, struct fs *fs, uint64_t count, bool layer) {
     uint64_t block;
     bool release;
 
-    prev = layer ? &fs->fs_extents : &gfs->gfs_extents;
+    /* Allocate from the global free space index, preferably from the
+     * allocation group of the layer.  If that group is full, the layer moves
+     * on to the group space was found in.
+     */
+    if (!layer) {
+        block = lc_spaceAlloc(gfs, gfs->gfs_extents, count,
+                              lc_layerGroup(gfs, fs));
+        if (block != LC_INVALID_BLOCK) {
+            fs->fs_group = lc_spaceGroup(gfs->gfs_extents, block);
+
+            /* Update global usage */
+            gfs->gfs_super->sb_blocks += count;
+            assert(gfs->gfs_super->sb_tblocks > gfs->gfs_super->sb_blocks);
+            assert(block < gfs->gfs_super->sb_tblocks);
+        }
+        return block;
+    }
+    prev = &fs->fs_extents;
     extent = *prev;
     while (extent) {
         if (lc_getExtentCount(extent) >= count) {
@@ -137,28 +755,20 @@ lc_allocateBlock(struct gfs *gfs, struct fs *fs, uint64_t count, bool layer) {
             release = lc_decrExtentCount(gfs, extent, count);
             /* Free the extent if it is fully consumed */
             if (release) {
-                lc_freeExtent(gfs, fs, extent, prev, layer);
+                lc_freeExtent(gfs, fs, extent, prev, true);
             } else {
                 lc_incrExtentStart(NULL, extent, count);
             }
 
-            if (layer) {
-
-                /* Update reserved pool and register this extent in the
-                 * allocated list of extents.
-                 */
-                assert(fs->fs_reservedBlocks >= count);
-                fs->fs_reservedBlocks -= count;
-                if (fs != lc_getGlobalFs(gfs)) {
-                    lc_addSpaceExtent(gfs, fs, &fs->fs_aextents, block,
-                                      count, true);
-                    fs->fs_blocks += count;
-                }
-            } else {
-
-                /* Update global usage */
-                gfs->gfs_super->sb_blocks += count;
-                assert(gfs->gfs_super->sb_tblocks > gfs->gfs_super->sb_blocks);
+            /* Update reserved pool and register this extent in the
+             * allocated list of extents.
+             */
+            assert(fs->fs_reservedBlocks >= count);
+            fs->fs_reservedBlocks -= count;
+            if (fs != lc_getGlobalFs(gfs)) {
+                lc_addSpaceExtent(gfs, fs, &fs->fs_aextents, block,
+                                  count, true);
+                fs->fs_blocks += count;
             }
             assert(block < gfs->gfs_super->sb_tblocks);
             return block;
@@ -183,7 +793,7 @@ lc_findFreeBlock(struct gfs *gfs, struct fs *fs,
     if ((block == LC_INVALID_BLOCK) && layer) {
         rsize = (!reserve || (count > LC_BLOCK_RESERVE)) ?
                 count : LC_BLOCK_RESERVE;
-        pthread_mutex_lock(&gfs->gfs_alock);
+        lc_mutexLock(&gfs->gfs_alock, LC_LOCK_GALLOC);
         block = lc_findFreeBlock(gfs, fs, rsize, false, false);
 
         /* If bigger reservation attempt failed, try with actual request size
@@ -192,7 +802,7 @@ lc_findFreeBlock(struct gfs *gfs, struct fs *fs,
             rsize = count;
             block = lc_findFreeBlock(gfs, fs, rsize, false, false);
         }
-        pthread_mutex_unlock(&gfs->gfs_alock);
+        lc_mutexUnlock(&gfs->gfs_alock, LC_LOCK_GALLOC);
         if (block != LC_INVALID_BLOCK) {
             rfs = lc_getGlobalFs(gfs);
             if (fs != rfs) {
@@ -215,6 +825,105 @@ lc_findFreeBlock(struct gfs *gfs, struct fs *fs,
     return block;
 }
 
+/* Set up allocation cursors of a layer */
+static void
+lc_initCursors(struct fs *fs) {
+    struct acursor *cursors;
+    int i;
+
+    lc_mutexLock(&fs->fs_alock, LC_LOCK_ALLOC);
+    if (fs->fs_cursors == NULL) {
+        cursors = lc_malloc(fs, sizeof(struct acursor) * LC_CURSOR_MAX,
+                            LC_MEMTYPE_CURSOR);
+        memset(cursors, 0, sizeof(struct acursor) * LC_CURSOR_MAX);
+        for (i = 0; i < LC_CURSOR_MAX; i++) {
+            pthread_mutex_init(&cursors[i].ac_lock, NULL);
+            cursors[i].ac_rsize = LC_BLOCK_RESERVE;
+        }
+        __sync_synchronize();
+        fs->fs_cursors = cursors;
+    }
+    lc_mutexUnlock(&fs->fs_alock, LC_LOCK_ALLOC);
+}
+
+/* Pick the allocation cursor of the calling thread */
+static struct acursor *
+lc_getCursor(struct fs *fs) {
+    if (fs->fs_cursors == NULL) {
+        lc_initCursors(fs);
+    }
+    if (lc_cursorIndex < 0) {
+        lc_cursorIndex = __sync_fetch_and_add(&lc_cursorNext, 1) %
+                         LC_CURSOR_MAX;
+    }
+    return &fs->fs_cursors[lc_cursorIndex];
+}
+
+/* Size the next reservation of a cursor based on how fast the previous one
+ * was consumed.
+ */
+static uint64_t
+lc_cursorReserveSize(struct acursor *cursor, uint64_t count) {
+    uint64_t rsize = cursor->ac_rsize;
+    time_t now = time(NULL), elapsed;
+
+    if (cursor->ac_time) {
+        elapsed = now - cursor->ac_time;
+        if ((elapsed <= 1) && (rsize < LC_CURSOR_MAX_RESERVE)) {
+            rsize *= 2;
+        } else if ((elapsed >= LC_CURSOR_SLOW) &&
+                   (rsize > LC_CURSOR_MIN_RESERVE)) {
+            rsize /= 2;
+        }
+    }
+    while ((rsize < count) && (rsize < LC_CURSOR_MAX_RESERVE)) {
+        rsize *= 2;
+    }
+    cursor->ac_rsize = rsize;
+    cursor->ac_time = now;
+    return rsize;
+}
+
+/* Allocate data blocks using the allocation cursor of the thread, making a
+ * new reservation for the cursor when needed.
+ */
+static uint64_t
+lc_cursorAlloc(struct gfs *gfs, struct fs *fs, uint64_t count) {
+    struct acursor *cursor = lc_getCursor(fs);
+    uint64_t block, rsize;
+
+    pthread_mutex_lock(&cursor->ac_lock);
+    if (cursor->ac_count < count) {
+
+        /* Return what is left in the current reservation */
+        lc_releaseCursor(gfs, fs, cursor);
+        rsize = lc_cursorReserveSize(cursor, count);
+        if (rsize < count) {
+            pthread_mutex_unlock(&cursor->ac_lock);
+            return LC_INVALID_BLOCK;
+        }
+        lc_mutexLock(&fs->fs_alock, LC_LOCK_ALLOC);
+        block = lc_findFreeBlock(gfs, fs, rsize, false, true);
+        lc_mutexUnlock(&fs->fs_alock, LC_LOCK_ALLOC);
+        if (block == LC_INVALID_BLOCK) {
+
+            /* Free space is fragmented, make smaller reservations */
+            if (cursor->ac_rsize > LC_CURSOR_MIN_RESERVE) {
+                cursor->ac_rsize /= 2;
+            }
+            pthread_mutex_unlock(&cursor->ac_lock);
+            return LC_INVALID_BLOCK;
+        }
+        cursor->ac_start = block;
+        cursor->ac_count = rsize;
+    }
+    block = cursor->ac_start;
+    cursor->ac_start += count;
+    cursor->ac_count -= count;
+    pthread_mutex_unlock(&cursor->ac_lock);
+    return block;
+}
+
 /* Flush extent pages */
 static void
 lc_flushExtentPages(struct gfs *gfs, struct fs *fs, struct page *fpage,
@@ -238,25 +947,100 @@ lc_flushExtentPages(struct gfs *gfs, struct fs *fs, struct page *fpage,
         page = page->p_dnext;
     }
     assert(count == 0);
+    lc_statsWrite(fs, LC_WRITE_EXTENT, pcount);
     lc_addPageForWriteBack(gfs, fs, fpage, tpage, pcount);
 }
 
+/* Claim blocks of the specified range found free in the global index for a
+ * layer.  Used while replaying the intent log, as blocks allocated after the
+ * last checkpoint are free on disk.
+ */
+void
+lc_blockClaim(struct gfs *gfs, struct fs *fs, uint64_t block, uint64_t count) {
+    struct fs *rfs = lc_getGlobalFs(gfs);
+    struct space *space = gfs->gfs_extents;
+    uint64_t end = block + count, start, ecount;
+    struct sextent *sextent;
+
+    assert(end <= gfs->gfs_super->sb_tblocks);
+    lc_mutexLock(&gfs->gfs_alock, LC_LOCK_GALLOC);
+    while (block < end) {
+        sextent = lc_spaceFindOverlap(space, block, end);
+        if (sextent == NULL) {
+
+            /* Nothing free in this group, move on to the next group */
+            block = (lc_spaceGroup(space, block) + 1) << space->sp_shift;
+            continue;
+        }
+        start = (sextent->se_start > block) ? sextent->se_start : block;
+        ecount = sextent->se_start + sextent->se_count;
+        if (ecount > end) {
+            ecount = end;
+        }
+        ecount -= start;
+        lc_spaceCarve(rfs, space, sextent, start, ecount);
+        gfs->gfs_super->sb_blocks += ecount;
+        if (fs != rfs) {
+            lc_addSpaceExtent(gfs, fs, &fs->fs_aextents, start, ecount, true);
+        }
+        fs->fs_blocks += ecount;
+        lc_markExtentsDirty(rfs);
+        block = start + ecount;
+    }
+    lc_mutexUnlock(&gfs->gfs_alock, LC_LOCK_GALLOC);
+}
+
 /* Free blocks used for storing allocated/free extent info */
 static void
 lc_freeExtentBlocks(struct gfs *gfs, struct fs *fs, uint64_t block,
                     uint64_t count, bool lock) {
     if (lock) {
-        pthread_mutex_lock(&gfs->gfs_alock);
+        lc_mutexLock(&gfs->gfs_alock, LC_LOCK_GALLOC);
     }
     assert(gfs->gfs_super->sb_blocks >= count);
     gfs->gfs_super->sb_blocks -= count;
-    lc_addSpaceExtent(gfs, fs, &gfs->gfs_fextents, block, count, true);
+    lc_spaceAdd(gfs, gfs->gfs_fextents, block, count);
     if (lock) {
-        pthread_mutex_unlock(&gfs->gfs_alock);
+        lc_mutexUnlock(&gfs->gfs_alock, LC_LOCK_GALLOC);
         lc_markExtentsDirty(fs);
     }
 }
 
+/* Add an extent to the disk block being filled up for flushing */
+static struct dextentBlock *
+lc_addFlushExtent(struct gfs *gfs, struct fs *rfs, struct dextentBlock *eblock,
+                  struct page **page, uint64_t *count, uint64_t *pcount,
+                  uint64_t start, uint64_t ecount) {
+    struct dextent *dextent;
+
+    /* Start a new block if current one is full */
+    if (*count >= LC_EXTENT_BLOCK) {
+        if (eblock) {
+            *page = lc_getPageNoBlock(gfs, rfs, (char *)eblock, *page);
+        }
+        lc_mallocBlockAligned(rfs, (void **)&eblock, LC_MEMTYPE_DATA);
+        (*pcount)++;
+        *count = 0;
+    }
+    dextent = &eblock->de_extents[(*count)++];
+    dextent->de_start = start;
+    dextent->de_count = ecount;
+    return eblock;
+}
+
+/* Allocate page for the last block filled up with extents */
+static struct page *
+lc_endFlushExtents(struct gfs *gfs, struct fs *rfs, struct dextentBlock *eblock,
+                   struct page *page, uint64_t count) {
+    if (eblock) {
+        if (count < LC_EXTENT_BLOCK) {
+            eblock->de_extents[count].de_start = 0;
+        }
+        page = lc_getPageNoBlock(gfs, rfs, (char *)eblock, page);
+    }
+    return page;
+}
+
 /* Perform requested actions on the extent list */
 uint64_t
 lc_blockFreeExtents(struct gfs *gfs, struct fs *fs, struct extent *extents,
@@ -271,7 +1055,6 @@ lc_blockFreeExtents(struct gfs *gfs, struct fs *fs, struct extent *extents,
     struct dextentBlock *eblock = NULL;
     struct page *page = NULL;
     uint64_t estart, ecount;
-    struct dextent *dextent;
     struct super *super;
 
     while (extent) {
@@ -281,17 +1064,9 @@ lc_blockFreeExtents(struct gfs *gfs, struct fs *fs, struct extent *extents,
         if (flush) {
 
             /* Add this extent to the disk block */
-            if (count >= LC_EXTENT_BLOCK) {
-                if (eblock) {
-                    page = lc_getPageNoBlock(gfs, rfs, (char *)eblock, page);
-                }
-                lc_mallocBlockAligned(rfs, (void **)&eblock, LC_MEMTYPE_DATA);
-                pcount++;
-                count = 0;
-            }
-            dextent = &eblock->de_extents[count++];
-            dextent->de_start = lc_getExtentStart(extent);
-            dextent->de_count = lc_getExtentCount(extent);
+            eblock = lc_addFlushExtent(gfs, rfs, eblock, &page, &count,
+                                       &pcount, lc_getExtentStart(extent),
+                                       lc_getExtentCount(extent));
         } else if (efree) {
 
             /* Free extent blocks */
@@ -309,53 +1084,77 @@ lc_blockFreeExtents(struct gfs *gfs, struct fs *fs, struct extent *extents,
     }
 
     /* Allocate page for the last block */
-    if (eblock) {
-        if (count < LC_EXTENT_BLOCK) {
-            eblock->de_extents[count].de_start = 0;
-        }
-        page = lc_getPageNoBlock(gfs, rfs, (char *)eblock, page);
-    }
+    page = lc_endFlushExtents(gfs, rfs, eblock, page, count);
 
-    /* Write out the allocated/free extent info to disk */
+    /* Write out the allocated extent info to disk */
     if (flush) {
         assert(pcount);
-        if (layer) {
-            super = fs->fs_super;
-            if (super->sb_extentCount) {
-                lc_freeExtentBlocks(gfs, rfs, super->sb_extentBlock,
-                                    super->sb_extentCount, false);
-            }
-
-            /* Allocate a new block */
-            block = lc_blockAllocExact(rfs, pcount, true, false);
-            super->sb_extentBlock = block;
-            super->sb_extentCount = pcount;
-            lc_printf("Syncing allocated map layer %d block %ld count %ld\n",
-                      fs->fs_gindex, block, pcount);
-        } else {
-
-            /* Use the pre-allocated block */
-            block = gfs->gfs_super->sb_extentBlock;
-            assert(block != LC_INVALID_BLOCK);
-            lc_printf("Syncing free extent map to block %ld count %ld\n",
-                      block, pcount);
+        assert(layer);
+        super = fs->fs_super;
+        if (super->sb_extentCount) {
+            lc_freeExtentBlocks(gfs, rfs, super->sb_extentBlock,
+                                super->sb_extentCount, false);
         }
 
+        /* Allocate a new block */
+        block = lc_blockAllocExact(rfs, pcount, true, false);
+        super->sb_extentBlock = block;
+        super->sb_extentCount = pcount;
+        lc_printf("Syncing allocated map layer %d block %ld count %ld\n",
+                  fs->fs_gindex, block, pcount);
+
         /* Queue write of newly created pages */
         lc_flushExtentPages(gfs, rfs, page, pcount, block);
     }
     return freed;
 }
 
+/* Flush global index of free extents to the blocks pre-allocated for it */
+static void
+lc_spaceFlush(struct gfs *gfs, struct fs *fs) {
+    uint64_t count = LC_EXTENT_BLOCK, pcount = 0, block;
+    struct space *space = gfs->gfs_extents;
+    struct dextentBlock *eblock = NULL;
+    struct sextent *sextent;
+    struct page *page = NULL;
+    uint64_t i;
+
+    for (i = 0; i < (space->sp_groups * LC_SPACE_BINS); i++) {
+        sextent = space->sp_bins[i];
+        while (sextent) {
+            eblock = lc_addFlushExtent(gfs, fs, eblock, &page, &count,
+                                       &pcount, sextent->se_start,
+                                       sextent->se_count);
+            sextent = sextent->se_bnext;
+        }
+    }
+
+    /* Write an empty block if there is no free space left */
+    if (eblock == NULL) {
+        lc_mallocBlockAligned(fs, (void **)&eblock, LC_MEMTYPE_DATA);
+        pcount++;
+        count = 0;
+    }
+    page = lc_endFlushExtents(gfs, fs, eblock, page, count);
+
+    /* Use the pre-allocated block */
+    block = gfs->gfs_super->sb_extentBlock;
+    assert(block != LC_INVALID_BLOCK);
+    assert(pcount <= gfs->gfs_super->sb_extentCount);
+    lc_printf("Syncing free extent map to block %ld count %ld\n",
+              block, pcount);
+    lc_flushExtentPages(gfs, fs, page, pcount, block);
+}
+
 /* Read extents list */
 void
 lc_readExtents(struct gfs *gfs, struct fs *fs) {
     uint64_t block, count = 0, ecount = 0;
     struct fs *rfs = lc_getGlobalFs(gfs);
     bool allocated = (fs != rfs);
+    struct extent **extents = NULL;
     struct dextentBlock *eblock;
     struct dextent *dextent;
-    struct extent **extents;
     int i;
 
     block = fs->fs_super->sb_extentBlock;
@@ -367,7 +1166,11 @@ lc_readExtents(struct gfs *gfs, struct fs *fs) {
         assert(fs->fs_super->sb_flags & LC_SUPER_DIRTY);
         return;
     }
-    extents = allocated ? &fs->fs_aextents : &gfs->gfs_extents;
+    if (allocated) {
+        extents = &fs->fs_aextents;
+    } else {
+        lc_spaceInit(gfs, fs);
+    }
     lc_mallocBlockAligned(fs, (void **)&eblock, LC_MEMTYPE_BLOCK);
     while (block != LC_INVALID_BLOCK) {
         //lc_printf("Reading extents from block %ld\n", block);
@@ -382,8 +1185,13 @@ lc_readExtents(struct gfs *gfs, struct fs *fs) {
             if ((dextent->de_start == 0) || (dextent->de_count == 0)) {
                 break;
             }
-            lc_addSpaceExtent(gfs, fs, extents, dextent->de_start,
-                              dextent->de_count, true);
+            if (allocated) {
+                lc_addSpaceExtent(gfs, fs, extents, dextent->de_start,
+                                  dextent->de_count, true);
+            } else {
+                lc_spaceAdd(gfs, gfs->gfs_extents, dextent->de_start,
+                            dextent->de_count);
+            }
             count += dextent->de_count;
         }
         block = eblock->de_next;
@@ -418,9 +1226,9 @@ lc_freeLayerExtent(struct gfs *gfs, struct fs *fs, struct fs *rfs,
     while (count) {
 
         /* Find the portion of the extent which is allocated in the layer */
-        pthread_mutex_lock(&fs->fs_alock);
+        lc_mutexLock(&fs->fs_alock, LC_LOCK_ALLOC);
         freed = lc_removeExtent(fs, &fs->fs_aextents, block, count);
-        pthread_mutex_unlock(&fs->fs_alock);
+        lc_mutexUnlock(&fs->fs_alock, LC_LOCK_ALLOC);
         if (freed) {
             lc_freeExtentBlocks(gfs, rfs, block, freed, true);
             total += freed;
@@ -457,11 +1265,11 @@ lc_blockFreeLayer(struct gfs *gfs, struct fs *fs, struct fs *rfs,
         count = lc_freeLayerExtent(gfs, fs, rfs, block, count);
     } else {
         if (reuse) {
-            pthread_mutex_lock(&fs->fs_alock);
+            lc_mutexLock(&fs->fs_alock, LC_LOCK_ALLOC);
             lc_addSpaceExtent(fs->fs_gfs, fs, &fs->fs_extents, block, count,
                               false);
             fs->fs_reservedBlocks += count;
-            pthread_mutex_unlock(&fs->fs_alock);
+            lc_mutexUnlock(&fs->fs_alock, LC_LOCK_ALLOC);
         } else {
 
             /* Release the blocks to the global pool */
@@ -471,9 +1279,77 @@ lc_blockFreeLayer(struct gfs *gfs, struct fs *fs, struct fs *rfs,
     lc_atomicUpdate(fs, &fs->fs_freed, count, true);
 }
 
+/* Display fragmentation of free space */
+static void
+lc_displaySpaceStats(struct gfs *gfs) {
+    uint64_t largest = 0, count, blocks, full = 0, g;
+    struct space *space = gfs->gfs_extents;
+    struct sextent *sextent;
+    int i;
+
+    if (space == NULL) {
+        return;
+    }
+    lc_mutexLock(&gfs->gfs_alock, LC_LOCK_GALLOC);
+    count = space->sp_count;
+    blocks = space->sp_blocks;
+
+    /* Largest extent is in the highest non-empty size class of a group */
+    for (g = 0; g < space->sp_groups; g++) {
+        if (space->sp_gblocks[g] == 0) {
+            full++;
+        }
+        for (i = LC_SPACE_BINS - 1; i >= 0; i--) {
+            sextent = space->sp_bins[(g * LC_SPACE_BINS) + i];
+            if (sextent == NULL) {
+                continue;
+            }
+            while (sextent) {
+                if (sextent->se_count > largest) {
+                    largest = sextent->se_count;
+                }
+                sextent = sextent->se_bnext;
+            }
+            break;
+        }
+    }
+    lc_syslog(LOG_INFO, "\tFree extents %ld blocks %ld largest %ld "
+              "average %ld fragmentation %ld%%\n", count, blocks, largest,
+              count ? blocks / count : 0,
+              blocks ? ((blocks - largest) * 100) / blocks : 0);
+    lc_syslog(LOG_INFO, "\tAllocation groups %ld of %ld blocks, %ld full\n",
+              space->sp_groups, 1ul << space->sp_shift, full);
+    if (gfs->gfs_fextents->sp_count) {
+        lc_syslog(LOG_INFO, "\tPending free extents %ld blocks %ld\n",
+                  gfs->gfs_fextents->sp_count, gfs->gfs_fextents->sp_blocks);
+    }
+
+    /* Display number of free extents in each size class */
+    for (i = 0; i < LC_SPACE_BINS; i++) {
+        count = 0;
+        blocks = 0;
+        for (g = 0; g < space->sp_groups; g++) {
+            sextent = space->sp_bins[(g * LC_SPACE_BINS) + i];
+            while (sextent) {
+                count++;
+                blocks += sextent->se_count;
+                sextent = sextent->se_bnext;
+            }
+        }
+        if (count) {
+            lc_syslog(LOG_INFO, "\t\t%ld - %ld blocks: extents %ld "
+                      "blocks %ld\n", 1ul << i, (2ul << i) - 1, count, blocks);
+        }
+    }
+    lc_mutexUnlock(&gfs->gfs_alock, LC_LOCK_GALLOC);
+}
+
 /* Display allocation stats of the layer */
 void
 lc_displayAllocStats(struct fs *fs) {
+    uint64_t count = 0;
+    int i;
+
     if (fs->fs_blocks) {
         lc_syslog(LOG_INFO, "\tblocks allocated %ld freed %ld in use %ld\n",
                   fs->fs_blocks, fs->fs_freed, fs->fs_blocks - fs->fs_freed);
@@ -481,6 +1357,37 @@ lc_displayAllocStats(struct fs *fs) {
     if (fs->fs_reservedBlocks) {
         lc_syslog(LOG_INFO, "\tReserved blocks %ld\n", fs->fs_reservedBlocks);
     }
+    if (fs->fs_group >= 0) {
+        lc_syslog(LOG_INFO, "\tAllocation group %ld\n", fs->fs_group);
+    }
+    if (fs->fs_cursors) {
+        for (i = 0; i < LC_CURSOR_MAX; i++) {
+            count += fs->fs_cursors[i].ac_count;
+        }
+        if (count) {
+            lc_syslog(LOG_INFO, "\tBlocks reserved by cursors %ld\n", count);
+        }
+    }
+    if (fs->fs_gindex == 0) {
+        lc_displaySpaceStats(fs->fs_gfs);
+    }
+}
+
+/* Render allocation stats of a layer */
+void
+lc_allocMetrics(struct metrics *m, struct fs *fs, const char *labels) {
+    uint64_t count = 0;
+    int i;
+
+    lc_metric(m, "blocks_allocated_total", labels, fs->fs_blocks);
+    lc_metric(m, "blocks_freed_total", labels, fs->fs_freed);
+    lc_metric(m, "blocks_reserved", labels, fs->fs_reservedBlocks);
+    if (fs->fs_cursors) {
+        for (i = 0; i < LC_CURSOR_MAX; i++) {
+            count += fs->fs_cursors[i].ac_count;
+        }
+    }
+    lc_metric(m, "blocks_cursor_reserved", labels, count);
 }
 
 /* Allocate specified number of blocks */
@@ -489,12 +1396,25 @@ lc_blockAlloc(struct fs *fs, uint64_t count, bool meta, bool reserve) {
     struct gfs *gfs = fs->fs_gfs;
     uint64_t block;
 
-    pthread_mutex_lock(&fs->fs_alock);
+    /* Data blocks are carved from reservations of allocation cursors without
+     * taking the layer allocation lock.
+     */
+    if (!meta && reserve) {
+        block = lc_cursorAlloc(gfs, fs, count);
+        if (block != LC_INVALID_BLOCK) {
+            lc_markExtentsDirty(fs);
+            assert((block + count) < gfs->gfs_super->sb_tblocks);
+            lc_probe3(blockalloc, fs->fs_gindex, count, block);
+            return block;
+        }
+    }
+    lc_mutexLock(&fs->fs_alock, LC_LOCK_ALLOC);
     block = lc_findFreeBlock(gfs, fs, count, true, true);
-    pthread_mutex_unlock(&fs->fs_alock);
+    lc_mutexUnlock(&fs->fs_alock, LC_LOCK_ALLOC);
     lc_markExtentsDirty(fs);
     assert(((block + count) < gfs->gfs_super->sb_tblocks) ||
            (block == LC_INVALID_BLOCK));
+    lc_probe3(blockalloc, fs->fs_gindex, count, block);
     return block;
 }
 
@@ -526,13 +1446,12 @@ lc_blockFree(struct gfs *gfs, struct fs *fs, uint64_t block,
     } else {
 
         /* Add blocks back to the global free list */
-        pthread_mutex_lock(&gfs->gfs_alock);
-        lc_addSpaceExtent(gfs, rfs,
-                          reuse ? &gfs->gfs_extents : &gfs->gfs_fextents,
-                          block, count, true);
+        lc_mutexLock(&gfs->gfs_alock, LC_LOCK_GALLOC);
+        lc_spaceAdd(gfs, reuse ? gfs->gfs_extents : gfs->gfs_fextents,
+                    block, count);
         assert(gfs->gfs_super->sb_blocks >= count);
         gfs->gfs_super->sb_blocks -= count;
-        pthread_mutex_unlock(&gfs->gfs_alock);
+        lc_mutexUnlock(&gfs->gfs_alock, LC_LOCK_GALLOC);
         if (!reuse) {
             lc_markExtentsDirty(rfs);
         }
@@ -592,12 +1511,12 @@ lc_moveExtents(struct fs *fs, struct extent **extents,
 
     /* Link the provided list to list of the layer */
     if (fs) {
-        pthread_mutex_lock(&fs->fs_alock);
+        lc_mutexLock(&fs->fs_alock, LC_LOCK_ALLOC);
     }
     last->ex_next = *extents;
     *extents = extent;
     if (fs) {
-        pthread_mutex_unlock(&fs->fs_alock);
+        lc_mutexUnlock(&fs->fs_alock, LC_LOCK_ALLOC);
     }
 }
 
@@ -607,6 +1526,7 @@ lc_processLayerBlocks(struct gfs *gfs, struct fs *fs, bool unmount,
                        bool remove, bool flush) {
 
     /* Release any unused reservation */
+    lc_releaseCursors(gfs, fs);
     lc_releaseReservedBlocks(gfs, fs);
 
     /* Process blocks freed in layer.  These blocks may or may not be
@@ -630,9 +1550,9 @@ lc_processLayerBlocks(struct gfs *gfs, struct fs *fs, bool unmount,
 /* Track an extent freed from a layer */
 void
 lc_addFreedBlocks(struct fs *fs, uint64_t block, uint64_t count) {
-    pthread_mutex_lock(&fs->fs_alock);
+    lc_mutexLock(&fs->fs_alock, LC_LOCK_ALLOC);
     lc_addSpaceExtent(fs->fs_gfs, fs, &fs->fs_fextents, block, count, false);
-    pthread_mutex_unlock(&fs->fs_alock);
+    lc_mutexUnlock(&fs->fs_alock, LC_LOCK_ALLOC);
 }
 
 /* Track a list of extents freed from a layer */
@@ -708,39 +1628,27 @@ lc_countExtents(struct gfs *gfs, struct extent *extent, uint64_t *bcount) {
     return count;
 }
 
-/* Flush and/or release global list of free extents to disk */
+/* Flush and/or release global index of free extents to disk */
 void
 lc_processFreeExtents(struct gfs *gfs, struct fs *fs, bool umount) {
-    uint64_t count, pcount, block = LC_INVALID_BLOCK, bcount = 0;
-    bool release, flush = fs->fs_extentsDirty;
-    struct extent *extent, **prev;
+    uint64_t count, pcount, block, bcount;
+    bool flush = fs->fs_extentsDirty;
 
     if (flush) {
 
-        /* Count the number of free extents to find number of blocks needed */
-        count = lc_countExtents(gfs, gfs->gfs_extents, &bcount);
-        count += lc_countExtents(gfs, gfs->gfs_fextents, &bcount);
+        /* Count the number of free extents to find number of blocks needed.
+         * Blocks currently storing the free extents are freed below, which
+         * could add one more extent.
+         */
+        count = gfs->gfs_extents->sp_count + gfs->gfs_fextents->sp_count + 1;
+        bcount = gfs->gfs_extents->sp_blocks + gfs->gfs_fextents->sp_blocks;
         pcount = (count + LC_EXTENT_BLOCK - 1) / LC_EXTENT_BLOCK;
         assert(pcount);
 
         /* Allocate blocks for storing free space extents */
         /* XXX Make sure space exists for tracking free space extents */
-        prev = &gfs->gfs_extents;
-        extent = gfs->gfs_extents;
-        while (extent) {
-            if (lc_getExtentCount(extent) >= pcount) {
-                block = lc_getExtentStart(extent);
-                release = lc_decrExtentCount(gfs, extent, pcount);
-                if (release) {
-                    lc_freeExtent(gfs, fs, extent, prev, true);
-                } else {
-                    lc_incrExtentStart(NULL, extent, pcount);
-                }
-                break;
-            }
-            prev = &extent->ex_next;
-            extent = extent->ex_next;
-        }
+        block = lc_spaceAlloc(gfs, gfs->gfs_extents, pcount,
+                              lc_layerGroup(gfs, fs));
         assert(block != LC_INVALID_BLOCK);
         assert((block + pcount) < gfs->gfs_super->sb_tblocks);
         gfs->gfs_super->sb_blocks += pcount;
@@ -755,32 +1663,24 @@ lc_processFreeExtents(struct gfs *gfs, struct fs *fs, bool umount) {
         gfs->gfs_super->sb_extentBlock = block;
         gfs->gfs_super->sb_extentCount = pcount;
     } else {
-        assert(gfs->gfs_fextents == NULL);
+        assert(gfs->gfs_fextents->sp_count == 0);
     }
 
     /* Transfer all the extents freed so far */
-    prev = &gfs->gfs_fextents;
-    extent = gfs->gfs_fextents;
-    while (extent) {
-        lc_addSpaceExtent(gfs, fs, &gfs->gfs_extents,
-                          lc_getExtentStart(extent), lc_getExtentCount(extent),
-                          true);
-        *prev = extent->ex_next;
-        lc_free(fs, extent, sizeof(struct extent), LC_MEMTYPE_EXTENT);
-        extent = *prev;
-    }
-
-    /* Flush global list of free extents to disk */
-    lc_blockFreeExtents(gfs, fs, gfs->gfs_extents,
-                        (umount ? 0 : LC_EXTENT_KEEP) |
-                        (flush ? LC_EXTENT_FLUSH : 0));
-    if (umount) {
-        gfs->gfs_extents = NULL;
-    }
+    lc_spaceMove(gfs, gfs->gfs_extents, gfs->gfs_fextents);
+
+    /* Flush global index of free extents to disk */
     if (flush) {
+        lc_spaceFlush(gfs, fs);
         fs->fs_extentsDirty = false;
         lc_markSuperDirty(fs);
     }
+    if (umount) {
+        lc_spaceFree(gfs, gfs->gfs_extents);
+        lc_spaceFree(gfs, gfs->gfs_fextents);
+        gfs->gfs_extents = NULL;
+        gfs->gfs_fextents = NULL;
+    }
 }
 
 /* Grow the size of a file system */
@@ -802,12 +1702,11 @@ lc_grow(struct gfs *gfs) {
     lc_printf("Growing file system, old size %ld new size %ld\n",
               oblock * LC_BLOCK_SIZE, size);
     lc_lockExclusive(fs);
-    pthread_mutex_lock(&gfs->gfs_alock);
+    lc_mutexLock(&gfs->gfs_alock, LC_LOCK_GALLOC);
     super->sb_tblocks = block;
-    lc_addSpaceExtent(gfs, fs, &gfs->gfs_extents, oblock, block - oblock,
-                      true);
+    lc_spaceAdd(gfs, gfs->gfs_extents, oblock, block - oblock);
     gfs->gfs_blocksReserved = (super->sb_tblocks * LC_RESERVED_BLOCKS) / 100ul;
-    pthread_mutex_unlock(&gfs->gfs_alock);
+    lc_mutexUnlock(&gfs->gfs_alock, LC_LOCK_GALLOC);
     lc_markExtentsDirty(fs);
     lc_markSuperDirty(fs);
     lc_unlockExclusive(fs);
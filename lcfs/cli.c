@@ -43,7 +43,8 @@ cmd_group lcfs_cmd_group[] = {
 #ifndef __MUSL__
             "[-p] "
 #endif
-            "[-f] [-d] [-m] [-r] [-t] [-v]",
+            "[-f] [-d] [-m] [-r] [-t] [-v] [-q] [-a] [-w <count>] "
+            "[-i <count>] [-k] [-l]",
         "\tdevice     - device or file - image layers will be saved here\n"
         "\thost-mount - mount point on host\n"
         "\thost-mount - mount point propogated to the plugin\n"
@@ -57,7 +58,14 @@ cmd_group lcfs_cmd_group[] = {
         "\t-p         - enable profiling (optional)\n"
 #endif
         "\t-s         - swap layers when committed\n"
-        "\t-v         - enable verbose mode (optional)\n",
+        "\t-v         - enable verbose mode (optional)\n"
+        "\t-q         - clone fuse device for each worker (optional)\n"
+        "\t-a         - pin workers to CPUs (optional)\n"
+        "\t-w <count> - maximum number of workers (default 256)\n"
+        "\t-i <count> - maximum number of idle workers (default 10)\n"
+        "\t-k         - enable kernel writeback cache and large requests"
+        " (optional)\n"
+        "\t-l         - make fsync persistent using an intent log (optional)\n",
         3,
         cmd_daemon
     },
@@ -113,6 +121,57 @@ cmd_group lcfs_cmd_group[] = {
         1,
         cmd_ioctl
     },
+    {
+        "defrag",
+        "Defragment a read only layer in the background",
+        "<mnt> <id> [rate]",
+        "\tmnt     - mount point\n"
+        "\tid      - layer name\n"
+        "\trate    - rate limit in MB per second, up to 255 "
+        "(default unlimited)\n",
+        2,
+        cmd_ioctl
+    },
+    {
+        "hot",
+        "Display files and layers accessed the most",
+        "<mnt> [-c]",
+        "\tmnt     - mount point\n"
+        "\t[-c]    - clear accesses tracked (optional)\n",
+        1,
+        cmd_ioctl
+    },
+    {
+        "qos",
+        "Limit I/O of a layer",
+        "<mnt> <id> <rate> <iops> [weight]",
+        "\tmnt     - mount point\n"
+        "\tid      - layer name\n"
+        "\trate    - bandwidth limit in MB per second, 0 for unlimited\n"
+        "\tiops    - I/O operations per second, 0 for unlimited\n"
+        "\tweight  - share of the device while busy (default 100)\n",
+        4,
+        cmd_ioctl
+    },
+    {
+        "trace",
+        "Trace requests or display requests traced",
+        "<mnt> [enable|disable|dump]",
+        "\tmnt                  - mount point\n"
+        "\t[enable|disable|dump] - enable/disable tracing requests, or "
+        "display requests traced\n",
+        2,
+        cmd_ioctl
+    },
+    {
+        "locks",
+        "Enable/Disable profiling lock contention",
+        "<mnt> [enable|disable]",
+        "\tmnt                  - mount point\n"
+        "\t[enable|disable]     - enable/disable profiling lock contention\n",
+        2,
+        cmd_ioctl
+    },
 #ifndef __MUSL__
     {
         "profile",
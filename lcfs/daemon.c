@@ -20,7 +20,9 @@ usage(char *prog) {
 #ifndef __MUSL__
                        " [-p]"
 #endif
-                       " [-f] [-c] [-d] [-m] [-r] [-t] [-s] [-v]\n",
+                       " [-f] [-c] [-d] [-m] [-r] [-t] [-s] [-v]"
+                       " [-q] [-a] [-w <count>] [-i <count>] [-k] [-l]"
+                       " [-e <device>]\n",
                        prog);
     lc_syslog(LOG_ERR, "\tdevice        - device or file - image layers"
                        " will be saved here\n"
@@ -37,7 +39,21 @@ usage(char *prog) {
                     "\t-p            - enable profiling (optional)\n"
 #endif
                     "\t-s            - swap layers when committed\n"
-                    "\t-v            - enable verbose mode (optional)\n");
+                    "\t-v            - enable verbose mode (optional)\n"
+                    "\t-q            - clone fuse device for each worker"
+                                       " (optional)\n"
+                    "\t-a            - pin workers to CPUs (optional)\n"
+                    "\t-w <count>    - maximum number of workers"
+                                       " (default 256)\n"
+                    "\t-i <count>    - maximum number of idle workers"
+                                       " (default 10)\n"
+                    "\t-e <device>   - emulate a slow device, hdd, ebs, ssd"
+                                       " or <latency usec>,<seek usec>,"
+                                       "<MB/s>,<queue depth> (optional)\n"
+                    "\t-k            - enable kernel writeback cache and"
+                                       " large requests (optional)\n"
+                    "\t-l            - make fsync persistent using an"
+                                       " intent log (optional)\n");
 }
 
 /* Notify parent process completion */
@@ -161,12 +177,20 @@ lc_serve(void *data) {
         }
     }
     if (!err) {
-        err = fuse_session_loop_mt(gfs->gfs_se[id]
 #ifdef FUSE3
-                                   , 0);
+
+        /* Cloned fuse devices are set up by the fuse library for its own
+         * workers.
+         */
+        if (gfs->gfs_cloneFd) {
+            err = fuse_session_loop_mt(gfs->gfs_se[id], 1);
+        } else {
+            err = lc_serveWorkers(gfs, gfs->gfs_se[id], id);
+            lc_displayWorkerStats(gfs, id);
+        }
     }
 #else
-                                   );
+        err = fuse_session_loop_mt(gfs->gfs_se[id]);
     }
 #endif
 
@@ -314,8 +338,9 @@ lc_start(struct gfs *gfs, char *device, enum lc_mountId id) {
 int
 lcfs_main(char *pgm, int argc, char *argv[]) {
     bool daemon = true, format = false, ftypes = false, swap = false;
-    int i, err = -1, waiter[2], fd, count;
-    char *arg[argc + 1], completed;
+    int i, err = -1, waiter[2], fd, count, workers = 0, idle = 0;
+    bool clone = false, pin = false, kcache = false, ilog = false;
+    char *arg[argc + 1], *device = NULL, completed;
     struct fuse_session *se;
 #ifndef __MUSL__
     bool profiling = false;
@@ -407,6 +432,34 @@ lcfs_main(char *pgm, int argc, char *argv[]) {
             swap = true;
         } else if (!strcmp(argv[i], "-v")) {
             lc_verbose = true;
+        } else if (!strcmp(argv[i], "-q")) {
+            clone = true;
+        } else if (!strcmp(argv[i], "-a")) {
+            pin = true;
+        } else if (!strcmp(argv[i], "-k")) {
+            kcache = true;
+        } else if (!strcmp(argv[i], "-l")) {
+            ilog = true;
+        } else if (!strcmp(argv[i], "-e")) {
+            if (((i + 1) >= argc) || lc_deviceEmulate(NULL, argv[i + 1])) {
+                usage(pgm);
+                close(fd);
+                closelog();
+                exit(EINVAL);
+            }
+            device = argv[++i];
+        } else if (!strcmp(argv[i], "-w") || !strcmp(argv[i], "-i")) {
+            if (((i + 1) >= argc) || (atoi(argv[i + 1]) <= 0)) {
+                usage(pgm);
+                close(fd);
+                closelog();
+                exit(EINVAL);
+            }
+            if (!strcmp(argv[i], "-w")) {
+                workers = atoi(argv[++i]);
+            } else {
+                idle = atoi(argv[++i]);
+            }
         } else {
             if (!strcmp(argv[i], "-f") ||
                 !strcmp(argv[i], "-d")) {
@@ -462,6 +515,15 @@ lcfs_main(char *pgm, int argc, char *argv[]) {
     gfs->gfs_profiling = profiling;
 #endif
     gfs->gfs_swapLayersForCommit = swap;
+    gfs->gfs_cloneFd = clone;
+    gfs->gfs_pinWorkers = pin;
+    gfs->gfs_maxWorkers = workers;
+    gfs->gfs_idleWorkers = idle;
+    gfs->gfs_kernelCache = kcache;
+    gfs->gfs_intentLog = ilog;
+    if (device) {
+        lc_deviceEmulate(gfs, device);
+    }
 
     /* Setup arguments for fuse mount */
     arg[0] = pgm;
@@ -536,11 +598,13 @@ out:
         if (gfs->gfs_mountpoint[i]) {
             lc_free(NULL, gfs->gfs_mountpoint[i], 0, LC_MEMTYPE_GFS);
         }
+        lc_freeWorkers(gfs, i);
     }
     lc_free(NULL, arg[3], LC_SIZEOF_MOUNTARGS, LC_MEMTYPE_GFS);
     close(fd);
     lc_free(NULL, gfs, sizeof(struct gfs), LC_MEMTYPE_GFS);
     lc_displayGlobalMemStats();
+    lc_freeDataPool();
     closelog();
     return err ? 1 : 0;
 }
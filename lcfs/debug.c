@@ -132,7 +132,7 @@ lc_validate(struct gfs *gfs) {
     struct super *super;
     int i;
 
-    assert(gfs->gfs_fextents == NULL);
+    assert(gfs->gfs_fextents->sp_count == 0);
     for (i = 0; i <= gfs->gfs_scount; i++) {
         fs = gfs->gfs_fs[i];
         if (fs) {
@@ -163,12 +163,18 @@ lc_validate(struct gfs *gfs) {
             lc_validateAllocatedBlocks(gfs, fs, rfs, lextents, &extents);
         }
     }
+
+    /* Space reserved for the intent log belongs to the root layer */
+    if (gfs->gfs_super->sb_logBlock) {
+        lc_addSpaceExtent(gfs, rfs, &rextents, gfs->gfs_super->sb_logBlock,
+                          gfs->gfs_super->sb_logCount, true);
+    }
     lc_copyExtents(gfs, rfs, rextents, &extents, rfs);
 
     /* Add all the free blocks and there should be a single extent covering the
      * whole file system.
      */
-    lc_copyExtents(gfs, rfs, gfs->gfs_extents, &extents, NULL);
+    lc_spaceExtents(gfs, rfs, gfs->gfs_extents, &extents);
     assert(extents->ex_next == NULL);
     assert(lc_getExtentStart(extents) == LC_START_BLOCK);
     assert(lc_getExtentCount(extents) ==
@@ -0,0 +1,462 @@
+#include "includes.h"
+
+/* Number of blocks copied at a time while relocating a file */
+#define LC_DEFRAG_CHUNK     256
+
+/* Time in microseconds to wait before retrying to lock layers */
+#define LC_DEFRAG_WAIT      1000
+
+/* Number of attempts made to lock child layers before skipping a file */
+#define LC_DEFRAG_RETRY     100
+
+/* State of a layer being defragmented */
+struct defrag {
+
+    /* Global file system */
+    struct gfs *df_gfs;
+
+    /* Buffers used for copying blocks */
+    void *df_buf[LC_DEFRAG_CHUNK];
+
+    /* Root inode of the layer */
+    ino_t df_root;
+
+    /* Index of the layer */
+    int df_gindex;
+
+    /* Rate limit in bytes per second, 0 for unlimited */
+    uint64_t df_rate;
+
+    /* Bytes copied so far */
+    uint64_t df_copied;
+
+    /* Number of files relocated */
+    uint64_t df_files;
+
+    /* Number of files skipped */
+    uint64_t df_skipped;
+
+    /* Time when defragmentation started */
+    struct timeval df_start;
+};
+
+/* Lock the layer being defragmented.  Return NULL if the layer is gone.
+ * Trylock is used so that the defragmenter does not sit on the lock queue
+ * ahead of operations in the layer.
+ */
+static struct fs *
+lc_defragGetLayer(struct defrag *df, bool exclusive) {
+    struct gfs *gfs = df->df_gfs;
+    struct fs *fs;
+
+    rcu_read_lock();
+    while (!gfs->gfs_unmounting) {
+        fs = rcu_dereference(gfs->gfs_fs[df->df_gindex]);
+        if ((fs == NULL) || (fs->fs_root != df->df_root)) {
+            break;
+        }
+        if (lc_tryLock(fs, exclusive) == 0) {
+            rcu_read_unlock();
+            if (!fs->fs_removed && (fs->fs_gindex == df->df_gindex)) {
+                return fs;
+            }
+            lc_unlock(fs);
+            return NULL;
+        }
+        rcu_read_unlock();
+        usleep(LC_DEFRAG_WAIT);
+        rcu_read_lock();
+    }
+    rcu_read_unlock();
+    return NULL;
+}
+
+/* Unlock child layers locked before reaching the specified layer */
+static void
+lc_defragUnlockChildren(struct fs *fs, struct fs *last) {
+    struct fs *cfs;
+
+    for (cfs = fs->fs_child; cfs != last; cfs = cfs->fs_next) {
+        lc_defragUnlockChildren(cfs, NULL);
+        lc_unlock(cfs);
+    }
+}
+
+/* Lock all layers descending from a layer exclusive, without waiting for any.
+ * Those layers may be reading through emap of inodes in the layer.
+ */
+static bool
+lc_defragLockChildren(struct fs *fs) {
+    struct fs *cfs;
+
+    for (cfs = fs->fs_child; cfs; cfs = cfs->fs_next) {
+        if (lc_tryLock(cfs, true)) {
+            break;
+        }
+        if (!lc_defragLockChildren(cfs)) {
+            lc_unlock(cfs);
+            break;
+        }
+    }
+    if (cfs) {
+        lc_defragUnlockChildren(fs, cfs);
+        return false;
+    }
+    return true;
+}
+
+/* Check if any layer descending from a layer has a copy of the inode */
+static bool
+lc_defragShared(struct fs *fs, ino_t ino) {
+    struct fs *cfs;
+
+    for (cfs = fs->fs_child; cfs; cfs = cfs->fs_next) {
+        if (lc_lookupInodeCache(cfs, ino, -1) || lc_defragShared(cfs, ino)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Check if a file could be relocated and return the number of blocks */
+static uint64_t
+lc_defragCandidate(struct inode *inode) {
+    struct extent *extent, *next;
+    uint64_t pcount;
+
+    /* Only fragmented files with all blocks owned by the layer are relocated
+     */
+    if (!S_ISREG(inode->i_mode) || !inode->i_private ||
+        (inode->i_flags & (LC_INODE_SHARED | LC_INODE_REMOVED |
+                           LC_INODE_TMP)) ||
+        lc_inodeDirty(inode) || (lc_inodeGetEmap(inode) == NULL)) {
+        return 0;
+    }
+
+    /* Skip sparse files */
+    pcount = (inode->i_size + LC_BLOCK_SIZE - 1) / LC_BLOCK_SIZE;
+    if (inode->i_dinode.di_blocks != pcount) {
+        return 0;
+    }
+
+    /* Skip files with blocks contiguous already */
+    extent = lc_inodeGetEmap(inode);
+    while ((next = extent->ex_next) &&
+           ((lc_getExtentBlock(extent) + lc_getExtentCount(extent)) ==
+            lc_getExtentBlock(next))) {
+        extent = next;
+    }
+    return next ? pcount : 0;
+}
+
+/* Sleep as needed to keep copying within the rate limit */
+static void
+lc_defragThrottle(struct defrag *df, uint64_t count) {
+    uint64_t elapsed, expected;
+    struct timeval now;
+
+    df->df_copied += count * LC_BLOCK_SIZE;
+    if (df->df_rate == 0) {
+        return;
+    }
+    gettimeofday(&now, NULL);
+    elapsed = ((now.tv_sec - df->df_start.tv_sec) * 1000000) +
+              (now.tv_usec - df->df_start.tv_usec);
+    expected = ((df->df_copied / df->df_rate) * 1000000) +
+               (((df->df_copied % df->df_rate) * 1000000) / df->df_rate);
+    if (expected > elapsed) {
+        usleep(expected - elapsed);
+    }
+}
+
+/* Copy a range of pages of a file to new blocks.  Blocks of a frozen layer do
+ * not change, so pages are copied holding the layer shared.
+ */
+static bool
+lc_defragCopy(struct defrag *df, ino_t ino, int hash, uint64_t page,
+              uint64_t block, uint64_t count) {
+    struct iovec iov[LC_DEFRAG_CHUNK];
+    struct gfs *gfs = df->df_gfs;
+    struct extent *extent;
+    struct inode *inode;
+    uint64_t i, bblock;
+    struct fs *fs;
+
+    fs = lc_defragGetLayer(df, false);
+    if (fs == NULL) {
+        return false;
+    }
+
+    /* Make sure blocks of the file are on disk */
+    if (fs->fs_dpcount) {
+        lc_flushDirtyPages(gfs, fs);
+    }
+    inode = lc_lookupInodeCache(fs, ino, hash);
+    assert(inode);
+    extent = lc_inodeGetEmap(inode);
+    for (i = 0; i < count; i++) {
+        bblock = lc_inodeEmapLookup(gfs, inode, page + i, &extent);
+        assert(bblock != LC_PAGE_HOLE);
+        lc_readBlock(gfs, fs, bblock, df->df_buf[i]);
+        iov[i].iov_base = df->df_buf[i];
+        iov[i].iov_len = LC_BLOCK_SIZE;
+    }
+    lc_writeBlocks(gfs, fs, iov, count, block);
+    lc_statsWrite(fs, LC_WRITE_DEFRAG, count);
+    lc_unlock(fs);
+    lc_defragThrottle(df, count);
+    return true;
+}
+
+/* Free emap blocks of a file switched over to a direct extent.  Frozen layers
+ * do not track those in memory, so follow the chain on disk.
+ */
+static void
+lc_defragFreeEmapBlocks(struct defrag *df, struct fs *fs,
+                        struct inode *inode) {
+    struct emapBlock *eblock = df->df_buf[0];
+    uint64_t block = inode->i_emapDirBlock;
+
+    /* Tracked emap blocks are freed when the inode is flushed */
+    if (inode->i_emapDirExtents) {
+        return;
+    }
+    while (block != LC_INVALID_BLOCK) {
+        lc_readBlock(df->df_gfs, fs, block, eblock);
+        assert(eblock->eb_magic == LC_EMAP_MAGIC);
+        lc_addFreedBlocks(fs, block, 1);
+        block = eblock->eb_next;
+    }
+}
+
+/* Switch a file over to relocated blocks and free the old ones.  Child layers
+ * are locked as those could be reading blocks of the file.  Files with a copy
+ * in any child layer are left alone, as that copy may still be sharing the
+ * emap or blocks of the file.
+ *
+ * The inode is then written out by the next checkpoint with lc_syncInodes,
+ * which is also how inodes of a layer are written right after the layer is
+ * frozen.  New inode blocks are prepended to the inode block chain, so the
+ * newer copy of the inode is the one read after mounting again, and blocks
+ * allocated for those are tracked in the allocated extent list of the layer.
+ */
+static bool
+lc_defragSwitch(struct defrag *df, ino_t ino, int hash, uint64_t block,
+                uint64_t pcount) {
+    struct extent *extents = NULL, *extent;
+    struct gfs *gfs = df->df_gfs;
+    struct inode *inode;
+    bool locked = false;
+    struct fs *fs;
+    int i;
+
+    for (i = 0; i < LC_DEFRAG_RETRY; i++) {
+        fs = lc_defragGetLayer(df, true);
+        if (fs == NULL) {
+
+            /* Blocks allocated are released along with the layer */
+            return false;
+        }
+
+        /* Layer tree is not changing while child layers are being locked */
+        pthread_mutex_lock(&gfs->gfs_lock);
+        locked = lc_defragLockChildren(fs);
+        pthread_mutex_unlock(&gfs->gfs_lock);
+        if (locked) {
+            break;
+        }
+        lc_unlock(fs);
+        usleep(LC_DEFRAG_WAIT);
+    }
+    if (!locked) {
+        fs = lc_defragGetLayer(df, false);
+        if (fs == NULL) {
+            return false;
+        }
+        lc_blockFree(gfs, fs, block, pcount, true, true);
+        df->df_skipped++;
+        lc_unlock(fs);
+        return true;
+    }
+    inode = lc_lookupInodeCache(fs, ino, hash);
+    assert(inode);
+    if (lc_defragShared(fs, ino)) {
+        lc_blockFree(gfs, fs, block, pcount, true, true);
+        df->df_skipped++;
+    } else {
+        if (fs->fs_dpcount) {
+            lc_flushDirtyPages(gfs, fs);
+        }
+        lc_defragFreeEmapBlocks(df, fs, inode);
+
+        /* Replace blocks in the emap and switch to a direct extent */
+        lc_inodeEmapUpdate(gfs, fs, inode, 0, block, pcount, &extents);
+        extent = lc_inodeGetEmap(inode);
+        while (extent) {
+            lc_freeExtent(gfs, fs, extent, lc_inodeGetEmapPtr(inode), true);
+            extent = lc_inodeGetEmap(inode);
+        }
+        assert(inode->i_dinode.di_blocks == pcount);
+        inode->i_extentBlock = block;
+        inode->i_extentLength = pcount;
+        lc_markInodeDirty(inode, LC_INODE_EMAPDIRTY);
+
+        /* Free old blocks and invalidate those in block cache */
+        lc_freeInodeDataBlocks(gfs, fs, &extents);
+        lc_layerChanged(gfs, false, false);
+        df->df_files++;
+    }
+    lc_defragUnlockChildren(fs, NULL);
+    lc_unlock(fs);
+    return true;
+}
+
+/* Relocate blocks of a file to a contiguous extent */
+static bool
+lc_defragFile(struct defrag *df, ino_t ino, int hash, uint64_t pcount) {
+    uint64_t page, count, block;
+    struct fs *fs;
+
+    fs = lc_defragGetLayer(df, false);
+    if (fs == NULL) {
+        return false;
+    }
+    block = lc_blockAlloc(fs, pcount, false, false);
+    lc_unlock(fs);
+    if (block == LC_INVALID_BLOCK) {
+        df->df_skipped++;
+        return true;
+    }
+    for (page = 0; page < pcount; page += count) {
+        count = pcount - page;
+        if (count > LC_DEFRAG_CHUNK) {
+            count = LC_DEFRAG_CHUNK;
+        }
+        if (!lc_defragCopy(df, ino, hash, page, block + page, count)) {
+            return false;
+        }
+    }
+    return lc_defragSwitch(df, ino, hash, block, pcount);
+}
+
+/* Defragment files of a layer in the background */
+static void *
+lc_defragmenter(void *data) {
+    struct defrag *df = (struct defrag *)data;
+    struct gfs *gfs = df->df_gfs;
+    struct fs *fs, *rfs = lc_getGlobalFs(gfs);
+    struct inode *inode;
+    uint64_t pcount;
+    int i, hash;
+    ino_t ino;
+
+    rcu_register_thread();
+    gettimeofday(&df->df_start, NULL);
+    for (i = 0; i < LC_DEFRAG_CHUNK; i++) {
+        lc_mallocBlockAligned(rfs, &df->df_buf[i], LC_MEMTYPE_DATA);
+    }
+    for (hash = 0; ; hash++) {
+        fs = lc_defragGetLayer(df, false);
+        if (fs == NULL) {
+            break;
+        }
+        if (hash >= fs->fs_icacheSize) {
+            lc_unlock(fs);
+            break;
+        }
+
+        /* Inodes are not removed from the cache of a frozen layer, so resume
+         * from the last inode processed after relocking the layer.
+         */
+        inode = fs->fs_icache[hash].ic_head;
+        while (inode) {
+            pcount = lc_defragCandidate(inode);
+            if (pcount == 0) {
+                inode = inode->i_cnext;
+                continue;
+            }
+            ino = inode->i_ino;
+            lc_unlock(fs);
+            if (!lc_defragFile(df, ino, hash, pcount)) {
+                goto out;
+            }
+            fs = lc_defragGetLayer(df, false);
+            if (fs == NULL) {
+                goto out;
+            }
+            inode = lc_lookupInodeCache(fs, ino, hash);
+            assert(inode);
+            inode = inode->i_cnext;
+        }
+        lc_unlock(fs);
+    }
+
+out:
+    lc_syslog(LOG_INFO, "Defragmented layer %ld, %ld files relocated, "
+              "%ld files skipped, %ld MB copied\n", df->df_root,
+              df->df_files, df->df_skipped, df->df_copied / (1024 * 1024));
+    for (i = 0; i < LC_DEFRAG_CHUNK; i++) {
+        lc_free(rfs, df->df_buf[i], LC_BLOCK_SIZE, LC_MEMTYPE_DATA);
+    }
+    lc_free(rfs, df, sizeof(struct defrag), LC_MEMTYPE_DEFRAG);
+    rcu_unregister_thread();
+    gfs->gfs_defragging = false;
+    return NULL;
+}
+
+/* Start defragmenting a layer, rate limited to the specified MB per second.
+ * Only frozen layers are defragmented, as blocks of those are not changing.
+ */
+void
+lc_defragLayer(fuse_req_t req, struct gfs *gfs,
+               const struct ldefrag *ldefrag) {
+    const char *name = ldefrag->d_name;
+    uint64_t rate = ldefrag->d_rate;
+    struct defrag *df;
+    struct fs *fs, *rfs;
+    pthread_t defragger;
+    uint64_t start;
+    int err = 0;
+    ino_t root;
+
+    lc_statsBegin(&start);
+    rfs = lc_getLayerLocked(LC_ROOT_INODE, false);
+    root = lc_getRootIno(rfs, name, NULL, true);
+    if (root == LC_INVALID_INODE) {
+        err = ENOENT;
+        goto out;
+    }
+    fs = lc_getLayerLocked(root, false);
+    if (!fs->fs_frozen) {
+        err = EINVAL;
+    } else if (!__sync_bool_compare_and_swap(&gfs->gfs_defragging,
+                                             false, true)) {
+        err = EBUSY;
+    } else {
+        df = lc_malloc(rfs, sizeof(struct defrag), LC_MEMTYPE_DEFRAG);
+        memset(df, 0, sizeof(struct defrag));
+        df->df_gfs = gfs;
+        df->df_root = fs->fs_root;
+        df->df_gindex = fs->fs_gindex;
+        df->df_rate = rate * 1024 * 1024;
+        err = pthread_create(&defragger, NULL, lc_defragmenter, df);
+        if (err) {
+            lc_free(rfs, df, sizeof(struct defrag), LC_MEMTYPE_DEFRAG);
+            gfs->gfs_defragging = false;
+        } else {
+            pthread_detach(defragger);
+            lc_syslog(LOG_INFO, "Defragmenting layer %s, rate %ld MB/s\n",
+                      name, rate);
+        }
+    }
+    lc_unlock(fs);
+
+out:
+    if (err) {
+        fuse_reply_err(req, err);
+    } else {
+        fuse_reply_ioctl(req, 0, NULL, 0);
+    }
+    lc_statsAdd(rfs, LC_DEFRAG, err, &start);
+    lc_unlock(rfs);
+}
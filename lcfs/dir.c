@@ -355,6 +355,7 @@ lc_dirFlushBlocks(struct gfs *gfs, struct fs *fs,
         page = page->p_dnext;
     }
     assert(count == 0);
+    lc_statsWrite(fs, LC_WRITE_DIR, pcount);
     lc_addPageForWriteBack(gfs, fs, fpage, tpage, pcount);
     return block;
 }
@@ -606,10 +607,12 @@ lc_dirRemoveName(struct fs *fs, struct inode *dir,
                 rfs = (struct fs *)*fsp;
                 if (rfs && rfs->fs_zfs &&
                     !(rfs->fs_super->sb_flags & LC_SUPER_INIT)) {
+                    char iname[len + sizeof("-init")];
+
                     rfs = rfs->fs_zfs;
                     ino = rfs->fs_root;
-                    len += strlen("-init");
-                    dirent = lc_dirGetDirent(dir, name, len, &prev, NULL);
+                    len = sprintf(iname, "%s-init", name);
+                    dirent = lc_dirGetDirent(dir, iname, len, &prev, NULL);
                     while (dirent && (dirent->di_ino != ino)) {
                         prev = &dirent->di_next;
                         dirent = dirent->di_next;
@@ -718,12 +721,14 @@ lc_dirReaddir(fuse_req_t req, struct fs *fs, struct inode *dir,
                 }
                 lc_copyStat(&ep.attr, inode);
                 lc_inodeUnlock(inode);
+                ep.ino = lc_setHandle(gindex, ino);
+                lc_epInit(&ep);
+                ep.entry_timeout = lc_cacheTimeout(fs, parent);
+                ep.attr_timeout = lc_cacheTimeout(nfs ? nfs : fs, ino);
                 if (nfs) {
                     lc_unlock(nfs);
                 }
                 nfs = NULL;
-                ep.ino = lc_setHandle(gindex, ino);
-                lc_epInit(&ep);
 #ifdef FUSE3
                 esize = fuse_add_direntry_plus(req, &buf[csize], size - csize,
                                                dirent->di_name, &ep,
@@ -756,6 +761,39 @@ out:
     return 0;
 }
 
+/* Copy the name of an inode from its parent directory, if the directory is
+ * on disk already.  Returns the size of the name, 0 if not found.
+ */
+int
+lc_dirGetName(struct fs *fs, ino_t parent, ino_t ino, char *name) {
+    struct inode *dir = lc_getInode(fs, parent, NULL, false, false);
+    struct dirent *dirent;
+    int i, max, size = 0;
+
+    if (dir == NULL) {
+        return 0;
+    }
+    if ((dir->i_fs == fs) && (dir->i_flags & LC_INODE_DISK) &&
+        !(dir->i_flags & LC_INODE_SHARED)) {
+        max = (dir->i_flags & LC_INODE_DHASHED) ? LC_DIRCACHE_SIZE : 1;
+        for (i = 0; (i < max) && (size == 0); i++) {
+            dirent = (dir->i_flags & LC_INODE_DHASHED) ? dir->i_hdirent[i] :
+                                                         dir->i_dirent;
+            while (dirent) {
+                if (dirent->di_ino == ino) {
+                    size = dirent->di_size;
+                    memcpy(name, dirent->di_name, size);
+                    name[size] = 0;
+                    break;
+                }
+                dirent = dirent->di_next;
+            }
+        }
+    }
+    lc_inodeUnlock(dir);
+    return size;
+}
+
 /* Find directory entry with the given inode number */
 struct dirent *
 lc_getDirent(struct fs *fs, ino_t parent, ino_t ino, int *hash,
@@ -243,6 +243,7 @@ lc_flushEmapBlocks(struct gfs *gfs, struct fs *fs,
         page = page->p_dnext;
     }
     assert(count == 0);
+    lc_statsWrite(fs, LC_WRITE_EMAP, pcount);
     lc_addPageForWriteBack(gfs, fs, fpage, tpage, pcount);
     return block;
 }
@@ -394,6 +395,88 @@ lc_freeInodeDataBlocks(struct gfs *gfs, struct fs *fs,
     }
 }
 
+/* Free blocks of the old emap of a file which are not mapped to the same
+ * pages in the new emap.
+ */
+static void
+lc_emapReleaseOld(struct gfs *gfs, struct fs *fs, struct inode *inode,
+                  uint64_t page, uint64_t block, uint64_t count,
+                  struct extent **cursor, struct extent **extents) {
+    uint64_t i, start = 0, fcount = 0;
+
+    for (i = 0; i < count; i++) {
+        if (lc_inodeEmapLookup(gfs, inode, page + i, cursor) == (block + i)) {
+            continue;
+        }
+        if (fcount && ((start + fcount) != (block + i))) {
+            lc_addSpaceExtent(gfs, fs, extents, start, fcount, false);
+            fcount = 0;
+        }
+        if (fcount == 0) {
+            start = block + i;
+        }
+        fcount++;
+    }
+    if (fcount) {
+        lc_addSpaceExtent(gfs, fs, extents, start, fcount, false);
+    }
+}
+
+/* Replace the emap of a file with the specified list of extents, freeing
+ * blocks not in use anymore.  Used while replaying the intent log.
+ */
+void
+lc_emapReplace(struct gfs *gfs, struct fs *fs, struct inode *inode,
+               struct extent *emap) {
+    uint64_t oblock = inode->i_extentBlock, olength = inode->i_extentLength;
+    bool shared = inode->i_flags & LC_INODE_SHARED;
+    struct extent *old = lc_inodeGetEmap(inode);
+    struct extent *extents = NULL, *extent, *cursor;
+    uint64_t bcount = 0;
+
+    assert(S_ISREG(inode->i_mode));
+    assert(lc_inodeGetDirtyPageCount(inode) == 0);
+    inode->i_extentBlock = 0;
+    inode->i_extentLength = 0;
+    inode->i_flags &= ~LC_INODE_SHARED;
+
+    /* Keep a single extent starting at the first page in the inode */
+    if (emap && (emap->ex_next == NULL) && (lc_getExtentStart(emap) == 0)) {
+        inode->i_extentBlock = lc_getExtentBlock(emap);
+        inode->i_extentLength = lc_getExtentCount(emap);
+        bcount = inode->i_extentLength;
+        lc_free(fs, emap, sizeof(struct extent), LC_MEMTYPE_EXTENT);
+        emap = NULL;
+    }
+    lc_inodeSetEmap(inode, emap);
+    for (extent = emap; extent; extent = extent->ex_next) {
+        bcount += lc_getExtentCount(extent);
+    }
+    inode->i_dinode.di_blocks = bcount;
+    lc_markInodeDirty(inode, LC_INODE_EMAPDIRTY);
+
+    /* Blocks and emap shared with the parent layer are left alone */
+    if (shared) {
+        return;
+    }
+    cursor = emap;
+    if (olength) {
+        lc_emapReleaseOld(gfs, fs, inode, 0, oblock, olength,
+                          &cursor, &extents);
+    }
+    while (old) {
+        lc_emapReleaseOld(gfs, fs, inode, lc_getExtentStart(old),
+                          lc_getExtentBlock(old), lc_getExtentCount(old),
+                          &cursor, &extents);
+        extent = old;
+        old = old->ex_next;
+        lc_free(fs, extent, sizeof(struct extent), LC_MEMTYPE_EXTENT);
+    }
+    if (extents) {
+        lc_freeInodeDataBlocks(gfs, fs, &extents);
+    }
+}
+
 /* Truncate the emap of a file */
 bool
 lc_emapTruncate(struct gfs *gfs, struct fs *fs, struct inode *inode,
@@ -178,6 +178,103 @@ lc_extentAdjacent(uint64_t estart, uint64_t eblock, uint64_t count,
     return ((estart + count) == nstart);
 }
 
+/* Number of size classes free space extents are indexed in */
+#define LC_SPACE_BINS       64
+
+/* Initial number of hash lists used for looking up free space extents */
+#define LC_SPACE_HASH_MIN   1024
+
+/* Smallest allocation group (1GB), as a power of two blocks */
+#define LC_GROUP_SHIFT_MIN  18
+
+/* Number of allocation groups beyond which groups are made bigger */
+#define LC_GROUP_MAX        256
+
+/* Free space extent, indexed by size class and by the blocks at both ends */
+struct sextent {
+
+    /* Start block */
+    uint64_t se_start;
+
+    /* Count of blocks */
+    uint64_t se_count;
+
+    /* Next and previous extents in the size class */
+    struct sextent *se_bnext;
+    struct sextent *se_bprev;
+
+    /* Next extent in the hash list on start block */
+    struct sextent *se_snext;
+
+    /* Next extent in the hash list on end block */
+    struct sextent *se_enext;
+};
+
+/* Index of free space extents.  The device is divided into allocation
+ * groups and free extents do not cross group boundaries.  Extents are binned
+ * by the power of two of their size within each group for best fit
+ * allocations and hashed on their start and end blocks for merging freed
+ * space with neighbours.
+ */
+struct space {
+
+    /* Size classes of each allocation group */
+    struct sextent **sp_bins;
+
+    /* Free blocks in each allocation group */
+    uint64_t *sp_gblocks;
+
+    /* Number of allocation groups */
+    uint64_t sp_groups;
+
+    /* Bits shifted from a block number to get its allocation group */
+    uint64_t sp_shift;
+
+    /* Group searched first when picking a group for a layer */
+    uint64_t sp_next;
+
+    /* Extents hashed on start block */
+    struct sextent **sp_shash;
+
+    /* Extents hashed on end block */
+    struct sextent **sp_ehash;
+
+    /* Number of hash lists */
+    uint64_t sp_hashSize;
+
+    /* Number of extents in the index */
+    uint64_t sp_count;
+
+    /* Number of blocks in the index */
+    uint64_t sp_blocks;
+};
+
+/* Number of allocation cursors in a layer */
+#define LC_CURSOR_MAX       8
+
+/* Allocation cursor carving data blocks from a contiguous reservation.
+ * Threads flushing data pick different cursors, so that those do not contend
+ * on the layer allocation lock for every allocation.  Blocks in the
+ * reservation are accounted as allocated to the layer.
+ */
+struct acursor {
+
+    /* Lock protecting the cursor */
+    pthread_mutex_t ac_lock;
+
+    /* Next block available in the reservation */
+    uint64_t ac_start;
+
+    /* Number of blocks left in the reservation */
+    uint64_t ac_count;
+
+    /* Size of the next reservation */
+    uint64_t ac_rsize;
+
+    /* Time when the last reservation was made */
+    time_t ac_time;
+};
+
 /* Flags used to manage extent list operations */
 #define LC_EXTENT_EFREE 0x01  /* Free extents */
 #define LC_EXTENT_FLUSH 0x02  /* Flush extent list to disk */
@@ -1,6 +1,7 @@
 #include "includes.h"
 
-#define LC_TIMEOUT_SEC  1.0
+/* Size of largest write requested from kernel */
+#define LC_MAX_WRITE    (1024 * 1024)
 
 /* Initialize default values in fuse_entry_param structure.
  */
@@ -75,6 +76,11 @@ lc_createInode(struct fs *fs, ino_t parent, const char *name, mode_t mode,
     if (fi) {
         inode->i_ocount++;
         fi->fh = (uint64_t)inode;
+
+        /* Let direct I/O bypass kernel page cache */
+        if (S_ISREG(mode) && lc_directIO(fi->flags)) {
+            fi->direct_io = 1;
+        }
     }
     lc_inodeUnlock(inode);
     ep->ino = lc_setHandle(fs->fs_gindex, ino);
@@ -261,12 +267,31 @@ lc_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
     struct fuse_entry_param ep;
     struct fs *fs, *nfs = NULL;
     struct inode *inode, *dir;
-    struct timeval start;
+    uint64_t start;
     int gindex, err = 0;
     ino_t ino;
 
-    lc_statsBegin(&start);
     lc_displayEntry(__func__, parent, 0, name);
+
+    /* Return fake inode info while looking up stats and trace files */
+    if (unlikely(parent == getfs()->gfs_layerRoot) &&
+        (!strcmp(name, LC_STATS_FILE) || !strcmp(name, LC_STATS_JSON_FILE) ||
+         !strcmp(name, LC_TRACE_FILE))) {
+        if (!strcmp(name, LC_STATS_FILE)) {
+            ep.ino = LC_STATS_INODE;
+        } else if (!strcmp(name, LC_STATS_JSON_FILE)) {
+            ep.ino = LC_STATS_JSON_INODE;
+        } else {
+            ep.ino = LC_TRACE_INODE;
+        }
+        lc_copyStatsStat(&ep.attr, ep.ino);
+        lc_epInit(&ep);
+        ep.attr_timeout = 0;
+        ep.entry_timeout = 0;
+        fuse_reply_entry(req, &ep);
+        return;
+    }
+    lc_statsBegin(&start);
     fs = lc_getLayerLocked(parent, false);
     dir = lc_getInode(fs, parent, NULL, false, false);
     if (unlikely(dir == NULL)) {
@@ -292,9 +317,12 @@ lc_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
             goto out;
         }
 
-        /* Let kernel remember lookup failure as a negative entry */
+        /* Let kernel remember lookup failure as a negative entry.  Names
+         * used for triggering commit may show up later.
+         */
         memset(&ep, 0, sizeof(struct fuse_entry_param));
-        ep.entry_timeout = LC_TIMEOUT_SEC;
+        ep.entry_timeout = strstr(name, LC_COMMIT_TRIGGER_PREFIX) ?
+                           LC_TIMEOUT_SEC : lc_cacheTimeout(fs, parent);
         fuse_reply_entry(req, &ep);
         err = ENOENT;
         goto out;
@@ -319,9 +347,12 @@ lc_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
         err = ENOENT;
     } else {
         lc_copyStat(&ep.attr, inode);
+        lc_hotRecord(nfs ? nfs : fs, inode, LC_HOT_OPS, 0);
         lc_inodeUnlock(inode);
         ep.ino = lc_setHandle(gindex, ino);
         lc_epInit(&ep);
+        ep.entry_timeout = lc_cacheTimeout(fs, parent);
+        ep.attr_timeout = lc_cacheTimeout(nfs ? nfs : fs, ino);
         fuse_reply_entry(req, &ep);
     }
 
@@ -336,7 +367,7 @@ out:
 /* Get attributes of a file */
 static void
 lc_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
-    struct timeval start;
+    uint64_t start;
     struct inode *inode;
     struct stat stbuf;
     struct fs *fs;
@@ -353,6 +384,11 @@ lc_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
         fuse_reply_attr(req, &stbuf, LC_TIMEOUT_SEC);
         return;
     }
+    if (unlikely(lc_isStatsInode(ino))) {
+        lc_copyStatsStat(&stbuf, ino);
+        fuse_reply_attr(req, &stbuf, 0);
+        return;
+    }
     lc_statsBegin(&start);
     fs = lc_getLayerLocked(ino, false);
     inode = lc_getInode(fs, ino, NULL, false, false);
@@ -367,7 +403,7 @@ lc_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
     lc_inodeUnlock(inode);
     stbuf.st_ino = lc_setHandle(lc_getIndex(fs, parent, stbuf.st_ino),
                                 stbuf.st_ino);
-    fuse_reply_attr(req, &stbuf, LC_TIMEOUT_SEC);
+    fuse_reply_attr(req, &stbuf, lc_cacheTimeout(fs, ino));
 
 out:
     lc_statsAdd(fs, LC_GETATTR, err, &start);
@@ -381,7 +417,7 @@ lc_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
     bool ctime = false, mtime = false, change;
     int err = 0, flags = 0, new_set;
     struct inode *inode, *handle;
-    struct timeval start;
+    uint64_t start;
     struct stat stbuf;
     struct fs *fs;
 
@@ -395,6 +431,10 @@ lc_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
         fuse_reply_attr(req, &stbuf, LC_TIMEOUT_SEC);
         return;
     }
+    if (unlikely(lc_isStatsInode(ino))) {
+        fuse_reply_err(req, EPERM);
+        return;
+    }
     lc_statsBegin(&start);
     change = (to_set &
               (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID |
@@ -508,7 +548,7 @@ out:
 static void
 lc_readlink(fuse_req_t req, fuse_ino_t ino) {
     char buf[LC_FILENAME_MAX + 1];
-    struct timeval start;
+    uint64_t start;
     struct inode *inode;
     int size, err = 0;
     struct fs *fs;
@@ -542,7 +582,7 @@ lc_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
           mode_t mode, dev_t rdev) {
     const struct fuse_ctx *ctx = fuse_req_ctx(req);
     struct fuse_entry_param e;
-    struct timeval start;
+    uint64_t start;
     struct fs *fs;
     int err;
 
@@ -565,7 +605,7 @@ static void
 lc_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
     const struct fuse_ctx *ctx = fuse_req_ctx(req);
     struct fuse_entry_param e;
-    struct timeval start;
+    uint64_t start;
     bool flush = false;
     struct gfs *gfs;
     struct fs *fs;
@@ -607,7 +647,7 @@ lc_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
 static void
 lc_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
     struct inode *inode = NULL;
-    struct timeval start;
+    uint64_t start;
     struct fs *fs;
     int err;
 
@@ -631,7 +671,7 @@ lc_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
 static void
 lc_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
     struct inode *dir = NULL;
-    struct timeval start;
+    uint64_t start;
     struct fs *fs;
     int err;
 
@@ -658,7 +698,7 @@ lc_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
             const char *name) {
     const struct fuse_ctx *ctx = fuse_req_ctx(req);
     struct fuse_entry_param e;
-    struct timeval start;
+    uint64_t start;
     struct fs *fs;
     int err;
 
@@ -699,7 +739,7 @@ lc_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
            ) {
     bool tdirFirst = lc_getInodeHandle(parent) > lc_getInodeHandle(newparent);
     struct inode *inode, *sdir, *tdir = NULL;
-    struct timeval start;
+    uint64_t start;
     struct fs *fs;
     int err = 0;
     ino_t ino;
@@ -856,7 +896,7 @@ lc_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
          const char *newname) {
     struct fuse_entry_param ep;
     struct inode *inode, *dir;
-    struct timeval start;
+    uint64_t start;
     struct fs *fs;
     int err = 0;
 
@@ -920,7 +960,7 @@ out:
 static int
 lc_openInode(struct fs *fs, fuse_ino_t ino, struct fuse_file_info *fi) {
     struct inode *inode;
-    bool modify, trunc;
+    bool modify, trunc, reg;
 
     fi->fh = 0;
     modify = (fi->flags & (O_WRONLY | O_RDWR));
@@ -963,16 +1003,21 @@ lc_openInode(struct fs *fs, fuse_ino_t ino, struct fuse_file_info *fi) {
             __sync_add_and_fetch(&inode->i_ocount, 1);
         }
     }
+    reg = S_ISREG(inode->i_mode);
     lc_inodeUnlock(inode);
     fi->fh = (uint64_t)inode;
 
-    /* Do not invalidate kernel page cache */
-    fi->keep_cache = 1;
-
-    /* XXX Cannot enable direct_io as that would break mmap. Need a new fuse
-     * option for direct io for files which are not memory mapped.
+    /* Let direct I/O bypass kernel page cache.  direct_io would break mmap,
+     * so it is enabled only for files opened with O_DIRECT, which are not
+     * expected to be memory mapped.
      */
-    //fi->direct_io = 1;
+    if (reg && lc_directIO(fi->flags)) {
+        fi->direct_io = 1;
+    } else {
+
+        /* Do not invalidate kernel page cache */
+        fi->keep_cache = 1;
+    }
     return 0;
 }
 
@@ -1052,7 +1097,7 @@ lc_closeInode(struct fs *fs, struct inode *inode, struct fuse_file_info *fi,
             /* Flush pages of the inode if layer has many dirty pages */
             if (fs->fs_pcount &&
                 (!lc_checkMemoryAvailable(false) ||
-                 (fs->fs_pcount >= LC_MAX_LAYER_DIRTYPAGES))) {
+                 (fs->fs_pcount >= fs->fs_gfs->gfs_flushLimit))) {
                 pthread_cond_signal(&fs->fs_gfs->gfs_flusherCond);
             }
             return;
@@ -1064,13 +1109,34 @@ lc_closeInode(struct fs *fs, struct inode *inode, struct fuse_file_info *fi,
 /* Open a file and return a handle corresponding to the inode number */
 static void
 lc_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
-    struct timeval start;
+    struct sfile *sf;
+    uint64_t start;
     struct fs *fs;
     bool inval;
     int err;
 
-    lc_statsBegin(&start);
     lc_displayEntry(__func__, 0, ino, NULL);
+
+    /* Render stats and requests traced as those files are opened */
+    if (unlikely(lc_isStatsInode(ino))) {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+            fuse_reply_err(req, EACCES);
+            return;
+        }
+        sf = (ino == LC_TRACE_INODE) ? lc_traceOpen(getfs()) :
+                        lc_statsOpen(getfs(), ino == LC_STATS_JSON_INODE);
+        if (sf == NULL) {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        fi->fh = (uint64_t)sf;
+        fi->direct_io = 1;
+        if (fuse_reply_open(req, fi)) {
+            lc_statsClose(sf);
+        }
+        return;
+    }
+    lc_statsBegin(&start);
     fs = lc_getLayerLocked(ino, false);
     err = lc_openInode(fs, ino, fi);
     if (unlikely(err)) {
@@ -1088,17 +1154,33 @@ lc_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
     lc_unlock(fs);
 }
 
+/* Pause a request with the layer unlocked, so that checkpoints and layer
+ * operations locking the layer exclusive are not held up meanwhile, then wait
+ * for memory if asked to.  Returns the layer locked again.
+ */
+static struct fs *
+lc_pauseUnlocked(struct fs *fs, ino_t ino, uint64_t pause, bool wait) {
+    struct gfs *gfs = fs->fs_gfs;
+
+    lc_unlock(fs);
+    if (pause) {
+        usleep(pause);
+    }
+    lc_waitMemory(gfs, wait);
+    return lc_getLayerLocked(ino, false);
+}
+
 /* Read from a file */
 static void
 lc_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
         struct fuse_file_info *fi) {
     struct fuse_bufvec *bufv;
-    struct timeval start;
+    uint64_t start;
     struct inode *inode;
     struct page **pages;
     char **dbuf = NULL;
     off_t endoffset;
-    uint64_t pcount;
+    uint64_t pcount, pause;
     int i, err = 0;
     struct fs *fs;
     size_t fsize;
@@ -1111,6 +1193,10 @@ lc_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
         fuse_reply_buf(req, NULL, 0);
         return;
     }
+    if (unlikely(lc_isStatsInode(ino))) {
+        lc_statsRead(req, (struct sfile *)fi->fh, size, off);
+        return;
+    }
     endoffset = off + size;
     pcount = ((endoffset + LC_BLOCK_SIZE - 1) -
               (off & ~(LC_BLOCK_SIZE - 1))) / LC_BLOCK_SIZE;
@@ -1119,6 +1205,12 @@ lc_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
     pages = alloca(sizeof(struct page *) * pcount);
     memset(bufv, 0, fsize);
     fs = lc_getLayerLocked(ino, false);
+
+    /* Pay off reads issued before if the layer is over its I/O limits */
+    pause = lc_qosPause(fs->fs_gfs, fs);
+    if (unlikely(pause)) {
+        fs = lc_pauseUnlocked(fs, ino, pause, false);
+    }
     inode = lc_getInode(fs, ino, (struct inode *)fi->fh, false, false);
     if (unlikely(inode == NULL)) {
         lc_reportError(__func__, __LINE__, ino, ENOENT);
@@ -1143,6 +1235,14 @@ retry:
         pcount = ((endoffset + LC_BLOCK_SIZE - 1) -
                   (off & ~(LC_BLOCK_SIZE - 1))) / LC_BLOCK_SIZE;
     }
+
+    lc_traceBytes(endoffset - off);
+
+    /* Read aligned direct I/O straight from disk */
+    if ((dbuf == NULL) && lc_directIO(fi->flags) &&
+        lc_directRead(req, fs, inode, off, endoffset, pcount, bufv)) {
+        goto out;
+    }
     err = lc_readFile(req, fs, inode, off, endoffset,
                       pcount, pages, dbuf, bufv);
     if (err) {
@@ -1170,6 +1270,9 @@ lc_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 
     lc_displayEntry(__func__, ino, 0, NULL);
     fuse_reply_err(req, 0);
+    if (unlikely(lc_isStatsInode(ino))) {
+        return;
+    }
     if (inode) {
         lc_statsAdd(inode->i_fs, LC_FLUSH, 0, NULL);
     } else {
@@ -1194,11 +1297,16 @@ lc_releaseInode(fuse_req_t req, struct fs *fs, fuse_ino_t ino,
 static void
 lc_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
     struct gfs *gfs = getfs();
-    struct timeval start;
+    uint64_t start;
     struct fs *fs;
     bool inval;
 
     lc_displayEntry(__func__, ino, 0, NULL);
+    if (unlikely(lc_isStatsInode(ino))) {
+        fuse_reply_err(req, 0);
+        lc_statsClose((struct sfile *)fi->fh);
+        return;
+    }
     if ((struct inode *)fi->fh == NULL) {
         fuse_reply_err(req, 0);
         assert(lc_getInodeHandle(ino) == LC_COMMIT_TRIGGER_INODE);
@@ -1224,19 +1332,43 @@ static void
 lc_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
           struct fuse_file_info *fi) {
     struct inode *inode = (struct inode *)fi->fh;
+    uint64_t start;
+    struct fs *fs;
 
-    /* Fsync is disabled in this file system as layers are made persistent when
-     * needed.
+    /* Fsync is disabled in this file system unless intent log is enabled, as
+     * layers are made persistent when needed.
      */
     lc_displayEntry(__func__, ino, 0, NULL);
+    if (unlikely(lc_isStatsInode(ino))) {
+        fuse_reply_err(req, 0);
+        return;
+    }
+    if (inode->i_fs->fs_gfs->gfs_log == NULL) {
+        fuse_reply_err(req, 0);
+        lc_statsAdd(inode->i_fs, LC_FSYNC, 0, NULL);
+        return;
+    }
+
+    /* Log the file so that it survives a crash before the next checkpoint.
+     * Files which could not be logged are made persistent by a checkpoint,
+     * waited for with the layer unlocked.
+     */
+    lc_statsBegin(&start);
+    fs = lc_getLayerLocked(ino, false);
+    if (!lc_logInode(fs, ino, inode)) {
+        lc_unlock(fs);
+        lc_logWaitCheckpoint(inode->i_fs->fs_gfs);
+        fs = lc_getLayerLocked(ino, false);
+    }
     fuse_reply_err(req, 0);
-    lc_statsAdd(inode->i_fs, LC_FSYNC, 0, NULL);
+    lc_statsAdd(fs, LC_FSYNC, 0, &start);
+    lc_unlock(fs);
 }
 
 /* Open a directory */
 static void
 lc_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
-    struct timeval start;
+    uint64_t start;
     struct fs *fs;
     int err;
 
@@ -1260,7 +1392,7 @@ lc_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 static void
 lc_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
             struct fuse_file_info *fi) {
-    struct timeval start;
+    uint64_t start;
     struct inode *dir;
     struct stat st;
     struct fs *fs;
@@ -1286,7 +1418,7 @@ lc_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 /* Release a directory */
 static void
 lc_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
-    struct timeval start;
+    uint64_t start;
     struct fs *fs;
 
     lc_displayEntry(__func__, ino, 0, NULL);
@@ -1316,7 +1448,7 @@ static void
 lc_statfs(fuse_req_t req, fuse_ino_t ino) {
     struct gfs *gfs = getfs();
     struct super *super = gfs->gfs_super;
-    struct timeval start;
+    uint64_t start;
     struct statvfs buf;
 
     lc_statsBegin(&start);
@@ -1347,6 +1479,10 @@ lc_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
              ) {
 #endif
     lc_displayEntry(__func__, ino, 0, name);
+    if (unlikely(lc_isStatsInode(ino))) {
+        fuse_reply_err(req, EPERM);
+        return;
+    }
     lc_xattrAdd(req, ino, name, value, size, flags);
 }
 
@@ -1377,8 +1513,8 @@ lc_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size
     }
 
     /* Take care of the special inode when commit is in progress */
-    if ((lc_getInodeHandle(ino) == LC_COMMIT_TRIGGER_INODE) &&
-        lc_getFsHandle(ino)) {
+    if (((lc_getInodeHandle(ino) == LC_COMMIT_TRIGGER_INODE) &&
+         lc_getFsHandle(ino)) || lc_isStatsInode(ino)) {
         fuse_reply_err(req, ENODATA);
         return;
     }
@@ -1397,7 +1533,7 @@ lc_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size) {
     lc_displayEntry(__func__, ino, 0, NULL);
 
     /* If the file system does not have any extended attributes, return */
-    if (!gfs->gfs_xattr_enabled) {
+    if (!gfs->gfs_xattr_enabled || lc_isStatsInode(ino)) {
         //lc_reportError(__func__, __LINE__, ino, ENODATA);
         if (size == 0) {
             fuse_reply_xattr(req, 0);
@@ -1424,8 +1560,8 @@ lc_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name) {
     }
 
     /* Take care of the special inode when commit is in progress */
-    if ((lc_getInodeHandle(ino) == LC_COMMIT_TRIGGER_INODE) &&
-        lc_getFsHandle(ino)) {
+    if (((lc_getInodeHandle(ino) == LC_COMMIT_TRIGGER_INODE) &&
+         lc_getFsHandle(ino)) || lc_isStatsInode(ino)) {
         fuse_reply_err(req, ENODATA);
         return;
     }
@@ -1438,7 +1574,7 @@ lc_create(fuse_req_t req, fuse_ino_t parent, const char *name,
           mode_t mode, struct fuse_file_info *fi) {
     const struct fuse_ctx *ctx = fuse_req_ctx(req);
     struct fuse_entry_param e;
-    struct timeval start;
+    uint64_t start;
     struct fs *fs;
     int err;
 
@@ -1502,7 +1638,8 @@ lc_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void *arg,
         return;
     }
     if ((op != SYNCER_TIME) && (op != DCACHE_MEMORY) && (op != DCACHE_FLUSH) &&
-        (op != LCFS_COMMIT) && (op != LCFS_GROW)) {
+        (op != LCFS_COMMIT) && (op != LCFS_GROW) && (op != LAYER_QOS) &&
+        (op != LAYER_DEFRAG) && (op != LCFS_HOT)) {
         if (in_bufsz) {
             memcpy(name, in_buf, in_bufsz);
         }
@@ -1538,6 +1675,32 @@ lc_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void *arg,
         lc_layerIoctl(req, gfs, name, op);
         break;
 
+    case LAYER_DEFRAG:
+        if ((in_bufsz != sizeof(struct ldefrag)) ||
+            !memchr(((const struct ldefrag *)in_buf)->d_name, 0,
+                    sizeof(((const struct ldefrag *)in_buf)->d_name))) {
+            fuse_reply_err(req, EINVAL);
+            break;
+        }
+        lc_defragLayer(req, gfs, in_buf);
+        break;
+
+    case LAYER_QOS:
+        if ((in_bufsz != sizeof(struct lqos)) ||
+            !memchr(((const struct lqos *)in_buf)->q_name, 0,
+                    sizeof(((const struct lqos *)in_buf)->q_name))) {
+            fuse_reply_err(req, EINVAL);
+            break;
+        }
+        lc_qosLayer(req, gfs, in_buf);
+        break;
+
+    case LCFS_HOT:
+
+        /* Tracked accesses are cleared if requested through the type */
+        lc_hotReport(req, gfs, out_bufsz, _IOC_TYPE(cmd));
+        break;
+
     case SYNCER_TIME:
         value = atoll(in_buf);
         if (gfs->gfs_syncInterval != value) {
@@ -1616,6 +1779,16 @@ lc_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void *arg,
         fuse_reply_ioctl(req, 0, NULL, 0);
         break;
 
+    case LCFS_TRACE:
+        lc_traceEnable(name[0]);
+        fuse_reply_ioctl(req, 0, NULL, 0);
+        break;
+
+    case LCFS_LOCKS:
+        lc_lockProfile(name[0]);
+        fuse_reply_ioctl(req, 0, NULL, 0);
+        break;
+
     default:
         lc_reportError(__func__, __LINE__, ino, ENOSYS);
         fuse_reply_err(req, ENOSYS);
@@ -1626,13 +1799,14 @@ lc_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void *arg,
 static void
 lc_write_buf(fuse_req_t req, fuse_ino_t ino,
              struct fuse_bufvec *bufv, off_t off, struct fuse_file_info *fi) {
-    uint64_t pcount, counted = 0, count = 0;
+    uint64_t pcount, counted = 0, count = 0, pause;
     struct fuse_bufvec *dst;
-    struct timeval start;
+    uint64_t start;
     struct inode *inode;
     struct dpage *dpages;
     size_t size, wsize;
     struct gfs *gfs;
+    bool wait, memory;
     struct fs *fs;
     int err = 0;
 
@@ -1647,6 +1821,19 @@ lc_write_buf(fuse_req_t req, fuse_ino_t ino,
     dpages = alloca(pcount * sizeof(struct dpage));
     fs = lc_getLayerLocked(ino, false);
     gfs = fs->fs_gfs;
+
+    /* Pay off writes issued before if the layer is over its I/O limits, slow
+     * down heavy writers and make sure enough memory available before
+     * proceeding.  Writers sleep and wait for memory with the layer unlocked.
+     */
+    pause = lc_qosPause(gfs, fs);
+    wait = lc_tuneThrottle(gfs, fs, pcount, &pause);
+    memory = lc_checkMemoryAvailable(false);
+    if (unlikely(pause || (wait && !memory))) {
+        fs = lc_pauseUnlocked(fs, ino, pause, wait);
+    } else if (unlikely(!memory)) {
+        lc_waitMemory(gfs, false);
+    }
     if (unlikely(fs->fs_frozen)) {
         lc_reportError(__func__, __LINE__, ino, EROFS);
         fuse_reply_err(req, EROFS);
@@ -1655,9 +1842,6 @@ lc_write_buf(fuse_req_t req, fuse_ino_t ino,
         goto out;
     }
 
-    /* Make sure enough memory available before proceeding */
-    lc_waitMemory(gfs, true);
-
     /* Copy in the data before taking the lock */
     pcount = lc_copyPages(fs, off, size, dpages, bufv, dst);
     counted = __sync_add_and_fetch(&fs->fs_pcount, pcount);
@@ -1678,13 +1862,24 @@ lc_write_buf(fuse_req_t req, fuse_ino_t ino,
         goto out;
     }
 
-    /* Now the write cannot fail, so respond success */
-    fuse_reply_write(req, size);
     assert(S_ISREG(inode->i_mode));
+    lc_statsLogicalWrite(fs, size);
+
+    /* Write aligned direct I/O straight to disk */
+    if (lc_directIO(fi->flags) && !fi->writepage &&
+        lc_directWrite(fs, inode, off, size, dpages, pcount)) {
+        fuse_reply_write(req, size);
+    } else {
+
+        /* Now the write cannot fail, so respond success */
+        fuse_reply_write(req, size);
 
-    /* Link the dirty pages to the inode and update times */
-    count = lc_addPages(inode, off, size, dpages, pcount);
-    assert(count <= pcount);
+        /* Link the dirty pages to the inode */
+        count = lc_addPages(inode, off, size, dpages, pcount);
+        assert(count <= pcount);
+    }
+
+    /* Update times */
     lc_updateInodeTimes(inode, true, true);
     lc_markInodeDirty(inode, LC_INODE_EMAPDIRTY);
     lc_inodeUnlock(inode);
@@ -1706,7 +1901,7 @@ out:
 
     /* Trigger flush of dirty pages if layer has too many now */
     if (!err &&
-        ((fs->fs_pcount >= LC_MAX_LAYER_DIRTYPAGES) ||
+        ((fs->fs_pcount >= gfs->gfs_flushLimit) ||
          !lc_checkMemoryAvailable(true))) {
         pthread_cond_signal(&gfs->gfs_flusherCond);
     }
@@ -1720,7 +1915,7 @@ lc_fallocate(fuse_req_t req, fuse_ino_t ino, int mode,
              off_t offset, off_t length, struct fuse_file_info *fi) {
     bool hole = mode & FALLOC_FL_PUNCH_HOLE;
     uint64_t endoffset = offset + length;
-    struct timeval start;
+    uint64_t start;
     struct inode *inode;
     struct gfs *gfs;
     struct fs *fs;
@@ -1774,7 +1969,7 @@ out:
 static void
 lc_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
                struct fuse_file_info *fi) {
-    struct timeval start;
+    uint64_t start;
     struct inode *dir;
     struct fs *fs;
     int err = 0;
@@ -1804,11 +1999,26 @@ lc_init(void *userdata, struct fuse_conn_info *conn) {
 
 #ifdef FUSE3
 
-    /* Use splice */
-    conn->want |= FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE;
+    /* Use splice, leaving data of writes in the pipe to be read directly into
+     * pages.
+     */
+    conn->want |= FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE |
+                  (conn->capable & FUSE_CAP_SPLICE_READ);
 
     /* Let kernel take care of setuid business */
     conn->want &= ~FUSE_CAP_HANDLE_KILLPRIV;
+
+    /* Let kernel cache writes and send larger requests if enabled */
+    if (gfs->gfs_kernelCache) {
+        if (conn->capable & FUSE_CAP_WRITEBACK_CACHE) {
+            conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+            gfs->gfs_writeback = true;
+        }
+        conn->want |= conn->capable &
+                      (FUSE_CAP_PARALLEL_DIROPS | FUSE_CAP_ASYNC_DIO);
+        conn->max_write = LC_MAX_WRITE;
+        conn->max_readahead = LC_MAX_WRITE;
+    }
 #else
 
     /* Need to support ioctls on directories */
@@ -9,15 +9,18 @@ lc_newLayer(struct gfs *gfs, bool rw) {
     fs->fs_gfs = gfs;
     fs->fs_readOnly = !rw;
     fs->fs_sblock = LC_INVALID_BLOCK;
+    fs->fs_group = -1;
     fs->fs_locked = true;
 #ifndef LC_IC_LOCK
     pthread_mutex_init(&fs->fs_ilock, NULL);
 #endif
     pthread_mutex_init(&fs->fs_plock, NULL);
+    pthread_cond_init(&fs->fs_wcond, NULL);
     pthread_mutex_init(&fs->fs_dilock, NULL);
     pthread_mutex_init(&fs->fs_alock, NULL);
     pthread_mutex_init(&fs->fs_hlock, NULL);
     pthread_rwlock_init(&fs->fs_rwlock, NULL);
+    lc_qosInit(fs);
     __sync_add_and_fetch(&gfs->gfs_count, 1);
     return fs;
 }
@@ -84,6 +87,7 @@ lc_flushInodeBlocks(struct gfs *gfs, struct fs *fs) {
         page = page->p_dnext;
     }
     assert(count == 0);
+    lc_statsWrite(fs, LC_WRITE_IBLOCK, pcount);
     lc_addPageForWriteBack(gfs, fs, fpage, tpage, pcount);
     fs->fs_inodeBlockCount = 0;
     fs->fs_inodeBlockPages = NULL;
@@ -129,10 +133,15 @@ lc_freeLayer(struct fs *fs, bool remove) {
 
     lc_freeHlinks(fs);
     assert(fs->fs_hlinks == NULL);
+    lc_freeCursors(fs);
 
     lc_destroyPages(gfs, fs, remove);
     assert(fs->fs_bcache == NULL);
     lc_statsDeinit(fs);
+    lc_qosFree(fs);
+#ifdef LC_COND_DESTROY
+    pthread_cond_destroy(&fs->fs_wcond);
+#endif
 #ifdef LC_MUTEX_DESTROY
 #ifndef LC_IC_LOCK
     pthread_mutex_destroy(&fs->fs_ilock);
@@ -171,18 +180,20 @@ lc_destroyLayer(struct fs *fs, bool remove) {
  */
 void
 lc_lock(struct fs *fs, bool exclusive) {
-    if (exclusive) {
-        pthread_rwlock_wrlock(&fs->fs_rwlock);
-    } else {
-        pthread_rwlock_rdlock(&fs->fs_rwlock);
-    }
+    lc_rwlockLock(&fs->fs_rwlock, exclusive, LC_LOCK_LAYER);
 }
 
 /* Trylock variant of the above */
 int
 lc_tryLock(struct fs *fs, bool exclusive) {
-    return exclusive ? pthread_rwlock_trywrlock(&fs->fs_rwlock) :
-                       pthread_rwlock_tryrdlock(&fs->fs_rwlock);
+    int err;
+
+    err = exclusive ? pthread_rwlock_trywrlock(&fs->fs_rwlock) :
+                      pthread_rwlock_tryrdlock(&fs->fs_rwlock);
+    if (unlikely(lc_lockProfiling) && (err == 0)) {
+        lc_lockAcquired(LC_LOCK_LAYER, 0, false);
+    }
+    return err;
 }
 
 /* Lock a layer exclusive */
@@ -195,7 +206,7 @@ lc_lockExclusive(struct fs *fs) {
 /* Unlock the file system */
 void
 lc_unlock(struct fs *fs) {
-    pthread_rwlock_unlock(&fs->fs_rwlock);
+    lc_rwlockUnlock(&fs->fs_rwlock, LC_LOCK_LAYER);
 }
 
 /* Unlock an exclusively locked layer */
@@ -234,13 +245,23 @@ struct fs *
 lc_getLayerLocked(ino_t ino, bool exclusive) {
     int gindex = lc_getFsHandle(ino);
     struct gfs *gfs = getfs();
+    uint64_t start = 0;
     struct fs *fs;
 
     assert(gindex < LC_LAYER_MAX);
+    lc_traceInode(ino);
 
 retry:
     fs = gfs->gfs_fs[gindex];
+
+    /* Time spent waiting for the lock is accounted to the request traced */
+    if (unlikely(lc_traceEnabled)) {
+        start = lc_traceNow();
+    }
     lc_lock(fs, exclusive);
+    if (unlikely(start)) {
+        lc_traceLockWait(lc_traceNow() - start);
+    }
     if (unlikely(fs->fs_gindex != gindex)) {
 
         /* This could happen if a layer is committed */
@@ -476,6 +497,8 @@ lc_gfsInit(struct gfs *gfs) {
     pthread_mutex_init(&gfs->gfs_clock, NULL);
     pthread_mutex_init(&gfs->gfs_flock, NULL);
     pthread_mutex_init(&gfs->gfs_slock, NULL);
+    lc_tuneInit(gfs);
+    lc_hotInit(gfs);
 }
 
 /* Free resources allocated for the global file system */
@@ -492,6 +515,11 @@ lc_gfsDeinit(struct gfs *gfs) {
         assert(err == 0);
     }
     assert(gfs->gfs_count == 0);
+    lc_logFree(gfs);
+    lc_tuneFree(gfs);
+    lc_hotFree(gfs);
+    lc_deviceFree(gfs);
+    lc_traceFree();
     lc_free(NULL, gfs->gfs_zPage, LC_BLOCK_SIZE, LC_MEMTYPE_GFS);
     lc_free(NULL, gfs->gfs_fs, sizeof(struct fs *) * LC_LAYER_MAX,
             LC_MEMTYPE_GFS);
@@ -633,11 +661,39 @@ lc_setupSpecialInodes(struct gfs *gfs, struct fs *fs) {
     }
 }
 
+/* Write back data cached in kernel for all mounts, so that the data reaches
+ * layers before those are frozen or committed.
+ */
+void
+lc_syncKernelCache(struct gfs *gfs) {
+#ifndef __APPLE__
+    int i, fd;
+
+    if (!gfs->gfs_writeback) {
+        return;
+    }
+    for (i = 0; i < LC_MAX_MOUNTS; i++) {
+        fd = open(gfs->gfs_mountpoint[i], O_RDONLY | O_DIRECTORY);
+        if (fd == -1) {
+            lc_syslog(LOG_ERR, "Failed to open %s, err %d\n",
+                      gfs->gfs_mountpoint[i], errno);
+            continue;
+        }
+        if (syncfs(fd)) {
+            lc_syslog(LOG_ERR, "Failed to sync %s, err %d\n",
+                      gfs->gfs_mountpoint[i], errno);
+        }
+        close(fd);
+    }
+#endif
+}
+
 /* Mount the device */
 void
 lc_mount(struct gfs *gfs, char *device, bool ftypes, size_t size,
          bool format) {
-    bool grow = false;
+    bool grow = false, commit;
+    uint64_t gen = 0;
     struct fs *fs;
     int i;
 
@@ -687,6 +743,7 @@ lc_mount(struct gfs *gfs, char *device, bool ftypes, size_t size,
         }
         fs = lc_getGlobalFs(gfs);
         lc_setupSpecialInodes(gfs, fs);
+        gen = lc_logReplay(gfs);
         lc_cleanupAfterRestart(gfs, fs);
         lc_validate(gfs);
     }
@@ -700,15 +757,22 @@ lc_mount(struct gfs *gfs, char *device, bool ftypes, size_t size,
     } else if (fs->fs_super->sb_flags & LC_SUPER_SWAP) {
         gfs->gfs_swapLayersForCommit = true;
     }
+    commit = lc_logInit(gfs, gfs->gfs_intentLog, gen);
     lc_unlockExclusive(fs);
     if (grow) {
         lc_grow(gfs);
     }
+
+    /* Checkpoint changes replayed and record the intent log */
+    if (commit) {
+        lc_commit(gfs);
+    }
 }
 
 /* Sync a dirty inodes in a layer */
 static void
 lc_sync(struct gfs *gfs, struct fs *fs, bool unmount) {
+    lc_probe2(sync, fs->fs_gindex, unmount);
 
     /* Flush dirty inodes and pages */
     if (fs->fs_inodesDirty) {
@@ -743,6 +807,7 @@ lc_umountSync(struct gfs *gfs) {
     assert(err == 0);
 
     /* Finally update superblock */
+    lc_logUnmount(gfs);
     if (fs->fs_dirty) {
         fs->fs_super->sb_unmountTime = time(NULL);
         lc_superWrite(gfs, fs, NULL);
@@ -761,23 +826,198 @@ lc_umountSync(struct gfs *gfs) {
     gfs->gfs_super = NULL;
 }
 
-/* Sync dirty data from all layers */
+/* Maximum number of threads syncing layers in parallel */
+#define LC_SYNC_THREADS_MAX     16
+
+/* State shared by threads syncing layers */
+struct lsync {
+
+    /* Global file system */
+    struct gfs *ls_gfs;
+
+    /* Index of the last layer picked */
+    int ls_next;
+
+    /* Set when layers are synced for a checkpoint instead of unmount */
+    bool ls_commit;
+
+    /* Set when a checkpoint is abandoned as a layer is busy */
+    bool ls_abort;
+};
+
+/* Sync dirty data from a layer on unmount */
 static void
-lc_syncAllLayers(struct gfs *gfs) {
+lc_syncLayer(struct gfs *gfs, struct fs *fs) {
+    lc_lockExclusive(fs);
+    assert(!fs->fs_removed);
+    lc_sync(gfs, fs, fs->fs_child == NULL);
+    lc_processLayerBlocks(gfs, fs, true, false, false);
+    lc_flushDirtyPages(gfs, fs);
+    lc_unlockExclusive(fs);
+}
+
+/* Check if a layer needs to be synced for a checkpoint */
+static bool
+lc_checkpointLayerNeeded(struct fs *fs) {
+    return (fs->fs_frozen || !fs->fs_mcount || fs->fs_fextents ||
+            fs->fs_logGen) &&
+           (fs->fs_inodesDirty || fs->fs_extentsDirty || fs->fs_fextents);
+}
+
+/* Sync a layer for a checkpoint.  Layers are not waited on, so return false
+ * if the layer is busy and the checkpoint has to be abandoned.
+ */
+static bool
+lc_checkpointLayer(struct gfs *gfs, int i) {
+    struct timeval lstart;
+    struct fs *fs;
+    int gindex;
+
+    rcu_read_lock();
+    fs = rcu_dereference(gfs->gfs_fs[i]);
+    if ((fs == NULL) || !lc_checkpointLayerNeeded(fs)) {
+        rcu_read_unlock();
+        return true;
+    }
+    gindex = fs->fs_gindex;
+
+    /* Flush dirty pages and metadata of dirty inodes with shared lock
+     * first, so that the layer is locked exclusive for a shorter time.
+     * Inodes of frozen layers have no locks and the dirty list of those
+     * tracks hidden inodes, so dirty pages of those are flushed later.
+     */
+    if (!fs->fs_frozen &&
+        (fs->fs_dpcount || fs->fs_pcount || fs->fs_inodesDirty)) {
+        if (lc_tryLock(fs, false)) {
+            rcu_read_unlock();
+            return false;
+        }
+        rcu_read_unlock();
+        if (gfs->gfs_layerInProgress) {
+            lc_unlock(fs);
+            return false;
+        }
+        assert(gindex == fs->fs_gindex);
+        lc_flushDirtyInodeList(fs, true);
+        lc_flushInodesMeta(gfs, fs);
+        lc_flushDirtyPages(gfs, fs);
+        lc_unlock(fs);
+        rcu_read_lock();
+        fs = rcu_dereference(gfs->gfs_fs[i]);
+    }
+
+    /* Lock the layer exclusive and flush all dirty inodes and
+     * allocated extent list.
+     */
+    if ((fs == NULL) || (gindex != fs->fs_gindex) ||
+        gfs->gfs_layerInProgress || lc_tryLock(fs, true)) {
+        rcu_read_unlock();
+        return false;
+    }
+    rcu_read_unlock();
+    assert(gindex == fs->fs_gindex);
+    if (gfs->gfs_layerInProgress) {
+        lc_unlock(fs);
+        return false;
+    }
+    gettimeofday(&lstart, NULL);
+    lc_sync(gfs, fs, false);
+    fs->fs_logGen = 0;
+    lc_processLayerBlocks(gfs, fs, false, false, true);
+    if (!fs->fs_frozen) {
+        lc_flushDirtyPages(gfs, fs);
+        fs->fs_super->sb_flags &= ~LC_SUPER_DIRTY;
+    }
+    lc_checkpointLockStats(gfs, &lstart);
+    lc_unlock(fs);
+    return true;
+}
+
+/* Sync layers picked from the table until all layers are synced */
+static void
+lc_syncLayers(struct lsync *ls) {
+    struct gfs *gfs = ls->ls_gfs;
     struct fs *fs;
     int i;
 
+    while (!ls->ls_abort &&
+           ((i = __sync_add_and_fetch(&ls->ls_next, 1)) <= gfs->gfs_scount)) {
+        if (ls->ls_commit) {
+            if (!lc_checkpointLayer(gfs, i)) {
+                ls->ls_abort = true;
+            }
+        } else {
+            fs = gfs->gfs_fs[i];
+            if (fs) {
+                lc_syncLayer(gfs, fs);
+            }
+        }
+    }
+}
+
+/* Start routine of threads syncing layers */
+static void *
+lc_syncLayersThread(void *data) {
+    rcu_register_thread();
+    lc_syncLayers((struct lsync *)data);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/* Sync layers by a bounded number of threads in parallel to keep the device
+ * busy, as layers are independent of each other while syncing.  Checkpoints
+ * stop picking layers once a layer is found busy, and return false then.
+ */
+static bool
+lc_syncLayersParallel(struct gfs *gfs, int count, bool commit) {
+    pthread_t threads[LC_SYNC_THREADS_MAX];
+    int i, nthreads;
+    struct lsync ls;
+    long cpus;
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (cpus > 0) ? cpus : 1;
+    if (nthreads > LC_SYNC_THREADS_MAX) {
+        nthreads = LC_SYNC_THREADS_MAX;
+    }
+    if (nthreads > count) {
+        nthreads = count;
+    }
+    ls.ls_gfs = gfs;
+    ls.ls_next = 0;
+    ls.ls_commit = commit;
+    ls.ls_abort = false;
+
+    /* This thread syncs layers as well along with the threads started */
+    for (i = 0; i < (nthreads - 1); i++) {
+        if (pthread_create(&threads[i], NULL, lc_syncLayersThread, &ls)) {
+            lc_syslog(LOG_ERR, "Failed to start thread for syncing layers\n");
+            break;
+        }
+    }
+    nthreads = i;
+    lc_syncLayers(&ls);
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (!commit && (count > 1)) {
+        lc_syslog(LOG_INFO, "Synced %d layers using %d threads\n",
+                  count, nthreads + 1);
+    }
+    return !ls.ls_abort;
+}
+
+/* Sync dirty data from all layers on unmount */
+static void
+lc_syncAllLayers(struct gfs *gfs) {
+    int i, count = 0;
+
     for (i = 1; i <= gfs->gfs_scount; i++) {
-        fs = gfs->gfs_fs[i];
-        if (fs) {
-            lc_lockExclusive(fs);
-            assert(!fs->fs_removed);
-            lc_sync(gfs, fs, fs->fs_child == NULL);
-            lc_processLayerBlocks(gfs, fs, true, false, false);
-            lc_flushDirtyPages(gfs, fs);
-            lc_unlockExclusive(fs);
+        if (gfs->gfs_fs[i]) {
+            count++;
         }
     }
+    lc_syncLayersParallel(gfs, count, false);
 }
 
 /* Free the global file system as part of unmount */
@@ -786,6 +1026,11 @@ lc_unmount(struct gfs *gfs) {
     struct fs *fs = lc_getGlobalFs(gfs);
 
     assert(gfs->gfs_unmounting);
+
+    /* Wait for the defragmenter to notice unmount */
+    while (gfs->gfs_defragging) {
+        usleep(1000);
+    }
     lc_lockExclusive(fs);
     assert(fs->fs_mcount == 1);
     fs->fs_mcount = 0;
@@ -810,16 +1055,22 @@ lc_cleanupAfterRestart(struct gfs *gfs, struct fs *fs) {
     }
 }
 
-/* Commit changes in root layer and write out superblock */
-void
+/* Commit changes in root layer and write out superblock.  Returns true if
+ * the file system is committed.
+ */
+bool
 lc_commitRoot(struct gfs *gfs, int count) {
     struct fs *fs = lc_getGlobalFs(gfs);
+    bool committed = false;
+    struct timeval start;
+    uint64_t gen;
     int err;
 
-    /* Flush dirty pages with shared lock */
-    if (fs->fs_dpcount || fs->fs_pcount) {
+    /* Flush dirty pages and metadata of dirty inodes with shared lock */
+    if (fs->fs_dpcount || fs->fs_pcount || fs->fs_inodesDirty) {
         lc_lock(fs, false);
         lc_flushDirtyInodeList(fs, true);
+        lc_flushInodesMeta(gfs, fs);
         lc_flushDirtyPages(gfs, fs);
         lc_unlock(fs);
         err = fsync(gfs->gfs_fd);
@@ -829,8 +1080,9 @@ lc_commitRoot(struct gfs *gfs, int count) {
     /* Lock the layer exclusive and flush everything and write out superblock
      */
     if (lc_tryLock(fs, true)) {
-        return;
+        return false;
     }
+    gettimeofday(&start, NULL);
     if ((gfs->gfs_layerInProgress == 0) && (count == gfs->gfs_syncRequired)) {
         lc_allocateSuperBlocks(gfs, fs);
         lc_sync(gfs, fs, false);
@@ -842,25 +1094,36 @@ lc_commitRoot(struct gfs *gfs, int count) {
         if (fs->fs_dirty) {
             fs->fs_super->sb_ncommitted++;
             fs->fs_super->sb_commitTime = time(NULL);
+            gen = lc_logCheckpoint(gfs);
             lc_superWrite(gfs, fs, NULL);
             err = fsync(gfs->gfs_fd);
             assert(err == 0);
+            lc_logCommitted(gfs, gen);
         }
         gfs->gfs_syncRequired -= count;
         lc_printf("file system committed to disk\n");
+        committed = true;
     }
+    lc_checkpointLockStats(gfs, &start);
     lc_unlock(fs);
+    return committed;
 }
 
 /* Commit the file system to a consistent state */
 void
 lc_commit(struct gfs *gfs) {
-    int i, count, gindex;
+    uint64_t gen, wblocks = gfs->gfs_wblocks;
+    int i, count, layers = 0;
+    struct timeval start;
     struct fs *fs;
 
     if (gfs->gfs_layerInProgress || (gfs->gfs_syncRequired == 0)) {
         return;
     }
+    gettimeofday(&start, NULL);
+
+    /* Log records to a new generation while layers are synced */
+    gen = lc_logSwitch(gfs);
 
     /* Sync all layers */
     rcu_register_thread();
@@ -868,60 +1131,16 @@ lc_commit(struct gfs *gfs) {
     count = gfs->gfs_syncRequired;
     for (i = 1; i <= gfs->gfs_scount; i++) {
         fs = rcu_dereference(gfs->gfs_fs[i]);
-        if ((fs == NULL) ||
-            (!fs->fs_frozen && fs->fs_mcount && (fs->fs_fextents == NULL)) ||
-            (!fs->fs_inodesDirty && !fs->fs_extentsDirty &&
-             (fs->fs_fextents == NULL))) {
-            continue;
-        }
-        gindex = fs->fs_gindex;
-
-        /* Flush dirty pages with shared lock first */
-        if (fs->fs_dpcount || fs->fs_pcount) {
-            if (lc_tryLock(fs, false)) {
-                rcu_read_unlock();
-                rcu_unregister_thread();
-                return;
-            }
-            rcu_read_unlock();
-            if (gfs->gfs_layerInProgress) {
-                lc_unlock(fs);
-                rcu_unregister_thread();
-                return;
-            }
-            assert(gindex == fs->fs_gindex);
-            lc_flushDirtyInodeList(fs, true);
-            lc_flushDirtyPages(gfs, fs);
-            lc_unlock(fs);
-            rcu_read_lock();
-            fs = rcu_dereference(gfs->gfs_fs[i]);
-        }
-
-        /* Lock the layer exclusive and flush all dirty inodes and
-         * allocated extent list.
-         */
-        if ((fs == NULL) || (gindex != fs->fs_gindex) ||
-            gfs->gfs_layerInProgress || lc_tryLock(fs, true)) {
-            rcu_read_unlock();
-            rcu_unregister_thread();
-            return;
-        }
-        rcu_read_unlock();
-        assert(gindex == fs->fs_gindex);
-        if (gfs->gfs_layerInProgress) {
-            lc_unlock(fs);
-            rcu_unregister_thread();
-            return;
-        }
-        lc_sync(gfs, fs, false);
-        lc_processLayerBlocks(gfs, fs, false, false, true);
-        if (!fs->fs_frozen) {
-            lc_flushDirtyPages(gfs, fs);
-            fs->fs_super->sb_flags &= ~LC_SUPER_DIRTY;
+        if (fs && lc_checkpointLayerNeeded(fs)) {
+            layers++;
         }
-        lc_unlock(fs);
-        rcu_read_lock();
     }
+    rcu_read_unlock();
+    if (!lc_syncLayersParallel(gfs, layers, true)) {
+        rcu_unregister_thread();
+        return;
+    }
+    rcu_read_lock();
 
     /* Flush all dirty pages */
     for (i = 1; i <= gfs->gfs_scount; i++) {
@@ -943,7 +1162,10 @@ lc_commit(struct gfs *gfs) {
     if ((gfs->gfs_layerInProgress == 0) && (count == gfs->gfs_syncRequired)) {
 
         /* Sync everything from the root layer */
-        lc_commitRoot(gfs, count);
+        lc_logSynced(gfs, gen);
+        if (lc_commitRoot(gfs, count)) {
+            lc_checkpointStats(gfs, &start, wblocks);
+        }
     }
 }
 
@@ -16,6 +16,47 @@ enum lc_mountId {
 /* Time in seconds syncer is woken to checkpoint file system */
 #define LC_SYNC_INTERVAL       60
 
+/* Number of buckets in the histogram of checkpoint times.  Bucket i counts
+ * checkpoints taking less than 2^i milliseconds, last one the rest.
+ */
+#define LC_CKPT_BUCKETS        16
+
+/* Type of accesses tracked for finding hot files and layers */
+enum lc_hotType {
+    LC_HOT_READ = 0,    /* Bytes read */
+
+    LC_HOT_WRITE = 1,   /* Bytes written */
+
+    LC_HOT_OPS = 2,     /* Operations */
+
+    LC_HOT_MAX = 3,     /* Number of types of accesses tracked */
+};
+
+/* Type of blocks written, for breaking down writes to the device */
+enum lc_writeType {
+    LC_WRITE_DATA = 0,      /* File data */
+
+    LC_WRITE_INODE = 1,     /* Inode blocks */
+
+    LC_WRITE_IBLOCK = 2,    /* Inode block map */
+
+    LC_WRITE_EMAP = 3,      /* Extent maps of files */
+
+    LC_WRITE_DIR = 4,       /* Directory blocks */
+
+    LC_WRITE_XATTR = 5,     /* Extended attribute blocks */
+
+    LC_WRITE_EXTENT = 6,    /* Allocated and free extent lists */
+
+    LC_WRITE_SUPER = 7,     /* Superblocks */
+
+    LC_WRITE_LOG = 8,       /* Intent log */
+
+    LC_WRITE_DEFRAG = 9,    /* Data relocated by defragmentation */
+
+    LC_WRITE_MAX = 10,      /* Number of types of blocks written */
+};
+
 /* Global file system */
 struct gfs {
 
@@ -72,6 +113,21 @@ struct gfs {
 
     /* fuse sessions */
     struct fuse_session *gfs_se[LC_MAX_MOUNTS];
+
+    /* Workers serving fuse sessions */
+    struct wpool *gfs_wpool[LC_MAX_MOUNTS];
+
+    /* Intent log for making fsync persistent between checkpoints */
+    struct ilog *gfs_log;
+
+    /* State of the controller tuning flusher and syncer */
+    struct tune *gfs_tune;
+
+    /* Tracker of hot files */
+    struct hot *gfs_hot;
+
+    /* Slow device emulated on top of the device, if enabled */
+    struct device *gfs_device;
 #ifndef FUSE3
     /* fuse channel */
     struct fuse_chan *gfs_ch[LC_MAX_MOUNTS];
@@ -86,11 +142,11 @@ struct gfs {
     /* Number of blocks reserved */
     uint64_t gfs_blocksReserved;
 
-    /* Global list of extents tracking unused space */
-    struct extent *gfs_extents;
+    /* Global index of extents tracking unused space */
+    struct space *gfs_extents;
 
     /* Extents freed from layers. Not for reuse until commit */
-    struct extent *gfs_fextents;
+    struct space *gfs_fextents;
 
     /* Lock protecting allocations */
     pthread_mutex_t gfs_alock;
@@ -143,12 +199,69 @@ struct gfs {
     /* Pages reused */
     uint64_t gfs_preused;
 
+    /* Number of blocks written */
+    uint64_t gfs_wblocks;
+
+    /* Blocks written of each type */
+    uint64_t gfs_wtype[LC_WRITE_MAX];
+
+    /* Bytes written by applications */
+    uint64_t gfs_wlogical;
+
+    /* Number of checkpoints completed */
+    uint64_t gfs_ckpts;
+
+    /* Time spent in checkpoints in microseconds */
+    uint64_t gfs_ckptTime;
+
+    /* Longest checkpoint in microseconds */
+    uint64_t gfs_ckptMax;
+
+    /* Time layers were locked exclusive by checkpoints in microseconds */
+    uint64_t gfs_ckptLockTime;
+
+    /* Longest time a layer was locked exclusive by a checkpoint */
+    uint64_t gfs_ckptLockMax;
+
+    /* Blocks written while checkpoints were in progress */
+    uint64_t gfs_ckptBlocks;
+
+    /* Most blocks written while a checkpoint was in progress */
+    uint64_t gfs_ckptBlocksMax;
+
+    /* Histogram of checkpoint times */
+    uint64_t gfs_ckptHist[LC_CKPT_BUCKETS];
+
+    /* Blocks written when the last checkpoint completed */
+    uint64_t gfs_ckptWblocks;
+
+    /* Time spent writing blocks in microseconds */
+    uint64_t gfs_wtime;
+
+    /* Time I/O was delayed for emulating a slow device in microseconds */
+    uint64_t gfs_dtime;
+
+    /* Dirty pages a layer could have before flusher is woken up */
+    uint64_t gfs_flushLimit;
+
+    /* Dirty pages queued for write in a layer before flusher writes those */
+    uint64_t gfs_flushCount;
+
+    /* Time in seconds background flusher is woken up */
+    int gfs_flushInterval;
+
     /* Sync interval in seconds */
     int gfs_syncInterval;
 
     /* Count of read only layers being populated */
     int gfs_layerInProgress;
 
+    /* Maximum number of workers serving a mount, 0 for default */
+    int gfs_maxWorkers;
+
+    /* Maximum number of idle workers of a mount, 0 for default */
+    int gfs_idleWorkers;
+
     /* Set if layers are pending flush */
     int gfs_syncRequired;
 
@@ -167,6 +280,24 @@ struct gfs {
     /* Set when purging of pages forced */
     bool gfs_pcleaningForced;
 
+    /* Set while a layer is being defragmented */
+    bool gfs_defragging;
+
+    /* Set if workers are pinned to CPUs */
+    bool gfs_pinWorkers;
+
+    /* Set if each worker reads requests from a cloned fuse device */
+    bool gfs_cloneFd;
+
+    /* Set if kernel writeback cache and large requests are requested */
+    bool gfs_kernelCache;
+
+    /* Set if kernel caches writes */
+    bool gfs_writeback;
+
+    /* Set if fsync is served from the intent log */
+    bool gfs_intentLog;
+
     /* Set if extended attributes are enabled */
     bool gfs_xattr_enabled;
 
@@ -291,9 +422,15 @@ struct fs {
     /* Dirty page count */
     uint64_t fs_dpcount;
 
+    /* Number of threads writing dirty pages, protected by fs_plock */
+    uint64_t fs_wcount;
+
     /* Lock protecting dirty page list */
     pthread_mutex_t fs_plock;
 
+    /* Condition signalled when threads complete writing dirty pages */
+    pthread_cond_t fs_wcond;
+
     /* Lock protecting extent lists */
     pthread_mutex_t fs_alock;
 
@@ -312,6 +449,17 @@ struct fs {
     /* Extents freed in layer, including inherited from parent layer */
     struct extent *fs_fextents;
 
+    /* Cursors for allocating data blocks */
+    struct acursor *fs_cursors;
+
+    /* Allocation group space is reserved from, -1 if not picked yet */
+    int64_t fs_group;
+
+    /* Generation of the intent log last record of the layer logged in, 0 if
+     * nothing logged since the layer was synced.
+     */
+    uint64_t fs_logGen;
+
 #ifdef DEBUG
 
     /* Extents used for inodes */
@@ -333,6 +481,24 @@ struct fs {
     /* Count of dirty pages */
     uint64_t fs_pcount;
 
+    /* Number of times writers were throttled */
+    uint64_t fs_throttled;
+
+    /* Time writers were paused for in microseconds */
+    uint64_t fs_throttleTime;
+
+    /* I/O limits of the layer */
+    struct qos *fs_qos;
+
+    /* Number of times I/O was paused for staying within limits */
+    uint64_t fs_qosThrottled;
+
+    /* Time I/O was paused for staying within limits in microseconds */
+    uint64_t fs_qosTime;
+
+    /* Sampled accesses made through the layer */
+    uint64_t fs_hot[LC_HOT_MAX];
+
     /* Count of blocks allocated */
     uint64_t fs_blocks;
 
@@ -345,6 +511,12 @@ struct fs {
     /* Number of writes */
     uint64_t fs_writes;
 
+    /* Blocks written of each type */
+    uint64_t fs_wtype[LC_WRITE_MAX];
+
+    /* Bytes written by applications */
+    uint64_t fs_wlogical;
+
     /* Inodes written */
     uint64_t fs_iwrite;
 
@@ -403,6 +575,13 @@ struct fs {
     bool fs_locked;
 } __attribute__((packed));
 
+/* Time in seconds kernel could cache names and attributes */
+#define LC_TIMEOUT_SEC      1.0
+
+/* Time in seconds kernel could cache names and attributes from frozen layers
+ */
+#define LC_TIMEOUT_FROZEN   (365.0 * 24 * 60 * 60)
+
 /* Let the syncer know something changed and a checkpoint could be triggered */
 static inline void
 lc_layerChanged(struct gfs *gfs, bool new, bool wakeup) {
@@ -478,4 +657,17 @@ lc_getGlobalFs(struct gfs *gfs) {
     return fs;
 }
 
+/* Return how long kernel could cache names in a directory or attributes of an
+ * inode.  Frozen layers do not change, so kernel could cache those until
+ * invalidated explicitly.  Root directories are rebuilt when a layer is
+ * committed, and init layers are moved under the committed layer, changing
+ * what shared inodes resolve to.
+ */
+static inline double
+lc_cacheTimeout(struct fs *fs, ino_t ino) {
+    return (fs->fs_frozen && !(fs->fs_super->sb_flags & LC_SUPER_INIT) &&
+            (lc_getInodeHandle(ino) != fs->fs_root)) ?
+           LC_TIMEOUT_FROZEN : LC_TIMEOUT_SEC;
+}
+
 #endif
@@ -40,7 +40,7 @@ lc_addHlink(struct fs *fs, struct inode *inode, ino_t parent) {
         parent = LC_ROOT_INODE;
     }
 
-    pthread_mutex_lock(&fs->fs_hlock);
+    lc_mutexLock(&fs->fs_hlock, LC_LOCK_HLINK);
     if (fs->fs_sharedHlinks) {
         lc_copyHlinks(fs);
     }
@@ -61,7 +61,7 @@ lc_addHlink(struct fs *fs, struct inode *inode, ino_t parent) {
          */
         if (parent == hldata->hl_parent) {
             hldata->hl_nlink++;
-            pthread_mutex_unlock(&fs->fs_hlock);
+            lc_mutexUnlock(&fs->fs_hlock, LC_LOCK_HLINK);
             return;
         }
         hldata = NULL;
@@ -92,7 +92,7 @@ lc_addHlink(struct fs *fs, struct inode *inode, ino_t parent) {
         hldata->hl_next = fs->fs_hlinks;
         fs->fs_hlinks = hldata;
     }
-    pthread_mutex_unlock(&fs->fs_hlock);
+    lc_mutexUnlock(&fs->fs_hlock, LC_LOCK_HLINK);
 }
 
 /* Remove a hardlink record for the inode */
@@ -115,7 +115,7 @@ lc_removeHlink(struct fs *fs, struct inode *inode, ino_t parent) {
     prev = &fs->fs_hlinks;
 
     /* Find the hardlink record */
-    pthread_mutex_lock(&fs->fs_hlock);
+    lc_mutexLock(&fs->fs_hlock, LC_LOCK_HLINK);
     if (fs->fs_sharedHlinks) {
         lc_copyHlinks(fs);
     }
@@ -133,10 +133,10 @@ lc_removeHlink(struct fs *fs, struct inode *inode, ino_t parent) {
     hldata->hl_nlink--;
     if (hldata->hl_nlink == 0) {
         *prev = hldata->hl_next;
-        pthread_mutex_unlock(&fs->fs_hlock);
+        lc_mutexUnlock(&fs->fs_hlock, LC_LOCK_HLINK);
         lc_free(fs, hldata, sizeof(struct hldata), LC_MEMTYPE_HLDATA);
     } else {
-        pthread_mutex_unlock(&fs->fs_hlock);
+        lc_mutexUnlock(&fs->fs_hlock, LC_LOCK_HLINK);
     }
 }
 
@@ -0,0 +1,304 @@
+#include "includes.h"
+
+/* One in these many accesses is sampled */
+#define LC_HOT_SAMPLE       16
+
+/* Number of files tracked in a shard for each type of access */
+#define LC_HOT_ENTRIES      32
+
+/* Number of shards, threads picking shards round robin */
+#define LC_HOT_SHARDS       8
+
+/* Number of files and layers reported for each type of access */
+#define LC_HOT_TOP          10
+
+/* A file tracked as a candidate for being hot */
+struct hentry {
+
+    /* File handle of the file, 0 if the entry is free */
+    uint64_t he_key;
+
+    /* Estimated count of accesses */
+    uint64_t he_count;
+
+    /* Maximum overestimation of the count */
+    uint64_t he_error;
+};
+
+/* Files tracked by a subset of threads */
+struct hshard {
+
+    /* Lock protecting the shard */
+    pthread_mutex_t hs_lock;
+
+    /* Files tracked for each type of access */
+    struct hentry hs_entries[LC_HOT_MAX][LC_HOT_ENTRIES];
+} __attribute__((aligned(64)));
+
+/* Tracker of hot files.  Each shard keeps approximate top files for each type
+ * of access using the space-saving algorithm, with the least accessed file
+ * replaced when a new file shows up.  Shards are merged when reported.
+ */
+struct hot {
+
+    /* Shards updated by threads */
+    struct hshard h_shards[LC_HOT_SHARDS];
+};
+
+/* Description of the type of accesses */
+static const char *lc_hotTypes[] = {
+    "bytes read",
+    "bytes written",
+    "operations",
+};
+
+/* Accesses seen by the thread since the last sample */
+static __thread uint32_t lc_hotTick;
+
+/* Shard used by the thread */
+static __thread int lc_hotShard = -1;
+
+/* Next shard to be assigned to a thread */
+static int lc_hotNext;
+
+/* Set up the tracker of hot files */
+void
+lc_hotInit(struct gfs *gfs) {
+    struct hot *hot;
+    int i;
+
+    hot = lc_malloc(NULL, sizeof(struct hot), LC_MEMTYPE_GFS);
+    memset(hot, 0, sizeof(struct hot));
+    for (i = 0; i < LC_HOT_SHARDS; i++) {
+        pthread_mutex_init(&hot->h_shards[i].hs_lock, NULL);
+    }
+    gfs->gfs_hot = hot;
+}
+
+/* Add accesses to a file, replacing the least accessed file if the file is
+ * not tracked already.
+ */
+static void
+lc_hotUpdate(struct hentry *entries, uint64_t key, uint64_t weight) {
+    struct hentry *min = &entries[0];
+    int i;
+
+    for (i = 0; i < LC_HOT_ENTRIES; i++) {
+        if (entries[i].he_key == key) {
+            entries[i].he_count += weight;
+            return;
+        }
+        if (entries[i].he_count < min->he_count) {
+            min = &entries[i];
+        }
+    }
+    min->he_key = key;
+    min->he_error = min->he_count;
+    min->he_count += weight;
+}
+
+/* Sample an access to a file from a layer */
+void
+lc_hotRecord(struct fs *fs, struct inode *inode, enum lc_hotType type,
+             uint64_t bytes) {
+    struct hot *hot = fs->fs_gfs->gfs_hot;
+    uint64_t key, weight;
+    struct hshard *hs;
+
+    if ((hot == NULL) || (++lc_hotTick < LC_HOT_SAMPLE)) {
+        return;
+    }
+    lc_hotTick = 0;
+    if (lc_hotShard < 0) {
+        lc_hotShard = __sync_fetch_and_add(&lc_hotNext, 1) % LC_HOT_SHARDS;
+    }
+    weight = ((type == LC_HOT_OPS) ? 1 : bytes) * LC_HOT_SAMPLE;
+
+    /* Files are tracked in the layers those belong to, layers by accesses
+     * made through those.
+     */
+    key = lc_setHandle(inode->i_fs->fs_gindex, inode->i_ino);
+    __sync_add_and_fetch(&fs->fs_hot[type], weight);
+    if (type != LC_HOT_OPS) {
+        __sync_add_and_fetch(&fs->fs_hot[LC_HOT_OPS], LC_HOT_SAMPLE);
+    }
+    hs = &hot->h_shards[lc_hotShard];
+    pthread_mutex_lock(&hs->hs_lock);
+    lc_hotUpdate(hs->hs_entries[type], key, weight);
+    if (type != LC_HOT_OPS) {
+        lc_hotUpdate(hs->hs_entries[LC_HOT_OPS], key, LC_HOT_SAMPLE);
+    }
+    pthread_mutex_unlock(&hs->hs_lock);
+}
+
+/* Compare entries by file handle */
+static int
+lc_hotCompareKey(const void *a, const void *b) {
+    const struct hentry *ea = a, *eb = b;
+
+    return (ea->he_key < eb->he_key) ? -1 : (ea->he_key > eb->he_key);
+}
+
+/* Compare entries by count, highest first */
+static int
+lc_hotCompareCount(const void *a, const void *b) {
+    const struct hentry *ea = a, *eb = b;
+
+    return (ea->he_count > eb->he_count) ? -1 :
+                                           (ea->he_count < eb->he_count);
+}
+
+/* Report top files for a type of access, merging entries from all shards */
+static void
+lc_hotFiles(FILE *fp, struct hot *hot, enum lc_hotType type) {
+    struct hentry entries[LC_HOT_SHARDS * LC_HOT_ENTRIES];
+    int i, count = 0, merged = 0;
+    struct hshard *hs;
+
+    for (i = 0; i < LC_HOT_SHARDS; i++) {
+        hs = &hot->h_shards[i];
+        pthread_mutex_lock(&hs->hs_lock);
+        memcpy(&entries[count], hs->hs_entries[type],
+               sizeof(struct hentry) * LC_HOT_ENTRIES);
+        pthread_mutex_unlock(&hs->hs_lock);
+        count += LC_HOT_ENTRIES;
+    }
+
+    /* Combine counts of files tracked in more than one shard */
+    qsort(entries, count, sizeof(struct hentry), lc_hotCompareKey);
+    for (i = 0; i < count; i++) {
+        if (entries[i].he_key == 0) {
+            continue;
+        }
+        if (merged && (entries[merged - 1].he_key == entries[i].he_key)) {
+            entries[merged - 1].he_count += entries[i].he_count;
+            entries[merged - 1].he_error += entries[i].he_error;
+        } else {
+            entries[merged++] = entries[i];
+        }
+    }
+    qsort(entries, merged, sizeof(struct hentry), lc_hotCompareCount);
+    fprintf(fp, "Top files by %s:\n", lc_hotTypes[type]);
+    for (i = 0; (i < merged) && (i < LC_HOT_TOP); i++) {
+        fprintf(fp, "\tlayer %ld inode %ld: %ld (+/- %ld)\n",
+                lc_getFsHandle(entries[i].he_key),
+                lc_getInodeHandle(entries[i].he_key),
+                entries[i].he_count, entries[i].he_error);
+    }
+}
+
+/* Report top layers for a type of access */
+static void
+lc_hotLayers(FILE *fp, struct gfs *gfs, enum lc_hotType type) {
+    struct hentry top[LC_HOT_TOP + 1];
+    int i, j, count = 0;
+    struct fs *fs;
+    uint64_t value;
+
+    rcu_register_thread();
+    rcu_read_lock();
+    for (i = 1; i <= gfs->gfs_scount; i++) {
+        fs = rcu_dereference(gfs->gfs_fs[i]);
+        if ((fs == NULL) || (fs->fs_hot[type] == 0)) {
+            continue;
+        }
+
+        /* Insert the layer in the sorted list of top layers */
+        value = fs->fs_hot[type];
+        for (j = count; (j > 0) && (top[j - 1].he_count < value); j--) {
+            top[j] = top[j - 1];
+        }
+        if (j < LC_HOT_TOP) {
+            top[j].he_key = lc_setHandle(i, fs->fs_root);
+            top[j].he_count = value;
+            if (count < LC_HOT_TOP) {
+                count++;
+            }
+        }
+    }
+    rcu_read_unlock();
+    rcu_unregister_thread();
+    fprintf(fp, "Top layers by %s:\n", lc_hotTypes[type]);
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "\tlayer %ld root %ld: %ld\n",
+                lc_getFsHandle(top[i].he_key),
+                lc_getInodeHandle(top[i].he_key), top[i].he_count);
+    }
+}
+
+/* Forget accesses tracked so far */
+static void
+lc_hotClear(struct gfs *gfs, struct hot *hot) {
+    struct hshard *hs;
+    struct fs *fs;
+    int i;
+
+    for (i = 0; i < LC_HOT_SHARDS; i++) {
+        hs = &hot->h_shards[i];
+        pthread_mutex_lock(&hs->hs_lock);
+        memset(hs->hs_entries, 0, sizeof(hs->hs_entries));
+        pthread_mutex_unlock(&hs->hs_lock);
+    }
+    rcu_register_thread();
+    rcu_read_lock();
+    for (i = 0; i <= gfs->gfs_scount; i++) {
+        fs = rcu_dereference(gfs->gfs_fs[i]);
+        if (fs) {
+            memset(fs->fs_hot, 0, sizeof(fs->fs_hot));
+        }
+    }
+    rcu_read_unlock();
+    rcu_unregister_thread();
+}
+
+/* Report hot files and layers, and optionally forget accesses tracked */
+void
+lc_hotReport(fuse_req_t req, struct gfs *gfs, size_t size, bool clear) {
+    struct hot *hot = gfs->gfs_hot;
+    enum lc_hotType type;
+    size_t len;
+    char *buf;
+    FILE *fp;
+
+    fp = open_memstream(&buf, &len);
+    if (fp == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    fprintf(fp, "Accesses sampled one in %d\n", LC_HOT_SAMPLE);
+    for (type = 0; type < LC_HOT_MAX; type++) {
+        lc_hotFiles(fp, hot, type);
+        lc_hotLayers(fp, gfs, type);
+    }
+    fclose(fp);
+    if (clear) {
+        lc_hotClear(gfs, hot);
+    }
+
+    /* Leave room for terminating the string */
+    if (len >= size) {
+        len = size ? size - 1 : 0;
+    }
+    fuse_reply_ioctl(req, 0, buf, len);
+    free(buf);
+}
+
+/* Free the tracker of hot files */
+void
+lc_hotFree(struct gfs *gfs) {
+    struct hot *hot = gfs->gfs_hot;
+#ifdef LC_MUTEX_DESTROY
+    int i;
+#endif
+
+    if (hot == NULL) {
+        return;
+    }
+    gfs->gfs_hot = NULL;
+#ifdef LC_MUTEX_DESTROY
+    for (i = 0; i < LC_HOT_SHARDS; i++) {
+        pthread_mutex_destroy(&hot->h_shards[i].hs_lock);
+    }
+#endif
+    lc_free(NULL, hot, sizeof(struct hot), LC_MEMTYPE_GFS);
+}
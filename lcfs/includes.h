@@ -30,6 +30,8 @@
 #include <zlib.h>
 #include <assert.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <syslog.h>
 #include <urcu.h>
 #include <nmmintrin.h>
@@ -57,6 +59,8 @@
 #include "diff.h"
 #include "stats.h"
 #include "inlines.h"
+#include "trace.h"
+#include "lock.h"
 #ifdef __APPLE__
 #include "apple.h"
 #else
@@ -73,10 +77,12 @@ uint64_t lc_memoryInit(uint64_t limit);
 void *lc_malloc(struct fs *fs, size_t size, enum lc_memTypes type);
 void lc_mallocBlockAligned(struct fs *fs, void **memptr,
                            enum lc_memTypes type);
+void lc_mallocBlocksAligned(struct fs *fs, void **memptr, uint64_t count);
 void lc_free(struct fs *fs, void *ptr, size_t size, enum lc_memTypes type);
 void lc_memMove(struct fs *fs, struct fs *to, size_t size,
                 enum lc_memTypes type);
 bool lc_checkMemoryAvailable(bool flush);
+uint64_t lc_dirtyLimit();
 void lc_waitMemory(struct gfs *gfs, bool wait);
 void lc_memUpdateTotal(struct fs *fs, size_t size);
 void lc_memTransferCount(struct fs *fs, struct fs *rfs, uint64_t count,
@@ -85,7 +91,10 @@ void lc_memTransferExtents(struct gfs *gfs, struct fs *fs, struct fs *cfs,
                            struct extent *extent);
 void lc_checkMemStats(struct fs *fs, bool unmount);
 void lc_displayGlobalMemStats();
+void lc_freeDataPool();
 void lc_displayMemStats(struct fs *fs);
+void lc_memMetrics(struct metrics *m);
+void lc_memLayerMetrics(struct metrics *m, struct fs *fs, const char *labels);
 
 void lc_readBlock(struct gfs *gfs, struct fs *fs, off_t block, void *dbuf);
 void lc_readBlocks(struct gfs *gfs, struct fs *fs, struct iovec *iov,
@@ -95,6 +104,9 @@ void lc_writeBlocks(struct gfs *gfs, struct fs *fs,
                     struct iovec *iov, int iovcnt, off_t block);
 void lc_updateCRC(void *buf, uint32_t *crc);
 void lc_verifyBlock(void *buf, uint32_t *crc);
+bool lc_validCRC(void *buf, uint32_t *crc);
+int lc_deviceEmulate(struct gfs *gfs, const char *model);
+void lc_deviceFree(struct gfs *gfs);
 
 int lc_deviceOpen(char *device);
 uint64_t lc_getTotalMemory();
@@ -110,6 +122,9 @@ void lc_inodeAddMetaExtent(struct gfs *gfs, struct fs *fs,
                            uint64_t count, bool sort);
 
 void lc_blockAllocatorInit(struct gfs *gfs, struct fs *fs);
+void lc_freeCursors(struct fs *fs);
+void lc_spaceExtents(struct gfs *gfs, struct fs *fs, struct space *space,
+                     struct extent **extents);
 void lc_processFreeExtents(struct gfs *gfs, struct fs *fs, bool umount);
 bool lc_hasSpace(struct gfs *gfs, bool root, bool layer);
 void lc_addSpaceExtent(struct gfs *gfs, struct fs *fs, struct extent **extents,
@@ -121,6 +136,8 @@ uint64_t lc_blockAllocExact(struct fs *fs, uint64_t count,
                             bool meta, bool reserve);
 void lc_blockFree(struct gfs *gfs, struct fs *fs, uint64_t block,
                   uint64_t count, bool layer, bool reuse);
+void lc_blockClaim(struct gfs *gfs, struct fs *fs, uint64_t block,
+                   uint64_t count);
 void lc_addFreedExtents(struct fs *fs, struct extent *extent, bool empty);
 void lc_addFreedBlocks(struct fs *fs, uint64_t block, uint64_t count);
 uint64_t lc_countExtents(struct gfs *gfs, struct extent *extent,
@@ -133,6 +150,7 @@ void lc_replaceFreedExtents(struct fs *fs, struct extent **extents,
 void lc_readExtents(struct gfs *gfs, struct fs *fs);
 void lc_grow(struct gfs *gfs);
 void lc_displayAllocStats(struct fs *fs);
+void lc_allocMetrics(struct metrics *m, struct fs *fs, const char *labels);
 
 bool lc_superValid(struct super *super);
 void lc_superRead(struct gfs *gfs, struct fs *fs, uint64_t block);
@@ -153,6 +171,7 @@ int lc_tryLock(struct fs *fs, bool exclusive);
 void lc_lockExclusive(struct fs *fs);
 void lc_unlock(struct fs *fs);
 void lc_unlockExclusive(struct fs *fs);
+void lc_syncKernelCache(struct gfs *gfs);
 void lc_mount(struct gfs *gfs, char *device, bool ftypes, size_t size,
               bool format);
 void lc_cleanupAfterRestart(struct gfs *gfs, struct fs *fs);
@@ -161,7 +180,8 @@ void lc_releaseInodeBlock(struct gfs *gfs, struct fs *fs);
 void lc_flushInodeBlocks(struct gfs *gfs, struct fs *fs);
 void lc_invalidateInodeBlocks(struct gfs *gfs, struct fs *fs);
 void *lc_syncer(void *data);
-void lc_commitRoot(struct gfs *gfs, int count);
+bool lc_commitRoot(struct gfs *gfs, int count);
+void lc_commit(struct gfs *gfs);
 void lc_unmount(struct gfs *gfs);
 struct fs *lc_newLayer(struct gfs *gfs, bool rw);
 void lc_destroyLayer(struct fs *fs, bool remove);
@@ -170,6 +190,7 @@ void lc_icache_init(struct fs *fs, size_t size);
 void lc_icache_deinit(struct icache *icache);
 void lc_copyStat(struct stat *st, struct inode *inode);
 void lc_copyFakeStat(struct stat *st);
+void lc_copyStatsStat(struct stat *st, ino_t ino);
 ino_t lc_inodeAlloc(struct fs *fs);
 void lc_updateFtypeStats(struct fs *fs, mode_t mode, bool incr);
 void lc_displayFtypeStats(struct fs *fs);
@@ -181,11 +202,13 @@ struct inode *lc_getInode(struct fs *fs, ino_t ino, struct inode *handle,
 struct inode *lc_inodeInit(struct fs *fs, mode_t mode,
                             uid_t uid, gid_t gid, dev_t rdev, ino_t parent,
                             const char *target);
+struct inode *lc_inodeRecreate(struct fs *fs, struct dinode *dinode);
 void lc_hideInode(struct fs *fs, ino_t ino, struct inode *inode);
 void lc_rootInit(struct fs *fs, ino_t root);
 void lc_cloneRootDir(struct inode *pdir, struct inode *dir);
 void lc_setLayerRoot(struct gfs *gfs, ino_t ino);
 void lc_updateInodeTimes(struct inode *inode, bool mtime, bool ctime);
+uint64_t lc_flushInodesMeta(struct gfs *gfs, struct fs *fs);
 void lc_syncInodes(struct gfs *gfs, struct fs *fs, bool unmount);
 void lc_inodeLock(struct inode *inode, bool exclusive);
 void lc_inodeUnlock(struct inode *inode);
@@ -199,6 +222,7 @@ void lc_swapRootInode(struct fs *fs, struct fs *cfs);
 void lc_freezeLayer(struct gfs *gfs, struct fs *fs);
 
 ino_t lc_dirLookup(struct fs *fs, struct inode *dir, const char *name);
+int lc_dirGetName(struct fs *fs, ino_t parent, ino_t ino, char *name);
 struct dirent *lc_getDirent(struct fs *fs, ino_t parent, ino_t ino, int *hash,
                             struct dirent *sdirent);
 void lc_dirAdd(struct inode *dir, ino_t ino, mode_t mode, const char *name,
@@ -233,6 +257,8 @@ bool lc_emapTruncate(struct gfs *gfs, struct fs *fs, struct inode *inode,
                      size_t size, uint64_t pg, bool remove);
 void lc_freeInodeDataBlocks(struct gfs *gfs, struct fs *fs,
                             struct extent **extents);
+void lc_emapReplace(struct gfs *gfs, struct fs *fs, struct inode *inode,
+                    struct extent *emap);
 
 void lc_bcacheInit(struct fs *fs, uint32_t count, uint32_t lcount);
 void lc_bcacheFree(struct fs *fs);
@@ -251,6 +277,7 @@ void lc_releaseReadPages(struct gfs *gfs, struct fs *fs,
                          bool recycle);
 int lc_invalPage(struct gfs *gfs, struct fs *fs, uint64_t block);
 struct page *lc_getPageNewData(struct fs *fs, uint64_t block, char *data);
+struct page *lc_findPage(struct fs *fs, uint64_t block);
 void lc_setPageBlock(struct page *page, uint64_t block);
 void lc_addPageBlockHash(struct gfs *gfs, struct fs *fs,
                          struct page *page, uint64_t block);
@@ -274,10 +301,16 @@ uint64_t lc_addPages(struct inode *inode, off_t off, size_t size,
 int lc_readFile(fuse_req_t req, struct fs *fs, struct inode *inode,
                 off_t soffset, off_t endoffset, uint64_t asize,
                 struct page **pages, char **dbuf, struct fuse_bufvec *bufv);
+bool lc_directRead(fuse_req_t req, struct fs *fs, struct inode *inode,
+                   off_t soffset, off_t endoffset, uint64_t asize,
+                   struct fuse_bufvec *bufv);
+bool lc_directWrite(struct fs *fs, struct inode *inode, off_t off,
+                    size_t size, struct dpage *dpages, uint64_t pcount);
 void lc_flushPages(struct gfs *gfs, struct fs *fs, struct inode *inode,
                    bool release, bool unlock);
 void lc_truncateFile(struct inode *inode, off_t size, bool remove);
 void lc_flushDirtyPages(struct gfs *gfs, struct fs *fs);
+void lc_syncDirtyPages(struct gfs *gfs, struct fs *fs);
 void lc_addDirtyInode(struct fs *fs, struct inode *inode);
 void lc_flushDirtyInodeList(struct fs *fs, bool all);
 void lc_invalidateDirtyPages(struct gfs *gfs, struct fs *fs);
@@ -315,6 +348,54 @@ void lc_layerIoctl(fuse_req_t req, struct gfs *gfs, const char *name,
 void lc_commitLayer(fuse_req_t req, struct fs *fs, ino_t ino, const char *name,
                     struct fuse_file_info *fi);
 
+void lc_defragLayer(fuse_req_t req, struct gfs *gfs,
+                    const struct ldefrag *ldefrag);
+
+int lc_serveWorkers(struct gfs *gfs, struct fuse_session *se,
+                    enum lc_mountId id);
+void lc_displayWorkerStats(struct gfs *gfs, enum lc_mountId id);
+void lc_freeWorkers(struct gfs *gfs, enum lc_mountId id);
+
+bool lc_logInode(struct fs *fs, ino_t ino, struct inode *handle);
+void lc_logWaitCheckpoint(struct gfs *gfs);
+uint64_t lc_logReplay(struct gfs *gfs);
+bool lc_logInit(struct gfs *gfs, bool enable, uint64_t gen);
+uint64_t lc_logSwitch(struct gfs *gfs);
+void lc_logSynced(struct gfs *gfs, uint64_t gen);
+uint64_t lc_logCheckpoint(struct gfs *gfs);
+void lc_logCommitted(struct gfs *gfs, uint64_t gen);
+void lc_logUnmount(struct gfs *gfs);
+void lc_logFree(struct gfs *gfs);
+
+void lc_tuneInit(struct gfs *gfs);
+void lc_tune(struct gfs *gfs);
+bool lc_tuneThrottle(struct gfs *gfs, struct fs *fs, uint64_t pcount,
+                     uint64_t *wpause);
+void lc_tuneFree(struct gfs *gfs);
+
+void lc_qosInit(struct fs *fs);
+void lc_qosCharge(struct gfs *gfs, struct fs *fs, uint64_t blocks);
+uint64_t lc_qosPause(struct gfs *gfs, struct fs *fs);
+void lc_qosBalance(struct gfs *gfs, bool saturated, uint64_t usec);
+void lc_qosLayer(fuse_req_t req, struct gfs *gfs, const struct lqos *lqos);
+void lc_qosFree(struct fs *fs);
+
+void lc_hotInit(struct gfs *gfs);
+void lc_hotRecord(struct fs *fs, struct inode *inode, enum lc_hotType type,
+                  uint64_t bytes);
+void lc_hotReport(fuse_req_t req, struct gfs *gfs, size_t size, bool clear);
+void lc_hotFree(struct gfs *gfs);
+
+void lc_traceEnable(bool enable);
+void lc_traceBegin();
+void lc_traceEnd(struct fs *fs, enum lc_stats type, bool err);
+struct sfile *lc_traceOpen(struct gfs *gfs);
+void lc_traceFree();
+
+void lc_lockProfile(bool enable);
+void lc_lockMetrics(struct metrics *m);
+void lc_displayLockStats();
+
 void lc_addHlink(struct fs *fs, struct inode *inode, ino_t parent);
 void lc_removeHlink(struct fs *fs, struct inode *inode, ino_t parent);
 void lc_freeHlinks(struct fs *fs);
@@ -325,13 +406,23 @@ int lc_layerDiff(fuse_req_t req, const char *name, size_t size);
 
 void lc_statsEnable();
 void lc_statsNew(struct fs *fs);
-void lc_statsBegin(struct timeval *start);
-void lc_statsAdd(struct fs *fs, enum lc_stats type, bool err,
-                  struct timeval *start);
+const char *lc_statsName(enum lc_stats type);
+void lc_statsWrite(struct fs *fs, enum lc_writeType type, uint64_t blocks);
+void lc_statsLogicalWrite(struct fs *fs, uint64_t bytes);
+void lc_statsBegin(uint64_t *start);
+void lc_statsAdd(struct fs *fs, enum lc_stats type, bool err, uint64_t *start);
 void lc_displayLayerStats(struct fs *fs);
 void lc_displayStats(struct fs *fs);
 void lc_displayStatsAll(struct gfs *gfs);
 void lc_displayGlobalStats(struct gfs *gfs);
+void lc_metric(struct metrics *m, const char *name, const char *labels,
+               uint64_t value);
+struct sfile *lc_statsOpen(struct gfs *gfs, bool json);
+void lc_statsRead(fuse_req_t req, struct sfile *sf, size_t size, off_t off);
+void lc_statsClose(struct sfile *sf);
+void lc_checkpointLockStats(struct gfs *gfs, struct timeval *start);
+void lc_checkpointStats(struct gfs *gfs, struct timeval *start,
+                        uint64_t wblocks);
 void lc_statsDeinit(struct fs *fs);
 
 #ifdef DEBUG
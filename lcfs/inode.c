@@ -68,6 +68,14 @@ lc_copyFakeStat(struct stat *st) {
     st->st_ctim = tv;
 }
 
+/* Copy attributes of a stats file */
+void
+lc_copyStatsStat(struct stat *st, ino_t ino) {
+    lc_copyFakeStat(st);
+    st->st_ino = ino;
+    st->st_mode = S_IFREG | 0400;
+}
+
 /* Initialize a disk inode */
 static void
 lc_dinodeInit(struct inode *inode, ino_t ino, mode_t mode,
@@ -232,9 +240,9 @@ lc_addInode(struct fs *fs, struct inode *inode, int hash, bool lock,
 
     if (lock) {
 #ifdef LC_IC_LOCK
-        pthread_mutex_lock(&fs->fs_icache[hash].ic_lock);
+        lc_mutexLock(&fs->fs_icache[hash].ic_lock, LC_LOCK_ICACHE);
 #else
-        pthread_mutex_lock(&fs->fs_ilock);
+        lc_mutexLock(&fs->fs_ilock, LC_LOCK_ICACHE);
 #endif
     }
     if (new) {
@@ -244,9 +252,9 @@ lc_addInode(struct fs *fs, struct inode *inode, int hash, bool lock,
             inode = lc_lookupInodeCache(fs, ino, hash);
             if (inode) {
 #ifdef LC_IC_LOCK
-                pthread_mutex_unlock(&fs->fs_icache[hash].ic_lock);
+                lc_mutexUnlock(&fs->fs_icache[hash].ic_lock, LC_LOCK_ICACHE);
 #else
-                pthread_mutex_unlock(&fs->fs_ilock);
+                lc_mutexUnlock(&fs->fs_ilock, LC_LOCK_ICACHE);
 #endif
                 new->i_flags |= LC_INODE_SHARED;
                 new->i_fs = fs;
@@ -276,9 +284,9 @@ lc_addInode(struct fs *fs, struct inode *inode, int hash, bool lock,
     }
     if (lock) {
 #ifdef LC_IC_LOCK
-        pthread_mutex_unlock(&fs->fs_icache[hash].ic_lock);
+        lc_mutexUnlock(&fs->fs_icache[hash].ic_lock, LC_LOCK_ICACHE);
 #else
-        pthread_mutex_unlock(&fs->fs_ilock);
+        lc_mutexUnlock(&fs->fs_ilock, LC_LOCK_ICACHE);
 #endif
     }
     return inode;
@@ -678,6 +686,7 @@ lc_flushInodePages(struct gfs *gfs, struct fs *fs) {
         count--;
     }
     assert(page == NULL);
+    lc_statsWrite(fs, LC_WRITE_INODE, fs->fs_inodePagesCount);
     lc_addPageForWriteBack(gfs, fs, fs->fs_inodePages, fs->fs_inodePagesLast,
                            fs->fs_inodePagesCount);
     fs->fs_inodePages = NULL;
@@ -745,17 +754,9 @@ lc_inodeReleaseExtentLists(struct gfs *gfs, struct fs *fs,
     }
 }
 
-/* Flush a dirty inode to disk */
-static int
-lc_flushInode(struct gfs *gfs, struct fs *fs, struct inode *inode) {
-    bool written = false;
-    char *inodes;
-    off_t offset;
-
-    assert(inode->i_fs == fs);
-    if (inode->i_flags & LC_INODE_TMP) {
-        return 0;
-    }
+/* Flush extended attributes, emap or directory entries of an inode */
+static void
+lc_flushInodeMeta(struct gfs *gfs, struct fs *fs, struct inode *inode) {
 
     /* Flush extended attributes if those are modified */
     if (inode->i_flags & LC_INODE_XATTRDIRTY) {
@@ -771,6 +772,20 @@ lc_flushInode(struct gfs *gfs, struct fs *fs, struct inode *inode) {
         /* Flush directory entries */
         lc_dirFlush(gfs, fs, inode);
     }
+}
+
+/* Flush a dirty inode to disk */
+static int
+lc_flushInode(struct gfs *gfs, struct fs *fs, struct inode *inode) {
+    bool written = false;
+    char *inodes;
+    off_t offset;
+
+    assert(inode->i_fs == fs);
+    if (inode->i_flags & LC_INODE_TMP) {
+        return 0;
+    }
+    lc_flushInodeMeta(gfs, fs, inode);
 
     /* Write out a dirty inode */
     if (inode->i_flags & LC_INODE_DIRTY) {
@@ -920,6 +935,58 @@ lc_freezeLayer(struct gfs *gfs, struct fs *fs) {
     }
 }
 
+/* Flush metadata of an inode ahead of a checkpoint if the inode is not busy
+ */
+static uint64_t
+lc_flushInodeMetaTry(struct gfs *gfs, struct fs *fs, struct inode *inode) {
+    uint32_t flags = LC_INODE_EMAPDIRTY | LC_INODE_DIRDIRTY |
+                     LC_INODE_XATTRDIRTY;
+    uint64_t count = 0;
+
+    if ((inode == NULL) || (inode->i_fs != fs) || !(inode->i_flags & flags) ||
+        (inode->i_flags & (LC_INODE_REMOVED | LC_INODE_TMP)) ||
+        pthread_rwlock_trywrlock(inode->i_rwlock)) {
+        return 0;
+    }
+    if ((inode->i_flags & flags) &&
+        !(inode->i_flags & (LC_INODE_REMOVED | LC_INODE_TMP))) {
+        lc_flushInodeMeta(gfs, fs, inode);
+        count++;
+    }
+    pthread_rwlock_unlock(inode->i_rwlock);
+    return count;
+}
+
+/* Flush emaps, directories and extended attributes of dirty inodes with the
+ * layer locked shared, so that a checkpoint has to write only inodes with the
+ * layer locked exclusive.  Each inode is flushed under its own lock and
+ * inodes busy are left for the checkpoint.  Returns number of inodes flushed.
+ */
+uint64_t
+lc_flushInodesMeta(struct gfs *gfs, struct fs *fs) {
+    struct inode *inode;
+    uint64_t count = 0;
+    int i;
+
+    if (fs->fs_frozen || !fs->fs_inodesDirty) {
+        return 0;
+    }
+    count += lc_flushInodeMetaTry(gfs, fs, fs->fs_rootInode);
+    if (fs == lc_getGlobalFs(gfs)) {
+        count += lc_flushInodeMetaTry(gfs, fs, gfs->gfs_layerRootInode);
+    }
+
+    /* Inodes are not taken off the cache while the layer is locked shared */
+    for (i = 0; (i < fs->fs_icacheSize) && !fs->fs_removed; i++) {
+        inode = fs->fs_icache[i].ic_head;
+        while (inode && !fs->fs_removed) {
+            count += lc_flushInodeMetaTry(gfs, fs, inode);
+            inode = inode->i_cnext;
+        }
+    }
+    return count;
+}
+
 /* Sync all dirty inodes */
 void
 lc_syncInodes(struct gfs *gfs, struct fs *fs, bool unmount) {
@@ -1362,6 +1429,30 @@ lc_inodeInit(struct fs *fs, mode_t mode, uid_t uid, gid_t gid,
     return inode;
 }
 
+/* Create a regular file again with the inode number it had, for a file
+ * created after the last checkpoint and found in the intent log.  Returns the
+ * inode locked exclusive.
+ */
+struct inode *
+lc_inodeRecreate(struct fs *fs, struct dinode *dinode) {
+    struct super *super = fs->fs_gfs->gfs_super;
+    struct inode *inode;
+
+    assert(S_ISREG(dinode->di_mode));
+    inode = lc_newInode(fs, 0, true, true, true, false);
+    lc_dinodeInit(inode, dinode->di_ino, dinode->di_mode, dinode->di_uid,
+                  dinode->di_gid, 0, 0, dinode->di_parent);
+    lc_updateFtypeStats(fs, dinode->di_mode, true);
+    lc_addInode(fs, inode, -1, true, NULL, NULL);
+    lc_inodeLock(inode, true);
+
+    /* Do not hand out the inode number again */
+    if (super->sb_ninode < dinode->di_ino) {
+        super->sb_ninode = dinode->di_ino;
+    }
+    return inode;
+}
+
 /* Move inodes from one layer to another */
 void
 lc_moveInodes(struct fs *fs, struct fs *cfs) {
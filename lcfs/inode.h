@@ -163,6 +163,11 @@ struct ixattr {
 /* Fake inode number used to trigger layer commit operation */
 #define LC_COMMIT_TRIGGER_INODE     LC_ROOT_INODE
 
+/* Fake inode numbers of stats files, never allocated to real inodes */
+#define LC_STATS_INODE              LC_FH_INODE
+#define LC_STATS_JSON_INODE         (LC_FH_INODE - 1)
+#define LC_TRACE_INODE              (LC_FH_INODE - 2)
+
 /* Number of inode pages which can be freed if inodes are re-written */
 #define LC_INODE_RELOCATE_PCOUNT    10
 
@@ -434,4 +439,25 @@ lc_invalInodePages(struct gfs *gfs, ino_t ino) {
     }
 }
 
+/* Invalidate attributes and names of an inode cached in kernel */
+static inline void
+lc_invalInodeAttr(struct gfs *gfs, ino_t ino) {
+    if (lc_getGlobalFs(gfs)->fs_mcount) {
+        fuse_lowlevel_notify_inval_inode(
+#ifdef FUSE3
+                                     gfs->gfs_se[LC_LAYER_MOUNT],
+#else
+                                     gfs->gfs_ch[LC_LAYER_MOUNT],
+#endif
+                                     ino, -1, 0);
+    }
+}
+
+/* Check if an inode is one of the fake stats or trace files */
+static inline bool
+lc_isStatsInode(uint64_t ino) {
+    return (ino == LC_STATS_INODE) || (ino == LC_STATS_JSON_INODE) ||
+           (ino == LC_TRACE_INODE);
+}
+
 #endif
@@ -1,14 +1,186 @@
 #include "includes.h"
 
+/* Parameters of a slow device emulated on top of a plain file.  Requests wait
+ * for a slot when the queue is full, then are delayed for the access latency,
+ * plus the seek time if not contiguous with the previous request, plus the
+ * time for transferring data.  Transfers share the bandwidth and are
+ * serialized, while latencies of queued requests overlap.
+ */
+struct device {
+
+    /* Lock protecting the queue */
+    pthread_mutex_t d_lock;
+
+    /* Condition requests wait on while the queue is full */
+    pthread_cond_t d_cond;
+
+    /* Access latency of a request in nanoseconds */
+    uint64_t d_latency;
+
+    /* Additional latency of a request not contiguous with previous one */
+    uint64_t d_seek;
+
+    /* Bandwidth in bytes per second, 0 if unlimited */
+    uint64_t d_bandwidth;
+
+    /* Maximum number of requests in progress, 0 if unlimited */
+    uint64_t d_depth;
+
+    /* Number of requests in progress */
+    uint64_t d_pending;
+
+    /* Time until which the device is busy transferring data */
+    uint64_t d_busy;
+
+    /* Block following the last one accessed */
+    uint64_t d_next;
+};
+
+/* Devices which can be emulated by name */
+static const struct {
+    const char *name;
+    uint64_t latency, seek, bandwidth, depth;
+} lc_devices[] = {
+
+    /* Rotating disk with a single head */
+    {"hdd", 200, 8000, 150, 1},
+
+    /* Cloud block storage throttled on bandwidth */
+    {"ebs", 600, 0, 250, 32},
+
+    /* Throttled solid state drive */
+    {"ssd", 100, 0, 500, 32},
+};
+
+/* Set up emulation of a slow device, specified either as a name from the
+ * table above or as <latency usec>,<seek usec>,<MB/s>,<queue depth>.  The
+ * model is only validated when gfs is NULL.
+ */
+int
+lc_deviceEmulate(struct gfs *gfs, const char *model) {
+    uint64_t latency, seek, bandwidth, depth;
+    struct device *device;
+    int i;
+
+    for (i = 0; i < (sizeof(lc_devices) / sizeof(lc_devices[0])); i++) {
+        if (!strcmp(model, lc_devices[i].name)) {
+            latency = lc_devices[i].latency;
+            seek = lc_devices[i].seek;
+            bandwidth = lc_devices[i].bandwidth;
+            depth = lc_devices[i].depth;
+            break;
+        }
+    }
+    if ((i == (sizeof(lc_devices) / sizeof(lc_devices[0]))) &&
+        (sscanf(model, "%lu,%lu,%lu,%lu",
+                &latency, &seek, &bandwidth, &depth) != 4)) {
+        return EINVAL;
+    }
+    if (gfs == NULL) {
+        return 0;
+    }
+    device = lc_malloc(NULL, sizeof(struct device), LC_MEMTYPE_GFS);
+    memset(device, 0, sizeof(struct device));
+    pthread_mutex_init(&device->d_lock, NULL);
+    pthread_cond_init(&device->d_cond, NULL);
+    device->d_latency = latency * 1000;
+    device->d_seek = seek * 1000;
+    device->d_bandwidth = bandwidth * 1024 * 1024;
+    device->d_depth = depth;
+    gfs->gfs_device = device;
+    lc_syslog(LOG_INFO, "Emulating device with latency %ld usec seek %ld usec"
+              " bandwidth %ldMB/s queue depth %ld\n",
+              latency, seek, bandwidth, depth);
+    return 0;
+}
+
+/* Free the emulated device */
+void
+lc_deviceFree(struct gfs *gfs) {
+    struct device *device = gfs->gfs_device;
+
+    if (device) {
+        assert(device->d_pending == 0);
+#ifdef LC_COND_DESTROY
+        pthread_cond_destroy(&device->d_cond);
+#endif
+#ifdef LC_MUTEX_DESTROY
+        pthread_mutex_destroy(&device->d_lock);
+#endif
+        lc_free(NULL, device, sizeof(struct device), LC_MEMTYPE_GFS);
+        gfs->gfs_device = NULL;
+    }
+}
+
+/* Queue a request on the emulated device and wait for it to be serviced */
+static void
+lc_deviceStart(struct gfs *gfs, off_t block, uint64_t blocks) {
+    struct device *device = gfs->gfs_device;
+    uint64_t now, start, done;
+    struct timespec ts;
+
+    pthread_mutex_lock(&device->d_lock);
+    while (device->d_depth && (device->d_pending >= device->d_depth)) {
+        pthread_cond_wait(&device->d_cond, &device->d_lock);
+    }
+    device->d_pending++;
+    now = lc_traceNow();
+    done = device->d_latency;
+    if (device->d_next != block) {
+        done += device->d_seek;
+    }
+    device->d_next = block + blocks;
+    if (device->d_bandwidth) {
+        start = (device->d_busy > now) ? device->d_busy : now;
+        device->d_busy = start + (blocks * LC_BLOCK_SIZE * 1000000000ul) /
+                                 device->d_bandwidth;
+        done += device->d_busy;
+    } else {
+        done += now;
+    }
+    pthread_mutex_unlock(&device->d_lock);
+    __sync_add_and_fetch(&gfs->gfs_dtime, (done - now) / 1000);
+    ts.tv_sec = done / 1000000000ul;
+    ts.tv_nsec = done % 1000000000ul;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR);
+}
+
+/* Complete a request on the emulated device */
+static void
+lc_deviceDone(struct gfs *gfs) {
+    struct device *device = gfs->gfs_device;
+
+    pthread_mutex_lock(&device->d_lock);
+    assert(device->d_pending > 0);
+    device->d_pending--;
+    pthread_cond_signal(&device->d_cond);
+    pthread_mutex_unlock(&device->d_lock);
+}
+
 /* Read a file system block */
 void
 lc_readBlock(struct gfs *gfs, struct fs *fs, off_t block, void *dbuf) {
+    uint64_t start = 0;
     size_t size;
 
     //lc_printf("Reading block %ld\n", block);
     assert((block == LC_SUPER_BLOCK) || (block < gfs->gfs_super->sb_tblocks));
+    lc_qosCharge(gfs, fs, 1);
+    if (unlikely(lc_traceEnabled)) {
+        start = lc_traceNow();
+    }
+    if (unlikely(gfs->gfs_device)) {
+        lc_deviceStart(gfs, block, 1);
+    }
     size = pread(gfs->gfs_fd, dbuf, LC_BLOCK_SIZE, block * LC_BLOCK_SIZE);
     assert(size == LC_BLOCK_SIZE);
+    if (unlikely(gfs->gfs_device)) {
+        lc_deviceDone(gfs);
+    }
+    if (unlikely(start)) {
+        lc_traceIO(lc_traceNow() - start);
+    }
     __sync_add_and_fetch(&gfs->gfs_reads, 1);
     __sync_add_and_fetch(&fs->fs_reads, 1);
 }
@@ -17,26 +189,66 @@ lc_readBlock(struct gfs *gfs, struct fs *fs, off_t block, void *dbuf) {
 void
 lc_readBlocks(struct gfs *gfs, struct fs *fs,
               struct iovec *iov, int iovcnt, off_t block) {
+    uint64_t start = 0;
     size_t size;
 
     //lc_printf("lc_readBlocks: Reading %d blocks %ld\n", iovcnt, block);
     assert((block + iovcnt) < gfs->gfs_super->sb_tblocks);
+    lc_qosCharge(gfs, fs, iovcnt);
+    if (unlikely(lc_traceEnabled)) {
+        start = lc_traceNow();
+    }
+    if (unlikely(gfs->gfs_device)) {
+        lc_deviceStart(gfs, block, iovcnt);
+    }
     size = lc_preadv(gfs->gfs_fd, iov, iovcnt, block * LC_BLOCK_SIZE);
     assert(size == (iovcnt * LC_BLOCK_SIZE));
+    if (unlikely(gfs->gfs_device)) {
+        lc_deviceDone(gfs);
+    }
+    if (unlikely(start)) {
+        lc_traceIO(lc_traceNow() - start);
+    }
     __sync_add_and_fetch(&gfs->gfs_reads, 1);
     __sync_add_and_fetch(&fs->fs_reads, 1);
 }
 
+/* Return time elapsed since a write started in microseconds */
+static inline uint64_t
+lc_writeElapsed(struct timeval *start) {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return ((now.tv_sec - start->tv_sec) * 1000000) +
+           (now.tv_usec - start->tv_usec);
+}
+
 /* Write a file system block */
 void
 lc_writeBlock(struct gfs *gfs, struct fs *fs, void *buf, off_t block) {
+    struct timeval start;
+    uint64_t elapsed;
     size_t count;
 
     //lc_printf("lc_writeBlock: Writing block %ld\n", block);
     assert(block < gfs->gfs_super->sb_tblocks);
+    lc_qosCharge(gfs, fs, 1);
+    gettimeofday(&start, NULL);
+    if (unlikely(gfs->gfs_device)) {
+        lc_deviceStart(gfs, block, 1);
+    }
     count = pwrite(gfs->gfs_fd, buf, LC_BLOCK_SIZE, block * LC_BLOCK_SIZE);
     assert(count == LC_BLOCK_SIZE);
+    if (unlikely(gfs->gfs_device)) {
+        lc_deviceDone(gfs);
+    }
+    elapsed = lc_writeElapsed(&start);
+    __sync_add_and_fetch(&gfs->gfs_wtime, elapsed);
+    if (unlikely(lc_traceEnabled)) {
+        lc_traceIO(elapsed * 1000);
+    }
     __sync_add_and_fetch(&gfs->gfs_writes, 1);
+    __sync_add_and_fetch(&gfs->gfs_wblocks, 1);
     __sync_add_and_fetch(&fs->fs_writes, 1);
 }
 
@@ -44,6 +256,8 @@ lc_writeBlock(struct gfs *gfs, struct fs *fs, void *buf, off_t block) {
 void
 lc_writeBlocks(struct gfs *gfs, struct fs *fs,
                struct iovec *iov, int iovcnt, off_t block) {
+    struct timeval start;
+    uint64_t elapsed;
     ssize_t count;
 
     //lc_printf("lc_writeBlocks: Writing %d blocks %ld\n", iovcnt, block);
@@ -51,9 +265,23 @@ lc_writeBlocks(struct gfs *gfs, struct fs *fs,
     if (fs->fs_removed) {
         return;
     }
+    lc_qosCharge(gfs, fs, iovcnt);
+    gettimeofday(&start, NULL);
+    if (unlikely(gfs->gfs_device)) {
+        lc_deviceStart(gfs, block, iovcnt);
+    }
     count = lc_pwritev(gfs->gfs_fd, iov, iovcnt, block * LC_BLOCK_SIZE);
     assert(count == (iovcnt * LC_BLOCK_SIZE));
+    if (unlikely(gfs->gfs_device)) {
+        lc_deviceDone(gfs);
+    }
+    elapsed = lc_writeElapsed(&start);
+    __sync_add_and_fetch(&gfs->gfs_wtime, elapsed);
+    if (unlikely(lc_traceEnabled)) {
+        lc_traceIO(elapsed * 1000);
+    }
     __sync_add_and_fetch(&gfs->gfs_writes, 1);
+    __sync_add_and_fetch(&gfs->gfs_wblocks, iovcnt);
     __sync_add_and_fetch(&fs->fs_writes, 1);
 }
 
@@ -102,3 +330,14 @@ lc_updateCRC(void *buf, uint32_t *crc) {
     *crc = 0;
     *crc = lc_checksum(buf);
 }
+
+/* Check crc of a block read, without asserting on mismatch */
+bool
+lc_validCRC(void *buf, uint32_t *crc) {
+    uint32_t old = *crc, new;
+
+    *crc = 0;
+    new = lc_checksum(buf);
+    *crc = old;
+    return old == new;
+}
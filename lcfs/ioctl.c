@@ -28,6 +28,38 @@ usage(char *pgm, char *name) {
         fprintf(stderr, "\t mnt              - mount point\n");
         fprintf(stderr, "\t [enable|disable] - enable/disable profiling\n");
 #endif
+    } else if (strcmp(name, "defrag") == 0) {
+        fprintf(stderr, "usage: %s %s <mnt> <id> [rate]\n", pgm, name);
+        fprintf(stderr, "\t mnt    - mount point\n");
+        fprintf(stderr, "\t id     - layer name\n");
+        fprintf(stderr, "\t [rate] - rate limit in MB per second "
+                "(default unlimited)\n");
+    } else if (strcmp(name, "hot") == 0) {
+        fprintf(stderr, "usage: %s %s <mnt> [-c]\n", pgm, name);
+        fprintf(stderr, "\t mnt    - mount point\n");
+        fprintf(stderr, "\t [-c]   - clear accesses tracked (optional)\n");
+    } else if (strcmp(name, "qos") == 0) {
+        fprintf(stderr, "usage: %s %s <mnt> <id> <rate> <iops> [weight]\n",
+                pgm, name);
+        fprintf(stderr, "\t mnt      - mount point\n");
+        fprintf(stderr, "\t id       - layer name\n");
+        fprintf(stderr, "\t rate     - bandwidth limit in MB per second, "
+                "0 for unlimited\n");
+        fprintf(stderr, "\t iops     - I/O operations per second, "
+                "0 for unlimited\n");
+        fprintf(stderr, "\t [weight] - share of the device while busy "
+                "(default 100)\n");
+    } else if (strcmp(name, "trace") == 0) {
+        fprintf(stderr, "usage: %s %s <mnt> [enable|disable|dump]\n",
+                pgm, name);
+        fprintf(stderr, "\t mnt                   - mount point\n");
+        fprintf(stderr, "\t [enable|disable|dump] - enable/disable tracing "
+                "requests, or display requests traced\n");
+    } else if (strcmp(name, "locks") == 0) {
+        fprintf(stderr, "usage: %s %s <mnt> [enable|disable]\n", pgm, name);
+        fprintf(stderr, "\t mnt              - mount point\n");
+        fprintf(stderr, "\t [enable|disable] - enable/disable profiling "
+                "lock contention\n");
     } else if (strcmp(name, "verbose") == 0) {
         fprintf(stderr, "usage: %s %s <mnt> [enable|disable]\n", pgm, name);
         fprintf(stderr, "\t mnt              - mount point\n");
@@ -44,12 +76,16 @@ usage(char *pgm, char *name) {
  */
 int
 ioctl_main(char *pgm, int argc, char *argv[]) {
-    char name[LAYER_NAME_MAX + 1], *dir, op;
-    int fd, err, len, value;
+    char name[LAYER_NAME_MAX + 1], hot[LC_HOT_REPLY_SIZE], *dir, op;
+    int fd, tfd, err, len, value;
     enum ioctl_cmd cmd;
+    ssize_t count;
+    struct ldefrag defrag;
+    struct lqos qos;
     struct stat st;
 
-    if ((argc != 2) && (argc != 3) && (argc != 4)) {
+    if ((argc < 2) || (argc > 6) ||
+        ((argc > 4) && strcmp(argv[0], "qos"))) {
         usage(pgm, argv[0]);
     }
     if (stat(argv[1], &st)) {
@@ -97,13 +133,72 @@ ioctl_main(char *pgm, int argc, char *argv[]) {
             usage(pgm, argv[0]);
         }
         err = ioctl(fd, _IO(0, LCFS_GROW), 0);
+    } else if (strcmp(argv[0], "defrag") == 0) {
+        if (argc < 3) {
+            close(fd);
+            usage(pgm, argv[0]);
+        }
+        value = (argc == 4) ? atoi(argv[3]) : 0;
+        if (value < 0) {
+            close(fd);
+            usage(pgm, argv[0]);
+        }
+        memset(&defrag, 0, sizeof(defrag));
+        defrag.d_rate = value;
+        len = strlen(argv[2]);
+        assert(len < LAYER_NAME_MAX);
+        memcpy(defrag.d_name, argv[2], len);
+        err = ioctl(fd, _IOW(0, LAYER_DEFRAG, defrag), &defrag);
+    } else if (strcmp(argv[0], "hot") == 0) {
+        if ((argc > 3) || ((argc == 3) && strcmp(argv[2], "-c"))) {
+            close(fd);
+            usage(pgm, argv[0]);
+        }
+        memset(hot, 0, sizeof(hot));
+
+        /* Request for clearing accesses is passed as the type */
+        err = ioctl(fd, _IOR(argc == 3, LCFS_HOT, hot), hot);
+        if (err == 0) {
+            printf("%s", hot);
+        }
+    } else if (strcmp(argv[0], "qos") == 0) {
+        if ((argc < 5) || (atoi(argv[3]) < 0) || (atoi(argv[4]) < 0) ||
+            ((argc == 6) && (atoi(argv[5]) < 0))) {
+            close(fd);
+            usage(pgm, argv[0]);
+        }
+        memset(&qos, 0, sizeof(qos));
+        qos.q_bandwidth = atoi(argv[3]);
+        qos.q_iops = atoi(argv[4]);
+        qos.q_weight = (argc == 6) ? atoi(argv[5]) : 0;
+        len = strlen(argv[2]);
+        assert(len < LAYER_NAME_MAX);
+        memcpy(qos.q_name, argv[2], len);
+        err = ioctl(fd, _IOW(0, LAYER_QOS, qos), &qos);
     } else if (strcmp(argv[0], "commit") == 0) {
         if (argc != 2) {
             close(fd);
             usage(pgm, argv[0]);
         }
         err = ioctl(fd, _IO(0, LCFS_COMMIT), 0);
-    } else if ((strcmp(argv[0], "verbose") == 0)
+    } else if ((strcmp(argv[0], "trace") == 0) && (argc == 3) &&
+               (strcmp(argv[2], "dump") == 0)) {
+
+        /* Requests traced are read from a fake file in layer root */
+        tfd = openat(fd, LC_TRACE_FILE, O_RDONLY);
+        if (tfd < 0) {
+            perror("open");
+            close(fd);
+            exit(errno);
+        }
+        while ((count = read(tfd, hot, sizeof(hot))) > 0) {
+            fwrite(hot, 1, count, stdout);
+        }
+        err = (count < 0) ? -1 : 0;
+        close(tfd);
+    } else if ((strcmp(argv[0], "verbose") == 0) ||
+               (strcmp(argv[0], "trace") == 0) ||
+               (strcmp(argv[0], "locks") == 0)
 #ifndef __MUSL__
                || (strcmp(argv[0], "profile") == 0)
 #endif
@@ -124,7 +219,8 @@ ioctl_main(char *pgm, int argc, char *argv[]) {
 #ifndef __MUSL__
             (strcmp(argv[0], "profile") == 0) ? LCFS_PROFILE :
 #endif
-            LCFS_VERBOSE;
+            (strcmp(argv[0], "trace") == 0) ? LCFS_TRACE :
+            (strcmp(argv[0], "locks") == 0) ? LCFS_LOCKS : LCFS_VERBOSE;
         err = ioctl(fd, _IOW(0, cmd, op), &op);
     } else {
         if (argc != 3) {
@@ -61,7 +61,7 @@ lc_createLayer(fuse_req_t req, struct gfs *gfs, const char *name,
                const char *parent, size_t size, bool rw) {
     struct fs *fs = NULL, *pfs = NULL, *rfs = NULL;
     ino_t root, pinum = 0;
-    struct timeval start;
+    uint64_t start;
     char pname[size + 1];
     int err = 0, inval;
     struct inode *pdir;
@@ -250,7 +250,7 @@ lc_deleteLayer(fuse_req_t req, struct gfs *gfs, const char *name) {
     struct fs *fs = NULL, *rfs, *bfs = NULL, *zfs;
     struct extent *extents = NULL;
     struct inode *pdir = NULL;
-    struct timeval start;
+    uint64_t start;
     int err = 0;
     ino_t root;
 
@@ -352,6 +352,9 @@ lc_umountLayer(fuse_req_t req, struct gfs *gfs, ino_t root) {
         gindex = fs->fs_gindex;
         lc_unlock(fs);
 
+        /* Get any data cached in kernel before freezing the layer */
+        lc_syncKernelCache(gfs);
+
         /* Allocate blocks for all dirty pages.  This must have been started by
          * release inode calls, and taking the exclusive lock make sure all
          * those operations are finished.
@@ -404,7 +407,7 @@ lc_umountLayer(fuse_req_t req, struct gfs *gfs, ino_t root) {
 void
 lc_layerIoctl(fuse_req_t req, struct gfs *gfs, const char *name,
               enum ioctl_cmd cmd) {
-    struct timeval start;
+    uint64_t start;
     struct fs *fs, *rfs;
     ino_t root;
     int err;
@@ -515,9 +518,12 @@ lc_commitLayer(fuse_req_t req, struct fs *fs, ino_t ino, const char *layer,
     struct fuse_entry_param e;
     struct inode *dir;
     uint64_t blocks;
-    ino_t root;
+    ino_t root, proot, nroot;
 
     lc_printf("Committing %s\n", layer);
+
+    /* Get any data cached in kernel for the layer being committed */
+    lc_syncKernelCache(gfs);
     lc_copyFakeStat(&e.attr);
     e.ino = lc_setHandle(fs->fs_gindex, e.attr.st_ino);
     lc_epInit(&e);
@@ -648,9 +654,16 @@ lc_commitLayer(fuse_req_t req, struct fs *fs, ino_t ino, const char *layer,
         bfs = fs->fs_rfs;
         lc_lock(bfs, false);
     }
+    proot = lc_setHandle(pfs->fs_gindex, pfs->fs_root);
+    nroot = lc_setHandle(newgindex, fs->fs_root);
     lc_unlock(fs);
     lc_unlock(pfs);
     lc_unlock(cfs);
+
+    /* Root directories of the layers were rebuilt */
+    lc_invalInodeAttr(gfs, proot);
+    lc_invalInodeAttr(gfs, lc_setHandle(gindex, root));
+    lc_invalInodeAttr(gfs, nroot);
     if (tfs) {
         lc_lockExclusive(tfs);
         lc_invalidateDirtyPages(gfs, tfs);
@@ -58,6 +58,9 @@
 /* Magic number stored in extended attribute blocks */
 #define LC_XATTR_MAGIC 0xBDEF4389
 
+/* Magic number stored in intent log blocks */
+#define LC_LOG_MAGIC   0x10C5EA1D
+
 /* Superblock Flags */
 #define LC_SUPER_DIRTY     0x00000001  /* Layer is dirty */
 #define LC_SUPER_RDWR      0x00000002  /* Layer is readwrite */
@@ -179,8 +182,17 @@ struct super {
     /* pcache limit */
     uint32_t sb_pcache;
 
+    /* First block of the intent log */
+    uint64_t sb_logBlock;
+
+    /* Oldest generation of intent log records not checkpointed */
+    uint64_t sb_logGen;
+
+    /* Number of blocks in the intent log */
+    uint32_t sb_logCount;
+
     /* Padding for filling up a block */
-    uint8_t  sb_pad[LC_BLOCK_SIZE - 216];
+    uint8_t  sb_pad[LC_BLOCK_SIZE - 236];
 } __attribute__((packed));
 static_assert(sizeof(struct super) == LC_BLOCK_SIZE, "superblock size != LC_BLOCK_SIZE");
 
@@ -350,6 +362,58 @@ struct emapBlock {
 };
 static_assert(sizeof(struct emapBlock) == LC_BLOCK_SIZE, "emapBlock size != LC_BLOCK_SIZE");
 
+/* Size of the header of an intent log block */
+#define LC_LOG_HEADER  (302 + sizeof(struct dinode))
+
+/* Number of emap entries in an intent log block */
+#define LC_LOG_EMAP    ((LC_BLOCK_SIZE - LC_LOG_HEADER) / sizeof(struct emap))
+
+/* Intent log block.  A record logged for a file spans one or more blocks,
+ * each carrying the inode and a portion of its emap.  Files created after the
+ * last checkpoint are logged along with the name of the file.
+ */
+struct logBlock {
+    /* Magic number */
+    uint32_t lb_magic;
+
+    /* Checksum */
+    uint32_t lb_crc;
+
+    /* Generation of the log the record belongs to */
+    uint64_t lb_gen;
+
+    /* Sequence number of the record */
+    uint64_t lb_seq;
+
+    /* Root inode of the layer */
+    uint64_t lb_root;
+
+    /* Index of the layer */
+    uint32_t lb_index;
+
+    /* Index of this block in the record */
+    uint16_t lb_part;
+
+    /* Number of blocks in the record */
+    uint16_t lb_parts;
+
+    /* Number of emap entries in this block */
+    uint32_t lb_count;
+
+    /* Size of the name of a file created, 0 if the file is on disk */
+    uint16_t lb_nsize;
+
+    /* Name of the file in its parent directory if created */
+    char lb_name[256];
+
+    /* Inode logged */
+    struct dinode lb_dinode;
+
+    /* Emap entries */
+    struct emap lb_emap[LC_LOG_EMAP];
+} __attribute__((packed));
+static_assert(sizeof(struct logBlock) <= LC_BLOCK_SIZE, "logBlock size > LC_BLOCK_SIZE");
+
 /* Directory entry structure */
 struct ddirent {
 
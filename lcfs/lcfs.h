@@ -18,11 +18,54 @@ enum ioctl_cmd {
     LCFS_GROW = 113,                /* Grow file system */
     LCFS_PROFILE = 114,             /* Enable/disable profiling */
     LCFS_VERBOSE = 115,             /* Enable/disable verbose mode */
+    LAYER_DEFRAG = 116,             /* Defragment a layer */
+    LAYER_QOS = 117,                /* Set I/O limits of a layer */
+    LCFS_HOT = 118,                 /* Report hot files and layers */
+    LCFS_TRACE = 119,               /* Enable/disable tracing requests */
+    LCFS_LOCKS = 120,               /* Enable/disable lock profiling */
 };
 
+/* Size of the buffer for receiving report of hot files and layers */
+#define LC_HOT_REPLY_SIZE           8192
+
+/* Data structure used to set I/O limits of a layer */
+struct lqos {
+
+    /* Bandwidth limit in MB per second, 0 for unlimited */
+    uint32_t q_bandwidth;
+
+    /* Limit on I/O operations per second, 0 for unlimited */
+    uint32_t q_iops;
+
+    /* Weight of the layer while device is busy, 0 for default */
+    uint32_t q_weight;
+
+    /* Name of the layer */
+    char q_name[256];
+} __attribute__((packed));
+
+/* Data structure used to defragment a layer */
+struct ldefrag {
+
+    /* Rate limit in MB per second, 0 for unlimited */
+    uint32_t d_rate;
+
+    /* Name of the layer */
+    char d_name[256];
+} __attribute__((packed));
+
 /* Prefix of fake file name used to trigger layer commit */
 #define LC_COMMIT_TRIGGER_PREFIX    ".lcfs-diff-"
 
+/* Fake files in layer root directory for reading stats in Prometheus text
+ * format and in JSON.
+ */
+#define LC_STATS_FILE               ".stats"
+#define LC_STATS_JSON_FILE          ".stats.json"
+
+/* Fake file in layer root directory for reading requests traced */
+#define LC_TRACE_FILE               ".trace"
+
 /* Data structure used to respond to layer diff */
 struct pchange {
 
@@ -35,6 +35,12 @@ lc_preadv(int fd, struct iovec *iov, int iovcnt, off_t offset) {
   return preadv(fd, iov, iovcnt, offset);
 }
 
+/* Check if a file is opened for direct I/O */
+static inline bool
+lc_directIO(int flags) {
+    return (flags & O_DIRECT) != 0;
+}
+
 /* Validate a lock is held */
 static inline void
 lc_lockOwned(pthread_rwlock_t *lock, bool exclusive) {
@@ -0,0 +1,238 @@
+#include "includes.h"
+
+/* Contention stats of a class of locks */
+struct lclass {
+
+    /* Number of times locks were acquired */
+    uint64_t lc_acquired;
+
+    /* Number of times locks were found held by others */
+    uint64_t lc_contended;
+
+    /* Time spent waiting for locks in nanoseconds */
+    uint64_t lc_wait;
+
+    /* Time locks were held in nanoseconds */
+    uint64_t lc_hold;
+
+    /* Longest time a lock was held in nanoseconds */
+    uint64_t lc_maxHold;
+};
+
+/* Lock stats updated by a subset of threads */
+struct lslot {
+
+    /* Stats for each class of locks */
+    struct lclass ls_class[LC_LOCK_MAX];
+} __attribute__((aligned(64)));
+
+/* Locks of a class held by a thread */
+struct lheld {
+
+    /* Time the outermost lock was acquired */
+    uint64_t lh_start;
+
+    /* Number of locks of the class held */
+    uint32_t lh_depth;
+};
+
+/* Names of lock classes */
+static const char *lc_lockNames[] = {
+    "gfs_alock",
+    "fs_alock",
+    "fs_plock",
+    "fs_dilock",
+    "fs_hlock",
+    "lb_flock",
+    "lb_pcacheLocks",
+    "lb_pioLocks",
+    "fs_ilock",
+    "fs_rwlock",
+};
+
+/* Set while lock contention is profiled */
+bool lc_lockProfiling = false;
+
+/* Lock stats, threads picking slots round robin */
+static struct lslot lc_lockSlots[LC_STATS_SLOTS];
+
+/* Slot of lock stats used by the thread */
+static __thread int lc_lockSlot = -1;
+
+/* Next slot to be assigned to a thread */
+static int lc_lockNext;
+
+/* Locks held by the thread */
+static __thread struct lheld lc_lockHeld[LC_LOCK_MAX];
+
+/* Profiling is restarted with a new epoch, so that threads forget locks
+ * held from before.
+ */
+static uint32_t lc_lockEpoch;
+static __thread uint32_t lc_lockThreadEpoch;
+
+/* Return locks of a class held by the thread */
+static inline struct lheld *
+lc_lockGetHeld(enum lc_lockClass class) {
+    if (unlikely(lc_lockThreadEpoch != lc_lockEpoch)) {
+        memset(lc_lockHeld, 0, sizeof(lc_lockHeld));
+        lc_lockThreadEpoch = lc_lockEpoch;
+    }
+    return &lc_lockHeld[class];
+}
+
+/* Account a lock acquired */
+void
+lc_lockAcquired(enum lc_lockClass class, uint64_t wait, bool contended) {
+    struct lheld *held = lc_lockGetHeld(class);
+    struct lclass *lc;
+
+    assert(class < LC_LOCK_MAX);
+    if (lc_lockSlot < 0) {
+        lc_lockSlot = __sync_fetch_and_add(&lc_lockNext, 1) % LC_STATS_SLOTS;
+    }
+    lc = &lc_lockSlots[lc_lockSlot].ls_class[class];
+    __sync_add_and_fetch(&lc->lc_acquired, 1);
+    if (contended) {
+        __sync_add_and_fetch(&lc->lc_contended, 1);
+        __sync_add_and_fetch(&lc->lc_wait, wait);
+    }
+
+    /* Locks of the same class taken while holding one are held as long as
+     * the outermost one.
+     */
+    if (held->lh_depth++ == 0) {
+        held->lh_start = lc_traceNow();
+    }
+}
+
+/* Account a lock about to be released */
+void
+lc_lockReleased(enum lc_lockClass class) {
+    struct lheld *held = lc_lockGetHeld(class);
+    uint64_t hold, value;
+    struct lclass *lc;
+
+    /* Ignore locks acquired before profiling was enabled */
+    if ((held->lh_depth == 0) || (--held->lh_depth > 0) ||
+        (lc_lockSlot < 0)) {
+        return;
+    }
+    hold = lc_traceNow() - held->lh_start;
+    lc = &lc_lockSlots[lc_lockSlot].ls_class[class];
+    __sync_add_and_fetch(&lc->lc_hold, hold);
+    value = lc->lc_maxHold;
+    while ((value < hold) &&
+           !__sync_bool_compare_and_swap(&lc->lc_maxHold, value, hold)) {
+        value = lc->lc_maxHold;
+    }
+}
+
+/* Lock a mutex, measuring time spent waiting if the mutex is held */
+void
+lc_mutexLockProfiled(pthread_mutex_t *lock, enum lc_lockClass class) {
+    uint64_t start;
+
+    if (pthread_mutex_trylock(lock) == 0) {
+        lc_lockAcquired(class, 0, false);
+        return;
+    }
+    start = lc_traceNow();
+    pthread_mutex_lock(lock);
+    lc_lockAcquired(class, lc_traceNow() - start, true);
+}
+
+/* Lock a rwlock, measuring time spent waiting if the lock is held */
+void
+lc_rwlockLockProfiled(pthread_rwlock_t *lock, bool exclusive,
+                      enum lc_lockClass class) {
+    uint64_t start;
+    int err;
+
+    err = exclusive ? pthread_rwlock_trywrlock(lock) :
+                      pthread_rwlock_tryrdlock(lock);
+    if (err == 0) {
+        lc_lockAcquired(class, 0, false);
+        return;
+    }
+    start = lc_traceNow();
+    if (exclusive) {
+        pthread_rwlock_wrlock(lock);
+    } else {
+        pthread_rwlock_rdlock(lock);
+    }
+    lc_lockAcquired(class, lc_traceNow() - start, true);
+}
+
+/* Enable or disable profiling lock contention.  Stats are cleared as
+ * profiling is enabled.
+ */
+void
+lc_lockProfile(bool enable) {
+    if (enable && !lc_lockProfiling) {
+        memset(lc_lockSlots, 0, sizeof(lc_lockSlots));
+        __sync_add_and_fetch(&lc_lockEpoch, 1);
+    }
+    lc_lockProfiling = enable;
+    lc_syslog(LOG_INFO, "Lock profiling %sabled\n", enable ? "en" : "dis");
+}
+
+/* Merge stats of a class of locks from all slots */
+static void
+lc_lockMerge(enum lc_lockClass class, struct lclass *lc) {
+    struct lclass *slc;
+    int i;
+
+    memset(lc, 0, sizeof(struct lclass));
+    for (i = 0; i < LC_STATS_SLOTS; i++) {
+        slc = &lc_lockSlots[i].ls_class[class];
+        lc->lc_acquired += slc->lc_acquired;
+        lc->lc_contended += slc->lc_contended;
+        lc->lc_wait += slc->lc_wait;
+        lc->lc_hold += slc->lc_hold;
+        if (slc->lc_maxHold > lc->lc_maxHold) {
+            lc->lc_maxHold = slc->lc_maxHold;
+        }
+    }
+}
+
+/* Render lock contention stats */
+void
+lc_lockMetrics(struct metrics *m) {
+    enum lc_lockClass class;
+    struct lclass lc;
+    char labels[64];
+
+    for (class = 0; class < LC_LOCK_MAX; class++) {
+        lc_lockMerge(class, &lc);
+        if (lc.lc_acquired == 0) {
+            continue;
+        }
+        snprintf(labels, sizeof(labels), "lock=\"%s\"", lc_lockNames[class]);
+        lc_metric(m, "lock_acquired_total", labels, lc.lc_acquired);
+        lc_metric(m, "lock_contended_total", labels, lc.lc_contended);
+        lc_metric(m, "lock_wait_nsec_total", labels, lc.lc_wait);
+        lc_metric(m, "lock_hold_nsec_total", labels, lc.lc_hold);
+        lc_metric(m, "lock_hold_nsec_max", labels, lc.lc_maxHold);
+    }
+}
+
+/* Display lock contention stats */
+void
+lc_displayLockStats() {
+    enum lc_lockClass class;
+    struct lclass lc;
+
+    for (class = 0; class < LC_LOCK_MAX; class++) {
+        lc_lockMerge(class, &lc);
+        if (lc.lc_acquired == 0) {
+            continue;
+        }
+        lc_syslog(LOG_INFO, "%s: acquired %ld contended %ld (%ld%%) "
+                  "wait %ld usec hold avg %ld nsec max %ld usec\n",
+                  lc_lockNames[class], lc.lc_acquired, lc.lc_contended,
+                  (lc.lc_contended * 100) / lc.lc_acquired,
+                  lc.lc_wait / 1000, lc.lc_hold / lc.lc_acquired,
+                  lc.lc_maxHold / 1000);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef _LOCK_H
+#define _LOCK_H
+
+/* Classes of locks tracked while profiling lock contention */
+enum lc_lockClass {
+    LC_LOCK_GALLOC = 0,         /* gfs_alock */
+    LC_LOCK_ALLOC = 1,          /* fs_alock */
+    LC_LOCK_PAGE = 2,           /* fs_plock */
+    LC_LOCK_DIRTY = 3,          /* fs_dilock */
+    LC_LOCK_HLINK = 4,          /* fs_hlock */
+    LC_LOCK_FREE = 5,           /* lb_flock */
+    LC_LOCK_PCACHE = 6,         /* lb_pcacheLocks */
+    LC_LOCK_PIO = 7,            /* lb_pioLocks */
+    LC_LOCK_ICACHE = 8,         /* fs_ilock or ic_lock */
+    LC_LOCK_LAYER = 9,          /* fs_rwlock */
+    LC_LOCK_MAX = 10,
+};
+
+/* Set while lock contention is profiled */
+extern bool lc_lockProfiling;
+
+void lc_lockAcquired(enum lc_lockClass class, uint64_t wait, bool contended);
+void lc_lockReleased(enum lc_lockClass class);
+void lc_mutexLockProfiled(pthread_mutex_t *lock, enum lc_lockClass class);
+void lc_rwlockLockProfiled(pthread_rwlock_t *lock, bool exclusive,
+                           enum lc_lockClass class);
+
+/* Lock a mutex, tracking contention if profiling */
+static inline void
+lc_mutexLock(pthread_mutex_t *lock, enum lc_lockClass class) {
+    if (unlikely(lc_lockProfiling)) {
+        lc_mutexLockProfiled(lock, class);
+    } else {
+        pthread_mutex_lock(lock);
+    }
+}
+
+/* Unlock a mutex locked with lc_mutexLock */
+static inline void
+lc_mutexUnlock(pthread_mutex_t *lock, enum lc_lockClass class) {
+    if (unlikely(lc_lockProfiling)) {
+        lc_lockReleased(class);
+    }
+    pthread_mutex_unlock(lock);
+}
+
+/* Lock a rwlock shared or exclusive, tracking contention if profiling */
+static inline void
+lc_rwlockLock(pthread_rwlock_t *lock, bool exclusive,
+              enum lc_lockClass class) {
+    if (unlikely(lc_lockProfiling)) {
+        lc_rwlockLockProfiled(lock, exclusive, class);
+    } else if (exclusive) {
+        pthread_rwlock_wrlock(lock);
+    } else {
+        pthread_rwlock_rdlock(lock);
+    }
+}
+
+/* Unlock a rwlock locked with lc_rwlockLock */
+static inline void
+lc_rwlockUnlock(pthread_rwlock_t *lock, enum lc_lockClass class) {
+    if (unlikely(lc_lockProfiling)) {
+        lc_lockReleased(class);
+    }
+    pthread_rwlock_unlock(lock);
+}
+
+#endif
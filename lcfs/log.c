@@ -0,0 +1,769 @@
+#include "includes.h"
+
+/* Size of the intent log in blocks, as a fraction of the device */
+#define LC_LOG_FRACTION     256
+
+/* Smallest and largest intent log in blocks */
+#define LC_LOG_BLOCKS_MIN   256
+#define LC_LOG_BLOCKS_MAX   8192
+
+/* Maximum number of blocks in a record */
+#define LC_LOG_RECORD_MAX   64
+
+/* Bits current time is shifted by to get the first generation of a new log.
+ * Records left in blocks used by an older log are not mistaken for records of
+ * the new log that way.
+ */
+#define LC_LOG_GEN_SHIFT    20
+
+/* Time in microseconds between nudging the syncer while waiting for a
+ * checkpoint.
+ */
+#define LC_LOG_CKPT_WAIT    10000
+
+/* A record waiting to be written to the log */
+struct lrecord {
+
+    /* Blocks of the record */
+    void *lr_blocks[LC_LOG_RECORD_MAX];
+
+    /* Next record in the list */
+    struct lrecord *lr_next;
+
+    /* Block the record is written at */
+    uint64_t lr_block;
+
+    /* Sequence number of the record */
+    uint64_t lr_seq;
+
+    /* Number of blocks in the record */
+    uint32_t lr_count;
+};
+
+/* Intent log.  The log is split into two halves and records are appended to
+ * the half of the current generation.  A checkpoint moves on to the next
+ * generation and records of the previous generation are not needed once the
+ * checkpoint is written.
+ */
+struct ilog {
+
+    /* Lock protecting the log */
+    pthread_mutex_t l_lock;
+
+    /* Condition signalled when records are written */
+    pthread_cond_t l_cond;
+
+    /* Records waiting to be written */
+    struct lrecord *l_pending;
+
+    /* Last record waiting to be written */
+    struct lrecord *l_pendingLast;
+
+    /* First block of the log */
+    uint64_t l_block;
+
+    /* Number of blocks in each half of the log */
+    uint64_t l_size;
+
+    /* Next block available in the half of the current generation */
+    uint64_t l_offset;
+
+    /* Current generation */
+    uint64_t l_gen;
+
+    /* Generation recorded by the next checkpoint */
+    uint64_t l_ckptGen;
+
+    /* Generation recorded by the last checkpoint written */
+    uint64_t l_cgen;
+
+    /* Sequence number of the last record queued */
+    uint64_t l_seq;
+
+    /* Sequence number of the last record written */
+    uint64_t l_done;
+
+    /* Number of records written */
+    uint64_t l_records;
+
+    /* Number of blocks written */
+    uint64_t l_blocks;
+
+    /* Number of times records were written and flushed together */
+    uint64_t l_batches;
+
+    /* Number of files not logged as the log was full */
+    uint64_t l_overflows;
+
+    /* Number of files made persistent by waiting for a checkpoint */
+    uint64_t l_checkpoints;
+
+    /* Number of checkpoints started */
+    uint64_t l_started;
+
+    /* Last checkpoint started which synced all layers */
+    uint64_t l_synced;
+
+    /* Last checkpoint started which synced all layers, as recorded in the
+     * checkpoint being written.
+     */
+    uint64_t l_ckptSynced;
+
+    /* Last checkpoint started which synced all layers and is written */
+    uint64_t l_committed;
+
+    /* Set while a thread is writing records */
+    bool l_writing;
+
+    /* Set once the log is recorded in a checkpoint */
+    bool l_ready;
+};
+
+/* Free a record */
+static void
+lc_logFreeRecord(struct gfs *gfs, struct lrecord *record) {
+    struct fs *rfs = lc_getGlobalFs(gfs);
+    uint32_t i;
+
+    for (i = 0; i < record->lr_count; i++) {
+        lc_free(rfs, record->lr_blocks[i], LC_BLOCK_SIZE, LC_MEMTYPE_DATA);
+    }
+    lc_free(NULL, record, sizeof(struct lrecord), LC_MEMTYPE_GFS);
+}
+
+/* Create a record with the inode and its emap, along with the name of the file
+ * if created after the last checkpoint.  Called with the inode locked.
+ */
+static struct lrecord *
+lc_logRecord(struct gfs *gfs, struct fs *fs, struct inode *inode,
+             const char *name, int nsize) {
+    struct extent *extent = lc_inodeGetEmap(inode);
+    struct logBlock *lblock = NULL;
+    uint64_t count = 0, parts;
+    struct lrecord *record;
+    struct emap *emap;
+    uint32_t i;
+
+    /* Find the number of blocks needed for the emap */
+    if (inode->i_extentLength) {
+        count++;
+    }
+    while (extent) {
+        count++;
+        extent = extent->ex_next;
+    }
+    parts = count ? (count + LC_LOG_EMAP - 1) / LC_LOG_EMAP : 1;
+    if (parts > LC_LOG_RECORD_MAX) {
+        return NULL;
+    }
+    record = lc_malloc(NULL, sizeof(struct lrecord), LC_MEMTYPE_GFS);
+    memset(record, 0, sizeof(struct lrecord));
+    record->lr_count = parts;
+    lc_mallocBlocksAligned(lc_getGlobalFs(gfs), record->lr_blocks, parts);
+    for (i = 0; i < parts; i++) {
+        lblock = record->lr_blocks[i];
+        memset(lblock, 0, LC_BLOCK_SIZE);
+        lblock->lb_magic = LC_LOG_MAGIC;
+        lblock->lb_root = fs->fs_root;
+        lblock->lb_index = fs->fs_gindex;
+        lblock->lb_part = i;
+        lblock->lb_parts = parts;
+        memcpy(&lblock->lb_dinode, &inode->i_dinode, sizeof(struct dinode));
+    }
+
+    /* Fill up emap entries */
+    lblock = record->lr_blocks[0];
+    lblock->lb_nsize = nsize;
+    memcpy(lblock->lb_name, name, nsize);
+    if (inode->i_extentLength) {
+        emap = &lblock->lb_emap[lblock->lb_count++];
+        emap->e_off = 0;
+        emap->e_block = inode->i_extentBlock;
+        emap->e_count = inode->i_extentLength;
+    }
+    i = 0;
+    extent = lc_inodeGetEmap(inode);
+    while (extent) {
+        if (lblock->lb_count >= LC_LOG_EMAP) {
+            lblock = record->lr_blocks[++i];
+        }
+        emap = &lblock->lb_emap[lblock->lb_count++];
+        emap->e_off = lc_getExtentStart(extent);
+        emap->e_block = lc_getExtentBlock(extent);
+        emap->e_count = lc_getExtentCount(extent);
+        extent = extent->ex_next;
+    }
+    return record;
+}
+
+/* Write records queued so far and flush those to disk.  Called with the log
+ * locked.
+ */
+static void
+lc_logFlush(struct gfs *gfs, struct ilog *log) {
+    struct iovec iov[LC_LOG_RECORD_MAX];
+    struct fs *rfs = lc_getGlobalFs(gfs);
+    uint64_t seq = 0, records, blocks;
+    struct lrecord *record, *next;
+    uint32_t i;
+    int err;
+
+    log->l_writing = true;
+    while (log->l_pending) {
+        record = log->l_pending;
+        log->l_pending = NULL;
+        log->l_pendingLast = NULL;
+        pthread_mutex_unlock(&log->l_lock);
+
+        /* Write all records and flush the device once */
+        records = 0;
+        blocks = 0;
+        for (next = record; next; next = next->lr_next) {
+            if (next->lr_count == 1) {
+                lc_writeBlock(gfs, rfs, next->lr_blocks[0], next->lr_block);
+            } else {
+                for (i = 0; i < next->lr_count; i++) {
+                    iov[i].iov_base = next->lr_blocks[i];
+                    iov[i].iov_len = LC_BLOCK_SIZE;
+                }
+                lc_writeBlocks(gfs, rfs, iov, next->lr_count, next->lr_block);
+            }
+            seq = next->lr_seq;
+            records++;
+            blocks += next->lr_count;
+        }
+        lc_statsWrite(rfs, LC_WRITE_LOG, blocks);
+        err = fsync(gfs->gfs_fd);
+        assert(err == 0);
+        while (record) {
+            next = record->lr_next;
+            lc_logFreeRecord(gfs, record);
+            record = next;
+        }
+
+        /* Wake up threads waiting for the records just written */
+        pthread_mutex_lock(&log->l_lock);
+        assert(seq > log->l_done);
+        log->l_done = seq;
+        log->l_records += records;
+        log->l_blocks += blocks;
+        log->l_batches++;
+        pthread_cond_broadcast(&log->l_cond);
+    }
+    log->l_writing = false;
+}
+
+/* Queue a record and wait for it to be written.  Records queued while another
+ * thread is writing are written together by a single thread, with a single
+ * flush of the device.
+ */
+static bool
+lc_logWrite(struct gfs *gfs, struct fs *fs, struct lrecord *record) {
+    struct ilog *log = gfs->gfs_log;
+    struct logBlock *lblock;
+    uint64_t seq;
+    uint32_t i;
+
+    pthread_mutex_lock(&log->l_lock);
+    if ((log->l_offset + record->lr_count) > log->l_size) {
+        log->l_overflows++;
+        pthread_mutex_unlock(&log->l_lock);
+        lc_logFreeRecord(gfs, record);
+        return false;
+    }
+
+    /* Place the record in the half of the current generation */
+    record->lr_block = log->l_block + ((log->l_gen & 1) * log->l_size) +
+                       log->l_offset;
+    log->l_offset += record->lr_count;
+    seq = ++log->l_seq;
+    record->lr_seq = seq;
+    for (i = 0; i < record->lr_count; i++) {
+        lblock = record->lr_blocks[i];
+        lblock->lb_gen = log->l_gen;
+        lblock->lb_seq = seq;
+        lc_updateCRC(lblock, &lblock->lb_crc);
+    }
+    fs->fs_logGen = log->l_gen;
+    if (log->l_pendingLast) {
+        log->l_pendingLast->lr_next = record;
+    } else {
+        log->l_pending = record;
+    }
+    log->l_pendingLast = record;
+
+    /* Write queued records if no one else is doing that */
+    while (log->l_done < seq) {
+        if (log->l_writing) {
+            pthread_cond_wait(&log->l_cond, &log->l_lock);
+        } else {
+            lc_logFlush(gfs, log);
+        }
+    }
+    pthread_mutex_unlock(&log->l_lock);
+    return true;
+}
+
+/* Make changes to a file persistent by logging the file after writing its
+ * dirty pages, instead of waiting for the next checkpoint.  Called with the
+ * layer locked shared.  Returns false if the file could not be logged and a
+ * checkpoint is needed for making it persistent.
+ */
+bool
+lc_logInode(struct fs *fs, ino_t ino, struct inode *handle) {
+    char name[LC_FILENAME_MAX + 1];
+    struct gfs *gfs = fs->fs_gfs;
+    struct ilog *log = gfs->gfs_log;
+    struct lrecord *record = NULL;
+    struct inode *inode;
+    ino_t parent = 0;
+    int nsize = 0;
+
+    /* Frozen layers do not change and changes to directories and such are
+     * made persistent by the next checkpoint.
+     */
+    if (fs->fs_frozen) {
+        return true;
+    }
+    inode = lc_getInode(fs, ino, handle, false, true);
+    if (inode == NULL) {
+        return true;
+    }
+
+    /* Nothing to log if the file is not modified in this layer */
+    if ((inode->i_fs != fs) || !S_ISREG(inode->i_mode) ||
+        (inode->i_flags & (LC_INODE_TMP | LC_INODE_REMOVED))) {
+        lc_inodeUnlock(inode);
+        return true;
+    }
+
+    /* Files not written by a checkpoint yet are logged along with the name,
+     * so that those could be created again after a restart.  Directories are
+     * locked before files, so the name is looked up with the file unlocked.
+     * Files with hard links, or in a directory not on disk either, are left
+     * for the checkpoint.
+     */
+    if (log->l_ready && !(inode->i_flags & LC_INODE_DISK) &&
+        (inode->i_nlink == 1)) {
+        parent = inode->i_parent;
+        lc_inodeUnlock(inode);
+        nsize = lc_dirGetName(fs, parent, ino, name);
+        inode = lc_getInode(fs, ino, handle, false, true);
+        if ((inode == NULL) || (inode->i_flags & LC_INODE_REMOVED)) {
+            if (inode) {
+                lc_inodeUnlock(inode);
+            }
+            return true;
+        }
+        if ((inode->i_parent != parent) || (inode->i_nlink != 1)) {
+            nsize = 0;
+        }
+    }
+
+    /* Assign blocks to dirty pages of the file and capture its emap */
+    if (log->l_ready && ((inode->i_flags & LC_INODE_DISK) || nsize)) {
+        lc_flushPages(gfs, fs, inode, false, false);
+        record = lc_logRecord(gfs, fs, inode, name,
+                              (inode->i_flags & LC_INODE_DISK) ? 0 : nsize);
+        if (record == NULL) {
+            __sync_add_and_fetch(&log->l_overflows, 1);
+        }
+    }
+    lc_inodeUnlock(inode);
+
+    /* Write dirty pages of the layer before logging the emap referring to
+     * those.
+     */
+    if (record) {
+        lc_syncDirtyPages(gfs, fs);
+        if (lc_logWrite(gfs, fs, record)) {
+            lc_layerChanged(gfs, false, false);
+            return true;
+        }
+    }
+
+    /* Make sure the next checkpoint syncs this layer even if mounted */
+    pthread_mutex_lock(&log->l_lock);
+    fs->fs_logGen = log->l_gen;
+    log->l_checkpoints++;
+    pthread_mutex_unlock(&log->l_lock);
+    return false;
+}
+
+/* Wait for a checkpoint started after this call to be written, for making
+ * changes which could not be logged persistent.  Called without holding any
+ * layer locked, so that the checkpoint could proceed.
+ */
+void
+lc_logWaitCheckpoint(struct gfs *gfs) {
+    struct ilog *log = gfs->gfs_log;
+    struct timespec ts;
+    struct timeval now;
+    uint64_t started;
+
+    pthread_mutex_lock(&log->l_lock);
+    started = log->l_started + 1;
+    while ((log->l_committed < started) && !gfs->gfs_unmounting) {
+
+        /* Checkpoints give up when layers are busy, so keep nudging the
+         * syncer until one gets through.
+         */
+        lc_layerChanged(gfs, false, true);
+        gettimeofday(&now, NULL);
+        now.tv_usec += LC_LOG_CKPT_WAIT;
+        ts.tv_sec = now.tv_sec + (now.tv_usec / 1000000);
+        ts.tv_nsec = (now.tv_usec % 1000000) * 1000;
+        pthread_cond_timedwait(&log->l_cond, &log->l_lock, &ts);
+    }
+    pthread_mutex_unlock(&log->l_lock);
+}
+
+/* Create a file logged after being created since the last checkpoint.
+ * Returns the inode locked exclusive, or NULL if the directory is gone or has
+ * another file with the name now.
+ */
+static struct inode *
+lc_logCreate(struct fs *fs, struct logBlock *lblock) {
+    struct dinode *dinode = &lblock->lb_dinode;
+    struct inode *dir, *inode = NULL;
+
+    if (!S_ISREG(dinode->di_mode)) {
+        return NULL;
+    }
+    dir = lc_lookupInodeCache(fs, dinode->di_parent, -1);
+    if (dir == NULL) {
+        return NULL;
+    }
+    lc_inodeLock(dir, true);
+    if (S_ISDIR(dir->i_mode) && !(dir->i_flags & LC_INODE_SHARED) &&
+        (lc_dirLookup(fs, dir, lblock->lb_name) == LC_INVALID_INODE)) {
+        inode = lc_inodeRecreate(fs, dinode);
+        lc_dirAdd(dir, inode->i_ino, inode->i_mode, lblock->lb_name,
+                  lblock->lb_nsize);
+        lc_updateInodeTimes(dir, true, true);
+        lc_markInodeDirty(dir, LC_INODE_DIRDIRTY);
+    }
+    lc_inodeUnlock(dir);
+    return inode;
+}
+
+/* Apply a record read from the log to the file logged */
+static bool
+lc_logApply(struct gfs *gfs, struct logBlock **lblocks, uint32_t parts) {
+    struct logBlock *lblock = lblocks[0];
+    struct dinode *dinode = &lblock->lb_dinode;
+    struct extent *emap = NULL, **tail = &emap;
+    struct inode *inode;
+    struct fs *fs = NULL;
+    struct emap *entry;
+    uint32_t i, j;
+
+    /* Skip records of layers removed or frozen since */
+    if (lblock->lb_index <= gfs->gfs_scount) {
+        fs = gfs->gfs_fs[lblock->lb_index];
+    }
+    if ((fs == NULL) || (fs->fs_root != lblock->lb_root) || fs->fs_frozen) {
+        return false;
+    }
+    /* Files logged belong to the layer, so look for those in the layer only.
+     * Create the file again if it was created after the checkpoint.
+     */
+    inode = lc_lookupInodeCache(fs, dinode->di_ino, -1);
+    if (inode == NULL) {
+        if (lblock->lb_nsize == 0) {
+            return false;
+        }
+        inode = lc_logCreate(fs, lblock);
+        if (inode == NULL) {
+            return false;
+        }
+    } else {
+        lc_inodeLock(inode, true);
+
+        /* Skip the record if the file changed after it was logged, and those
+         * changes were made persistent by a checkpoint.
+         */
+        if (!S_ISREG(inode->i_mode) ||
+            (inode->i_flags & LC_INODE_REMOVED) ||
+            (inode->i_dinode.di_ctime.tv_sec > dinode->di_ctime.tv_sec) ||
+            ((inode->i_dinode.di_ctime.tv_sec == dinode->di_ctime.tv_sec) &&
+             (inode->i_dinode.di_ctime.tv_nsec > dinode->di_ctime.tv_nsec))) {
+            lc_inodeUnlock(inode);
+            return false;
+        }
+    }
+
+    /* Claim blocks allocated after the checkpoint and replace the emap */
+    for (i = 0; i < parts; i++) {
+        for (j = 0; j < lblocks[i]->lb_count; j++) {
+            entry = &lblocks[i]->lb_emap[j];
+            lc_blockClaim(gfs, fs, entry->e_block, entry->e_count);
+            lc_addExtent(gfs, fs, tail, entry->e_off, entry->e_block,
+                         entry->e_count, true);
+            tail = &((*tail)->ex_next);
+        }
+    }
+    lc_emapReplace(gfs, fs, inode, emap);
+    inode->i_size = dinode->di_size;
+    inode->i_mode = dinode->di_mode;
+    inode->i_dinode.di_uid = dinode->di_uid;
+    inode->i_dinode.di_gid = dinode->di_gid;
+    inode->i_dinode.di_mtime = dinode->di_mtime;
+    inode->i_dinode.di_ctime = dinode->di_ctime;
+    lc_markInodeDirty(inode, 0);
+    lc_inodeUnlock(inode);
+    return true;
+}
+
+/* Check if a block read from the log belongs to the record expected */
+static bool
+lc_logValid(struct logBlock *lblock, uint64_t gen, uint64_t seq,
+            uint32_t part) {
+    if ((lblock->lb_magic != LC_LOG_MAGIC) || (lblock->lb_gen != gen) ||
+        (lblock->lb_part != part) || (lblock->lb_parts == 0) ||
+        (lblock->lb_parts > LC_LOG_RECORD_MAX) ||
+        (lblock->lb_count > LC_LOG_EMAP) ||
+        (lblock->lb_nsize > LC_FILENAME_MAX) ||
+        (part ? (lblock->lb_seq != seq) : (lblock->lb_seq <= seq))) {
+        return false;
+    }
+    return lc_validCRC(lblock, &lblock->lb_crc);
+}
+
+/* Replay records of a generation from its half of the log.  Returns the
+ * number of records found.
+ */
+static uint64_t
+lc_logReplayGen(struct gfs *gfs, void **buf, uint64_t gen, uint64_t *applied) {
+    struct super *super = gfs->gfs_super;
+    struct fs *rfs = lc_getGlobalFs(gfs);
+    uint64_t size = super->sb_logCount / 2, block, offset = 0, seq = 0;
+    uint64_t count = 0;
+    struct logBlock **lblocks = (struct logBlock **)buf;
+    uint32_t i, parts;
+
+    block = super->sb_logBlock + ((gen & 1) * size);
+    while (offset < size) {
+
+        /* Stop at the first block not part of a complete record */
+        lc_readBlock(gfs, rfs, block + offset, lblocks[0]);
+        if (!lc_logValid(lblocks[0], gen, seq, 0)) {
+            break;
+        }
+        parts = lblocks[0]->lb_parts;
+        if ((offset + parts) > size) {
+            break;
+        }
+        seq = lblocks[0]->lb_seq;
+        for (i = 1; i < parts; i++) {
+            lc_readBlock(gfs, rfs, block + offset + i, lblocks[i]);
+            if (!lc_logValid(lblocks[i], gen, seq, i)) {
+                break;
+            }
+        }
+        if (i < parts) {
+            break;
+        }
+        if (lc_logApply(gfs, lblocks, parts)) {
+            (*applied)++;
+        }
+        offset += parts;
+        count++;
+    }
+    return count;
+}
+
+/* Replay the intent log after a restart.  Records of the generation recorded
+ * in the last checkpoint and of the one following it are replayed in order.
+ * Returns the generation the log could continue from.
+ */
+uint64_t
+lc_logReplay(struct gfs *gfs) {
+    struct super *super = gfs->gfs_super;
+    struct fs *rfs = lc_getGlobalFs(gfs);
+    uint64_t gen = super->sb_logGen, count, records, applied = 0;
+    void *buf[LC_LOG_RECORD_MAX];
+    int i;
+
+    if (super->sb_logBlock == 0) {
+        return 0;
+    }
+    lc_mallocBlocksAligned(rfs, buf, LC_LOG_RECORD_MAX);
+    count = lc_logReplayGen(gfs, buf, gen, &applied);
+    records = lc_logReplayGen(gfs, buf, gen + 1, &applied);
+    if (records) {
+        count += records;
+        gen++;
+    }
+    for (i = 0; i < LC_LOG_RECORD_MAX; i++) {
+        lc_free(rfs, buf[i], LC_BLOCK_SIZE, LC_MEMTYPE_DATA);
+    }
+    if (count) {
+        lc_syslog(LOG_INFO, "Replayed %ld of %ld records from intent log\n",
+                  applied, count);
+    }
+    return gen + 1;
+}
+
+/* Set up the intent log after mounting.  A new log is created if the log is
+ * enabled and there is none already, and the log is released if not enabled
+ * anymore.  Returns true if a checkpoint is needed for recording the log.
+ */
+bool
+lc_logInit(struct gfs *gfs, bool enable, uint64_t gen) {
+    struct fs *rfs = lc_getGlobalFs(gfs);
+    struct super *super = gfs->gfs_super;
+    struct ilog *log;
+    uint64_t count;
+
+    if (!enable) {
+        if (super->sb_logBlock == 0) {
+            return false;
+        }
+        lc_addFreedBlocks(rfs, super->sb_logBlock, super->sb_logCount);
+        super->sb_logBlock = 0;
+        super->sb_logCount = 0;
+        super->sb_logGen = 0;
+    } else {
+        if (super->sb_logBlock == 0) {
+            count = super->sb_tblocks / LC_LOG_FRACTION;
+            if (count < LC_LOG_BLOCKS_MIN) {
+                count = LC_LOG_BLOCKS_MIN;
+            } else if (count > LC_LOG_BLOCKS_MAX) {
+                count = LC_LOG_BLOCKS_MAX;
+            }
+            super->sb_logBlock = lc_blockAllocExact(rfs, count, true, false);
+            super->sb_logCount = count;
+            super->sb_logGen = time(NULL) << LC_LOG_GEN_SHIFT;
+            gen = super->sb_logGen;
+        }
+        log = lc_malloc(NULL, sizeof(struct ilog), LC_MEMTYPE_GFS);
+        memset(log, 0, sizeof(struct ilog));
+        pthread_mutex_init(&log->l_lock, NULL);
+        pthread_cond_init(&log->l_cond, NULL);
+        log->l_block = super->sb_logBlock;
+        log->l_size = super->sb_logCount / 2;
+        log->l_gen = gen;
+        log->l_ckptGen = super->sb_logGen;
+        gfs->gfs_log = log;
+        lc_syslog(LOG_INFO, "Intent log with %d blocks at block %ld\n",
+                  super->sb_logCount, super->sb_logBlock);
+    }
+
+    /* Log is used only after a checkpoint records it, and records replayed
+     * are discarded only after the checkpoint syncs the layers modified.
+     */
+    lc_markSuperDirty(rfs);
+    lc_layerChanged(gfs, true, false);
+    return true;
+}
+
+/* Move on to the next generation of the log as a checkpoint starts.  Records
+ * logged so far are made persistent by the checkpoint.  The half of the log
+ * used by the previous generation is reused only after the previous
+ * checkpoint is written.  Returns the generation records are logged to.
+ */
+uint64_t
+lc_logSwitch(struct gfs *gfs) {
+    struct ilog *log = gfs->gfs_log;
+    uint64_t gen;
+
+    if (log == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&log->l_lock);
+    log->l_started++;
+    if (log->l_ready && log->l_offset && (log->l_gen == log->l_cgen)) {
+        log->l_gen++;
+        log->l_offset = 0;
+        lc_markSuperDirty(lc_getGlobalFs(gfs));
+    }
+    gen = log->l_gen;
+    pthread_mutex_unlock(&log->l_lock);
+    return gen;
+}
+
+/* Note that all layers with records logged before switching to the
+ * specified generation are synced, so that the next checkpoint could skip
+ * records of older generations.
+ */
+void
+lc_logSynced(struct gfs *gfs, uint64_t gen) {
+    struct ilog *log = gfs->gfs_log;
+
+    if (log == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&log->l_lock);
+    if (gen > log->l_ckptGen) {
+        log->l_ckptGen = gen;
+    }
+    log->l_synced = log->l_started;
+    pthread_mutex_unlock(&log->l_lock);
+}
+
+/* Record the generation of the log in the superblock being written by a
+ * checkpoint.  Returns the generation recorded.
+ */
+uint64_t
+lc_logCheckpoint(struct gfs *gfs) {
+    struct ilog *log = gfs->gfs_log;
+    uint64_t gen;
+
+    if (log == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&log->l_lock);
+    gen = log->l_ckptGen;
+    gfs->gfs_super->sb_logGen = gen;
+    log->l_ckptSynced = log->l_synced;
+    pthread_mutex_unlock(&log->l_lock);
+    return gen;
+}
+
+/* Note that a checkpoint recording the specified generation is written */
+void
+lc_logCommitted(struct gfs *gfs, uint64_t gen) {
+    struct ilog *log = gfs->gfs_log;
+
+    if (log == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&log->l_lock);
+    log->l_cgen = gen;
+    log->l_ready = true;
+    log->l_committed = log->l_ckptSynced;
+    pthread_cond_broadcast(&log->l_cond);
+    pthread_mutex_unlock(&log->l_lock);
+}
+
+/* Discard all records on unmount as everything is made persistent */
+void
+lc_logUnmount(struct gfs *gfs) {
+    struct ilog *log = gfs->gfs_log;
+
+    if (log == NULL) {
+        return;
+    }
+    gfs->gfs_super->sb_logGen = log->l_gen + 1;
+    lc_markSuperDirty(lc_getGlobalFs(gfs));
+}
+
+/* Display stats and free the intent log */
+void
+lc_logFree(struct gfs *gfs) {
+    struct ilog *log = gfs->gfs_log;
+
+    if (log == NULL) {
+        return;
+    }
+    gfs->gfs_log = NULL;
+    assert(log->l_pending == NULL);
+    lc_syslog(LOG_INFO, "Intent log: %ld records %ld blocks written in %ld "
+              "batches, %ld files not logged, %ld files waited for "
+              "checkpoints\n", log->l_records, log->l_blocks,
+              log->l_batches, log->l_overflows, log->l_checkpoints);
+    pthread_mutex_destroy(&log->l_lock);
+    pthread_cond_destroy(&log->l_cond);
+    lc_free(NULL, log, sizeof(struct ilog), LC_MEMTYPE_GFS);
+}
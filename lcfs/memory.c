@@ -28,7 +28,21 @@ static struct lc_memory {
 
     /* Count of global free */
     uint64_t m_globalFree;
-} lc_mem;
+
+    /* Free data buffers kept for reuse, linked through the first word */
+    void *m_pool;
+
+    /* Number of buffers in the pool */
+    uint64_t m_poolCount;
+
+    /* Number of allocations satisfied from the pool */
+    uint64_t m_poolHits;
+
+    /* Lock protecting the pool */
+    pthread_mutex_t m_poolLock;
+} lc_mem = {
+    .m_poolLock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 /* Type of malloc requests */
 static const char *mrequests[] = {
@@ -58,6 +72,9 @@ static const char *mrequests[] = {
     "SYMLINK",
     "RWLOCK",
     "STATS",
+    "SPACE",
+    "CURSOR",
+    "DEFRAG",
 };
 
 /* Initialize limit based on available memory */
@@ -89,6 +106,12 @@ lc_checkMemoryAvailable(bool flush) {
                                    lc_mem.m_purgeMemory : lc_mem.m_dataMemory);
 }
 
+/* Number of dirty pages allowed before writers are throttled */
+uint64_t
+lc_dirtyLimit() {
+    return ((lc_mem.m_purgeMemory / LC_BLOCK_SIZE) * LC_DIRTY_RATIO) / 100;
+}
+
 /* Wake up flusher and cleaner threads if too many data pages created */
 void
 lc_waitMemory(struct gfs *gfs, bool wait) {
@@ -190,23 +213,97 @@ lc_malloc(struct fs *fs, size_t size, enum lc_memTypes type) {
     return malloc(size);
 }
 
+/* Take up to the specified number of data buffers from the pool */
+static uint64_t
+lc_poolGet(void **memptr, uint64_t count) {
+    uint64_t i = 0;
+
+    if (lc_mem.m_poolCount == 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&lc_mem.m_poolLock);
+    while ((i < count) && lc_mem.m_pool) {
+        memptr[i] = lc_mem.m_pool;
+        lc_mem.m_pool = *(void **)memptr[i];
+        i++;
+    }
+    lc_mem.m_poolCount -= i;
+    lc_mem.m_poolHits += i;
+    pthread_mutex_unlock(&lc_mem.m_poolLock);
+    return i;
+}
+
+/* Return a data buffer to the pool, unless the pool is full */
+static bool
+lc_poolPut(void *ptr) {
+    bool added = false;
+
+    if (lc_mem.m_poolCount >= LC_DATA_POOL_MAX) {
+        return false;
+    }
+    pthread_mutex_lock(&lc_mem.m_poolLock);
+    if (lc_mem.m_poolCount < LC_DATA_POOL_MAX) {
+        *(void **)ptr = lc_mem.m_pool;
+        lc_mem.m_pool = ptr;
+        lc_mem.m_poolCount++;
+        added = true;
+    }
+    pthread_mutex_unlock(&lc_mem.m_poolLock);
+    return added;
+}
+
 /* Allocate block aligned memory, needed for direct I/O */
 void
 lc_mallocBlockAligned(struct fs *fs, void **memptr, enum lc_memTypes type) {
-    int err = posix_memalign(memptr, LC_BLOCK_SIZE, LC_BLOCK_SIZE);
+    int err;
 
-    assert(err == 0);
+    if ((type != LC_MEMTYPE_DATA) || (lc_poolGet(memptr, 1) == 0)) {
+        err = posix_memalign(memptr, LC_BLOCK_SIZE, LC_BLOCK_SIZE);
+        assert(err == 0);
+    }
     lc_memStatsUpdate(fs, LC_BLOCK_SIZE, true, type);
 }
 
+/* Allocate a number of block aligned data buffers, reusing freed buffers */
+void
+lc_mallocBlocksAligned(struct fs *fs, void **memptr, uint64_t count) {
+    uint64_t i, pooled = lc_poolGet(memptr, count);
+    int err;
+
+    for (i = 0; i < count; i++) {
+        if (i >= pooled) {
+            err = posix_memalign(&memptr[i], LC_BLOCK_SIZE, LC_BLOCK_SIZE);
+            assert(err == 0);
+        }
+        lc_memStatsUpdate(fs, LC_BLOCK_SIZE, true, LC_MEMTYPE_DATA);
+    }
+}
+
 /* Release previously allocated memory */
 void
 lc_free(struct fs *fs, void *ptr, size_t size, enum lc_memTypes type) {
     assert(size || (type == LC_MEMTYPE_GFS));
-    free(ptr);
+    if ((type != LC_MEMTYPE_DATA) || !lc_poolPut(ptr)) {
+        free(ptr);
+    }
     lc_memStatsUpdate(fs, size, false, type);
 }
 
+/* Release data buffers kept in the pool */
+void
+lc_freeDataPool() {
+    void *ptr;
+
+    pthread_mutex_lock(&lc_mem.m_poolLock);
+    while (lc_mem.m_pool) {
+        ptr = lc_mem.m_pool;
+        lc_mem.m_pool = *(void **)ptr;
+        free(ptr);
+    }
+    lc_mem.m_poolCount = 0;
+    pthread_mutex_unlock(&lc_mem.m_poolLock);
+}
+
 /* Move previously allocated memory from one layer to another */
 void
 lc_memMove(struct fs *from, struct fs *to, size_t size,
@@ -243,6 +340,38 @@ lc_displayGlobalMemStats() {
     }
     lc_syslog(LOG_INFO, "Total memory used for pages %ld limit %ldMB\n",
               lc_mem.m_totalMemory, lc_mem.m_purgeMemory / (1024 * 1024));
+    lc_syslog(LOG_INFO, "Data buffers in pool %ld, reused %ld times\n",
+              lc_mem.m_poolCount, lc_mem.m_poolHits);
+}
+
+/* Render global memory stats */
+void
+lc_memMetrics(struct metrics *m) {
+    lc_metric(m, "memory_global_bytes", NULL, lc_mem.m_globalMemory);
+    lc_metric(m, "memory_pages_bytes", NULL, lc_mem.m_totalMemory);
+    lc_metric(m, "memory_pages_limit_bytes", NULL, lc_mem.m_purgeMemory);
+    lc_metric(m, "memory_pool_buffers", NULL, lc_mem.m_poolCount);
+    lc_metric(m, "memory_pool_hits_total", NULL, lc_mem.m_poolHits);
+}
+
+/* Render memory stats of a layer */
+void
+lc_memLayerMetrics(struct metrics *m, struct fs *fs, const char *labels) {
+    char tlabels[strlen(labels) + 32];
+    enum lc_memTypes i;
+
+    lc_metric(m, "memory_bytes", labels, fs->fs_memory);
+    if (!memStatsEnabled) {
+        return;
+    }
+    for (i = LC_MEMTYPE_GFS + 1; i < LC_MEMTYPE_MAX; i++) {
+        if (fs->fs_malloc[i]) {
+            snprintf(tlabels, sizeof(tlabels), "%s,type=\"%s\"", labels,
+                     mrequests[i]);
+            lc_metric(m, "memory_type_bytes", tlabels,
+                      fs->fs_malloc[i] - fs->fs_free[i]);
+        }
+    }
 }
 
 /* Display memory stats */
@@ -29,7 +29,10 @@ enum lc_memTypes {
     LC_MEMTYPE_SYMLINK = 23,        /* Symbolic link */
     LC_MEMTYPE_IRWLOCK = 24,        /* Inode lock */
     LC_MEMTYPE_STATS = 25,          /* Request stats */
-    LC_MEMTYPE_MAX = 26,
+    LC_MEMTYPE_SPACE = 26,          /* Free space index */
+    LC_MEMTYPE_CURSOR = 27,         /* Allocation cursors */
+    LC_MEMTYPE_DEFRAG = 28,         /* Layer defragmentation */
+    LC_MEMTYPE_MAX = 29,
 };
 
 #endif
@@ -133,7 +133,7 @@ lc_flushInodeDirtyPages(struct inode *inode, uint64_t page, bool unlock,
 void
 lc_addDirtyInode(struct fs *fs, struct inode *inode) {
     assert(S_ISREG(inode->i_mode));
-    pthread_mutex_lock(&fs->fs_dilock);
+    lc_mutexLock(&fs->fs_dilock, LC_LOCK_DIRTY);
     if ((lc_inodeGetDirtyNext(inode) == NULL) &&
         (fs->fs_dirtyInodesLast != inode)) {
         if (fs->fs_dirtyInodesLast) {
@@ -144,7 +144,7 @@ lc_addDirtyInode(struct fs *fs, struct inode *inode) {
         }
         fs->fs_dirtyInodesLast = inode;
     }
-    pthread_mutex_unlock(&fs->fs_dilock);
+    lc_mutexUnlock(&fs->fs_dilock, LC_LOCK_DIRTY);
 }
 
 /* Remove an inode from the layer dirty list */
@@ -213,7 +213,7 @@ lc_processHiddenInodes(struct gfs *gfs, struct fs *nfs) {
     while (fs) {
         assert(fs->fs_frozen);
         if (fs->fs_dirtyInodes) {
-            pthread_mutex_lock(&fs->fs_dilock);
+            lc_mutexLock(&fs->fs_dilock, LC_LOCK_DIRTY);
             inode = fs->fs_dirtyInodes;
             while (inode) {
                 assert(inode->i_fs == fs);
@@ -222,12 +222,12 @@ lc_processHiddenInodes(struct gfs *gfs, struct fs *nfs) {
                      fs->fs_dirtyInodesLast = NULL;
                 }
                 lc_inodeSetDirtyNext(inode, NULL);
-                pthread_mutex_unlock(&fs->fs_dilock);
+                lc_mutexUnlock(&fs->fs_dilock, LC_LOCK_DIRTY);
                 lc_invalidateParentPages(gfs, fs, inode);
-                pthread_mutex_lock(&fs->fs_dilock);
+                lc_mutexLock(&fs->fs_dilock, LC_LOCK_DIRTY);
                 inode = fs->fs_dirtyInodes;
             }
-            pthread_mutex_unlock(&fs->fs_dilock);
+            lc_mutexUnlock(&fs->fs_dilock, LC_LOCK_DIRTY);
         }
         fs = fs->fs_parent;
     }
@@ -244,8 +244,8 @@ lc_flushDirtyInodeList(struct fs *fs, bool all) {
         return;
     }
     force = all || !lc_checkMemoryAvailable(true) ||
-            (fs->fs_pcount >= LC_MAX_LAYER_DIRTYPAGES);
-    pthread_mutex_lock(&fs->fs_dilock);
+            (fs->fs_pcount >= fs->fs_gfs->gfs_flushLimit);
+    lc_mutexLock(&fs->fs_dilock, LC_LOCK_DIRTY);
 
     /* Increment flusher id and store it with inodes flushed by this thread.
      * This helps to avoid processing same inodes over and over.
@@ -269,7 +269,7 @@ lc_flushDirtyInodeList(struct fs *fs, bool all) {
             if (lc_inodeGetDirtyPageCount(inode) &&
                 !(inode->i_flags & LC_INODE_REMOVED) &&
                 ((inode->i_ocount == 0) || force)) {
-                pthread_mutex_unlock(&fs->fs_dilock);
+                lc_mutexUnlock(&fs->fs_dilock, LC_LOCK_DIRTY);
 
                 /* Attempt to flush dirty inodes if lock is available and no
                  * thread has the file open.
@@ -287,7 +287,8 @@ lc_flushDirtyInodeList(struct fs *fs, bool all) {
                     }
                     pthread_rwlock_unlock(inode->i_rwlock);
                 } else if (!all && lc_checkMemoryAvailable(true) &&
-                           (fs->fs_pcount < (LC_MAX_LAYER_DIRTYPAGES / 2))) {
+                           (fs->fs_pcount <
+                            (fs->fs_gfs->gfs_flushLimit / 2))) {
                     return;
                 }
             } else {
@@ -295,7 +296,7 @@ lc_flushDirtyInodeList(struct fs *fs, bool all) {
                 inode = next;
                 continue;
             }
-            pthread_mutex_lock(&fs->fs_dilock);
+            lc_mutexLock(&fs->fs_dilock, LC_LOCK_DIRTY);
             prev = NULL;
             inode = fs->fs_dirtyInodes;
         } else {
@@ -303,7 +304,7 @@ lc_flushDirtyInodeList(struct fs *fs, bool all) {
             inode = lc_inodeGetDirtyNext(inode);
         }
     }
-    pthread_mutex_unlock(&fs->fs_dilock);
+    lc_mutexUnlock(&fs->fs_dilock, LC_LOCK_DIRTY);
 }
 
 /* Fill up a partial page */
@@ -683,17 +684,62 @@ lc_mergePage(struct gfs *gfs, struct inode *inode, uint64_t pg,
     return 0;
 }
 
+/* Read data left in the fuse pipe directly into page aligned buffers */
+static size_t
+lc_readPipe(int fd, struct fuse_bufvec *dst) {
+    struct iovec iov[dst->count];
+    size_t count = 0;
+    ssize_t res;
+    int i;
+
+    for (i = 0; i < dst->count; i++) {
+        iov[i].iov_base = dst->buf[i].mem;
+        iov[i].iov_len = dst->buf[i].size;
+    }
+    i = 0;
+    while (i < dst->count) {
+        res = readv(fd, &iov[i], dst->count - i);
+        if (res <= 0) {
+            if ((res < 0) && (errno == EINTR)) {
+                continue;
+            }
+            break;
+        }
+        count += res;
+
+        /* Skip buffers filled completely */
+        while (res && (i < dst->count)) {
+            if (res >= iov[i].iov_len) {
+                res -= iov[i].iov_len;
+                i++;
+            } else {
+                iov[i].iov_base = (char *)iov[i].iov_base + res;
+                iov[i].iov_len -= res;
+                res = 0;
+            }
+        }
+    }
+    return count;
+}
+
 /* Copy in provided data into page aligned buffers */
 uint64_t
 lc_copyPages(struct fs *fs, off_t off, size_t size, struct dpage *dpages,
              struct fuse_bufvec *bufv, struct fuse_bufvec *dst) {
-    uint64_t page, spage, pcount = 0, poffset;
+    uint64_t page, spage, pcount = 0, poffset, count;
+    struct fuse_buf *buf = &bufv->buf[bufv->idx];
     size_t wsize = size, psize;
-    char *pdata;
+    char **pdata;
 
     spage = off / LC_BLOCK_SIZE;
     page = spage;
 
+    /* Take all the buffers needed at once */
+    count = size ? (((off + size) + LC_BLOCK_SIZE - 1) -
+                    (spage * LC_BLOCK_SIZE)) / LC_BLOCK_SIZE : 0;
+    pdata = alloca(count * sizeof(char *));
+    lc_mallocBlocksAligned(fs, (void **)pdata, count);
+
     /* Break the down the write into pages */
     while (wsize) {
         if (page == spage) {
@@ -706,18 +752,34 @@ lc_copyPages(struct fs *fs, off_t off, size_t size, struct dpage *dpages,
         if (psize > wsize) {
             psize = wsize;
         }
-        lc_mallocBlockAligned(fs, (void **)&pdata, LC_MEMTYPE_DATA);
-        lc_updateVec(pdata, dst, poffset, psize);
-        dpages[pcount].dp_data = pdata;
+        lc_updateVec(pdata[pcount], dst, poffset, psize);
+        dpages[pcount].dp_data = pdata[pcount];
         dpages[pcount].dp_poffset = poffset;
         dpages[pcount].dp_psize = psize;
         pcount++;
         page++;
         wsize -= psize;
     }
+    assert(pcount == count);
+
+    /* Read data from fuse.  If data is still in the fuse pipe, read that
+     * directly into the pages instead of copying through the library.
+     */
+    if ((bufv->count == (bufv->idx + 1)) && (bufv->off == 0) &&
+        (buf->flags & FUSE_BUF_IS_FD) && !(buf->flags & FUSE_BUF_FD_SEEK)) {
+        wsize = lc_readPipe(buf->fd, dst);
 
-    /* Read data from fuse */
-    wsize = fuse_buf_copy(dst, bufv, FUSE_BUF_SPLICE_MOVE);
+        /* Let fuse know data is consumed from the pipe, as fuse_buf_copy
+         * does, so that the pipe is not cleared and created again.
+         */
+        bufv->off += wsize;
+        if (bufv->off == buf->size) {
+            bufv->idx++;
+            bufv->off = 0;
+        }
+    } else {
+        wsize = fuse_buf_copy(dst, bufv, FUSE_BUF_SPLICE_MOVE);
+    }
     assert(wsize == size);
     return pcount;
 }
@@ -774,6 +836,8 @@ lc_addPages(struct inode *inode, off_t off, size_t size,
     uint64_t added = 0;
 
     assert(S_ISREG(inode->i_mode));
+    lc_hotRecord(fs, inode, LC_HOT_WRITE, size);
+    lc_traceBytes(size);
 
     /* Update inode size if needed */
     lc_updateInodeSize(gfs, inode, off > inode->i_size, endoffset);
@@ -838,6 +902,7 @@ lc_readFile(fuse_req_t req, struct fs *fs, struct inode *inode, off_t soffset,
     ino_t ino;
 
     assert(S_ISREG(inode->i_mode));
+    lc_hotRecord(fs, inode, LC_HOT_READ, endoffset - soffset);
     poffset = soffset % LC_BLOCK_SIZE;
     psize = LC_BLOCK_SIZE - poffset;
     while (rsize) {
@@ -928,9 +993,155 @@ lc_readFile(fuse_req_t req, struct fs *fs, struct inode *inode, off_t soffset,
         /* Consider all the pages read as missed in the cache */
         __sync_add_and_fetch(&gfs->gfs_pmissed, rcount);
     }
+    lc_traceCache(pcount - rcount, rcount);
     return 0;
 }
 
+/* Read an aligned direct I/O request straight from the device, bypassing the
+ * block cache.  Blocks still in the block cache are used from there, as
+ * those may not be written to disk yet.  Returns false if the read needs to
+ * go through the block cache.  Inode is unlocked otherwise.
+ */
+bool
+lc_directRead(fuse_req_t req, struct fs *fs, struct inode *inode,
+              off_t soffset, off_t endoffset, uint64_t asize,
+              struct fuse_bufvec *bufv) {
+    uint64_t block, pg = soffset / LC_BLOCK_SIZE, bstart = 0;
+    uint64_t i, pcount = 0, rstart = 0, rcount = 0;
+    struct extent *extent = lc_inodeGetEmap(inode);
+    size_t psize, rsize = endoffset - soffset;
+    struct gfs *gfs = fs->fs_gfs;
+    struct page *page, **pages;
+    struct iovec *iovec;
+    char **dbuf;
+
+    /* Dirty pages are found only through the page cache */
+    if ((soffset % LC_BLOCK_SIZE) || lc_inodeGetDirtyPageCount(inode)) {
+        return false;
+    }
+    dbuf = alloca(asize * sizeof(char *));
+    pages = alloca(asize * sizeof(struct page *));
+    iovec = alloca(asize * sizeof(struct iovec));
+    lc_mallocBlocksAligned(fs, (void **)dbuf, asize);
+    for (i = 0; i < asize; i++, pg++) {
+        psize = (rsize > LC_BLOCK_SIZE) ? LC_BLOCK_SIZE : rsize;
+        rsize -= psize;
+        bufv->buf[i].size = psize;
+        block = lc_inodeEmapLookup(gfs, inode, pg, &extent);
+        if (block == LC_PAGE_HOLE) {
+            bufv->buf[i].mem = gfs->gfs_zPage;
+            continue;
+        }
+        page = lc_findPage(fs, block);
+        if (page) {
+            bufv->buf[i].mem = page->p_data;
+            pages[pcount++] = page;
+            continue;
+        }
+
+        /* Read blocks accumulated if this block is not contiguous to those */
+        if (rcount && ((bstart + rcount) != block)) {
+            lc_readBlocks(gfs, fs, &iovec[rstart], rcount, bstart);
+            rstart += rcount;
+            rcount = 0;
+        }
+        if (rcount == 0) {
+            bstart = block;
+        }
+        iovec[rstart + rcount].iov_base = dbuf[i];
+        iovec[rstart + rcount].iov_len = LC_BLOCK_SIZE;
+        rcount++;
+        bufv->buf[i].mem = dbuf[i];
+    }
+    assert(rsize == 0);
+    if (rcount) {
+        lc_readBlocks(gfs, fs, &iovec[rstart], rcount, bstart);
+    }
+    bufv->count = asize;
+    fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+    lc_inodeUnlock(inode);
+    for (i = 0; i < pcount; i++) {
+        lc_releasePage(gfs, fs, pages[i], true, false);
+    }
+    for (i = 0; i < asize; i++) {
+        lc_free(fs, dbuf[i], LC_BLOCK_SIZE, LC_MEMTYPE_DATA);
+    }
+    return true;
+}
+
+/* Write an aligned direct I/O request straight to newly allocated blocks,
+ * bypassing dirty pages and the block cache.  Returns false if the write
+ * needs to go through dirty pages.  Called with inode locked exclusive.
+ */
+bool
+lc_directWrite(struct fs *fs, struct inode *inode, off_t off, size_t size,
+               struct dpage *dpages, uint64_t pcount) {
+    uint64_t pg = off / LC_BLOCK_SIZE, block, i;
+    struct extent *extents = NULL;
+    struct gfs *gfs = fs->fs_gfs;
+    struct iovec *iovec;
+
+    assert(S_ISREG(inode->i_mode));
+    assert(inode->i_fs == fs);
+    if ((off % LC_BLOCK_SIZE) || (size % LC_BLOCK_SIZE) || (pcount == 0) ||
+        lc_inodeGetDirtyPageCount(inode) ||
+        (inode->i_flags & LC_INODE_TMP)) {
+        return false;
+    }
+    block = lc_blockAlloc(fs, pcount, false, true);
+    if (block == LC_INVALID_BLOCK) {
+        return false;
+    }
+
+    /* Write the data before making it visible in the emap */
+    iovec = alloca(pcount * sizeof(struct iovec));
+    for (i = 0; i < pcount; i++) {
+        assert(dpages[i].dp_poffset == 0);
+        assert(dpages[i].dp_psize == LC_BLOCK_SIZE);
+        iovec[i].iov_base = dpages[i].dp_data;
+        iovec[i].iov_len = LC_BLOCK_SIZE;
+    }
+    lc_markSuperDirty(fs);
+    if (pcount == 1) {
+        lc_writeBlock(gfs, fs, dpages[0].dp_data, block);
+    } else {
+        lc_writeBlocks(gfs, fs, iovec, pcount, block);
+    }
+    lc_statsWrite(fs, LC_WRITE_DATA, pcount);
+
+    /* Make a private copy of the emap list if inode is sharing that */
+    if (inode->i_flags & LC_INODE_SHARED) {
+        lc_copyEmap(gfs, fs, inode);
+    }
+    if ((inode->i_dinode.di_blocks == 0) && (pg == 0)) {
+
+        /* Start a single direct extent for a file written from the start */
+        assert(lc_inodeGetEmap(inode) == NULL);
+        inode->i_extentBlock = block;
+        inode->i_extentLength = pcount;
+        inode->i_dinode.di_blocks = pcount;
+    } else if (inode->i_extentLength && (pg == inode->i_extentLength) &&
+               ((inode->i_extentBlock + inode->i_extentLength) == block)) {
+
+        /* Extend the single direct extent */
+        inode->i_extentLength += pcount;
+        inode->i_dinode.di_blocks += pcount;
+    } else {
+        if (inode->i_extentLength) {
+            lc_expandEmap(gfs, fs, inode);
+        }
+        lc_inodeEmapUpdate(gfs, fs, inode, pg, block, pcount, &extents);
+    }
+    lc_updateInodeSize(gfs, inode, off > inode->i_size, off + size);
+    lc_markInodeDirty(inode, LC_INODE_EMAPDIRTY);
+
+    /* Free blocks overwritten and invalidate those from block cache */
+    if (extents) {
+        lc_freeInodeDataBlocks(gfs, fs, &extents);
+    }
+    return true;
+}
+
 /* Flush dirty pages of an inode */
 void
 lc_flushPages(struct gfs *gfs, struct fs *fs, struct inode *inode,
@@ -1209,6 +1420,7 @@ out:
     if (tcount) {
 
         /* Queue the dirty pages for write */
+        lc_statsWrite(fs, LC_WRITE_DATA, tcount);
         lc_addPageForWriteBack(gfs, fs, tpage, dpage, tcount);
     }
     tcount += fcount;
@@ -30,6 +30,9 @@
 /* Maximum memory in bytes allowed for data pages */
 #define LC_PCACHE_MEMORY        (512ull * 1024ull * 1024ull)
 
+/* Number of free data buffers kept around for reuse */
+#define LC_DATA_POOL_MAX        4096
+
 /* Percentage of memory allowed above LC_PCACHE_MEMORY before threads are
  * blocked.
  */
@@ -53,6 +56,14 @@
 /* Number of dirty pages accumulated for waking up syncer */
 #define LC_SYNCER_DIRTY_COUNT   8192
 
+/* Percentage of memory for data pages which could be dirty before writers
+ * are throttled.
+ */
+#define LC_DIRTY_RATIO          50
+
+/* Number of dirty pages a layer could have without its writers throttled */
+#define LC_DIRTY_LIGHT          8192
+
 /* Number of minimum blocks a file need to grow before it is converted to use a
  * hash scheme for dirty pages.
  */
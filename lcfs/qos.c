@@ -0,0 +1,264 @@
+#include "includes.h"
+
+/* Default weight of a layer while sharing the device with other layers */
+#define LC_QOS_WEIGHT       100
+
+/* Maximum time in microseconds a reader is paused for at a time */
+#define LC_QOS_WAIT_MAX     1000000
+
+/* Limits and token buckets of a layer.  Buckets are refilled at the rate
+ * configured and hold up to a second worth of tokens.  I/O is charged against
+ * the buckets as issued, and the layer is in debt when a bucket goes negative.
+ */
+struct qos {
+
+    /* Lock protecting buckets */
+    pthread_mutex_t q_lock;
+
+    /* Bandwidth limit in bytes per second, 0 if unlimited */
+    uint64_t q_bandwidth;
+
+    /* Limit on I/O operations per second, 0 if unlimited */
+    uint64_t q_iops;
+
+    /* Share of I/O operations per second while device is saturated */
+    uint64_t q_share;
+
+    /* Weight of the layer while device is saturated */
+    uint64_t q_weight;
+
+    /* Bytes available in the bandwidth bucket */
+    int64_t q_bytes;
+
+    /* Operations available in the operations bucket */
+    int64_t q_ops;
+
+    /* Time buckets were refilled last */
+    struct timeval q_last;
+
+    /* I/O operations of the layer as of the last balancing */
+    uint64_t q_sampled;
+};
+
+/* Set up limits of a new layer, unlimited to start with */
+void
+lc_qosInit(struct fs *fs) {
+    struct qos *qos;
+
+    qos = lc_malloc(NULL, sizeof(struct qos), LC_MEMTYPE_GFS);
+    memset(qos, 0, sizeof(struct qos));
+    pthread_mutex_init(&qos->q_lock, NULL);
+    qos->q_weight = LC_QOS_WEIGHT;
+    gettimeofday(&qos->q_last, NULL);
+    fs->fs_qos = qos;
+}
+
+/* Return limit on operations per second currently applied */
+static inline uint64_t
+lc_qosIops(struct qos *qos) {
+    uint64_t iops = qos->q_iops, share = qos->q_share;
+
+    return (share && (!iops || (share < iops))) ? share : iops;
+}
+
+/* Refill buckets based on time elapsed and charge I/O against those.  Returns
+ * time in microseconds the layer needs for getting out of debt.
+ */
+static uint64_t
+lc_qosRefill(struct qos *qos, uint64_t bytes, uint64_t ops) {
+    uint64_t iops, usec, wait = 0, ewait;
+    struct timeval now, elapsed;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, &qos->q_last, &elapsed);
+    usec = (elapsed.tv_sec * 1000000) + elapsed.tv_usec;
+    if ((elapsed.tv_sec < 0) || (usec > 1000000)) {
+        usec = 1000000;
+    }
+    qos->q_last = now;
+    if (qos->q_bandwidth) {
+        qos->q_bytes += (qos->q_bandwidth * usec) / 1000000;
+        if (qos->q_bytes > (int64_t)qos->q_bandwidth) {
+            qos->q_bytes = qos->q_bandwidth;
+        }
+        qos->q_bytes -= bytes;
+        if (qos->q_bytes < 0) {
+            wait = (-qos->q_bytes * 1000000) / qos->q_bandwidth;
+        }
+    }
+    iops = lc_qosIops(qos);
+    if (iops) {
+        qos->q_ops += (iops * usec) / 1000000;
+        if (qos->q_ops > (int64_t)iops) {
+            qos->q_ops = iops;
+        }
+        qos->q_ops -= ops;
+        if (qos->q_ops < 0) {
+            ewait = (-qos->q_ops * 1000000) / iops;
+            if (ewait > wait) {
+                wait = ewait;
+            }
+        }
+    }
+    return wait;
+}
+
+/* Charge I/O of the specified number of blocks to a layer.  I/O is issued
+ * with locks held, including locks on pages shared with other layers, so this
+ * only puts the layer in debt, which readers and writers of the layer pay off
+ * before issuing more requests, as returned by lc_qosPause.  I/O on the global layer is
+ * never limited.
+ */
+void
+lc_qosCharge(struct gfs *gfs, struct fs *fs, uint64_t blocks) {
+    struct qos *qos = fs->fs_qos;
+
+    if ((qos == NULL) || (fs->fs_gindex == 0) ||
+        ((qos->q_bandwidth == 0) && (qos->q_iops == 0) &&
+         (qos->q_share == 0))) {
+        return;
+    }
+    pthread_mutex_lock(&qos->q_lock);
+    lc_qosRefill(qos, blocks * LC_BLOCK_SIZE, 1);
+    pthread_mutex_unlock(&qos->q_lock);
+}
+
+/* Return time in microseconds a reader or writer needs to be paused for,
+ * while the layer is in debt for I/O issued before.  Callers pause with the
+ * layer unlocked.
+ */
+uint64_t
+lc_qosPause(struct gfs *gfs, struct fs *fs) {
+    struct qos *qos = fs->fs_qos;
+    uint64_t wait;
+
+    if ((qos == NULL) ||
+        ((qos->q_bandwidth == 0) && (qos->q_iops == 0) &&
+         (qos->q_share == 0))) {
+        return 0;
+    }
+    pthread_mutex_lock(&qos->q_lock);
+    wait = lc_qosRefill(qos, 0, 0);
+    pthread_mutex_unlock(&qos->q_lock);
+    if (wait) {
+        if (wait > LC_QOS_WAIT_MAX) {
+            wait = LC_QOS_WAIT_MAX;
+        }
+        __sync_add_and_fetch(&fs->fs_qosThrottled, 1);
+        __sync_add_and_fetch(&fs->fs_qosTime, wait);
+    }
+    return wait;
+}
+
+/* Share the device between layers doing I/O while it is saturated.  Layers
+ * get a share of the operations the device completed recently in proportion
+ * to their weights, and layers doing more than their share are limited to
+ * it until the device is not saturated anymore.  Called from the flusher
+ * thread.
+ */
+void
+lc_qosBalance(struct gfs *gfs, bool saturated, uint64_t usec) {
+    uint64_t ops, total = 0, weights = 0, share;
+    struct qos *qos;
+    struct fs *fs;
+    int i;
+
+    rcu_register_thread();
+    rcu_read_lock();
+    for (i = 1; i <= gfs->gfs_scount; i++) {
+        fs = rcu_dereference(gfs->gfs_fs[i]);
+        if ((fs == NULL) || (fs->fs_qos == NULL)) {
+            continue;
+        }
+        qos = fs->fs_qos;
+        ops = fs->fs_reads + fs->fs_writes;
+        if (ops > qos->q_sampled) {
+            total += ops - qos->q_sampled;
+            weights += qos->q_weight;
+        }
+    }
+    for (i = 1; i <= gfs->gfs_scount; i++) {
+        fs = rcu_dereference(gfs->gfs_fs[i]);
+        if ((fs == NULL) || (fs->fs_qos == NULL)) {
+            continue;
+        }
+        qos = fs->fs_qos;
+        ops = fs->fs_reads + fs->fs_writes;
+        share = 0;
+        if (saturated && weights && (ops > qos->q_sampled)) {
+            share = (total * qos->q_weight * 1000000) / (weights * usec);
+            if (share == 0) {
+                share = 1;
+            }
+
+            /* Layers limited already stay limited while device is busy */
+            if ((qos->q_share == 0) &&
+                (((ops - qos->q_sampled) * 1000000) <= (share * usec))) {
+                share = 0;
+            }
+        }
+        qos->q_sampled = ops;
+        if (share != qos->q_share) {
+            pthread_mutex_lock(&qos->q_lock);
+            qos->q_share = share;
+            pthread_mutex_unlock(&qos->q_lock);
+        }
+    }
+    rcu_read_unlock();
+    rcu_unregister_thread();
+}
+
+/* Set limits and weight of a layer */
+void
+lc_qosLayer(fuse_req_t req, struct gfs *gfs, const struct lqos *lqos) {
+    uint64_t start;
+    struct fs *fs, *rfs;
+    struct qos *qos;
+    int err = 0;
+    ino_t root;
+
+    lc_statsBegin(&start);
+    rfs = lc_getLayerLocked(LC_ROOT_INODE, false);
+    root = lc_getRootIno(rfs, lqos->q_name, NULL, true);
+    if (root == LC_INVALID_INODE) {
+        err = ENOENT;
+        goto out;
+    }
+    fs = lc_getLayerLocked(root, false);
+    qos = fs->fs_qos;
+    pthread_mutex_lock(&qos->q_lock);
+    qos->q_bandwidth = lqos->q_bandwidth * 1024ull * 1024ull;
+    qos->q_iops = lqos->q_iops;
+    qos->q_weight = lqos->q_weight ? lqos->q_weight : LC_QOS_WEIGHT;
+    qos->q_bytes = qos->q_bandwidth;
+    qos->q_ops = qos->q_iops;
+    gettimeofday(&qos->q_last, NULL);
+    pthread_mutex_unlock(&qos->q_lock);
+    lc_syslog(LOG_INFO, "Layer %s limited to %u MB/s %u iops, weight %ld\n",
+              lqos->q_name, lqos->q_bandwidth, lqos->q_iops, qos->q_weight);
+    lc_unlock(fs);
+
+out:
+    if (err) {
+        fuse_reply_err(req, err);
+    } else {
+        fuse_reply_ioctl(req, 0, NULL, 0);
+    }
+    lc_statsAdd(rfs, LC_QOS, err, &start);
+    lc_unlock(rfs);
+}
+
+/* Free limits of a layer */
+void
+lc_qosFree(struct fs *fs) {
+    struct qos *qos = fs->fs_qos;
+
+    if (qos == NULL) {
+        return;
+    }
+    fs->fs_qos = NULL;
+#ifdef LC_MUTEX_DESTROY
+    pthread_mutex_destroy(&qos->q_lock);
+#endif
+    lc_free(NULL, qos, sizeof(struct qos), LC_MEMTYPE_GFS);
+}
@@ -0,0 +1,2129 @@
+#include "includes.h"
+
+/* Replay streams of requests by calling fuse handlers of the file system
+ * directly with fake requests, against a file system formatted on a temporary
+ * file, without mounting it through the kernel.  Each thread replays the
+ * stream in a directory of its own.  Lifecycle of containers can be run
+ * instead, managing layers the way the docker plugin does.  Results are printed
+ * as one JSON object per line.
+ */
+
+/* Default size of the file system image */
+#define LC_REPLAY_SIZE      (4ul * 1024ul * 1024ul * 1024ul)
+
+/* Default number of files in synthetic streams */
+#define LC_REPLAY_COUNT     1024
+
+/* Default number of threads replaying streams */
+#define LC_REPLAY_THREADS   4
+
+/* Largest read or write issued, as kernel splits bigger requests */
+#define LC_REPLAY_IOSIZE    (128 * 1024)
+
+/* Size of buffers used for reading directories and extended attributes */
+#define LC_REPLAY_BUFSIZE   4096
+
+/* Number of files created in a directory of synthetic streams */
+#define LC_REPLAY_FILES     32
+
+/* Size of the name cache of a thread */
+#define LC_REPLAY_NCACHE    4096
+
+/* Longest path in a stream */
+#define LC_REPLAY_PATH      256
+
+/* Directory under which threads replay streams */
+#define LC_REPLAY_DIR       "replay"
+
+/* Number of layers in the image containers are started from */
+#define LC_REPLAY_DEPTH     8
+
+/* Number of files extracted to each layer of the image */
+#define LC_REPLAY_LFILES    256
+
+/* Checkpoint the file system after this many containers in a thread */
+#define LC_REPLAY_CHECKPOINT 16
+
+/* Number of pieces files of the defrag scenario are written in, and the size
+ * of each piece.
+ */
+#define LC_REPLAY_DPIECES   8
+#define LC_REPLAY_DPIECE    (4 * LC_BLOCK_SIZE)
+
+/* Time in seconds to wait for a checkpoint requested */
+#define LC_REPLAY_CKPT_WAIT 30
+
+extern struct fuse_lowlevel_ops lc_ll_oper;
+
+static struct gfs *gfs;
+bool lc_verbose = false;
+
+/* Return global file system */
+struct gfs *
+getfs() {
+    return gfs;
+}
+
+/* Operations in a stream */
+enum lc_replayOp {
+    LC_REPLAY_MKDIR = 0,
+    LC_REPLAY_CREATE = 1,
+    LC_REPLAY_OPEN = 2,
+    LC_REPLAY_CLOSE = 3,
+    LC_REPLAY_READ = 4,
+    LC_REPLAY_WRITE = 5,
+    LC_REPLAY_STAT = 6,
+    LC_REPLAY_READDIR = 7,
+    LC_REPLAY_UNLINK = 8,
+    LC_REPLAY_RMDIR = 9,
+    LC_REPLAY_RENAME = 10,
+    LC_REPLAY_SYMLINK = 11,
+    LC_REPLAY_LINK = 12,
+    LC_REPLAY_SETXATTR = 13,
+    LC_REPLAY_GETXATTR = 14,
+    LC_REPLAY_TRUNCATE = 15,
+    LC_REPLAY_CHMOD = 16,
+    LC_REPLAY_FSYNC = 17,
+    LC_REPLAY_MAX = 18,
+};
+
+/* Names of operations, as used in streams read from files */
+static const char *lc_replayOps[] = {
+    "mkdir",
+    "create",
+    "open",
+    "close",
+    "read",
+    "write",
+    "stat",
+    "readdir",
+    "unlink",
+    "rmdir",
+    "rename",
+    "symlink",
+    "link",
+    "setxattr",
+    "getxattr",
+    "truncate",
+    "chmod",
+    "fsync",
+};
+
+/* Steps of the lifecycle of containers timed */
+enum lc_replayStep {
+    LC_STEP_IMAGE_CREATE = 0,
+    LC_STEP_IMAGE_POPULATE = 1,
+    LC_STEP_IMAGE_FREEZE = 2,
+    LC_STEP_INIT_CREATE = 3,
+    LC_STEP_INIT = 4,
+    LC_STEP_RW_CREATE = 5,
+    LC_STEP_START = 6,
+    LC_STEP_RUN = 7,
+    LC_STEP_STOP = 8,
+    LC_STEP_COMMIT = 9,
+    LC_STEP_REMOVE = 10,
+    LC_STEP_CHECKPOINT = 11,
+    LC_STEP_FORMAT = 12,
+    LC_STEP_MOUNT = 13,
+    LC_STEP_UNMOUNT = 14,
+    LC_STEP_MAX = 15,
+};
+
+/* Names of steps of the lifecycle of containers */
+static const char *lc_replaySteps[] = {
+    "image_layer_create",
+    "image_layer_populate",
+    "image_layer_freeze",
+    "init_layer_create",
+    "init_layer_populate",
+    "rw_layer_create",
+    "start",
+    "run",
+    "stop",
+    "commit",
+    "remove",
+    "checkpoint",
+    "format",
+    "mount",
+    "unmount",
+};
+
+/* Time taken by each time a step was run */
+struct rsample {
+
+    /* Time taken in nanoseconds */
+    uint64_t *rs_nsec;
+
+    /* Number of times the step was run */
+    uint64_t rs_count;
+
+    /* Number of samples space allocated for */
+    uint64_t rs_size;
+};
+
+/* An operation in a stream */
+struct rop {
+
+    /* Type of the operation */
+    enum lc_replayOp ro_op;
+
+    /* Path relative to the directory of the thread */
+    char *ro_path;
+
+    /* New path of rename and link, target of symlink, name of xattr */
+    char *ro_arg;
+
+    /* Offset of reads and writes, size of truncate, mode */
+    uint64_t ro_off;
+
+    /* Bytes read or written, size of xattr value */
+    uint64_t ro_len;
+};
+
+/* A stream of operations */
+struct rstream {
+
+    /* Operations in the stream */
+    struct rop *rs_ops;
+
+    /* Number of operations in the stream */
+    uint64_t rs_count;
+
+    /* Number of operations space allocated for */
+    uint64_t rs_size;
+};
+
+/* Fake request passed to fuse handlers, taking replies */
+struct fuse_req {
+
+    /* Credentials of the requester */
+    struct fuse_ctx r_ctx;
+
+    /* Error replied */
+    int r_err;
+
+    /* Set while reading a directory */
+    bool r_readdir;
+
+    /* Inode number replied to lookup and create requests */
+    fuse_ino_t r_ino;
+
+    /* File handle replied to open requests */
+    uint64_t r_fh;
+
+    /* Number of bytes replied */
+    size_t r_size;
+
+    /* Mode of the inode replied to getattr requests */
+    mode_t r_mode;
+
+    /* Buffer data read is copied to, if any */
+    char *r_data;
+
+    /* Offset of the last directory entry replied */
+    off_t r_off;
+};
+
+/* Directory entry as formatted by fuse_add_direntry */
+struct rdirent {
+
+    /* Inode number */
+    uint64_t rd_ino;
+
+    /* Offset of the next entry */
+    uint64_t rd_off;
+
+    /* Length of the name following */
+    uint32_t rd_namelen;
+
+    /* Type of the entry */
+    uint32_t rd_type;
+};
+
+/* Name cached by a thread, like the kernel caches dentries */
+struct rname {
+
+    /* Next name in the hash chain */
+    struct rname *rn_next;
+
+    /* Path relative to the directory of the thread */
+    char *rn_path;
+
+    /* Inode number */
+    fuse_ino_t rn_ino;
+
+    /* File handle while the file is open */
+    struct fuse_file_info rn_fi;
+
+    /* Set while the file is open */
+    bool rn_open;
+};
+
+/* A thread replaying a stream */
+struct rthread {
+
+    /* Thread replaying the stream */
+    pthread_t rt_thread;
+
+    /* Stream replayed before starting the clock */
+    struct rstream *rt_setup;
+
+    /* Stream timed */
+    struct rstream *rt_run;
+
+    /* Directory of the thread */
+    fuse_ino_t rt_root;
+
+    /* Buffer for data written and read */
+    char *rt_buf;
+
+    /* Names looked up */
+    struct rname *rt_names[LC_REPLAY_NCACHE];
+
+    /* Number of operations replayed of each type */
+    uint64_t rt_count[LC_REPLAY_MAX];
+
+    /* Time spent on operations of each type in nanoseconds */
+    uint64_t rt_nsec[LC_REPLAY_MAX];
+
+    /* Number of requests sent to the file system */
+    uint64_t rt_requests;
+
+    /* Number of operations failed */
+    uint64_t rt_errors;
+
+    /* Time taken by steps of the lifecycle of containers */
+    struct rsample rt_steps[LC_STEP_MAX];
+
+    /* Number of containers run */
+    uint64_t rt_containers;
+
+    /* Index of the thread */
+    int rt_id;
+};
+
+/* Directory under which threads replay streams */
+static fuse_ino_t lc_replayDir;
+
+/* Threads wait for others to complete setup before replaying streams */
+static pthread_barrier_t lc_replayBarrier;
+
+/* Streams replayed in layers while running containers */
+static struct rstream lc_replayImage, lc_replayInit, lc_replayRunning;
+static struct rstream lc_replayStarting;
+
+/* Number of containers run and threads running those */
+static uint64_t lc_replayContainerCount;
+static int lc_replayThreadCount;
+
+/* Background threads flushing and cleaning pages */
+static pthread_t lc_replayCleaner;
+
+/* Slow device emulated, if any */
+static char *lc_replayDevice;
+
+/* Record error replied */
+int
+fuse_reply_err(fuse_req_t req, int err) {
+    req->r_err = err;
+    return 0;
+}
+
+/* Record inode looked up, treating negative entries as failures */
+int
+fuse_reply_entry(fuse_req_t req, const struct fuse_entry_param *e) {
+    req->r_ino = e->ino;
+    if (e->ino == 0) {
+        req->r_err = ENOENT;
+    }
+    return 0;
+}
+
+/* Record inode created and the file handle */
+int
+fuse_reply_create(fuse_req_t req, const struct fuse_entry_param *e,
+                  const struct fuse_file_info *fi) {
+    req->r_ino = e->ino;
+    req->r_fh = fi->fh;
+    return 0;
+}
+
+/* Record size of the file */
+int
+fuse_reply_attr(fuse_req_t req, const struct stat *attr,
+                double attr_timeout) {
+    req->r_size = attr->st_size;
+    req->r_mode = attr->st_mode;
+    return 0;
+}
+
+/* Record length of the target of a symbolic link */
+int
+fuse_reply_readlink(fuse_req_t req, const char *link) {
+    req->r_size = strlen(link);
+    return 0;
+}
+
+/* Record file handle of the file opened */
+int
+fuse_reply_open(fuse_req_t req, const struct fuse_file_info *fi) {
+    req->r_fh = fi->fh;
+    return 0;
+}
+
+/* Record bytes written */
+int
+fuse_reply_write(fuse_req_t req, size_t count) {
+    req->r_size = count;
+    return 0;
+}
+
+/* Record bytes replied and the offset of the last directory entry */
+int
+fuse_reply_buf(fuse_req_t req, const char *buf, size_t size) {
+    struct rdirent *dirent;
+    size_t off = 0;
+
+    req->r_size = size;
+    if (req->r_readdir) {
+        while ((off + sizeof(struct rdirent)) <= size) {
+            dirent = (struct rdirent *)&buf[off];
+            req->r_off = dirent->rd_off;
+            off += (sizeof(struct rdirent) + dirent->rd_namelen + 7) & ~7;
+        }
+    }
+    return 0;
+}
+
+/* Record bytes read, copying those if asked to */
+int
+fuse_reply_data(fuse_req_t req, struct fuse_bufvec *bufv,
+                enum fuse_buf_copy_flags flags) {
+    size_t i, off = 0;
+
+    req->r_size = fuse_buf_size(bufv);
+    if (req->r_data) {
+        for (i = bufv->idx; i < bufv->count; i++) {
+            memcpy(&req->r_data[off], bufv->buf[i].mem, bufv->buf[i].size);
+            off += bufv->buf[i].size;
+        }
+    }
+    return 0;
+}
+
+/* Ignore file system stats replied */
+int
+fuse_reply_statfs(fuse_req_t req, const struct statvfs *stbuf) {
+    return 0;
+}
+
+/* Record size of extended attributes */
+int
+fuse_reply_xattr(fuse_req_t req, size_t count) {
+    req->r_size = count;
+    return 0;
+}
+
+/* Record result of ioctl */
+int
+fuse_reply_ioctl(fuse_req_t req, int result, const void *buf, size_t size) {
+    req->r_err = (result < 0) ? -result : 0;
+    req->r_size = size;
+    return 0;
+}
+
+/* Return credentials of the requester */
+const struct fuse_ctx *
+fuse_req_ctx(fuse_req_t req) {
+    return &req->r_ctx;
+}
+
+/* Nothing to invalidate without the kernel */
+int
+fuse_lowlevel_notify_delete(struct fuse_session *se, fuse_ino_t parent,
+                            fuse_ino_t child, const char *name,
+                            size_t namelen) {
+    return 0;
+}
+
+/* Nothing to invalidate without the kernel */
+int
+fuse_lowlevel_notify_inval_inode(struct fuse_session *se, fuse_ino_t ino,
+                                 off_t off, off_t len) {
+    return 0;
+}
+
+/* Display usage */
+static void
+usage(char *pgm) {
+    fprintf(stderr, "usage: %s [-d <dir>] [-s <size>] [-e <device>] "
+            "[-n <count>] [-t <threads>] [-r] [-p] "
+            "<smallfiles|untar|start|build|lifecycle|defrag|file>\n", pgm);
+    fprintf(stderr, "\t-d <dir>     - directory for the file system image "
+            "(default /tmp)\n");
+    fprintf(stderr, "\t-s <size>    - size of the file system image in GB "
+            "(default %ld)\n", LC_REPLAY_SIZE / (1024ul * 1024ul * 1024ul));
+    fprintf(stderr, "\t-e <device>  - emulate a slow device, hdd, ebs, ssd or "
+            "<latency usec>,<seek usec>,<MB/s>,<queue depth>\n");
+    fprintf(stderr, "\t-n <count>   - files in synthetic streams and defrag, "
+            "containers run in lifecycle (default %d)\n", LC_REPLAY_COUNT);
+    fprintf(stderr, "\t-t <threads> - threads replaying the stream "
+            "(default %d)\n", LC_REPLAY_THREADS);
+    fprintf(stderr, "\t-r           - display file system stats at the end\n");
+    fprintf(stderr, "\t-p           - print the stream instead of "
+            "replaying it\n");
+    fprintf(stderr, "\tsmallfiles   - create, stat, read and remove "
+            "small files\n");
+    fprintf(stderr, "\tuntar        - extract a layer\n");
+    fprintf(stderr, "\tstart        - start a container from a layer "
+            "extracted\n");
+    fprintf(stderr, "\tbuild        - build an image on a layer extracted\n");
+    fprintf(stderr, "\tlifecycle    - create, start, commit and remove "
+            "containers\n");
+    fprintf(stderr, "\tdefrag       - defragment a layer with fragmented "
+            "files and verify those\n");
+    fprintf(stderr, "\tfile         - replay a stream read from the file, "
+            "one operation per line:\n");
+    fprintf(stderr, "\t\tmkdir|create <path> [<mode>]\n");
+    fprintf(stderr, "\t\topen|close|stat|readdir|unlink|rmdir|fsync <path>\n");
+    fprintf(stderr, "\t\tread|write <path> <offset> <length>\n");
+    fprintf(stderr, "\t\trename|link <path> <newpath>\n");
+    fprintf(stderr, "\t\tsymlink <target> <path>\n");
+    fprintf(stderr, "\t\tsetxattr <path> <name> <length>\n");
+    fprintf(stderr, "\t\tgetxattr <path> <name>\n");
+    fprintf(stderr, "\t\ttruncate <path> <size>\n");
+    fprintf(stderr, "\t\tchmod <path> <mode>\n");
+    exit(EINVAL);
+}
+
+/* Add an operation to a stream */
+static void
+lc_replayAdd(struct rstream *rs, enum lc_replayOp type, const char *path,
+             const char *arg, uint64_t off, uint64_t len) {
+    struct rop *op;
+
+    if (rs->rs_count == rs->rs_size) {
+        rs->rs_size = rs->rs_size ? rs->rs_size * 2 : 1024;
+        rs->rs_ops = realloc(rs->rs_ops, sizeof(struct rop) * rs->rs_size);
+        assert(rs->rs_ops);
+    }
+    op = &rs->rs_ops[rs->rs_count++];
+    op->ro_op = type;
+    op->ro_path = strdup(path);
+    op->ro_arg = arg ? strdup(arg) : NULL;
+    op->ro_off = off;
+    op->ro_len = len;
+}
+
+/* Free a stream */
+static void
+lc_replayFreeStream(struct rstream *rs) {
+    uint64_t i;
+
+    for (i = 0; i < rs->rs_count; i++) {
+        free(rs->rs_ops[i].ro_path);
+        free(rs->rs_ops[i].ro_arg);
+    }
+    free(rs->rs_ops);
+    rs->rs_ops = NULL;
+    rs->rs_count = 0;
+    rs->rs_size = 0;
+}
+
+/* Print a stream in the format streams are read from files */
+static void
+lc_replayPrint(struct rstream *rs) {
+    struct rop *op;
+    uint64_t i;
+
+    for (i = 0; i < rs->rs_count; i++) {
+        op = &rs->rs_ops[i];
+        printf("%s", lc_replayOps[op->ro_op]);
+        switch (op->ro_op) {
+        case LC_REPLAY_MKDIR:
+        case LC_REPLAY_CREATE:
+            printf(" %s %lo\n", op->ro_path, op->ro_off);
+            break;
+
+        case LC_REPLAY_READ:
+        case LC_REPLAY_WRITE:
+            printf(" %s %ld %ld\n", op->ro_path, op->ro_off, op->ro_len);
+            break;
+
+        case LC_REPLAY_RENAME:
+        case LC_REPLAY_LINK:
+            printf(" %s %s\n", op->ro_path, op->ro_arg);
+            break;
+
+        case LC_REPLAY_SYMLINK:
+            printf(" %s %s\n", op->ro_arg, op->ro_path);
+            break;
+
+        case LC_REPLAY_SETXATTR:
+            printf(" %s %s %ld\n", op->ro_path, op->ro_arg, op->ro_len);
+            break;
+
+        case LC_REPLAY_GETXATTR:
+            printf(" %s %s\n", op->ro_path, op->ro_arg);
+            break;
+
+        case LC_REPLAY_TRUNCATE:
+            printf(" %s %ld\n", op->ro_path, op->ro_off);
+            break;
+
+        case LC_REPLAY_CHMOD:
+            printf(" %s %lo\n", op->ro_path, op->ro_off);
+            break;
+
+        default:
+            printf(" %s\n", op->ro_path);
+        }
+    }
+}
+
+/* Read a stream from a file */
+static int
+lc_replayRead(struct rstream *rs, char *file) {
+    char line[LC_REPLAY_PATH * 3], name[32], a1[LC_REPLAY_PATH];
+    char a2[LC_REPLAY_PATH], a3[LC_REPLAY_PATH];
+    enum lc_replayOp type;
+    int count, lineno = 0;
+    FILE *fp;
+
+    fp = fopen(file, "r");
+    if (fp == NULL) {
+        perror("fopen");
+        return errno;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        a1[0] = 0;
+        a2[0] = 0;
+        a3[0] = 0;
+        count = sscanf(line, "%31s %255s %255s %255s", name, a1, a2, a3);
+        if ((count <= 0) || (name[0] == '#')) {
+            continue;
+        }
+        for (type = 0; type < LC_REPLAY_MAX; type++) {
+            if (!strcmp(name, lc_replayOps[type])) {
+                break;
+            }
+        }
+        if ((type == LC_REPLAY_MAX) || (count < 2)) {
+            fprintf(stderr, "%s:%d: invalid operation\n", file, lineno);
+            fclose(fp);
+            return EINVAL;
+        }
+        switch (type) {
+        case LC_REPLAY_MKDIR:
+            lc_replayAdd(rs, type, a1, NULL,
+                         (count > 2) ? strtoull(a2, NULL, 8) : 0755, 0);
+            break;
+
+        case LC_REPLAY_CREATE:
+            lc_replayAdd(rs, type, a1, NULL,
+                         (count > 2) ? strtoull(a2, NULL, 8) : 0644, 0);
+            break;
+
+        case LC_REPLAY_READ:
+        case LC_REPLAY_WRITE:
+            lc_replayAdd(rs, type, a1, NULL, strtoull(a2, NULL, 0),
+                         strtoull(a3, NULL, 0));
+            break;
+
+        case LC_REPLAY_RENAME:
+        case LC_REPLAY_LINK:
+        case LC_REPLAY_GETXATTR:
+            lc_replayAdd(rs, type, a1, a2, 0, 0);
+            break;
+
+        case LC_REPLAY_SYMLINK:
+            lc_replayAdd(rs, type, a2, a1, 0, 0);
+            break;
+
+        case LC_REPLAY_SETXATTR:
+            lc_replayAdd(rs, type, a1, a2, 0, strtoull(a3, NULL, 0));
+            break;
+
+        case LC_REPLAY_TRUNCATE:
+            lc_replayAdd(rs, type, a1, NULL, strtoull(a2, NULL, 0), 0);
+            break;
+
+        case LC_REPLAY_CHMOD:
+            lc_replayAdd(rs, type, a1, NULL, strtoull(a2, NULL, 8), 0);
+            break;
+
+        default:
+            lc_replayAdd(rs, type, a1, NULL, 0, 0);
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* Pick size of a file, most files in images being small */
+static uint64_t
+lc_replayFileSize(unsigned int *seed) {
+    int r = rand_r(seed) % 100;
+
+    if (r < 40) {
+        return rand_r(seed) % 4096;
+    }
+    if (r < 80) {
+        return 4096 + (rand_r(seed) % (60 * 1024));
+    }
+    if (r < 95) {
+        return (64 * 1024) + (rand_r(seed) % (448 * 1024));
+    }
+    return (512 * 1024) + (rand_r(seed) % (512 * 1024));
+}
+
+/* Path of a file in a layer extracted */
+static void
+lc_replayTreePath(char *path, uint64_t i) {
+    uint64_t dir = i / LC_REPLAY_FILES;
+
+    snprintf(path, LC_REPLAY_PATH, "usr/d%ld/s%ld/f%ld", dir / 16, dir % 16, i);
+}
+
+/* Extract a layer the way docker does while pulling an image.  Sizes of
+ * regular files are returned, zero for links.
+ */
+static void
+lc_replayUntar(struct rstream *rs, uint64_t count, uint64_t *sizes) {
+    char path[LC_REPLAY_PATH], arg[LC_REPLAY_PATH];
+    unsigned int seed = 1;
+    uint64_t i, dir, size;
+    int r;
+
+    lc_replayAdd(rs, LC_REPLAY_MKDIR, "usr", NULL, 0755, 0);
+    for (i = 0; i < count; i++) {
+
+        /* Create directories as the first file in those are extracted */
+        dir = i / LC_REPLAY_FILES;
+        if ((i % LC_REPLAY_FILES) == 0) {
+            if ((dir % 16) == 0) {
+                snprintf(path, sizeof(path), "usr/d%ld", dir / 16);
+                lc_replayAdd(rs, LC_REPLAY_MKDIR, path, NULL, 0755, 0);
+            }
+            snprintf(path, sizeof(path), "usr/d%ld/s%ld", dir / 16, dir % 16);
+            lc_replayAdd(rs, LC_REPLAY_MKDIR, path, NULL, 0755, 0);
+        }
+        lc_replayTreePath(path, i);
+        sizes[i] = 0;
+        r = rand_r(&seed) % 100;
+        if ((r < 5) && (i % LC_REPLAY_FILES)) {
+            snprintf(arg, sizeof(arg), "f%ld", i - 1);
+            lc_replayAdd(rs, LC_REPLAY_SYMLINK, path, arg, 0, 0);
+            continue;
+        }
+        if ((r < 6) && (i % LC_REPLAY_FILES)) {
+            lc_replayTreePath(arg, i - 1);
+            lc_replayAdd(rs, LC_REPLAY_LINK, arg, path, 0, 0);
+            continue;
+        }
+        size = lc_replayFileSize(&seed);
+        lc_replayAdd(rs, LC_REPLAY_CREATE, path, NULL, 0600, 0);
+        if (size) {
+            lc_replayAdd(rs, LC_REPLAY_WRITE, path, NULL, 0, size);
+        }
+        if (r < 15) {
+            lc_replayAdd(rs, LC_REPLAY_SETXATTR, path, "security.capability",
+                         0, 20);
+        }
+        lc_replayAdd(rs, LC_REPLAY_CLOSE, path, NULL, 0, 0);
+        lc_replayAdd(rs, LC_REPLAY_CHMOD, path, NULL,
+                     (r < 30) ? 0755 : 0644, 0);
+        sizes[i] = size;
+    }
+}
+
+/* Create, stat, read and remove small files */
+static void
+lc_replaySmallFiles(struct rstream *rs, uint64_t count) {
+    char path[LC_REPLAY_PATH];
+    unsigned int seed = 1;
+    uint64_t i, size;
+
+    for (i = 0; i < count; i++) {
+        if ((i % LC_REPLAY_FILES) == 0) {
+            snprintf(path, sizeof(path), "s%ld", i / LC_REPLAY_FILES);
+            lc_replayAdd(rs, LC_REPLAY_MKDIR, path, NULL, 0755, 0);
+        }
+        snprintf(path, sizeof(path), "s%ld/f%ld", i / LC_REPLAY_FILES, i);
+        size = rand_r(&seed) % (2 * LC_BLOCK_SIZE);
+        lc_replayAdd(rs, LC_REPLAY_CREATE, path, NULL, 0644, 0);
+        lc_replayAdd(rs, LC_REPLAY_WRITE, path, NULL, 0, size + 1);
+        lc_replayAdd(rs, LC_REPLAY_CLOSE, path, NULL, 0, 0);
+    }
+    for (i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "s%ld/f%ld", i / LC_REPLAY_FILES, i);
+        lc_replayAdd(rs, LC_REPLAY_STAT, path, NULL, 0, 0);
+        lc_replayAdd(rs, LC_REPLAY_OPEN, path, NULL, 0, 0);
+        lc_replayAdd(rs, LC_REPLAY_READ, path, NULL, 0, 2 * LC_BLOCK_SIZE);
+        lc_replayAdd(rs, LC_REPLAY_CLOSE, path, NULL, 0, 0);
+    }
+    for (i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "s%ld/f%ld", i / LC_REPLAY_FILES, i);
+        lc_replayAdd(rs, LC_REPLAY_UNLINK, path, NULL, 0, 0);
+        if ((i % LC_REPLAY_FILES) == (LC_REPLAY_FILES - 1)) {
+            snprintf(path, sizeof(path), "s%ld", i / LC_REPLAY_FILES);
+            lc_replayAdd(rs, LC_REPLAY_RMDIR, path, NULL, 0, 0);
+        }
+    }
+}
+
+/* Start a container, looking up every file and reading some of those */
+static void
+lc_replayStart(struct rstream *rs, uint64_t count, uint64_t *sizes) {
+    char path[LC_REPLAY_PATH];
+    uint64_t i, dir;
+
+    for (i = 0; i < count; i++) {
+        if ((i % LC_REPLAY_FILES) == 0) {
+            dir = i / LC_REPLAY_FILES;
+            snprintf(path, sizeof(path), "usr/d%ld/s%ld", dir / 16, dir % 16);
+            lc_replayAdd(rs, LC_REPLAY_READDIR, path, NULL, 0, 0);
+        }
+        lc_replayTreePath(path, i);
+        lc_replayAdd(rs, LC_REPLAY_STAT, path, NULL, 0, 0);
+        if (sizes[i] && ((i % 4) == 0)) {
+            lc_replayAdd(rs, LC_REPLAY_OPEN, path, NULL, 0, 0);
+            lc_replayAdd(rs, LC_REPLAY_GETXATTR, path, "security.capability",
+                         0, 0);
+            lc_replayAdd(rs, LC_REPLAY_READ, path, NULL, 0, sizes[i]);
+            lc_replayAdd(rs, LC_REPLAY_CLOSE, path, NULL, 0, 0);
+        }
+    }
+}
+
+/* Build an image, creating new files and modifying some existing ones */
+static void
+lc_replayBuild(struct rstream *rs, uint64_t count, uint64_t *sizes) {
+    char path[LC_REPLAY_PATH], arg[LC_REPLAY_PATH];
+    uint64_t i;
+
+    lc_replayAdd(rs, LC_REPLAY_MKDIR, "build", NULL, 0755, 0);
+    for (i = 0; i < count; i++) {
+
+        /* Write a temporary file and rename it in place */
+        snprintf(path, sizeof(path), "build/.tmp%ld", i);
+        snprintf(arg, sizeof(arg), "build/o%ld", i);
+        lc_replayAdd(rs, LC_REPLAY_CREATE, path, NULL, 0600, 0);
+        lc_replayAdd(rs, LC_REPLAY_WRITE, path, NULL, 0, 2 * LC_BLOCK_SIZE);
+        lc_replayAdd(rs, LC_REPLAY_FSYNC, path, NULL, 0, 0);
+        lc_replayAdd(rs, LC_REPLAY_CLOSE, path, NULL, 0, 0);
+        lc_replayAdd(rs, LC_REPLAY_RENAME, path, arg, 0, 0);
+        lc_replayAdd(rs, LC_REPLAY_CHMOD, arg, NULL, 0755, 0);
+        lc_replayAdd(rs, LC_REPLAY_STAT, arg, NULL, 0, 0);
+
+        /* Rewrite or remove some of the files in the base layer */
+        if (sizes[i] && ((i % 8) == 0)) {
+            lc_replayTreePath(path, i);
+            lc_replayAdd(rs, LC_REPLAY_OPEN, path, NULL, 0, 0);
+            lc_replayAdd(rs, LC_REPLAY_TRUNCATE, path, NULL, 0, 0);
+            lc_replayAdd(rs, LC_REPLAY_WRITE, path, NULL, 0, sizes[i]);
+            lc_replayAdd(rs, LC_REPLAY_CLOSE, path, NULL, 0, 0);
+        } else if (sizes[i] && ((i % 8) == 1)) {
+            lc_replayTreePath(path, i);
+            lc_replayAdd(rs, LC_REPLAY_UNLINK, path, NULL, 0, 0);
+        }
+    }
+    lc_replayAdd(rs, LC_REPLAY_READDIR, "build", NULL, 0, 0);
+}
+
+/* Initialize a request */
+static inline void
+lc_replayRequest(struct rthread *rt, struct fuse_req *req) {
+    memset(req, 0, sizeof(struct fuse_req));
+    req->r_ctx.pid = getpid();
+    req->r_ctx.umask = 022;
+    rt->rt_requests++;
+}
+
+/* Hash a path for the name cache */
+static inline int
+lc_replayHash(const char *path) {
+    uint32_t hash = 5381;
+
+    while (*path) {
+        hash = (hash * 33) + *path++;
+    }
+    return hash % LC_REPLAY_NCACHE;
+}
+
+/* Look up a path in the name cache */
+static struct rname *
+lc_replayCached(struct rthread *rt, const char *path) {
+    struct rname *rn = rt->rt_names[lc_replayHash(path)];
+
+    while (rn && strcmp(rn->rn_path, path)) {
+        rn = rn->rn_next;
+    }
+    return rn;
+}
+
+/* Add a path to the name cache */
+static struct rname *
+lc_replayCache(struct rthread *rt, const char *path, fuse_ino_t ino) {
+    int hash = lc_replayHash(path);
+    struct rname *rn;
+
+    rn = malloc(sizeof(struct rname));
+    assert(rn);
+    memset(rn, 0, sizeof(struct rname));
+    rn->rn_path = strdup(path);
+    rn->rn_ino = ino;
+    rn->rn_next = rt->rt_names[hash];
+    rt->rt_names[hash] = rn;
+    return rn;
+}
+
+/* Close a file, sending flush and release like the kernel does */
+static void
+lc_replayClose(struct rthread *rt, struct rname *rn) {
+    struct fuse_req req;
+
+    assert(rn->rn_open);
+    lc_replayRequest(rt, &req);
+    lc_ll_oper.flush(&req, rn->rn_ino, &rn->rn_fi);
+    lc_replayRequest(rt, &req);
+    lc_ll_oper.release(&req, rn->rn_ino, &rn->rn_fi);
+    rn->rn_open = false;
+}
+
+/* Remove a path from the name cache, closing the file if open */
+static void
+lc_replayForget(struct rthread *rt, const char *path) {
+    struct rname **prev = &rt->rt_names[lc_replayHash(path)], *rn;
+
+    while ((rn = *prev)) {
+        if (!strcmp(rn->rn_path, path)) {
+            *prev = rn->rn_next;
+            if (rn->rn_open) {
+                lc_replayClose(rt, rn);
+            }
+            free(rn->rn_path);
+            free(rn);
+            return;
+        }
+        prev = &rn->rn_next;
+    }
+}
+
+static struct rname *lc_replayResolve(struct rthread *rt, const char *path);
+
+/* Return the parent directory of a path and the last component */
+static fuse_ino_t
+lc_replayParent(struct rthread *rt, const char *path, const char **name) {
+    char dir[LC_REPLAY_PATH];
+    char *slash = strrchr(path, '/');
+    struct rname *rn;
+
+    if (slash == NULL) {
+        *name = path;
+        return rt->rt_root;
+    }
+    *name = slash + 1;
+    memcpy(dir, path, slash - path);
+    dir[slash - path] = 0;
+    rn = lc_replayResolve(rt, dir);
+    return rn ? rn->rn_ino : 0;
+}
+
+/* Return the cached name for a path, looking up components not cached */
+static struct rname *
+lc_replayResolve(struct rthread *rt, const char *path) {
+    struct rname *rn = lc_replayCached(rt, path);
+    struct fuse_req req;
+    const char *name;
+    fuse_ino_t parent;
+
+    if (rn) {
+        return rn;
+    }
+    parent = lc_replayParent(rt, path, &name);
+    if (parent == 0) {
+        return NULL;
+    }
+    lc_replayRequest(rt, &req);
+    lc_ll_oper.lookup(&req, parent, name);
+    return req.r_err ? NULL : lc_replayCache(rt, path, req.r_ino);
+}
+
+/* Open a file if not open already, returning true if opened */
+static bool
+lc_replayOpen(struct rthread *rt, struct rname *rn, int *err) {
+    struct fuse_req req;
+
+    if (rn->rn_open) {
+        return false;
+    }
+    lc_replayRequest(rt, &req);
+    memset(&rn->rn_fi, 0, sizeof(struct fuse_file_info));
+    rn->rn_fi.flags = O_RDWR;
+    lc_ll_oper.open(&req, rn->rn_ino, &rn->rn_fi);
+    *err = req.r_err;
+    if (req.r_err == 0) {
+        rn->rn_fi.fh = req.r_fh;
+        rn->rn_open = true;
+    }
+    return rn->rn_open;
+}
+
+/* Read or write a range of a file, split the way the kernel does */
+static int
+lc_replayIO(struct rthread *rt, struct rname *rn, struct rop *op) {
+    struct fuse_bufvec bufv;
+    uint64_t off, end;
+    struct fuse_req req;
+    bool opened;
+    size_t size;
+    int err = 0;
+
+    opened = lc_replayOpen(rt, rn, &err);
+    if (err) {
+        return err;
+    }
+    end = op->ro_off + op->ro_len;
+    for (off = op->ro_off; off < end; off += size) {
+        size = end - off;
+        if (size > LC_REPLAY_IOSIZE) {
+            size = LC_REPLAY_IOSIZE;
+        }
+        lc_replayRequest(rt, &req);
+        if (op->ro_op == LC_REPLAY_WRITE) {
+            bufv = FUSE_BUFVEC_INIT(size);
+            bufv.buf[0].mem = rt->rt_buf;
+            lc_ll_oper.write_buf(&req, rn->rn_ino, &bufv, off, &rn->rn_fi);
+        } else {
+            lc_ll_oper.read(&req, rn->rn_ino, size, off, &rn->rn_fi);
+        }
+        if (req.r_err) {
+            err = req.r_err;
+            break;
+        }
+
+        /* Stop reading at the end of the file */
+        if (req.r_size < size) {
+            break;
+        }
+    }
+    if (opened) {
+        lc_replayClose(rt, rn);
+    }
+    return err;
+}
+
+/* Read all entries of a directory */
+static int
+lc_replayReaddir(struct rthread *rt, struct rname *rn) {
+    struct fuse_file_info fi;
+    struct fuse_req req;
+    off_t off = 0;
+    int err;
+
+    memset(&fi, 0, sizeof(struct fuse_file_info));
+    lc_replayRequest(rt, &req);
+    lc_ll_oper.opendir(&req, rn->rn_ino, &fi);
+    if (req.r_err) {
+        return req.r_err;
+    }
+    fi.fh = req.r_fh;
+    do {
+        lc_replayRequest(rt, &req);
+        req.r_readdir = true;
+        lc_ll_oper.readdir(&req, rn->rn_ino, LC_REPLAY_BUFSIZE, off, &fi);
+        off = req.r_off;
+    } while ((req.r_err == 0) && req.r_size);
+    err = req.r_err;
+    lc_replayRequest(rt, &req);
+    lc_ll_oper.releasedir(&req, rn->rn_ino, &fi);
+    return err;
+}
+
+/* Change size or mode of a file */
+static int
+lc_replaySetattr(struct rthread *rt, struct rname *rn, struct rop *op) {
+    struct fuse_req req;
+    struct stat st;
+
+    memset(&st, 0, sizeof(struct stat));
+    lc_replayRequest(rt, &req);
+    if (op->ro_op == LC_REPLAY_TRUNCATE) {
+        st.st_size = op->ro_off;
+        lc_ll_oper.setattr(&req, rn->rn_ino, &st, FUSE_SET_ATTR_SIZE,
+                           rn->rn_open ? &rn->rn_fi : NULL);
+    } else {
+
+        /* Mode recorded does not include the type of the file */
+        lc_ll_oper.getattr(&req, rn->rn_ino, NULL);
+        if (req.r_err) {
+            return req.r_err;
+        }
+        st.st_mode = (req.r_mode & S_IFMT) | (op->ro_off & ~S_IFMT);
+        lc_replayRequest(rt, &req);
+        lc_ll_oper.setattr(&req, rn->rn_ino, &st, FUSE_SET_ATTR_MODE, NULL);
+    }
+    return req.r_err;
+}
+
+/* Replay an operation which creates or removes a name */
+static int
+lc_replayNamespace(struct rthread *rt, struct rop *op) {
+    const char *name, *newname;
+    struct fuse_file_info fi;
+    fuse_ino_t parent, dir;
+    struct fuse_req req;
+    struct rname *rn;
+
+    parent = lc_replayParent(rt, op->ro_path, &name);
+    if (parent == 0) {
+        return ENOENT;
+    }
+    lc_replayRequest(rt, &req);
+    switch (op->ro_op) {
+    case LC_REPLAY_MKDIR:
+        lc_ll_oper.mkdir(&req, parent, name, op->ro_off);
+        break;
+
+    case LC_REPLAY_CREATE:
+        memset(&fi, 0, sizeof(struct fuse_file_info));
+        fi.flags = O_CREAT | O_WRONLY | O_TRUNC;
+        lc_ll_oper.create(&req, parent, name, S_IFREG | op->ro_off, &fi);
+        if (req.r_err == 0) {
+            lc_replayForget(rt, op->ro_path);
+            rn = lc_replayCache(rt, op->ro_path, req.r_ino);
+            rn->rn_fi = fi;
+            rn->rn_fi.fh = req.r_fh;
+            rn->rn_open = true;
+        }
+        return req.r_err;
+
+    case LC_REPLAY_SYMLINK:
+        lc_ll_oper.symlink(&req, op->ro_arg, parent, name);
+        break;
+
+    case LC_REPLAY_UNLINK:
+    case LC_REPLAY_RMDIR:
+        lc_replayForget(rt, op->ro_path);
+        if (op->ro_op == LC_REPLAY_UNLINK) {
+            lc_ll_oper.unlink(&req, parent, name);
+        } else {
+            lc_ll_oper.rmdir(&req, parent, name);
+        }
+        return req.r_err;
+
+    case LC_REPLAY_RENAME:
+        dir = lc_replayParent(rt, op->ro_arg, &newname);
+        if (dir == 0) {
+            return ENOENT;
+        }
+        lc_replayForget(rt, op->ro_path);
+        lc_replayForget(rt, op->ro_arg);
+        lc_ll_oper.rename(&req, parent, name, dir, newname, 0);
+        return req.r_err;
+
+    default:
+        assert(0);
+    }
+    if (req.r_err == 0) {
+        lc_replayCache(rt, op->ro_path, req.r_ino);
+    }
+    return req.r_err;
+}
+
+/* Replay an operation */
+static int
+lc_replayOp(struct rthread *rt, struct rop *op) {
+    struct fuse_req req;
+    const char *name;
+    fuse_ino_t parent;
+    struct rname *rn;
+    int err = 0;
+
+    switch (op->ro_op) {
+    case LC_REPLAY_MKDIR:
+    case LC_REPLAY_CREATE:
+    case LC_REPLAY_SYMLINK:
+    case LC_REPLAY_UNLINK:
+    case LC_REPLAY_RMDIR:
+    case LC_REPLAY_RENAME:
+        return lc_replayNamespace(rt, op);
+
+    default:
+        break;
+    }
+    rn = lc_replayResolve(rt, op->ro_path);
+    if (rn == NULL) {
+        return ENOENT;
+    }
+    switch (op->ro_op) {
+    case LC_REPLAY_OPEN:
+        lc_replayOpen(rt, rn, &err);
+        break;
+
+    case LC_REPLAY_CLOSE:
+        if (rn->rn_open) {
+            lc_replayClose(rt, rn);
+        }
+        break;
+
+    case LC_REPLAY_READ:
+    case LC_REPLAY_WRITE:
+        err = lc_replayIO(rt, rn, op);
+        break;
+
+    case LC_REPLAY_STAT:
+        lc_replayRequest(rt, &req);
+        lc_ll_oper.getattr(&req, rn->rn_ino, NULL);
+        err = req.r_err;
+        break;
+
+    case LC_REPLAY_READDIR:
+        err = lc_replayReaddir(rt, rn);
+        break;
+
+    case LC_REPLAY_LINK:
+        parent = lc_replayParent(rt, op->ro_arg, &name);
+        if (parent == 0) {
+            return ENOENT;
+        }
+        lc_replayRequest(rt, &req);
+        lc_ll_oper.link(&req, rn->rn_ino, parent, name);
+        err = req.r_err;
+        if (err == 0) {
+            lc_replayCache(rt, op->ro_arg, req.r_ino);
+        }
+        break;
+
+    case LC_REPLAY_SETXATTR:
+        lc_replayRequest(rt, &req);
+        lc_ll_oper.setxattr(&req, rn->rn_ino, op->ro_arg, rt->rt_buf,
+                            op->ro_len, 0);
+        err = req.r_err;
+        break;
+
+    case LC_REPLAY_GETXATTR:
+        lc_replayRequest(rt, &req);
+        lc_ll_oper.getxattr(&req, rn->rn_ino, op->ro_arg, LC_REPLAY_BUFSIZE);
+        err = (req.r_err == ENODATA) ? 0 : req.r_err;
+        break;
+
+    case LC_REPLAY_TRUNCATE:
+    case LC_REPLAY_CHMOD:
+        err = lc_replaySetattr(rt, rn, op);
+        break;
+
+    case LC_REPLAY_FSYNC:
+        if (rn->rn_open) {
+            lc_replayRequest(rt, &req);
+            lc_ll_oper.fsync(&req, rn->rn_ino, 0, &rn->rn_fi);
+            err = req.r_err;
+        }
+        break;
+
+    default:
+        assert(0);
+    }
+    return err;
+}
+
+/* Replay a stream, accounting time spent on each operation if timed */
+static void
+lc_replayStream(struct rthread *rt, struct rstream *rs, bool timed) {
+    uint64_t i, start;
+    struct rop *op;
+
+    for (i = 0; i < rs->rs_count; i++) {
+        op = &rs->rs_ops[i];
+        start = timed ? lc_traceNow() : 0;
+        if (lc_replayOp(rt, op)) {
+            rt->rt_errors++;
+        }
+        if (timed) {
+            rt->rt_nsec[op->ro_op] += lc_traceNow() - start;
+            rt->rt_count[op->ro_op]++;
+        }
+    }
+}
+
+/* Close files left open and free the name cache of a thread */
+static void
+lc_replayFreeNames(struct rthread *rt) {
+    struct rname *rn;
+    int i;
+
+    for (i = 0; i < LC_REPLAY_NCACHE; i++) {
+        while ((rn = rt->rt_names[i])) {
+            rt->rt_names[i] = rn->rn_next;
+            if (rn->rn_open) {
+                lc_replayClose(rt, rn);
+            }
+            free(rn->rn_path);
+            free(rn);
+        }
+    }
+}
+
+/* Replay streams from a thread in a directory of its own */
+static void *
+lc_replayThread(void *data) {
+    struct rthread *rt = (struct rthread *)data;
+    struct fuse_req req;
+    char name[32];
+    uint64_t i;
+
+    rt->rt_buf = malloc(LC_REPLAY_IOSIZE);
+    assert(rt->rt_buf);
+    for (i = 0; i < LC_REPLAY_IOSIZE; i++) {
+        rt->rt_buf[i] = i;
+    }
+    snprintf(name, sizeof(name), "t%d", rt->rt_id);
+    lc_replayRequest(rt, &req);
+    lc_ll_oper.mkdir(&req, lc_replayDir, name, 0755);
+    assert(req.r_err == 0);
+    rt->rt_root = req.r_ino;
+    lc_replayStream(rt, rt->rt_setup, false);
+    rt->rt_requests = 0;
+    rt->rt_errors = 0;
+
+    /* Start replaying streams at the same time in all threads */
+    pthread_barrier_wait(&lc_replayBarrier);
+    lc_replayStream(rt, rt->rt_run, true);
+    pthread_barrier_wait(&lc_replayBarrier);
+    lc_replayFreeNames(rt);
+    free(rt->rt_buf);
+    return NULL;
+}
+
+/* Run background threads the same way the daemon does */
+static void *
+lc_replayBackground(void *data) {
+    struct gfs *gfs = (struct gfs *)data;
+    pthread_t flusher, syncer;
+    int err;
+
+    err = pthread_create(&flusher, NULL, lc_flusher, gfs);
+    assert(err == 0);
+    err = pthread_create(&syncer, NULL, lc_syncer, gfs);
+    assert(err == 0);
+    lc_cleaner();
+    pthread_cond_signal(&gfs->gfs_flusherCond);
+    pthread_cond_signal(&gfs->gfs_syncerCond);
+    pthread_join(syncer, NULL);
+    pthread_join(flusher, NULL);
+    return NULL;
+}
+
+/* Set up the file system on the image the same way the daemon does, and let
+ * handlers know both mounts are ready.
+ */
+static void
+lc_replayMount(int fd, char *path, size_t size, bool format, bool swap) {
+    struct fuse_conn_info conn;
+    int i, err;
+
+    gfs = lc_malloc(NULL, sizeof(struct gfs), LC_MEMTYPE_GFS);
+    memset(gfs, 0, sizeof(struct gfs));
+    gfs->gfs_fd = fd;
+    gfs->gfs_swapLayersForCommit = swap;
+    if (lc_replayDevice) {
+        lc_deviceEmulate(gfs, lc_replayDevice);
+    }
+    lc_mount(gfs, path, false, size, format);
+    memset(&conn, 0, sizeof(struct fuse_conn_info));
+    for (i = 0; i < LC_MAX_MOUNTS; i++) {
+        lc_ll_oper.init(gfs, &conn);
+    }
+    err = pthread_create(&lc_replayCleaner, NULL, lc_replayBackground, gfs);
+    if (err) {
+        perror("pthread_create");
+        exit(err);
+    }
+}
+
+/* Stop background threads and unmount the file system */
+static void
+lc_replayUnmount() {
+    int i;
+
+    gfs->gfs_unmounting = true;
+    pthread_mutex_lock(&gfs->gfs_lock);
+    pthread_cond_signal(&gfs->gfs_cleanerCond);
+    pthread_mutex_unlock(&gfs->gfs_lock);
+    pthread_join(lc_replayCleaner, NULL);
+    for (i = 0; i < LC_MAX_MOUNTS; i++) {
+        lc_ll_oper.destroy(gfs);
+    }
+    lc_free(NULL, gfs, sizeof(struct gfs), LC_MEMTYPE_GFS);
+    gfs = NULL;
+}
+
+/* Print results of replaying a stream */
+static void
+lc_replayReport(const char *stream, struct rthread *rt, int threads,
+                uint64_t elapsed) {
+    uint64_t ops = 0, requests = 0, errors = 0, count, nsec;
+    enum lc_replayOp type;
+    int i;
+
+    if (elapsed == 0) {
+        elapsed = 1;
+    }
+    for (i = 0; i < threads; i++) {
+        for (type = 0; type < LC_REPLAY_MAX; type++) {
+            ops += rt[i].rt_count[type];
+        }
+        requests += rt[i].rt_requests;
+        errors += rt[i].rt_errors;
+    }
+    printf("{\"replay\": \"%s\", \"threads\": %d, \"ops\": %ld, "
+           "\"requests\": %ld, \"errors\": %ld, \"nsec\": %ld, "
+           "\"ops_per_sec\": %.0f, \"requests_per_sec\": %.0f}\n",
+           stream, threads, ops, requests, errors, elapsed,
+           ((double)ops * 1000000000.0) / elapsed,
+           ((double)requests * 1000000000.0) / elapsed);
+    for (type = 0; type < LC_REPLAY_MAX; type++) {
+        count = 0;
+        nsec = 0;
+        for (i = 0; i < threads; i++) {
+            count += rt[i].rt_count[type];
+            nsec += rt[i].rt_nsec[type];
+        }
+        if (count) {
+            printf("{\"replay\": \"%s\", \"op\": \"%s\", \"count\": %ld, "
+                   "\"nsec_per_op\": %.1f}\n", stream, lc_replayOps[type],
+                   count, (double)nsec / count);
+        }
+    }
+    fflush(stdout);
+}
+
+/* Replay a stream from all threads */
+static void
+lc_replayThreads(const char *stream, struct rstream *setup,
+                 struct rstream *run, int threads) {
+    uint64_t start, elapsed;
+    struct rthread *rt;
+    struct fuse_req req;
+    int i, err;
+
+    rt = malloc(sizeof(struct rthread) * threads);
+    assert(rt);
+    memset(rt, 0, sizeof(struct rthread) * threads);
+    memset(&req, 0, sizeof(struct fuse_req));
+    lc_ll_oper.mkdir(&req, LC_ROOT_INODE, LC_REPLAY_DIR, 0755);
+    assert(req.r_err == 0);
+    lc_replayDir = req.r_ino;
+    pthread_barrier_init(&lc_replayBarrier, NULL, threads + 1);
+    for (i = 0; i < threads; i++) {
+        rt[i].rt_id = i;
+        rt[i].rt_setup = setup;
+        rt[i].rt_run = run;
+        err = pthread_create(&rt[i].rt_thread, NULL, lc_replayThread, &rt[i]);
+        if (err) {
+            perror("pthread_create");
+            exit(err);
+        }
+    }
+    pthread_barrier_wait(&lc_replayBarrier);
+    start = lc_traceNow();
+    pthread_barrier_wait(&lc_replayBarrier);
+    elapsed = lc_traceNow() - start;
+    for (i = 0; i < threads; i++) {
+        pthread_join(rt[i].rt_thread, NULL);
+    }
+    lc_replayReport(stream, rt, threads, elapsed);
+    pthread_barrier_destroy(&lc_replayBarrier);
+    free(rt);
+}
+
+/* Record time taken by a step of the lifecycle of a container */
+static void
+lc_replayStep(struct rthread *rt, enum lc_replayStep step, uint64_t start) {
+    struct rsample *rs = &rt->rt_steps[step];
+
+    if (rs->rs_count == rs->rs_size) {
+        rs->rs_size = rs->rs_size ? rs->rs_size * 2 : 64;
+        rs->rs_nsec = realloc(rs->rs_nsec, sizeof(uint64_t) * rs->rs_size);
+        assert(rs->rs_nsec);
+    }
+    rs->rs_nsec[rs->rs_count++] = lc_traceNow() - start;
+}
+
+/* Issue an ioctl on the layer root directory the way the docker plugin does,
+ * passing names of the parent layer and the layer as "parent/layer".  Layers
+ * are defragmented the way the lcfs command does, without a rate limit.
+ */
+static int
+lc_replayIoctl(struct rthread *rt, enum ioctl_cmd cmd, const char *parent,
+               const char *layer) {
+    char name[LC_REPLAY_PATH];
+    struct fuse_file_info fi;
+    struct ldefrag defrag;
+    struct fuse_req req;
+    size_t plen = 0;
+    int len = 0;
+
+    if (parent) {
+        plen = strlen(parent);
+        len = snprintf(name, sizeof(name), "%s/%s", parent, layer);
+    } else if (layer) {
+        len = snprintf(name, sizeof(name), "%s", layer);
+    }
+    memset(&fi, 0, sizeof(struct fuse_file_info));
+    lc_replayRequest(rt, &req);
+    if (cmd == LAYER_DEFRAG) {
+        memset(&defrag, 0, sizeof(struct ldefrag));
+        assert(len < sizeof(defrag.d_name));
+        memcpy(defrag.d_name, name, len);
+        lc_ll_oper.ioctl(&req, gfs->gfs_layerRoot,
+                         _IOW(0, LAYER_DEFRAG, defrag), NULL, &fi, 0,
+                         &defrag, sizeof(struct ldefrag), 0);
+    } else {
+        lc_ll_oper.ioctl(&req, gfs->gfs_layerRoot,
+                         len ? _IOC(_IOC_WRITE, plen, cmd, len) : _IO(0, cmd),
+                         NULL, &fi, 0, len ? name : NULL, len, 0);
+    }
+    if (req.r_err) {
+        rt->rt_errors++;
+    }
+    return req.r_err;
+}
+
+/* Look up a name in a directory */
+static fuse_ino_t
+lc_replayLookup(struct rthread *rt, fuse_ino_t parent, const char *name) {
+    struct fuse_req req;
+
+    lc_replayRequest(rt, &req);
+    lc_ll_oper.lookup(&req, parent, name);
+    if (req.r_err) {
+        rt->rt_errors++;
+        return 0;
+    }
+    return req.r_ino;
+}
+
+/* Replay a stream in a directory */
+static void
+lc_replayIn(struct rthread *rt, fuse_ino_t dir, struct rstream *rs) {
+    if (dir) {
+        rt->rt_root = dir;
+        lc_replayStream(rt, rs, false);
+        lc_replayFreeNames(rt);
+    }
+}
+
+/* Create a read-only layer of the image and extract files to it */
+static void
+lc_replayImageLayer(struct rthread *rt, int i) {
+    char layer[32], parent[32], dir[32];
+    struct fuse_req req;
+    fuse_ino_t root;
+    uint64_t start;
+
+    snprintf(layer, sizeof(layer), "img%d", i);
+    snprintf(parent, sizeof(parent), "img%d", i - 1);
+    snprintf(dir, sizeof(dir), "l%d", i);
+    start = lc_traceNow();
+    lc_replayIoctl(rt, LAYER_CREATE, i ? parent : NULL, layer);
+    lc_replayStep(rt, LC_STEP_IMAGE_CREATE, start);
+
+    /* Files of each layer are extracted to a directory of its own */
+    start = lc_traceNow();
+    lc_replayIoctl(rt, LAYER_MOUNT, NULL, layer);
+    root = lc_replayLookup(rt, gfs->gfs_layerRoot, layer);
+    if (root) {
+        lc_replayRequest(rt, &req);
+        lc_ll_oper.mkdir(&req, root, dir, 0755);
+        if (req.r_err) {
+            rt->rt_errors++;
+        } else {
+            lc_replayIn(rt, req.r_ino, &lc_replayImage);
+        }
+    }
+    lc_replayStep(rt, LC_STEP_IMAGE_POPULATE, start);
+    start = lc_traceNow();
+    lc_replayIoctl(rt, LAYER_UMOUNT, NULL, layer);
+    lc_replayStep(rt, LC_STEP_IMAGE_FREEZE, start);
+}
+
+/* Commit a container to a new image layer, the way docker does with layers
+ * swapped on commit.  The new layer is created on the image and the container
+ * layer is committed to it as a file with the trigger name is created in it.
+ */
+static void
+lc_replayCommit(struct rthread *rt, const char *image, const char *container,
+                const char *layer) {
+    struct fuse_file_info fi;
+    char name[LC_REPLAY_PATH];
+    struct fuse_req req;
+    fuse_ino_t root;
+
+    if (lc_replayIoctl(rt, LAYER_CREATE, image, layer) ||
+        lc_replayIoctl(rt, LAYER_MOUNT, NULL, layer)) {
+        return;
+    }
+    root = lc_replayLookup(rt, gfs->gfs_layerRoot, layer);
+    if (root) {
+        snprintf(name, sizeof(name), "%s%s", LC_COMMIT_TRIGGER_PREFIX,
+                 container);
+        memset(&fi, 0, sizeof(struct fuse_file_info));
+        fi.flags = O_CREAT | O_WRONLY | O_TRUNC;
+        lc_replayRequest(rt, &req);
+        lc_ll_oper.create(&req, root, name, S_IFREG | 0644, &fi);
+        if (req.r_err) {
+            rt->rt_errors++;
+        } else {
+            root = req.r_ino;
+            fi.fh = req.r_fh;
+            lc_replayRequest(rt, &req);
+            lc_ll_oper.release(&req, root, &fi);
+        }
+    }
+    lc_replayIoctl(rt, LAYER_UMOUNT, NULL, layer);
+}
+
+/* Run a container through its lifecycle */
+static void
+lc_replayContainer(struct rthread *rt, uint64_t id) {
+    char image[32], init[32], container[32], layer[32], dir[32];
+    fuse_ino_t root;
+    uint64_t start;
+    int i;
+
+    snprintf(image, sizeof(image), "img%d", LC_REPLAY_DEPTH - 1);
+    snprintf(init, sizeof(init), "c%ld-init", id);
+    snprintf(container, sizeof(container), "c%ld", id);
+    snprintf(layer, sizeof(layer), "n%ld", id);
+
+    /* Create and populate the init layer */
+    start = lc_traceNow();
+    if (lc_replayIoctl(rt, LAYER_CREATE_RW, image, init)) {
+        return;
+    }
+    lc_replayStep(rt, LC_STEP_INIT_CREATE, start);
+    start = lc_traceNow();
+    lc_replayIoctl(rt, LAYER_MOUNT, NULL, init);
+    lc_replayIn(rt, lc_replayLookup(rt, gfs->gfs_layerRoot, init),
+                &lc_replayInit);
+    lc_replayIoctl(rt, LAYER_UMOUNT, NULL, init);
+    lc_replayStep(rt, LC_STEP_INIT, start);
+
+    /* Create the container layer and start the container reading files from
+     * all layers of the image.
+     */
+    start = lc_traceNow();
+    if (lc_replayIoctl(rt, LAYER_CREATE_RW, init, container)) {
+        return;
+    }
+    lc_replayStep(rt, LC_STEP_RW_CREATE, start);
+    start = lc_traceNow();
+    lc_replayIoctl(rt, LAYER_MOUNT, NULL, container);
+    root = lc_replayLookup(rt, gfs->gfs_layerRoot, container);
+    for (i = 0; root && (i < LC_REPLAY_DEPTH); i++) {
+        snprintf(dir, sizeof(dir), "l%d", i);
+        lc_replayIn(rt, lc_replayLookup(rt, root, dir), &lc_replayStarting);
+    }
+    lc_replayStep(rt, LC_STEP_START, start);
+
+    /* Modify files in the container and stop it */
+    start = lc_traceNow();
+    if (root) {
+        snprintf(dir, sizeof(dir), "l%d", LC_REPLAY_DEPTH - 1);
+        lc_replayIn(rt, lc_replayLookup(rt, root, dir), &lc_replayRunning);
+    }
+    lc_replayStep(rt, LC_STEP_RUN, start);
+    start = lc_traceNow();
+    lc_replayIoctl(rt, LAYER_UMOUNT, NULL, container);
+    lc_replayStep(rt, LC_STEP_STOP, start);
+
+    /* Commit the container and remove it */
+    start = lc_traceNow();
+    lc_replayCommit(rt, image, container, layer);
+    lc_replayStep(rt, LC_STEP_COMMIT, start);
+    start = lc_traceNow();
+    lc_replayIoctl(rt, LAYER_REMOVE, NULL, container);
+    lc_replayStep(rt, LC_STEP_REMOVE, start);
+
+    /* Checkpoint the file system every now and then */
+    if ((rt->rt_containers++ % LC_REPLAY_CHECKPOINT) ==
+        (LC_REPLAY_CHECKPOINT - 1)) {
+        start = lc_traceNow();
+        lc_replayIoctl(rt, LCFS_COMMIT, NULL, NULL);
+        lc_replayStep(rt, LC_STEP_CHECKPOINT, start);
+    }
+}
+
+/* Run containers from a thread */
+static void *
+lc_replayContainers(void *data) {
+    struct rthread *rt = (struct rthread *)data;
+    uint64_t id;
+
+    rt->rt_buf = malloc(LC_REPLAY_IOSIZE);
+    assert(rt->rt_buf);
+    memset(rt->rt_buf, 0, LC_REPLAY_IOSIZE);
+    pthread_barrier_wait(&lc_replayBarrier);
+    for (id = rt->rt_id; id < lc_replayContainerCount;
+         id += lc_replayThreadCount) {
+        lc_replayContainer(rt, id);
+    }
+    pthread_barrier_wait(&lc_replayBarrier);
+    free(rt->rt_buf);
+    return NULL;
+}
+
+/* Compare samples while sorting those */
+static int
+lc_replayCompare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x < y) ? -1 : (x > y);
+}
+
+/* Print percentiles of time taken by steps of the lifecycle of containers */
+static void
+lc_replayReportSteps(struct rthread *rt, int threads) {
+    uint64_t *nsec, count, total, i;
+    enum lc_replayStep step;
+    int j;
+
+    for (step = 0; step < LC_STEP_MAX; step++) {
+        count = 0;
+        for (j = 0; j < threads; j++) {
+            count += rt[j].rt_steps[step].rs_count;
+        }
+        if (count == 0) {
+            continue;
+        }
+        nsec = malloc(sizeof(uint64_t) * count);
+        assert(nsec);
+        count = 0;
+        total = 0;
+        for (j = 0; j < threads; j++) {
+            for (i = 0; i < rt[j].rt_steps[step].rs_count; i++) {
+                nsec[count++] = rt[j].rt_steps[step].rs_nsec[i];
+                total += rt[j].rt_steps[step].rs_nsec[i];
+            }
+            free(rt[j].rt_steps[step].rs_nsec);
+        }
+        qsort(nsec, count, sizeof(uint64_t), lc_replayCompare);
+        printf("{\"lifecycle\": \"%s\", \"count\": %ld, \"nsec_avg\": %ld, "
+               "\"nsec_p50\": %ld, \"nsec_p90\": %ld, \"nsec_p99\": %ld, "
+               "\"nsec_max\": %ld}\n", lc_replaySteps[step], count,
+               total / count, nsec[(count * 50) / 100],
+               nsec[(count * 90) / 100], nsec[(count * 99) / 100],
+               nsec[count - 1]);
+        free(nsec);
+    }
+    fflush(stdout);
+}
+
+/* Build an image and run containers on it from all threads, then measure
+ * time taken for unmounting and mounting the file system with all the layers
+ * committed.
+ */
+static void
+lc_replayLifecycle(int fd, char *path, size_t size, uint64_t count,
+                   int threads) {
+    uint64_t start, elapsed, layers, errors = 0;
+    struct rthread *rt;
+    struct fuse_req req;
+    int i, err;
+
+    /* The extra thread structure accounts for work done from this thread */
+    rt = malloc(sizeof(struct rthread) * (threads + 1));
+    assert(rt);
+    memset(rt, 0, sizeof(struct rthread) * (threads + 1));
+    start = lc_traceNow();
+    lc_replayMount(fd, path, size, true, true);
+    lc_replayStep(&rt[threads], LC_STEP_FORMAT, start);
+
+    /* Create the layer root directory and the image */
+    memset(&req, 0, sizeof(struct fuse_req));
+    lc_ll_oper.mkdir(&req, LC_ROOT_INODE, LC_LAYER_ROOT_DIR, 0755);
+    assert(req.r_err == 0);
+    rt[threads].rt_buf = malloc(LC_REPLAY_IOSIZE);
+    assert(rt[threads].rt_buf);
+    memset(rt[threads].rt_buf, 0, LC_REPLAY_IOSIZE);
+    for (i = 0; i < LC_REPLAY_DEPTH; i++) {
+        lc_replayImageLayer(&rt[threads], i);
+    }
+    free(rt[threads].rt_buf);
+
+    /* Run containers from all threads, each thread picking every other one */
+    lc_replayContainerCount = count;
+    lc_replayThreadCount = threads;
+    pthread_barrier_init(&lc_replayBarrier, NULL, threads + 1);
+    for (i = 0; i < threads; i++) {
+        rt[i].rt_id = i;
+        err = pthread_create(&rt[i].rt_thread, NULL, lc_replayContainers,
+                             &rt[i]);
+        if (err) {
+            perror("pthread_create");
+            exit(err);
+        }
+    }
+    pthread_barrier_wait(&lc_replayBarrier);
+    start = lc_traceNow();
+    pthread_barrier_wait(&lc_replayBarrier);
+    elapsed = lc_traceNow() - start;
+    for (i = 0; i < threads; i++) {
+        pthread_join(rt[i].rt_thread, NULL);
+        errors += rt[i].rt_errors;
+    }
+    pthread_barrier_destroy(&lc_replayBarrier);
+    errors += rt[threads].rt_errors;
+    layers = gfs->gfs_count - 1;
+
+    /* Unmount and mount again with all the layers created */
+    start = lc_traceNow();
+    lc_replayUnmount();
+    lc_replayStep(&rt[threads], LC_STEP_UNMOUNT, start);
+    start = lc_traceNow();
+    lc_replayMount(fd, path, size, false, true);
+    lc_replayStep(&rt[threads], LC_STEP_MOUNT, start);
+    start = lc_traceNow();
+    lc_replayUnmount();
+    lc_replayStep(&rt[threads], LC_STEP_UNMOUNT, start);
+
+    if (elapsed == 0) {
+        elapsed = 1;
+    }
+    printf("{\"lifecycle\": \"total\", \"threads\": %d, \"containers\": %ld, "
+           "\"layers\": %ld, \"errors\": %ld, \"nsec\": %ld, "
+           "\"containers_per_sec\": %.1f}\n", threads, count, layers, errors,
+           elapsed, ((double)count * 1000000000.0) / elapsed);
+    lc_replayReportSteps(rt, threads + 1);
+    free(rt);
+}
+
+/* Fill a piece of a file of the defrag scenario with data unique to it */
+static void
+lc_replayPiece(char *buf, uint64_t file, uint64_t piece) {
+    uint64_t i;
+
+    for (i = 0; i < LC_REPLAY_DPIECE; i++) {
+        buf[i] = (file * 7) + (piece * 13) + i;
+    }
+}
+
+/* Append a piece to a file of the defrag scenario, closing the file after
+ * writing the piece.  Read-only layers flush pages of a file on last close,
+ * so pieces of files written in turns end up in blocks interleaved with
+ * those of other files.
+ */
+static void
+lc_replayPieceWrite(struct rthread *rt, fuse_ino_t root, uint64_t file,
+                    uint64_t piece) {
+    struct fuse_file_info fi;
+    struct fuse_bufvec bufv;
+    struct fuse_req req;
+    char name[32];
+    fuse_ino_t ino;
+
+    snprintf(name, sizeof(name), "f%ld", file);
+    memset(&fi, 0, sizeof(struct fuse_file_info));
+    lc_replayRequest(rt, &req);
+    if (piece == 0) {
+        fi.flags = O_CREAT | O_WRONLY | O_TRUNC;
+        lc_ll_oper.create(&req, root, name, S_IFREG | 0644, &fi);
+    } else {
+        lc_ll_oper.lookup(&req, root, name);
+        if (req.r_err == 0) {
+            ino = req.r_ino;
+            fi.flags = O_WRONLY;
+            lc_replayRequest(rt, &req);
+            lc_ll_oper.open(&req, ino, &fi);
+            req.r_ino = ino;
+        }
+    }
+    if (req.r_err) {
+        rt->rt_errors++;
+        return;
+    }
+    ino = req.r_ino;
+    fi.fh = req.r_fh;
+    lc_replayPiece(rt->rt_buf, file, piece);
+    bufv = FUSE_BUFVEC_INIT(LC_REPLAY_DPIECE);
+    bufv.buf[0].mem = rt->rt_buf;
+    lc_replayRequest(rt, &req);
+    lc_ll_oper.write_buf(&req, ino, &bufv, piece * LC_REPLAY_DPIECE, &fi);
+    if (req.r_err || (req.r_size != LC_REPLAY_DPIECE)) {
+        rt->rt_errors++;
+    }
+    lc_replayRequest(rt, &req);
+    lc_ll_oper.flush(&req, ino, &fi);
+    lc_replayRequest(rt, &req);
+    lc_ll_oper.release(&req, ino, &fi);
+}
+
+/* Read files of the defrag scenario through a layer and count files with
+ * contents not matching those written.
+ */
+static void
+lc_replayPieceVerify(struct rthread *rt, const char *layer, uint64_t count) {
+    char name[32], expected[LC_REPLAY_DPIECE];
+    uint64_t file, piece;
+    struct fuse_file_info fi;
+    fuse_ino_t root, ino;
+    struct fuse_req req;
+
+    root = lc_replayLookup(rt, gfs->gfs_layerRoot, layer);
+    if (root == 0) {
+        return;
+    }
+    for (file = 0; file < count; file++) {
+        snprintf(name, sizeof(name), "f%ld", file);
+        ino = lc_replayLookup(rt, root, name);
+        if (ino == 0) {
+            continue;
+        }
+        memset(&fi, 0, sizeof(struct fuse_file_info));
+        fi.flags = O_RDONLY;
+        lc_replayRequest(rt, &req);
+        lc_ll_oper.open(&req, ino, &fi);
+        if (req.r_err) {
+            rt->rt_errors++;
+            continue;
+        }
+        fi.fh = req.r_fh;
+        for (piece = 0; piece < LC_REPLAY_DPIECES; piece++) {
+            lc_replayRequest(rt, &req);
+            req.r_data = rt->rt_buf;
+            lc_ll_oper.read(&req, ino, LC_REPLAY_DPIECE,
+                            piece * LC_REPLAY_DPIECE, &fi);
+            lc_replayPiece(expected, file, piece);
+            if (req.r_err || (req.r_size != LC_REPLAY_DPIECE) ||
+                memcmp(rt->rt_buf, expected, LC_REPLAY_DPIECE)) {
+                rt->rt_errors++;
+                break;
+            }
+        }
+        lc_replayRequest(rt, &req);
+        lc_ll_oper.release(&req, ino, &fi);
+    }
+}
+
+/* Request a checkpoint and wait for one to complete */
+static void
+lc_replayCheckpoint(struct rthread *rt) {
+    uint64_t ckpts = gfs->gfs_ckpts;
+    int i;
+
+    lc_replayIoctl(rt, LCFS_COMMIT, NULL, NULL);
+    for (i = 0; (gfs->gfs_ckpts == ckpts) && (i < LC_REPLAY_CKPT_WAIT * 1000);
+         i++) {
+        usleep(1000);
+    }
+    if (gfs->gfs_ckpts == ckpts) {
+        rt->rt_errors++;
+    }
+}
+
+/* Fragment files of a read-only layer, freeze the layer and create a child
+ * layer on it, defragment the layer and check contents of the files through
+ * the child layer, then again after a checkpoint and after mounting the file
+ * system again.
+ */
+static void
+lc_replayDefrag(int fd, char *path, size_t size, uint64_t count) {
+    uint64_t start, elapsed, file, piece, blocks;
+    struct rthread rt;
+    struct fuse_req req;
+    fuse_ino_t root;
+
+    memset(&rt, 0, sizeof(struct rthread));
+    rt.rt_buf = malloc(LC_REPLAY_IOSIZE);
+    assert(rt.rt_buf);
+    lc_replayMount(fd, path, size, true, false);
+    memset(&req, 0, sizeof(struct fuse_req));
+    lc_ll_oper.mkdir(&req, LC_ROOT_INODE, LC_LAYER_ROOT_DIR, 0755);
+    assert(req.r_err == 0);
+
+    /* Write files of the layer in turns, a piece at a time */
+    lc_replayIoctl(&rt, LAYER_CREATE, NULL, "dbase");
+    lc_replayIoctl(&rt, LAYER_MOUNT, NULL, "dbase");
+    root = lc_replayLookup(&rt, gfs->gfs_layerRoot, "dbase");
+    for (piece = 0; root && (piece < LC_REPLAY_DPIECES); piece++) {
+        for (file = 0; file < count; file++) {
+            lc_replayPieceWrite(&rt, root, file, piece);
+        }
+    }
+    lc_replayIoctl(&rt, LAYER_UMOUNT, NULL, "dbase");
+    lc_replayIoctl(&rt, LAYER_CREATE_RW, "dbase", "dchild");
+    lc_replayIoctl(&rt, LAYER_MOUNT, NULL, "dchild");
+
+    /* Files of a layer with dirty inodes are not relocated */
+    lc_replayCheckpoint(&rt);
+
+    /* Defragment the layer and wait for that to finish */
+    blocks = gfs->gfs_wtype[LC_WRITE_DEFRAG];
+    start = lc_traceNow();
+    lc_replayIoctl(&rt, LAYER_DEFRAG, NULL, "dbase");
+    while (gfs->gfs_defragging) {
+        usleep(1000);
+    }
+    elapsed = lc_traceNow() - start;
+    blocks = gfs->gfs_wtype[LC_WRITE_DEFRAG] - blocks;
+    if (blocks == 0) {
+        rt.rt_errors++;
+    }
+    lc_replayPieceVerify(&rt, "dchild", count);
+
+    /* Check the files survive a checkpoint and mounting again */
+    lc_replayCheckpoint(&rt);
+    lc_replayPieceVerify(&rt, "dchild", count);
+    lc_replayUnmount();
+    lc_replayMount(fd, path, size, false, false);
+    lc_replayPieceVerify(&rt, "dchild", count);
+    lc_replayUnmount();
+    printf("{\"defrag\": \"total\", \"files\": %ld, \"blocks\": %ld, "
+           "\"errors\": %ld, \"nsec\": %ld}\n", count, blocks, rt.rt_errors,
+           elapsed);
+    fflush(stdout);
+    free(rt.rt_buf);
+}
+
+/* Set up streams replayed in layers while running containers */
+static void
+lc_replayLifecycleStreams(uint64_t *sizes) {
+    lc_replayUntar(&lc_replayImage, LC_REPLAY_LFILES, sizes);
+    lc_replayStart(&lc_replayStarting, LC_REPLAY_LFILES, sizes);
+    lc_replayBuild(&lc_replayRunning, LC_REPLAY_FILES, sizes);
+
+    /* Files docker sets up in the init layer */
+    lc_replayAdd(&lc_replayInit, LC_REPLAY_MKDIR, "etc", NULL, 0755, 0);
+    lc_replayAdd(&lc_replayInit, LC_REPLAY_CREATE, "etc/hosts", NULL, 0644, 0);
+    lc_replayAdd(&lc_replayInit, LC_REPLAY_CLOSE, "etc/hosts", NULL, 0, 0);
+    lc_replayAdd(&lc_replayInit, LC_REPLAY_CREATE, "etc/hostname", NULL,
+                 0644, 0);
+    lc_replayAdd(&lc_replayInit, LC_REPLAY_CLOSE, "etc/hostname", NULL, 0, 0);
+    lc_replayAdd(&lc_replayInit, LC_REPLAY_CREATE, "etc/resolv.conf", NULL,
+                 0644, 0);
+    lc_replayAdd(&lc_replayInit, LC_REPLAY_CLOSE, "etc/resolv.conf", NULL,
+                 0, 0);
+    lc_replayAdd(&lc_replayInit, LC_REPLAY_MKDIR, "dev", NULL, 0755, 0);
+    lc_replayAdd(&lc_replayInit, LC_REPLAY_MKDIR, "dev/shm", NULL, 0755, 0);
+    lc_replayAdd(&lc_replayInit, LC_REPLAY_CREATE, ".dockerenv", NULL,
+                 0755, 0);
+    lc_replayAdd(&lc_replayInit, LC_REPLAY_CLOSE, ".dockerenv", NULL, 0, 0);
+}
+
+/* Format a file system on a temporary file and replay streams on it */
+int
+main(int argc, char *argv[]) {
+    int i, fd, err, threads = LC_REPLAY_THREADS;
+    uint64_t count = LC_REPLAY_COUNT, *sizes;
+    char *dir = "/tmp", *path, *stream = NULL;
+    bool print = false, stats = false;
+    size_t size = LC_REPLAY_SIZE;
+    struct rstream setup, run;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r")) {
+            stats = true;
+        } else if (!strcmp(argv[i], "-p")) {
+            print = true;
+        } else if ((argv[i][0] != '-') && (stream == NULL)) {
+            stream = argv[i];
+        } else if ((i + 1) >= argc) {
+            usage(argv[0]);
+        } else if (!strcmp(argv[i], "-d")) {
+            dir = argv[++i];
+        } else if (!strcmp(argv[i], "-s")) {
+            size = atoll(argv[++i]) * 1024ul * 1024ul * 1024ul;
+        } else if (!strcmp(argv[i], "-e")) {
+            lc_replayDevice = argv[++i];
+        } else if (!strcmp(argv[i], "-n")) {
+            count = atoll(argv[++i]);
+        } else if (!strcmp(argv[i], "-t")) {
+            threads = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if ((stream == NULL) || (count < 2) || (threads <= 0) ||
+        ((size / LC_BLOCK_SIZE) < LC_MIN_BLOCKS) ||
+        (lc_replayDevice && lc_deviceEmulate(NULL, lc_replayDevice))) {
+        usage(argv[0]);
+    }
+
+    /* Set up the streams to replay */
+    memset(&setup, 0, sizeof(struct rstream));
+    memset(&run, 0, sizeof(struct rstream));
+    sizes = malloc(sizeof(uint64_t) *
+                   ((count > LC_REPLAY_LFILES) ? count : LC_REPLAY_LFILES));
+    assert(sizes);
+    if (!strcmp(stream, "smallfiles")) {
+        lc_replaySmallFiles(&run, count);
+    } else if (!strcmp(stream, "untar")) {
+        lc_replayUntar(&run, count, sizes);
+    } else if (!strcmp(stream, "start")) {
+        lc_replayUntar(&setup, count, sizes);
+        lc_replayStart(&run, count, sizes);
+    } else if (!strcmp(stream, "build")) {
+        lc_replayUntar(&setup, count, sizes);
+        lc_replayBuild(&run, count, sizes);
+    } else if (!strcmp(stream, "lifecycle")) {
+        lc_replayLifecycleStreams(sizes);
+    } else if (!strcmp(stream, "defrag")) {
+
+        /* Files of the defrag scenario are written by lc_replayDefrag */
+    } else {
+        err = lc_replayRead(&run, stream);
+        if (err) {
+            exit(err);
+        }
+    }
+    free(sizes);
+    if (print) {
+        lc_replayPrint(&setup);
+        lc_replayPrint(&run);
+        lc_replayPrint(&lc_replayImage);
+        lc_replayPrint(&lc_replayInit);
+        lc_replayPrint(&lc_replayStarting);
+        lc_replayPrint(&lc_replayRunning);
+        exit(0);
+    }
+    openlog("lcfsreplay", LOG_PID | LOG_PERROR, LOG_USER);
+    if (stats) {
+        lc_statsEnable();
+    }
+
+    /* Create a sparse image, removed as soon as it is opened */
+    path = alloca(strlen(dir) + 32);
+    sprintf(path, "%s/lcfsreplay.XXXXXX", dir);
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(errno);
+    }
+    unlink(path);
+    if (ftruncate(fd, size)) {
+        perror("ftruncate");
+        exit(errno);
+    }
+    lc_memoryInit(0);
+    if (!strcmp(stream, "lifecycle")) {
+        lc_replayLifecycle(fd, path, size, count, threads);
+    } else if (!strcmp(stream, "defrag")) {
+        lc_replayDefrag(fd, path, size, count);
+    } else {
+        lc_replayMount(fd, path, size, true, false);
+        lc_replayThreads(stream, &setup, &run, threads);
+        lc_replayUnmount();
+    }
+    lc_replayFreeStream(&setup);
+    lc_replayFreeStream(&run);
+    lc_replayFreeStream(&lc_replayImage);
+    lc_replayFreeStream(&lc_replayInit);
+    lc_replayFreeStream(&lc_replayStarting);
+    lc_replayFreeStream(&lc_replayRunning);
+    close(fd);
+    closelog();
+    return 0;
+}
@@ -48,91 +48,288 @@ static const char *requests[] = {
     "STAT",
     "UMOUNT",
     "CLEANUP",
+    "DEFRAG",
+    "QOS",
 };
 
+/* Return name of a type of request */
+const char *
+lc_statsName(enum lc_stats type) {
+    return (type < LC_REQUEST_MAX) ? requests[type] : "UNKNOWN";
+}
+
+/* Slot of stats used by the thread */
+static __thread int lc_statsSlot = -1;
+
+/* Next slot of stats to be assigned to a thread */
+static int lc_statsNext;
+
 /* Allocate a new stats structure */
 void
 lc_statsNew(struct fs *fs) {
     struct stats *stats;
-    struct timeval min;
-    enum lc_stats i;
 
     if (!stats_enabled) {
         return;
     }
-    gettimeofday(&min, NULL);
     stats = lc_malloc(fs, sizeof(struct stats), LC_MEMTYPE_STATS);
-    memset(&stats->s_count, 0, sizeof(uint64_t) * LC_REQUEST_MAX);
-    memset(&stats->s_err, 0, sizeof(uint64_t) * LC_REQUEST_MAX);
-    memset(&stats->s_max, 0, sizeof(struct timeval) * LC_REQUEST_MAX);
-    memset(&stats->s_total, 0, sizeof(struct timeval) * LC_REQUEST_MAX);
-    for (i = 0; i < LC_REQUEST_MAX; i++) {
-
-        /* Time is not tracked for certain requests */
-        stats->s_min[i] = ((i == LC_FLUSH) || (i == LC_FSYNCDIR) ||
-                           (i == LC_FSYNC)) ?  (struct timeval){0, 0} : min;
-    }
-    pthread_mutex_init(&stats->s_lock, NULL);
+    memset(stats, 0, sizeof(struct stats));
     fs->fs_stats = stats;
 }
 
+/* Return current time from a monotonic clock in nanoseconds */
+static inline uint64_t
+lc_statsNow() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000000ull) + now.tv_nsec;
+}
+
 /* Begin stats tracking for a new request starting */
 void
-lc_statsBegin(struct timeval *start) {
+lc_statsBegin(uint64_t *start) {
     if (stats_enabled) {
-        gettimeofday(start, NULL);
+        *start = lc_statsNow();
+    }
+    if (unlikely(lc_traceEnabled)) {
+        lc_traceBegin();
     }
 }
 
-/* Update stats for the specified request type */
+/* Return the histogram bucket for the time specified in nanoseconds */
+static inline int
+lc_statsBucket(uint64_t elapsed) {
+    int bits;
+
+    if (elapsed < LC_STATS_SUB_COUNT) {
+        return elapsed;
+    }
+    bits = 63 - __builtin_clzll(elapsed);
+    if (bits >= LC_STATS_MAX_BITS) {
+        return LC_STATS_BUCKETS - 1;
+    }
+    bits -= LC_STATS_SUB_BITS;
+    return ((bits + 1) << LC_STATS_SUB_BITS) +
+           ((elapsed >> bits) & (LC_STATS_SUB_COUNT - 1));
+}
+
+/* Return the smallest time in nanoseconds counted in a histogram bucket */
+static inline uint64_t
+lc_statsBucketTime(int bucket) {
+    int bits = (bucket >> LC_STATS_SUB_BITS) - 1;
+
+    if (bits < 0) {
+        return bucket;
+    }
+    return (uint64_t)(LC_STATS_SUB_COUNT +
+                      (bucket & (LC_STATS_SUB_COUNT - 1))) << bits;
+}
+
+/* Update stats for the specified request type.  Stats are updated in the
+ * slot of the thread with atomic operations and merged while displayed.
+ */
 void
-lc_statsAdd(struct fs *fs, enum lc_stats type, bool err,
-             struct timeval *start) {
+lc_statsAdd(struct fs *fs, enum lc_stats type, bool err, uint64_t *start) {
     struct stats *stats = fs->fs_stats;
-    struct timeval stop, total;
+    uint64_t elapsed, value;
+    uint32_t *hist;
+    struct sreq *sr;
+    time_t now;
 
+    if (unlikely(lc_traceEnabled) && start) {
+        lc_traceEnd(fs, type, err);
+    }
     if (!stats_enabled) {
         return;
     }
+    if (lc_statsSlot < 0) {
+        lc_statsSlot = __sync_fetch_and_add(&lc_statsNext, 1) %
+                       LC_STATS_SLOTS;
+    }
+    sr = &stats->s_slots[lc_statsSlot].ss_req[type];
+    __sync_add_and_fetch(&sr->sr_count, 1);
+    if (err) {
+        __sync_add_and_fetch(&sr->sr_err, 1);
+    }
 
     /* Times are not tracked for certain type of operations */
     if (start == NULL) {
-        __sync_add_and_fetch(&stats->s_count[type], 1);
-        if (err) {
-            __sync_add_and_fetch(&stats->s_err[type], 1);
-        }
         return;
     }
 
     /* Calculate time taken to process this request and update stats */
-    gettimeofday(&stop, NULL);
-    timersub(&stop, start, &total);
-    pthread_mutex_lock(&stats->s_lock);
-
-    /* Increment total count */
-    stats->s_count[type]++;
-    if (err) {
-        stats->s_err[type]++;
+    elapsed = lc_statsNow() - *start;
+    if (elapsed == 0) {
+        elapsed = 1;
     }
-    timeradd(&stats->s_total[type], &total, &stats->s_total[type]);
-    if (timercmp(&stats->s_max[type], &total, <)) {
-        stats->s_max[type] = total;
+    __sync_add_and_fetch(&sr->sr_total, elapsed);
+    value = sr->sr_max;
+    while ((value < elapsed) &&
+           !__sync_bool_compare_and_swap(&sr->sr_max, value, elapsed)) {
+        value = sr->sr_max;
     }
-    if (timercmp(&stats->s_min[type], &total, >)) {
-        stats->s_min[type] = total;
+    value = sr->sr_min;
+    while (((value == 0) || (value > elapsed)) &&
+           !__sync_bool_compare_and_swap(&sr->sr_min, value, elapsed)) {
+        value = sr->sr_min;
     }
+    hist = sr->sr_hist;
+    if (hist == NULL) {
+        hist = lc_malloc(fs, sizeof(uint32_t) * LC_STATS_BUCKETS,
+                         LC_MEMTYPE_STATS);
+        memset(hist, 0, sizeof(uint32_t) * LC_STATS_BUCKETS);
+        if (!__sync_bool_compare_and_swap(&sr->sr_hist, NULL, hist)) {
+            lc_free(fs, hist, sizeof(uint32_t) * LC_STATS_BUCKETS,
+                    LC_MEMTYPE_STATS);
+            hist = sr->sr_hist;
+        }
+    }
+    __sync_add_and_fetch(&hist[lc_statsBucket(elapsed)], 1);
 
     /* Update layer access time */
-    fs->fs_super->sb_atime = stop.tv_sec;
-    pthread_mutex_unlock(&stats->s_lock);
+    now = time(NULL);
+    if (fs->fs_super->sb_atime != now) {
+        fs->fs_super->sb_atime = now;
+    }
+}
+
+/* Names of types of blocks written */
+static const char *lc_writeTypes[] = {
+    "data",
+    "inode",
+    "iblock",
+    "emap",
+    "dir",
+    "xattr",
+    "extent",
+    "super",
+    "log",
+    "defrag",
+};
+
+/* Account blocks of a type queued for write or written by a layer */
+void
+lc_statsWrite(struct fs *fs, enum lc_writeType type, uint64_t blocks) {
+    assert(type < LC_WRITE_MAX);
+    __sync_add_and_fetch(&fs->fs_wtype[type], blocks);
+    __sync_add_and_fetch(&fs->fs_gfs->gfs_wtype[type], blocks);
+}
+
+/* Account bytes written by applications to a layer */
+void
+lc_statsLogicalWrite(struct fs *fs, uint64_t bytes) {
+    __sync_add_and_fetch(&fs->fs_wlogical, bytes);
+    __sync_add_and_fetch(&fs->fs_gfs->gfs_wlogical, bytes);
+}
+
+/* Render breakdown of blocks written */
+static void
+lc_writeMetrics(struct metrics *m, const char *prefix, const char *labels,
+                uint64_t *wtype, uint64_t logical) {
+    char name[64], tlabels[(labels ? strlen(labels) : 0) + 32];
+    enum lc_writeType type;
+
+    for (type = 0; type < LC_WRITE_MAX; type++) {
+        snprintf(tlabels, sizeof(tlabels), "%s%stype=\"%s\"",
+                 labels ? labels : "", labels ? "," : "",
+                 lc_writeTypes[type]);
+        snprintf(name, sizeof(name), "%swrite_type_blocks_total", prefix);
+        lc_metric(m, name, tlabels, wtype[type]);
+        snprintf(name, sizeof(name), "%swrite_type_bytes_total", prefix);
+        lc_metric(m, name, tlabels, wtype[type] * LC_BLOCK_SIZE);
+    }
+    snprintf(name, sizeof(name), "%slogical_write_bytes_total", prefix);
+    lc_metric(m, name, labels, logical);
+}
+
+/* Display breakdown of blocks written and write amplification */
+static void
+lc_displayWriteStats(const char *who, uint64_t *wtype, uint64_t logical) {
+    uint64_t total = 0;
+    enum lc_writeType type;
+
+    for (type = 0; type < LC_WRITE_MAX; type++) {
+        total += wtype[type];
+    }
+    if (total == 0) {
+        return;
+    }
+    lc_syslog(LOG_INFO, "%s wrote %ld blocks for %ld bytes written by "
+              "applications\n", who, total, logical);
+    for (type = 0; type < LC_WRITE_MAX; type++) {
+        if (wtype[type]) {
+            lc_syslog(LOG_INFO, "\t%s %ld blocks (%ld%%)\n",
+                      lc_writeTypes[type], wtype[type],
+                      (wtype[type] * 100) / total);
+        }
+    }
+    if (logical) {
+        lc_syslog(LOG_INFO, "\tWrite amplification %.2f\n",
+                  (double)(total * LC_BLOCK_SIZE) / logical);
+    }
+}
+
+/* Merge stats of a request type from all slots */
+static void
+lc_statsMerge(struct stats *stats, enum lc_stats type, struct sreq *sr,
+              uint64_t *hist) {
+    struct sreq *ssr;
+    int i, j;
+
+    memset(sr, 0, sizeof(struct sreq));
+    memset(hist, 0, sizeof(uint64_t) * LC_STATS_BUCKETS);
+    for (i = 0; i < LC_STATS_SLOTS; i++) {
+        ssr = &stats->s_slots[i].ss_req[type];
+        sr->sr_count += ssr->sr_count;
+        sr->sr_err += ssr->sr_err;
+        sr->sr_total += ssr->sr_total;
+        if (ssr->sr_max > sr->sr_max) {
+            sr->sr_max = ssr->sr_max;
+        }
+        if (ssr->sr_min && ((sr->sr_min == 0) ||
+                            (ssr->sr_min < sr->sr_min))) {
+            sr->sr_min = ssr->sr_min;
+        }
+        if (ssr->sr_hist) {
+            for (j = 0; j < LC_STATS_BUCKETS; j++) {
+                hist[j] += ssr->sr_hist[j];
+            }
+        }
+    }
+}
+
+/* Return time in nanoseconds within which the specified fraction of requests
+ * in a histogram completed.
+ */
+static uint64_t
+lc_statsPercentile(uint64_t *hist, uint64_t count, uint64_t max,
+                   uint64_t permille) {
+    uint64_t target = ((count * permille) + 999) / 1000, seen = 0, value;
+    int i;
+
+    for (i = 0; i < LC_STATS_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen && (seen >= target)) {
+
+            /* Report upper end of the bucket, bounded by the maximum */
+            value = (i < (LC_STATS_BUCKETS - 1)) ?
+                    lc_statsBucketTime(i + 1) - 1 : max;
+            return (value < max) ? value : max;
+        }
+    }
+    return max;
 }
 
 /* Display stats of a file system */
 void
 lc_displayStats(struct fs *fs) {
+    uint64_t hist[LC_STATS_BUCKETS], count;
     struct stats *stats = fs->fs_stats;
     struct timeval now;
     enum lc_stats i;
+    struct sreq sr;
+    int j;
 
     if (!stats_enabled) {
         return;
@@ -149,18 +346,26 @@ lc_displayStats(struct fs *fs) {
         goto out;
     }
     lc_syslog(LOG_INFO,
-              "\tRequest:\tTotal\t\tFailed\tAverage\t\tMax\t\tMin\n\n");
+              "\tRequest:\tTotal\t\tFailed\tAverage\tMax\tMin\t"
+              "p50\tp90\tp99\tp99.9 (usec)\n\n");
     for (i = 0; i < LC_REQUEST_MAX; i++) {
-        if (stats->s_count[i]) {
-            lc_syslog(LOG_INFO,
-                      "%15s: %10ld\t%10ld\t%2lds.%06ldu\t%2lds.%06ldu\t"
-                      "%2lds.%06ldu\n",
-                      requests[i], stats->s_count[i], stats->s_err[i],
-                      stats->s_total[i].tv_sec / stats->s_count[i],
-                      stats->s_total[i].tv_usec / stats->s_count[i],
-                      stats->s_max[i].tv_sec, stats->s_max[i].tv_usec,
-                      stats->s_min[i].tv_sec, stats->s_min[i].tv_usec);
+        lc_statsMerge(stats, i, &sr, hist);
+        if (sr.sr_count == 0) {
+            continue;
         }
+        count = 0;
+        for (j = 0; j < LC_STATS_BUCKETS; j++) {
+            count += hist[j];
+        }
+        lc_syslog(LOG_INFO,
+                  "%15s: %10ld\t%10ld\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\n",
+                  requests[i], sr.sr_count, sr.sr_err,
+                  count ? (sr.sr_total / count) / 1000 : 0,
+                  sr.sr_max / 1000, sr.sr_min / 1000,
+                  lc_statsPercentile(hist, count, sr.sr_max, 500) / 1000,
+                  lc_statsPercentile(hist, count, sr.sr_max, 900) / 1000,
+                  lc_statsPercentile(hist, count, sr.sr_max, 990) / 1000,
+                  lc_statsPercentile(hist, count, sr.sr_max, 999) / 1000);
     }
     lc_syslog(LOG_INFO, "\n\n");
 
@@ -177,8 +382,22 @@ out:
 /* Display stats of a layer */
 void
 lc_displayLayerStats(struct fs *fs) {
+    char who[32];
+
     lc_displayMemStats(fs);
     lc_displayStats(fs);
+    snprintf(who, sizeof(who), "Layer %ld", fs->fs_root);
+    lc_displayWriteStats(who, fs->fs_wtype, fs->fs_wlogical);
+    if (fs->fs_throttled) {
+        lc_syslog(LOG_INFO, "Layer %ld writers throttled %ld times for "
+                  "%ld usec\n", fs->fs_root, fs->fs_throttled,
+                  fs->fs_throttleTime);
+    }
+    if (fs->fs_qosThrottled) {
+        lc_syslog(LOG_INFO, "Layer %ld I/O throttled %ld times for "
+                  "%ld usec\n", fs->fs_root, fs->fs_qosThrottled,
+                  fs->fs_qosTime);
+    }
 }
 
 /* Display stats of all file systems */
@@ -200,6 +419,492 @@ lc_displayStatsAll(struct gfs *gfs) {
     }
     rcu_read_unlock();
     rcu_unregister_thread();
+    for (i = 0; i < LC_MAX_MOUNTS; i++) {
+        lc_displayWorkerStats(gfs, i);
+    }
+}
+
+/* Write labels of a metric as members of a JSON object */
+static void
+lc_metricLabelsJSON(FILE *fp, const char *labels) {
+    const char *c = labels;
+
+    fputc('{', fp);
+    while (*c) {
+
+        /* Labels are of the form name="value" separated by commas */
+        fputc('"', fp);
+        while (*c && (*c != '=')) {
+            fputc(*c++, fp);
+        }
+        fputs("\":", fp);
+        if (*c == '=') {
+            c++;
+        }
+        while (*c && (*c != ',')) {
+            fputc(*c++, fp);
+        }
+        if (*c == ',') {
+            fputc(*c++, fp);
+        }
+    }
+    fputc('}', fp);
+}
+
+/* Families of metrics rendered, in the order written in Prometheus format */
+static const struct mdesc lc_metricFamilies[] = {
+    {"blocks_total", "gauge",
+     "Total blocks in the file system"},
+    {"blocks_used", "gauge",
+     "Blocks in use in the file system"},
+    {"layers", "gauge",
+     "Layers in the file system"},
+    {"reads_total", "counter",
+     "Blocks read from the device"},
+    {"writes_total", "counter",
+     "Write requests issued to the device"},
+    {"write_blocks_total", "counter",
+     "Blocks written to the device"},
+    {"write_time_usec_total", "counter",
+     "Time spent writing to the device in microseconds"},
+    {"device_delay_usec_total", "counter",
+     "Delay added by device emulation in microseconds"},
+    {"dirty_pages", "gauge",
+     "Dirty data pages in all layers"},
+    {"inodes_cloned_total", "counter",
+     "Inodes cloned from parent layers"},
+    {"pages_hit_total", "counter",
+     "Page cache hits"},
+    {"pages_missed_total", "counter",
+     "Page cache misses"},
+    {"pages_recycled_total", "counter",
+     "Pages recycled from the page cache"},
+    {"pages_reused_total", "counter",
+     "Pages reused from the page cache"},
+    {"pages_purged_total", "counter",
+     "Pages purged from the page cache"},
+    {"checkpoints_total", "counter",
+     "Checkpoints taken"},
+    {"checkpoint_time_usec_total", "counter",
+     "Time spent taking checkpoints in microseconds"},
+    {"checkpoint_lock_time_usec_total", "counter",
+     "Time layers were locked by checkpoints in microseconds"},
+    {"checkpoint_blocks_total", "counter",
+     "Blocks written by checkpoints"},
+    {"flush_limit_pages", "gauge",
+     "Dirty pages a layer could have before flushed"},
+    {"write_type_blocks_total", "counter",
+     "Blocks written by type"},
+    {"write_type_bytes_total", "counter",
+     "Bytes written by type"},
+    {"logical_write_bytes_total", "counter",
+     "Bytes written by applications"},
+    {"lock_acquired_total", "counter",
+     "Locks acquired by class"},
+    {"lock_contended_total", "counter",
+     "Locks contended by class"},
+    {"lock_wait_nsec_total", "counter",
+     "Time waited for locks in nanoseconds"},
+    {"lock_hold_nsec_total", "counter",
+     "Time locks were held in nanoseconds"},
+    {"lock_hold_nsec_max", "gauge",
+     "Longest time a lock was held in nanoseconds"},
+    {"memory_global_bytes", "gauge",
+     "Memory in use by the file system"},
+    {"memory_pages_bytes", "gauge",
+     "Memory in use for data pages"},
+    {"memory_pages_limit_bytes", "gauge",
+     "Memory for data pages before purging"},
+    {"memory_pool_buffers", "gauge",
+     "Buffers in the page pool"},
+    {"memory_pool_hits_total", "counter",
+     "Buffers allocated from the page pool"},
+    {"layer_inodes", "gauge",
+     "Inodes in a layer"},
+    {"layer_dirty_pages", "gauge",
+     "Dirty data pages in a layer"},
+    {"layer_reads_total", "counter",
+     "Blocks read by a layer"},
+    {"layer_writes_total", "counter",
+     "Blocks written by a layer"},
+    {"layer_inodes_written_total", "counter",
+     "Inodes written by a layer"},
+    {"layer_throttled_total", "counter",
+     "Writers throttled for dirty pages"},
+    {"layer_throttled_usec_total", "counter",
+     "Time writers were throttled for dirty pages in microseconds"},
+    {"layer_io_throttled_total", "counter",
+     "Requests throttled for I/O limits"},
+    {"layer_io_throttled_usec_total", "counter",
+     "Time requests were throttled for I/O limits in microseconds"},
+    {"layer_write_type_blocks_total", "counter",
+     "Blocks written by a layer by type"},
+    {"layer_write_type_bytes_total", "counter",
+     "Bytes written by a layer by type"},
+    {"layer_logical_write_bytes_total", "counter",
+     "Bytes written by applications to a layer"},
+    {"blocks_allocated_total", "counter",
+     "Blocks allocated by a layer"},
+    {"blocks_freed_total", "counter",
+     "Blocks freed by a layer"},
+    {"blocks_reserved", "gauge",
+     "Blocks reserved by a layer"},
+    {"blocks_cursor_reserved", "gauge",
+     "Blocks reserved by allocation cursors of a layer"},
+    {"memory_bytes", "gauge",
+     "Memory in use by a layer"},
+    {"memory_type_bytes", "gauge",
+     "Memory in use by a layer by type"},
+    {"requests_total", "counter",
+     "Requests processed by a layer"},
+    {"request_errors_total", "counter",
+     "Requests failed by a layer"},
+    {"request_time_nsec", "summary",
+     "Time taken to process requests in nanoseconds"},
+};
+
+#define LC_METRIC_FAMILIES \
+    (sizeof(lc_metricFamilies) / sizeof(struct mdesc))
+
+/* Find the family a metric belongs to.  Sum and count of a summary belong to
+ * the summary.
+ */
+static int
+lc_metricFamily(const char *name) {
+    const struct mdesc *md;
+    size_t len;
+    int i;
+
+    for (i = 0; i < LC_METRIC_FAMILIES; i++) {
+        md = &lc_metricFamilies[i];
+        if (strcmp(name, md->md_name) == 0) {
+            return i;
+        }
+        len = strlen(md->md_name);
+        if ((strcmp(md->md_type, "summary") == 0) &&
+            (strncmp(name, md->md_name, len) == 0) &&
+            ((strcmp(&name[len], "_sum") == 0) ||
+             (strcmp(&name[len], "_count") == 0))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Return the stream samples of a metric are written to in Prometheus text
+ * format.
+ */
+static FILE *
+lc_metricStream(struct metrics *m, const char *name) {
+    struct mfamily *mf;
+    int i;
+
+    i = lc_metricFamily(name);
+    assert(i >= 0);
+    if ((i < 0) || (m->m_families == NULL)) {
+        return m->m_fp;
+    }
+    mf = &m->m_families[i];
+    if (mf->mf_fp == NULL) {
+        mf->mf_fp = open_memstream(&mf->mf_buf, &mf->mf_size);
+        if (mf->mf_fp == NULL) {
+            return m->m_fp;
+        }
+    }
+    return mf->mf_fp;
+}
+
+/* Write a metric in the format of the stats file being rendered */
+void
+lc_metric(struct metrics *m, const char *name, const char *labels,
+          uint64_t value) {
+    FILE *fp;
+
+    if (m->m_json) {
+        fprintf(m->m_fp, "%s\n  {\"name\": \"lcfs_%s\", \"labels\": ",
+                m->m_first ? "" : ",", name);
+        lc_metricLabelsJSON(m->m_fp, labels ? labels : "");
+        fprintf(m->m_fp, ", \"value\": %lu}", value);
+    } else {
+        fp = lc_metricStream(m, name);
+        if (labels && labels[0]) {
+            fprintf(fp, "lcfs_%s{%s} %lu\n", name, labels, value);
+        } else {
+            fprintf(fp, "lcfs_%s %lu\n", name, value);
+        }
+    }
+    m->m_first = false;
+}
+
+/* Write out samples of all families one family at a time, each preceded by
+ * its help text and type.
+ */
+static void
+lc_metricFlush(struct metrics *m) {
+    const struct mdesc *md;
+    struct mfamily *mf;
+    int i;
+
+    if (m->m_families == NULL) {
+        return;
+    }
+    for (i = 0; i < LC_METRIC_FAMILIES; i++) {
+        mf = &m->m_families[i];
+        if (mf->mf_fp == NULL) {
+            continue;
+        }
+        fclose(mf->mf_fp);
+        md = &lc_metricFamilies[i];
+        fprintf(m->m_fp, "# HELP lcfs_%s %s\n# TYPE lcfs_%s %s\n",
+                md->md_name, md->md_help, md->md_name, md->md_type);
+        fwrite(mf->mf_buf, 1, mf->mf_size, m->m_fp);
+        free(mf->mf_buf);
+    }
+    lc_free(NULL, m->m_families, LC_METRIC_FAMILIES * sizeof(struct mfamily),
+            LC_MEMTYPE_GFS);
+    m->m_families = NULL;
+}
+
+/* Render global stats */
+static void
+lc_globalMetrics(struct metrics *m, struct gfs *gfs) {
+    struct super *super = gfs->gfs_super;
+
+    lc_metric(m, "blocks_total", NULL, super->sb_tblocks);
+    lc_metric(m, "blocks_used", NULL, super->sb_blocks);
+    lc_metric(m, "layers", NULL, gfs->gfs_count);
+    lc_metric(m, "reads_total", NULL, gfs->gfs_reads);
+    lc_metric(m, "writes_total", NULL, gfs->gfs_writes);
+    lc_metric(m, "write_blocks_total", NULL, gfs->gfs_wblocks);
+    lc_metric(m, "write_time_usec_total", NULL, gfs->gfs_wtime);
+    lc_metric(m, "device_delay_usec_total", NULL, gfs->gfs_dtime);
+    lc_metric(m, "dirty_pages", NULL, gfs->gfs_dcount);
+    lc_metric(m, "inodes_cloned_total", NULL, gfs->gfs_clones);
+    lc_metric(m, "pages_hit_total", NULL, gfs->gfs_phit);
+    lc_metric(m, "pages_missed_total", NULL, gfs->gfs_pmissed);
+    lc_metric(m, "pages_recycled_total", NULL, gfs->gfs_precycle);
+    lc_metric(m, "pages_reused_total", NULL, gfs->gfs_preused);
+    lc_metric(m, "pages_purged_total", NULL, gfs->gfs_purged);
+    lc_metric(m, "checkpoints_total", NULL, gfs->gfs_ckpts);
+    lc_metric(m, "checkpoint_time_usec_total", NULL, gfs->gfs_ckptTime);
+    lc_metric(m, "checkpoint_lock_time_usec_total", NULL,
+              gfs->gfs_ckptLockTime);
+    lc_metric(m, "checkpoint_blocks_total", NULL, gfs->gfs_ckptBlocks);
+    lc_metric(m, "flush_limit_pages", NULL, gfs->gfs_flushLimit);
+    lc_writeMetrics(m, "", NULL, gfs->gfs_wtype, gfs->gfs_wlogical);
+    lc_lockMetrics(m);
+}
+
+/* Render request stats of a layer */
+static void
+lc_requestMetrics(struct metrics *m, struct fs *fs, const char *labels) {
+    static const char *quantiles[] = {"0.5", "0.9", "0.99", "0.999"};
+    static const uint64_t permille[] = {500, 900, 990, 999};
+    char rlabels[strlen(labels) + 64], qlabels[strlen(labels) + 96];
+    uint64_t hist[LC_STATS_BUCKETS], count;
+    struct stats *stats = fs->fs_stats;
+    enum lc_stats i;
+    struct sreq sr;
+    int j;
+
+    if (stats == NULL) {
+        return;
+    }
+    for (i = 0; i < LC_REQUEST_MAX; i++) {
+        lc_statsMerge(stats, i, &sr, hist);
+        if (sr.sr_count == 0) {
+            continue;
+        }
+        snprintf(rlabels, sizeof(rlabels), "%s,op=\"%s\"", labels,
+                 requests[i]);
+        lc_metric(m, "requests_total", rlabels, sr.sr_count);
+        lc_metric(m, "request_errors_total", rlabels, sr.sr_err);
+        count = 0;
+        for (j = 0; j < LC_STATS_BUCKETS; j++) {
+            count += hist[j];
+        }
+        for (j = 0; count && (j < (sizeof(permille) / sizeof(uint64_t)));
+             j++) {
+            snprintf(qlabels, sizeof(qlabels), "%s,quantile=\"%s\"",
+                     rlabels, quantiles[j]);
+            lc_metric(m, "request_time_nsec", qlabels,
+                      lc_statsPercentile(hist, count, sr.sr_max,
+                                         permille[j]));
+        }
+        lc_metric(m, "request_time_nsec_sum", rlabels, sr.sr_total);
+        lc_metric(m, "request_time_nsec_count", rlabels, sr.sr_count);
+    }
+}
+
+/* Render stats of a layer */
+static void
+lc_layerMetrics(struct metrics *m, struct fs *fs) {
+    char labels[64];
+
+    snprintf(labels, sizeof(labels), "layer=\"%d\",root=\"%ld\"",
+             fs->fs_gindex, fs->fs_root);
+    lc_metric(m, "layer_inodes", labels, fs->fs_icount);
+    lc_metric(m, "layer_dirty_pages", labels, fs->fs_pcount);
+    lc_metric(m, "layer_reads_total", labels, fs->fs_reads);
+    lc_metric(m, "layer_writes_total", labels, fs->fs_writes);
+    lc_metric(m, "layer_inodes_written_total", labels, fs->fs_iwrite);
+    lc_metric(m, "layer_throttled_total", labels, fs->fs_throttled);
+    lc_metric(m, "layer_throttled_usec_total", labels, fs->fs_throttleTime);
+    lc_metric(m, "layer_io_throttled_total", labels, fs->fs_qosThrottled);
+    lc_metric(m, "layer_io_throttled_usec_total", labels, fs->fs_qosTime);
+    lc_writeMetrics(m, "layer_", labels, fs->fs_wtype, fs->fs_wlogical);
+    lc_allocMetrics(m, fs, labels);
+    lc_memLayerMetrics(m, fs, labels);
+    lc_requestMetrics(m, fs, labels);
+}
+
+/* Render stats of the file system and all layers when a stats file is
+ * opened, so that the file reads consistently.
+ */
+struct sfile *
+lc_statsOpen(struct gfs *gfs, bool json) {
+    struct metrics m;
+    struct sfile *sf;
+    struct fs *fs;
+    char *buf;
+    size_t size;
+    int i;
+
+    m.m_fp = open_memstream(&buf, &size);
+    if (m.m_fp == NULL) {
+        return NULL;
+    }
+    m.m_json = json;
+    m.m_first = true;
+    m.m_families = NULL;
+    if (json) {
+        fputs("{\"metrics\": [", m.m_fp);
+    } else {
+        m.m_families = lc_malloc(NULL,
+                                 LC_METRIC_FAMILIES * sizeof(struct mfamily),
+                                 LC_MEMTYPE_GFS);
+        memset(m.m_families, 0, LC_METRIC_FAMILIES * sizeof(struct mfamily));
+    }
+    lc_globalMetrics(&m, gfs);
+    lc_memMetrics(&m);
+    rcu_register_thread();
+    rcu_read_lock();
+    for (i = 0; i <= gfs->gfs_scount; i++) {
+        fs = rcu_dereference(gfs->gfs_fs[i]);
+        if (fs) {
+            lc_layerMetrics(&m, fs);
+        }
+    }
+    rcu_read_unlock();
+    rcu_unregister_thread();
+    if (json) {
+        fputs("\n]}\n", m.m_fp);
+    } else {
+        lc_metricFlush(&m);
+    }
+    fclose(m.m_fp);
+    sf = lc_malloc(NULL, sizeof(struct sfile), LC_MEMTYPE_GFS);
+    sf->sf_data = buf;
+    sf->sf_size = size;
+    return sf;
+}
+
+/* Read contents of a stats file */
+void
+lc_statsRead(fuse_req_t req, struct sfile *sf, size_t size, off_t off) {
+    if (off >= sf->sf_size) {
+        fuse_reply_buf(req, NULL, 0);
+        return;
+    }
+    if ((off + size) > sf->sf_size) {
+        size = sf->sf_size - off;
+    }
+    fuse_reply_buf(req, sf->sf_data + off, size);
+}
+
+/* Free contents of a stats file after it is closed */
+void
+lc_statsClose(struct sfile *sf) {
+    free(sf->sf_data);
+    lc_free(NULL, sf, sizeof(struct sfile), LC_MEMTYPE_GFS);
+}
+
+/* Return time elapsed since the specified time in microseconds */
+static uint64_t
+lc_statsElapsed(struct timeval *start) {
+    struct timeval now, elapsed;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, start, &elapsed);
+    return (elapsed.tv_sec * 1000000) + elapsed.tv_usec;
+}
+
+/* Account time a layer was locked exclusive by a checkpoint.  Layers are
+ * synced by multiple threads in parallel.
+ */
+void
+lc_checkpointLockStats(struct gfs *gfs, struct timeval *start) {
+    uint64_t elapsed = lc_statsElapsed(start), max;
+
+    __sync_add_and_fetch(&gfs->gfs_ckptLockTime, elapsed);
+    max = gfs->gfs_ckptLockMax;
+    while ((elapsed > max) &&
+           !__sync_bool_compare_and_swap(&gfs->gfs_ckptLockMax, max, elapsed)) {
+        max = gfs->gfs_ckptLockMax;
+    }
+}
+
+/* Account a checkpoint completed, with blocks written since it started */
+void
+lc_checkpointStats(struct gfs *gfs, struct timeval *start, uint64_t wblocks) {
+    uint64_t elapsed = lc_statsElapsed(start), msec = elapsed / 1000;
+    uint64_t blocks = gfs->gfs_wblocks - wblocks;
+    int i = 0;
+
+    gfs->gfs_ckpts++;
+    gfs->gfs_ckptWblocks = gfs->gfs_wblocks;
+    gfs->gfs_ckptTime += elapsed;
+    if (elapsed > gfs->gfs_ckptMax) {
+        gfs->gfs_ckptMax = elapsed;
+    }
+    gfs->gfs_ckptBlocks += blocks;
+    if (blocks > gfs->gfs_ckptBlocksMax) {
+        gfs->gfs_ckptBlocksMax = blocks;
+    }
+    while (msec && (i < (LC_CKPT_BUCKETS - 1))) {
+        msec >>= 1;
+        i++;
+    }
+    gfs->gfs_ckptHist[i]++;
+}
+
+/* Display checkpoint stats */
+static void
+lc_displayCheckpointStats(struct gfs *gfs) {
+    int i;
+
+    if (gfs->gfs_ckpts == 0) {
+        return;
+    }
+    lc_syslog(LOG_INFO, "%ld checkpoints, avg %ld usec max %ld usec, "
+              "layers locked avg %ld usec max %ld usec\n", gfs->gfs_ckpts,
+              gfs->gfs_ckptTime / gfs->gfs_ckpts, gfs->gfs_ckptMax,
+              gfs->gfs_ckptLockTime / gfs->gfs_ckpts, gfs->gfs_ckptLockMax);
+    lc_syslog(LOG_INFO, "Checkpoints wrote avg %ld bytes max %ld bytes\n",
+              (gfs->gfs_ckptBlocks / gfs->gfs_ckpts) * LC_BLOCK_SIZE,
+              gfs->gfs_ckptBlocksMax * LC_BLOCK_SIZE);
+    for (i = 0; i < LC_CKPT_BUCKETS; i++) {
+        if (gfs->gfs_ckptHist[i] == 0) {
+            continue;
+        }
+        if (i == (LC_CKPT_BUCKETS - 1)) {
+            lc_syslog(LOG_INFO, "\t>= %ld msec: %ld\n", 1ul << (i - 1),
+                      gfs->gfs_ckptHist[i]);
+        } else {
+            lc_syslog(LOG_INFO, "\t< %ld msec: %ld\n", 1ul << i,
+                      gfs->gfs_ckptHist[i]);
+        }
+    }
 }
 
 /* Display global stats */
@@ -217,6 +922,10 @@ lc_displayGlobalStats(struct gfs *gfs) {
         lc_syslog(LOG_INFO, "Total %ld reads %ld writes\n",
                gfs->gfs_reads, gfs->gfs_writes);
     }
+    if (gfs->gfs_dtime) {
+        lc_syslog(LOG_INFO, "I/O delayed %ld usecs by emulated device\n",
+                  gfs->gfs_dtime);
+    }
     if (gfs->gfs_clones) {
         lc_syslog(LOG_INFO, "%ld inodes cloned\n", gfs->gfs_clones);
     }
@@ -227,17 +936,31 @@ lc_displayGlobalStats(struct gfs *gfs) {
                   "reused %ld purged %ld\n", gfs->gfs_phit, gfs->gfs_pmissed,
                   gfs->gfs_precycle, gfs->gfs_preused, gfs->gfs_purged);
     }
+    lc_displayWriteStats("File system", gfs->gfs_wtype, gfs->gfs_wlogical);
+    lc_displayCheckpointStats(gfs);
+    lc_displayLockStats();
 }
 
 /* Free resources associated with the stats of a file system */
 void
 lc_statsDeinit(struct fs *fs) {
+    struct stats *stats = fs->fs_stats;
+    struct sreq *sr;
+    int i, j;
+
     if (stats_enabled) {
         lc_displayStats(fs);
-#ifdef LC_MUTEX_DESTROY
-        pthread_mutex_destroy(&fs->fs_stats->s_lock);
-#endif
-        lc_free(fs, fs->fs_stats, sizeof(struct stats), LC_MEMTYPE_STATS);
+        for (i = 0; i < LC_STATS_SLOTS; i++) {
+            for (j = 0; j < LC_REQUEST_MAX; j++) {
+                sr = &stats->s_slots[i].ss_req[j];
+                if (sr->sr_hist) {
+                    lc_free(fs, sr->sr_hist,
+                            sizeof(uint32_t) * LC_STATS_BUCKETS,
+                            LC_MEMTYPE_STATS);
+                }
+            }
+        }
+        lc_free(fs, stats, sizeof(struct stats), LC_MEMTYPE_STATS);
     } else {
         assert(fs->fs_stats == NULL);
     }
@@ -38,29 +38,119 @@ enum lc_stats {
     LC_STAT = 32,
     LC_UMOUNT = 33,
     LC_CLEANUP = 34,
-    LC_REQUEST_MAX = 35,
+    LC_DEFRAG = 35,
+    LC_QOS = 36,
+    LC_REQUEST_MAX = 37,
 };
 
+/* Number of slots stats are spread across, threads picking slots round robin
+ * so that threads do not share slots often.
+ */
+#define LC_STATS_SLOTS          16
+
+/* Bits of latency kept in histograms as sub-buckets of each power of two */
+#define LC_STATS_SUB_BITS       3
+
+/* Number of sub-buckets for each power of two */
+#define LC_STATS_SUB_COUNT      (1 << LC_STATS_SUB_BITS)
+
+/* Latencies beyond 2^LC_STATS_MAX_BITS nanoseconds are counted in the last
+ * bucket.
+ */
+#define LC_STATS_MAX_BITS       40
+
+/* Number of buckets in latency histograms */
+#define LC_STATS_BUCKETS        \
+    ((LC_STATS_MAX_BITS - LC_STATS_SUB_BITS + 1) << LC_STATS_SUB_BITS)
+
+/* Stats of a type of requests in a slot */
+struct sreq {
+
+    /* Count of requests processed */
+    uint64_t sr_count;
+
+    /* Count of requests failed */
+    uint64_t sr_err;
+
+    /* Total time taken by requests in nanoseconds */
+    uint64_t sr_total;
+
+    /* Maximum time taken by a request in nanoseconds */
+    uint64_t sr_max;
+
+    /* Minimum time taken by a request in nanoseconds, 0 if none timed */
+    uint64_t sr_min;
+
+    /* Log-linear histogram of time taken, allocated on first use */
+    uint32_t *sr_hist;
+};
+
+/* Slot of stats updated by a subset of threads */
+struct sslot {
+
+    /* Stats of each type of requests */
+    struct sreq ss_req[LC_REQUEST_MAX];
+} __attribute__((aligned(64)));
+
 /* Structure tracking stats */
 struct stats {
 
-    /* Lock protecting stats */
-    pthread_mutex_t s_lock;
+    /* Slots updated by threads without locking */
+    struct sslot s_slots[LC_STATS_SLOTS];
+};
 
-    /* Count of each requests processed */
-    uint64_t s_count[LC_REQUEST_MAX];
+/* Description of a family of metrics */
+struct mdesc {
 
-    /* Count of requests failed */
-    uint64_t s_err[LC_REQUEST_MAX];
+    /* Name of the family, without the lcfs_ prefix */
+    const char *md_name;
+
+    /* Prometheus type of the family */
+    const char *md_type;
+
+    /* Help text of the family */
+    const char *md_help;
+};
+
+/* Samples of a family of metrics rendered in Prometheus text format */
+struct mfamily {
+
+    /* Stream samples of the family are written to */
+    FILE *mf_fp;
+
+    /* Samples written */
+    char *mf_buf;
+
+    /* Size of the samples written */
+    size_t mf_size;
+};
+
+/* Stats being rendered for a stats file */
+struct metrics {
+
+    /* Stream contents are written to */
+    FILE *m_fp;
+
+    /* Set if rendered in JSON, otherwise in Prometheus text format */
+    bool m_json;
+
+    /* Set until the first metric is written */
+    bool m_first;
+
+    /* Samples of each family in Prometheus text format, written out one
+     * family at a time once all the samples are rendered.
+     */
+    struct mfamily *m_families;
+};
 
-    /* Maximum time taken by each request */
-    struct timeval s_max[LC_REQUEST_MAX];
+/* Contents of a stats file, rendered when the file is opened */
+struct sfile {
 
-    /* Minimum time taken by each request */
-    struct timeval s_min[LC_REQUEST_MAX];
+    /* Contents of the file */
+    char *sf_data;
 
-    /* Total time taken by each request */
-    struct timeval s_total[LC_REQUEST_MAX];
+    /* Size of the contents */
+    size_t sf_size;
 };
 
 #endif
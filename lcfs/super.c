@@ -63,6 +63,7 @@ lc_superWrite(struct gfs *gfs, struct fs *fs, struct fs *rfs) {
 
     /* Update checksum before writing to disk */
     lc_updateCRC(super, &super->sb_crc);
+    lc_statsWrite(fs, LC_WRITE_SUPER, 1);
     if (rfs == NULL) {
         lc_writeBlock(gfs, fs, super, fs->fs_sblock);
     } else {
@@ -0,0 +1,217 @@
+#include "includes.h"
+
+/* States of a trace ring */
+#define LC_TRING_USED       0
+#define LC_TRING_FREE       1
+#define LC_TRING_ORPHANED   2
+
+/* Trace ring of a thread.  Only the owning thread adds records, and readers
+ * skip records being overwritten by checking sequence numbers.  Rings are
+ * reused by new threads after threads exit.  Rings in use when tracing is
+ * torn down are orphaned and freed by the threads owning those.
+ */
+struct tring {
+
+    /* Next ring in the list of all rings */
+    struct tring *tr_next;
+
+    /* Number of records added */
+    uint64_t tr_head;
+
+    /* Set to free when the thread using the ring exits, or to orphaned when
+     * the ring is taken off the list while a thread is using it.
+     */
+    uint32_t tr_state;
+
+    /* Records of requests traced */
+    struct trecord tr_records[LC_TRACE_RECORDS];
+};
+
+/* Set while requests are traced */
+bool lc_traceEnabled = false;
+
+/* Request being traced by the thread */
+__thread struct tspan lc_traceSpan;
+
+/* Trace ring used by the thread */
+static __thread struct tring *lc_traceRing;
+
+/* List of all trace rings */
+static struct tring *lc_traceRings;
+
+/* Key for releasing the ring of a thread when the thread exits */
+static pthread_key_t lc_traceKey;
+static pthread_once_t lc_traceOnce = PTHREAD_ONCE_INIT;
+
+/* Release the ring of an exiting thread for reuse, or free it if the ring is
+ * not on the list anymore.
+ */
+static void
+lc_traceRelease(void *data) {
+    struct tring *ring = (struct tring *)data;
+
+    __sync_synchronize();
+    if (!__sync_bool_compare_and_swap(&ring->tr_state, LC_TRING_USED,
+                                      LC_TRING_FREE)) {
+        assert(ring->tr_state == LC_TRING_ORPHANED);
+        lc_free(NULL, ring, sizeof(struct tring), LC_MEMTYPE_GFS);
+    }
+}
+
+/* Create the key for releasing rings */
+static void
+lc_traceKeyInit() {
+    pthread_key_create(&lc_traceKey, lc_traceRelease);
+}
+
+/* Return the ring of the thread, reusing a released ring if available */
+static struct tring *
+lc_traceGetRing() {
+    struct tring *ring;
+
+    ring = lc_traceRing;
+    if (ring) {
+        if (ring->tr_state == LC_TRING_USED) {
+            return ring;
+        }
+
+        /* Free the ring orphaned when tracing was torn down */
+        assert(ring->tr_state == LC_TRING_ORPHANED);
+        lc_free(NULL, ring, sizeof(struct tring), LC_MEMTYPE_GFS);
+        lc_traceRing = NULL;
+    }
+    pthread_once(&lc_traceOnce, lc_traceKeyInit);
+    ring = lc_traceRings;
+    while (ring && !((ring->tr_state == LC_TRING_FREE) &&
+                     __sync_bool_compare_and_swap(&ring->tr_state,
+                                                  LC_TRING_FREE,
+                                                  LC_TRING_USED))) {
+        ring = ring->tr_next;
+    }
+    if (ring == NULL) {
+        ring = lc_malloc(NULL, sizeof(struct tring), LC_MEMTYPE_GFS);
+        memset(ring, 0, sizeof(struct tring));
+        do {
+            ring->tr_next = lc_traceRings;
+        } while (!__sync_bool_compare_and_swap(&lc_traceRings,
+                                               ring->tr_next, ring));
+    }
+    pthread_setspecific(lc_traceKey, ring);
+    lc_traceRing = ring;
+    return ring;
+}
+
+/* Enable or disable tracing of requests */
+void
+lc_traceEnable(bool enable) {
+    lc_traceEnabled = enable;
+    lc_syslog(LOG_INFO, "Tracing %sabled\n", enable ? "en" : "dis");
+}
+
+/* Start tracing a request */
+void
+lc_traceBegin() {
+    memset(&lc_traceSpan, 0, sizeof(struct tspan));
+    lc_traceSpan.ts_start = lc_traceNow();
+    lc_traceSpan.ts_active = true;
+}
+
+/* Add a record for the request completed to the ring of the thread */
+void
+lc_traceEnd(struct fs *fs, enum lc_stats type, bool err) {
+    struct tspan *span = &lc_traceSpan;
+    struct trecord *record;
+    struct tring *ring;
+    uint64_t head;
+
+    if (!span->ts_active) {
+        return;
+    }
+    span->ts_active = false;
+    ring = lc_traceGetRing();
+    head = ring->tr_head;
+    record = &ring->tr_records[head % LC_TRACE_RECORDS];
+    record->tr_seq = 0;
+    __sync_synchronize();
+    record->tr_start = span->ts_start;
+    record->tr_elapsed = lc_traceNow() - span->ts_start;
+    record->tr_ino = span->ts_ino;
+    record->tr_bytes = span->ts_bytes;
+    record->tr_lockWait = span->ts_lockWait;
+    record->tr_ioTime = span->ts_ioTime;
+    record->tr_hits = span->ts_hits;
+    record->tr_misses = span->ts_misses;
+    record->tr_op = type;
+    record->tr_gindex = fs->fs_gindex;
+    record->tr_err = err;
+    __sync_synchronize();
+    record->tr_seq = head + 1;
+    ring->tr_head = head + 1;
+}
+
+/* Render records in all trace rings when the trace file is opened */
+struct sfile *
+lc_traceOpen(struct gfs *gfs) {
+    struct trecord record;
+    struct tring *ring;
+    struct sfile *sf;
+    uint64_t i, head;
+    int index = 0;
+    size_t size;
+    char *buf;
+    FILE *fp;
+
+    fp = open_memstream(&buf, &size);
+    if (fp == NULL) {
+        return NULL;
+    }
+    fprintf(fp, "# ring start_ns op layer inode bytes elapsed_ns "
+            "lockwait_ns io_ns hits misses err\n");
+    for (ring = lc_traceRings; ring; ring = ring->tr_next, index++) {
+        head = ring->tr_head;
+        i = (head > LC_TRACE_RECORDS) ? head - LC_TRACE_RECORDS : 0;
+        for (; i < head; i++) {
+            record = ring->tr_records[i % LC_TRACE_RECORDS];
+            __sync_synchronize();
+
+            /* Skip records overwritten while being copied */
+            if ((record.tr_seq != (i + 1)) ||
+                (ring->tr_records[i % LC_TRACE_RECORDS].tr_seq != (i + 1))) {
+                continue;
+            }
+            fprintf(fp, "%d %ld %s %d %ld %ld %ld %ld %ld %d %d %d\n",
+                    index, record.tr_start, lc_statsName(record.tr_op),
+                    record.tr_gindex, record.tr_ino, record.tr_bytes,
+                    record.tr_elapsed, record.tr_lockWait, record.tr_ioTime,
+                    record.tr_hits, record.tr_misses, record.tr_err);
+        }
+    }
+    fclose(fp);
+    sf = lc_malloc(NULL, sizeof(struct sfile), LC_MEMTYPE_GFS);
+    sf->sf_data = buf;
+    sf->sf_size = size;
+    return sf;
+}
+
+/* Free trace rings not in use.  Threads may still be holding rings, so those
+ * are orphaned and freed by the owning thread on its next request or when it
+ * exits.
+ */
+void
+lc_traceFree() {
+    struct tring *ring = lc_traceRings, *next;
+
+    lc_traceEnabled = false;
+    lc_traceRings = NULL;
+    while (ring) {
+        next = ring->tr_next;
+        if (__sync_bool_compare_and_swap(&ring->tr_state, LC_TRING_FREE,
+                                         LC_TRING_ORPHANED)) {
+            lc_free(NULL, ring, sizeof(struct tring), LC_MEMTYPE_GFS);
+        } else {
+            __sync_val_compare_and_swap(&ring->tr_state, LC_TRING_USED,
+                                        LC_TRING_ORPHANED);
+        }
+        ring = next;
+    }
+}
@@ -0,0 +1,147 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/* Static probes for tools like bpftrace, available when the system provides
+ * sys/sdt.h, and compiled out otherwise.
+ */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define LC_PROBES
+#endif
+#endif
+
+#ifdef LC_PROBES
+#define lc_probe2(name, a, b)       DTRACE_PROBE2(lcfs, name, a, b)
+#define lc_probe3(name, a, b, c)    DTRACE_PROBE3(lcfs, name, a, b, c)
+#else
+#define lc_probe2(name, a, b)
+#define lc_probe3(name, a, b, c)
+#endif
+
+/* Number of requests kept in the trace ring of a thread */
+#define LC_TRACE_RECORDS    1024
+
+/* A request traced */
+struct trecord {
+
+    /* Sequence number of the record, updated last */
+    uint64_t tr_seq;
+
+    /* Time request started in nanoseconds */
+    uint64_t tr_start;
+
+    /* Time taken by the request in nanoseconds */
+    uint64_t tr_elapsed;
+
+    /* Inode the request was made on */
+    ino_t tr_ino;
+
+    /* Bytes read or written */
+    uint64_t tr_bytes;
+
+    /* Time spent waiting for layer locks in nanoseconds */
+    uint64_t tr_lockWait;
+
+    /* Time spent on device I/O in nanoseconds */
+    uint64_t tr_ioTime;
+
+    /* Pages found in the cache */
+    uint32_t tr_hits;
+
+    /* Pages read from the device */
+    uint32_t tr_misses;
+
+    /* Type of request */
+    uint16_t tr_op;
+
+    /* Index of the layer */
+    uint16_t tr_gindex;
+
+    /* Set if the request failed */
+    bool tr_err;
+};
+
+/* Request being traced by a thread */
+struct tspan {
+
+    /* Time request started in nanoseconds */
+    uint64_t ts_start;
+
+    /* Inode the request was made on */
+    ino_t ts_ino;
+
+    /* Bytes read or written */
+    uint64_t ts_bytes;
+
+    /* Time spent waiting for layer locks in nanoseconds */
+    uint64_t ts_lockWait;
+
+    /* Time spent on device I/O in nanoseconds */
+    uint64_t ts_ioTime;
+
+    /* Pages found in the cache */
+    uint32_t ts_hits;
+
+    /* Pages read from the device */
+    uint32_t ts_misses;
+
+    /* Set while a request is being traced */
+    bool ts_active;
+};
+
+/* Set while requests are traced */
+extern bool lc_traceEnabled;
+
+/* Request being traced by the thread */
+extern __thread struct tspan lc_traceSpan;
+
+/* Return current time from a monotonic clock in nanoseconds */
+static inline uint64_t
+lc_traceNow() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000000ull) + now.tv_nsec;
+}
+
+/* Remember the inode of the request being traced */
+static inline void
+lc_traceInode(ino_t ino) {
+    if (unlikely(lc_traceEnabled) && (lc_traceSpan.ts_ino == 0)) {
+        lc_traceSpan.ts_ino = ino;
+    }
+}
+
+/* Account bytes read or written by the request being traced */
+static inline void
+lc_traceBytes(uint64_t bytes) {
+    if (unlikely(lc_traceEnabled)) {
+        lc_traceSpan.ts_bytes += bytes;
+    }
+}
+
+/* Account pages found in the cache and read from the device by the request
+ * being traced.
+ */
+static inline void
+lc_traceCache(uint32_t hits, uint32_t misses) {
+    if (unlikely(lc_traceEnabled)) {
+        lc_traceSpan.ts_hits += hits;
+        lc_traceSpan.ts_misses += misses;
+    }
+}
+
+/* Account time the request being traced waited for a lock */
+static inline void
+lc_traceLockWait(uint64_t elapsed) {
+    lc_traceSpan.ts_lockWait += elapsed;
+}
+
+/* Account time the request being traced spent on device I/O */
+static inline void
+lc_traceIO(uint64_t elapsed) {
+    lc_traceSpan.ts_ioTime += elapsed;
+}
+
+#endif
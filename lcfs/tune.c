@@ -0,0 +1,265 @@
+#include "includes.h"
+
+/* Seconds of device write throughput a layer could have as dirty pages */
+#define LC_TUNE_DIRTY_TIME      5
+
+/* Smallest number of dirty pages a layer could have before flushing */
+#define LC_TUNE_DIRTY_MIN       16384
+
+/* Smallest number of dirty pages queued before flusher writes those */
+#define LC_TUNE_FLUSH_MIN       1024
+
+/* Average write latency in microseconds beyond which device is considered
+ * saturated.
+ */
+#define LC_TUNE_LATENCY         50000
+
+/* Number of blocks written or dirtied since the last checkpoint before syncer
+ * is woken up early, limiting work lost after a crash.
+ */
+#define LC_TUNE_EXPOSURE        262144
+
+/* Minimum time in seconds between checkpoints triggered early */
+#define LC_TUNE_SYNC_MIN        5
+
+/* Time in microseconds a writer is paused for when write rate is not known */
+#define LC_TUNE_PAUSE_MIN       1000
+
+/* Maximum time in microseconds a writer is paused for */
+#define LC_TUNE_PAUSE_MAX       100000
+
+/* Controller tuning flusher and syncer based on the rate pages are dirtied
+ * and write throughput and latency of the device.  Rates are moving averages
+ * of samples taken as flusher wakes up.
+ */
+struct tune {
+
+    /* Time of the last sample */
+    struct timeval t_last;
+
+    /* Blocks written as of the last sample */
+    uint64_t t_wblocks;
+
+    /* Writes issued as of the last sample */
+    uint64_t t_writes;
+
+    /* Time spent writing as of the last sample */
+    uint64_t t_wtime;
+
+    /* Dirty pages as of the last sample */
+    uint64_t t_dcount;
+
+    /* Blocks written per second */
+    uint64_t t_writeRate;
+
+    /* Pages dirtied per second */
+    uint64_t t_dirtyRate;
+
+    /* Average write latency in microseconds */
+    uint64_t t_latency;
+
+    /* Time of the last checkpoint triggered early */
+    time_t t_synced;
+
+    /* Number of samples taken */
+    uint64_t t_samples;
+
+    /* Number of samples with device saturated */
+    uint64_t t_saturated;
+
+    /* Number of checkpoints triggered early */
+    uint64_t t_syncs;
+};
+
+/* Update a moving average with a new sample */
+static inline uint64_t
+lc_tuneAverage(uint64_t avg, uint64_t sample, uint64_t samples) {
+    return samples ? ((avg * 3) + sample) / 4 : sample;
+}
+
+/* Set up the controller with static limits to start with */
+void
+lc_tuneInit(struct gfs *gfs) {
+    struct tune *tune;
+
+    tune = lc_malloc(NULL, sizeof(struct tune), LC_MEMTYPE_GFS);
+    memset(tune, 0, sizeof(struct tune));
+    gettimeofday(&tune->t_last, NULL);
+    gfs->gfs_tune = tune;
+    gfs->gfs_flushLimit = LC_MAX_LAYER_DIRTYPAGES;
+    gfs->gfs_flushCount = LC_SYNCER_DIRTY_COUNT;
+    gfs->gfs_flushInterval = LC_FLUSH_INTERVAL;
+}
+
+/* Sample device and dirty page counters and adjust limits.  Layers are
+ * allowed a few seconds worth of device throughput as dirty pages, so that
+ * flushing those does not take long, and flusher is woken up often enough
+ * to keep up with the rate pages are dirtied.  When device is saturated,
+ * limits are relaxed up to the static limits to avoid thrashing the device.
+ * Called from the flusher thread.
+ */
+void
+lc_tune(struct gfs *gfs) {
+    uint64_t wblocks = gfs->gfs_wblocks, writes = gfs->gfs_writes;
+    uint64_t wtime = gfs->gfs_wtime, dcount = gfs->gfs_dcount;
+    uint64_t usec, written, dirtied, limit, count, exposure;
+    struct tune *tune = gfs->gfs_tune;
+    struct timeval now, elapsed;
+    bool saturated;
+    int interval;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, &tune->t_last, &elapsed);
+    if (elapsed.tv_sec == 0) {
+        return;
+    }
+    usec = (elapsed.tv_sec * 1000000) + elapsed.tv_usec;
+
+    /* Pages dirtied are pages written plus growth in dirty pages */
+    written = wblocks - tune->t_wblocks;
+    dirtied = written;
+    if (dcount > tune->t_dcount) {
+        dirtied += dcount - tune->t_dcount;
+    }
+    tune->t_writeRate = lc_tuneAverage(tune->t_writeRate,
+                                       (written * 1000000) / usec,
+                                       tune->t_samples);
+    tune->t_dirtyRate = lc_tuneAverage(tune->t_dirtyRate,
+                                       (dirtied * 1000000) / usec,
+                                       tune->t_samples);
+    if (writes > tune->t_writes) {
+        tune->t_latency = lc_tuneAverage(tune->t_latency,
+                                         (wtime - tune->t_wtime) /
+                                         (writes - tune->t_writes),
+                                         tune->t_samples);
+    }
+    tune->t_last = now;
+    tune->t_wblocks = wblocks;
+    tune->t_writes = writes;
+    tune->t_wtime = wtime;
+    tune->t_dcount = dcount;
+    tune->t_samples++;
+    saturated = tune->t_latency > LC_TUNE_LATENCY;
+
+    /* Share the device between layers by weight while it is saturated */
+    lc_qosBalance(gfs, saturated, usec);
+
+    /* Find new limits for flushing dirty pages */
+    if (saturated) {
+        tune->t_saturated++;
+        limit = LC_MAX_LAYER_DIRTYPAGES;
+        count = LC_SYNCER_DIRTY_COUNT;
+    } else {
+        limit = tune->t_writeRate * LC_TUNE_DIRTY_TIME;
+        if (limit < LC_TUNE_DIRTY_MIN) {
+            limit = LC_TUNE_DIRTY_MIN;
+        } else if (limit > LC_MAX_LAYER_DIRTYPAGES) {
+            limit = LC_MAX_LAYER_DIRTYPAGES;
+        }
+        count = tune->t_writeRate / 4;
+        if (count < LC_TUNE_FLUSH_MIN) {
+            count = LC_TUNE_FLUSH_MIN;
+        } else if (count > LC_SYNCER_DIRTY_COUNT) {
+            count = LC_SYNCER_DIRTY_COUNT;
+        }
+    }
+
+    /* Wake up often enough for dirty pages to stay below the limit */
+    interval = LC_FLUSH_INTERVAL;
+    if (tune->t_dirtyRate && !saturated &&
+        ((limit / tune->t_dirtyRate) < (LC_FLUSH_INTERVAL * 2))) {
+        interval = limit / (tune->t_dirtyRate * 2);
+        if (interval == 0) {
+            interval = 1;
+        }
+    }
+    if ((limit != gfs->gfs_flushLimit) || (count != gfs->gfs_flushCount) ||
+        (interval != gfs->gfs_flushInterval)) {
+        lc_printf("Flusher limit %ld count %ld interval %d, write rate %ld "
+                  "dirty rate %ld latency %ld\n", limit, count, interval,
+                  tune->t_writeRate, tune->t_dirtyRate, tune->t_latency);
+        gfs->gfs_flushLimit = limit;
+        gfs->gfs_flushCount = count;
+        gfs->gfs_flushInterval = interval;
+    }
+
+    /* Trigger a checkpoint early if too much would be lost after a crash,
+     * unless device is busy already.
+     */
+    exposure = (wblocks - gfs->gfs_ckptWblocks) + dcount;
+    if (!saturated && gfs->gfs_syncInterval &&
+        (exposure >= LC_TUNE_EXPOSURE) &&
+        ((now.tv_sec - tune->t_synced) >= LC_TUNE_SYNC_MIN)) {
+        tune->t_synced = now.tv_sec;
+        tune->t_syncs++;
+        lc_layerChanged(gfs, false, true);
+    }
+}
+
+/* Throttle a writer about to add pages to a layer, similar to balancing
+ * dirty pages in the kernel.  Writers are not throttled while dirty pages are
+ * below half the limit.  Beyond that, writers are paused for a time
+ * proportional to how long the device takes to write the pages added, how
+ * close dirty pages are to the limit and the share of the layer in dirty
+ * pages.  Writers to layers with few dirty pages are not paused, but still
+ * wait for memory to be freed once dirty pages reach the limit or memory for
+ * data pages is exhausted, as many such layers could add up.  The pause is
+ * added to the one passed in, for the writer to sleep with the layer unlocked,
+ * the way the kernel pauses writers with no file system locks held.  Returns
+ * true if the writer should wait for memory when memory for data pages is
+ * exhausted.
+ */
+bool
+lc_tuneThrottle(struct gfs *gfs, struct fs *fs, uint64_t pcount,
+                uint64_t *wpause) {
+    uint64_t limit = lc_dirtyLimit(), freerun = limit / 2;
+    uint64_t dirty = gfs->gfs_dcount, layer = fs->fs_pcount;
+    uint64_t rate = gfs->gfs_tune->t_writeRate, pause;
+
+    if (layer < LC_DIRTY_LIGHT) {
+        return (dirty >= limit) || !lc_checkMemoryAvailable(false);
+    }
+    if ((dirty <= freerun) || (limit <= freerun)) {
+        return true;
+    }
+    if (dirty > limit) {
+        dirty = limit;
+    }
+    if (layer > dirty) {
+        layer = dirty;
+    }
+
+    /* Time device needs for writing the pages, scaled by pressure and the
+     * share of the layer.
+     */
+    pause = rate ? (pcount * 1000000) / rate : LC_TUNE_PAUSE_MIN;
+    pause = (pause * 2 * (dirty - freerun)) / (limit - freerun);
+    pause = (pause * layer) / dirty;
+    if (pause == 0) {
+        return true;
+    }
+    if (pause > LC_TUNE_PAUSE_MAX) {
+        pause = LC_TUNE_PAUSE_MAX;
+    }
+    __sync_add_and_fetch(&fs->fs_throttled, 1);
+    __sync_add_and_fetch(&fs->fs_throttleTime, pause);
+    *wpause += pause;
+    return true;
+}
+
+/* Display stats and free the controller */
+void
+lc_tuneFree(struct gfs *gfs) {
+    struct tune *tune = gfs->gfs_tune;
+
+    if (tune == NULL) {
+        return;
+    }
+    gfs->gfs_tune = NULL;
+    if (tune->t_samples) {
+        lc_syslog(LOG_INFO, "Flusher tuned %ld times, device saturated %ld "
+                  "times, %ld checkpoints triggered early\n", tune->t_samples,
+                  tune->t_saturated, tune->t_syncs);
+    }
+    lc_free(NULL, tune, sizeof(struct tune), LC_MEMTYPE_GFS);
+}
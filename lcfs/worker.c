@@ -0,0 +1,366 @@
+#include "includes.h"
+
+/* Default maximum number of workers serving a mount */
+#define LC_WORKER_MAX       256
+
+/* Default maximum number of idle workers kept around */
+#define LC_WORKER_IDLE      10
+
+/* A worker thread serving requests of a mount.  Slots are reused when a
+ * worker exits after being idle, and stats are cumulative for the slot.
+ */
+struct worker {
+
+    /* Pool the worker belongs to */
+    struct wpool *w_pool;
+
+    /* Buffer for receiving requests */
+    struct fuse_buf w_buf;
+
+    /* Thread running the worker */
+    pthread_t w_thread;
+
+    /* Index of the worker */
+    int w_index;
+
+    /* Set while the worker thread is running */
+    bool w_running;
+
+    /* Set if the slot ever had a thread started */
+    bool w_started;
+
+    /* Number of requests processed */
+    uint64_t w_requests;
+
+    /* Time spent waiting for requests in microseconds */
+    uint64_t w_waitTime;
+
+    /* Time spent processing requests in microseconds */
+    uint64_t w_busyTime;
+
+    /* Number of requests which were queued while all workers were busy */
+    uint64_t w_queued;
+
+    /* Time requests spent queued before being processed in microseconds */
+    uint64_t w_queueTime;
+
+    /* Time the request being processed was queued.  Requests are queued in
+     * the kernel, so a request found pending when the worker is ready is
+     * taken to be queued when the pool last became saturated.
+     */
+    struct timeval w_enqueued;
+};
+
+/* Pool of workers serving a mount */
+struct wpool {
+
+    /* Fuse session of the mount */
+    struct fuse_session *wp_se;
+
+    /* Worker slots */
+    struct worker *wp_workers;
+
+    /* Lock protecting the pool */
+    pthread_mutex_t wp_lock;
+
+    /* Condition signalled when the session exits */
+    pthread_cond_t wp_cond;
+
+    /* Maximum number of workers */
+    int wp_max;
+
+    /* Maximum number of idle workers */
+    int wp_maxIdle;
+
+    /* Number of workers running */
+    int wp_count;
+
+    /* Number of workers waiting for requests */
+    int wp_idle;
+
+    /* Number of CPUs workers are pinned to, 0 if not pinned */
+    int wp_cpus;
+
+    /* Error which stopped the session */
+    int wp_error;
+
+    /* Number of times all workers were busy */
+    uint64_t wp_saturated;
+
+    /* Time since when all workers are busy, cleared when a worker finds
+     * no request pending.
+     */
+    struct timeval wp_busySince;
+
+    /* Set when the session exits */
+    bool wp_done;
+};
+
+/* Return time between the specified times in microseconds */
+static uint64_t
+lc_workerTimeDiff(struct timeval *start, struct timeval *end) {
+    return ((end->tv_sec - start->tv_sec) * 1000000) +
+           (end->tv_usec - start->tv_usec);
+}
+
+/* Return time elapsed since the specified time in microseconds */
+static uint64_t
+lc_workerElapsed(struct timeval *start) {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return lc_workerTimeDiff(start, &now);
+}
+
+/* Check if a request is already pending on the fuse device */
+static bool
+lc_workerPending(int fd) {
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return (poll(&pfd, 1, 0) == 1) && (pfd.revents & POLLIN);
+}
+
+static int lc_workerStart(struct wpool *wp);
+
+/* Receive and process requests */
+static void *
+lc_worker(void *data) {
+    struct worker *w = (struct worker *)data;
+    struct wpool *wp = w->w_pool;
+    struct fuse_session *se = wp->wp_se;
+    int res, fd = fuse_session_fd(se);
+    struct timeval start, now;
+    bool pending;
+#ifndef __APPLE__
+    cpu_set_t cpus;
+
+    /* Spread workers across CPUs if requested */
+    if (wp->wp_cpus) {
+        CPU_ZERO(&cpus);
+        CPU_SET(w->w_index % wp->wp_cpus, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+    }
+#endif
+    while (!fuse_session_exited(se)) {
+
+        /* Allow the thread to be cancelled while waiting for a request */
+        gettimeofday(&start, NULL);
+        pending = lc_workerPending(fd);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        res = fuse_session_receive_buf(se, &w->w_buf);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        gettimeofday(&now, NULL);
+        w->w_waitTime += lc_workerTimeDiff(&start, &now);
+        if (res == -EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            if (res < 0) {
+                fuse_session_exit(se);
+                wp->wp_error = -res;
+            }
+            break;
+        }
+
+        /* Record when the request was queued.  A request pending while
+         * all workers were busy waited since the pool became saturated,
+         * otherwise the request was taken as soon as it arrived.
+         */
+        pthread_mutex_lock(&wp->wp_lock);
+        if (wp->wp_done) {
+            pthread_mutex_unlock(&wp->wp_lock);
+            return NULL;
+        }
+        if (pending && timerisset(&wp->wp_busySince)) {
+            w->w_enqueued = wp->wp_busySince;
+            w->w_queued++;
+        } else {
+            w->w_enqueued = now;
+            if (!pending && timercmp(&wp->wp_busySince, &start, <)) {
+                timerclear(&wp->wp_busySince);
+            }
+        }
+
+        /* Start another worker if this was the last one waiting */
+        wp->wp_idle--;
+        if (wp->wp_idle == 0) {
+            if ((wp->wp_count >= wp->wp_max) || lc_workerStart(wp)) {
+                wp->wp_saturated++;
+                if (!timerisset(&wp->wp_busySince)) {
+                    wp->wp_busySince = now;
+                }
+            }
+        }
+        pthread_mutex_unlock(&wp->wp_lock);
+
+        gettimeofday(&start, NULL);
+        w->w_queueTime += lc_workerTimeDiff(&w->w_enqueued, &start);
+        fuse_session_process_buf(se, &w->w_buf);
+        w->w_busyTime += lc_workerElapsed(&start);
+        w->w_requests++;
+
+        /* Exit if too many workers are idle */
+        pthread_mutex_lock(&wp->wp_lock);
+        if (wp->wp_idle >= wp->wp_maxIdle) {
+            w->w_running = false;
+            wp->wp_count--;
+            pthread_mutex_unlock(&wp->wp_lock);
+            return NULL;
+        }
+        wp->wp_idle++;
+        pthread_mutex_unlock(&wp->wp_lock);
+    }
+
+    /* Wake up the thread waiting for the session to exit */
+    pthread_mutex_lock(&wp->wp_lock);
+    wp->wp_done = true;
+    pthread_cond_signal(&wp->wp_cond);
+    pthread_mutex_unlock(&wp->wp_lock);
+    return NULL;
+}
+
+/* Start a new worker in a free slot, called with pool locked */
+static int
+lc_workerStart(struct wpool *wp) {
+    struct worker *w = NULL;
+    int i, err;
+
+    for (i = 0; i < wp->wp_max; i++) {
+        if (!wp->wp_workers[i].w_running) {
+            w = &wp->wp_workers[i];
+            break;
+        }
+    }
+    assert(w);
+
+    /* Reap the thread which used the slot before */
+    if (w->w_started) {
+        pthread_join(w->w_thread, NULL);
+    }
+    w->w_running = true;
+    err = pthread_create(&w->w_thread, NULL, lc_worker, w);
+    if (err) {
+        lc_syslog(LOG_ERR, "Failed to start worker thread, err %d\n", err);
+        w->w_running = false;
+        w->w_started = false;
+        return err;
+    }
+    w->w_started = true;
+    wp->wp_count++;
+    wp->wp_idle++;
+    return 0;
+}
+
+/* Serve requests on a mount with a pool of workers */
+int
+lc_serveWorkers(struct gfs *gfs, struct fuse_session *se, enum lc_mountId id) {
+    struct timespec wait;
+    struct wpool *wp;
+    struct worker *w;
+    int i, err;
+
+    wp = lc_malloc(NULL, sizeof(struct wpool), LC_MEMTYPE_GFS);
+    memset(wp, 0, sizeof(struct wpool));
+    wp->wp_se = se;
+    wp->wp_max = gfs->gfs_maxWorkers ? gfs->gfs_maxWorkers : LC_WORKER_MAX;
+    wp->wp_maxIdle = gfs->gfs_idleWorkers ? gfs->gfs_idleWorkers :
+                                            LC_WORKER_IDLE;
+#ifndef __APPLE__
+    wp->wp_cpus = gfs->gfs_pinWorkers ? get_nprocs() : 0;
+#endif
+    wp->wp_workers = lc_malloc(NULL, sizeof(struct worker) * wp->wp_max,
+                               LC_MEMTYPE_GFS);
+    memset(wp->wp_workers, 0, sizeof(struct worker) * wp->wp_max);
+    for (i = 0; i < wp->wp_max; i++) {
+        w = &wp->wp_workers[i];
+        w->w_pool = wp;
+        w->w_index = i;
+    }
+    pthread_mutex_init(&wp->wp_lock, NULL);
+    pthread_cond_init(&wp->wp_cond, NULL);
+    gfs->gfs_wpool[id] = wp;
+    lc_syslog(LOG_INFO, "Serving %s with up to %d workers, %d idle%s\n",
+              gfs->gfs_mountpoint[id], wp->wp_max, wp->wp_maxIdle,
+              wp->wp_cpus ? ", pinned to CPUs" : "");
+
+    /* Start the first worker and wait for the session to exit.  Session
+     * could be exited from a signal handler as well.
+     */
+    pthread_mutex_lock(&wp->wp_lock);
+    err = lc_workerStart(wp);
+    if (err == 0) {
+        wait.tv_nsec = 0;
+        while (!wp->wp_done && !fuse_session_exited(se)) {
+            wait.tv_sec = time(NULL) + 1;
+            pthread_cond_timedwait(&wp->wp_cond, &wp->wp_lock, &wait);
+        }
+    }
+
+    /* Stop workers still waiting for requests */
+    wp->wp_done = true;
+    for (i = 0; i < wp->wp_max; i++) {
+        w = &wp->wp_workers[i];
+        if (w->w_running) {
+            pthread_cancel(w->w_thread);
+        }
+    }
+    pthread_mutex_unlock(&wp->wp_lock);
+    for (i = 0; i < wp->wp_max; i++) {
+        w = &wp->wp_workers[i];
+        if (w->w_started) {
+            pthread_join(w->w_thread, NULL);
+        }
+        free(w->w_buf.mem);
+    }
+    if (err == 0) {
+        err = wp->wp_error;
+    }
+    fuse_session_reset(se);
+    return err;
+}
+
+/* Display stats of workers serving a mount */
+void
+lc_displayWorkerStats(struct gfs *gfs, enum lc_mountId id) {
+    struct wpool *wp = gfs->gfs_wpool[id];
+    struct worker *w;
+    int i;
+
+    if (wp == NULL) {
+        return;
+    }
+    lc_syslog(LOG_INFO, "Workers serving %s: %d running %d idle, "
+              "all workers busy %ld times\n", gfs->gfs_mountpoint[id],
+              wp->wp_count, wp->wp_idle, wp->wp_saturated);
+    for (i = 0; i < wp->wp_max; i++) {
+        w = &wp->wp_workers[i];
+        if (w->w_requests == 0) {
+            continue;
+        }
+        lc_syslog(LOG_INFO, "\tWorker %d: %ld requests, idle %ld usec, "
+                  "busy %ld usec (%ld usec per request), %ld queued, "
+                  "queue wait %ld usec (%ld usec per request)\n", i,
+                  w->w_requests, w->w_waitTime, w->w_busyTime,
+                  w->w_busyTime / w->w_requests, w->w_queued,
+                  w->w_queueTime, w->w_queueTime / w->w_requests);
+    }
+}
+
+/* Free the pool of workers of a mount */
+void
+lc_freeWorkers(struct gfs *gfs, enum lc_mountId id) {
+    struct wpool *wp = gfs->gfs_wpool[id];
+
+    if (wp == NULL) {
+        return;
+    }
+    gfs->gfs_wpool[id] = NULL;
+    pthread_mutex_destroy(&wp->wp_lock);
+    pthread_cond_destroy(&wp->wp_cond);
+    lc_free(NULL, wp->wp_workers, sizeof(struct worker) * wp->wp_max,
+            LC_MEMTYPE_GFS);
+    lc_free(NULL, wp, sizeof(struct wpool), LC_MEMTYPE_GFS);
+}
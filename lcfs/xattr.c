@@ -43,7 +43,7 @@ lc_xattrAdd(fuse_req_t req, ino_t ino, const char *name,
              const char *value, size_t size, int flags) {
     struct gfs *gfs = getfs();
     int len = strlen(name);
-    struct timeval start;
+    uint64_t start;
     struct xattr *xattr;
     struct inode *inode;
     struct fs *fs;
@@ -150,7 +150,7 @@ out:
 void
 lc_xattrGet(fuse_req_t req, ino_t ino, const char *name,
              size_t size) {
-    struct timeval start;
+    uint64_t start;
     struct xattr *xattr;
     struct inode *inode;
     struct fs *fs;
@@ -214,7 +214,7 @@ out:
 /* List the specified attributes of the inode */
 void
 lc_xattrList(fuse_req_t req, ino_t ino, size_t size) {
-    struct timeval start;
+    uint64_t start;
     struct xattr *xattr;
     struct inode *inode;
     int i = 0, err = 0;
@@ -312,7 +312,7 @@ lc_freeXattr(struct fs *fs, struct xattr *xattr) {
 void
 lc_xattrRemove(fuse_req_t req, ino_t ino, const char *name) {
     struct xattr *xattr, **pxattr = NULL;
-    struct timeval start;
+    uint64_t start;
     struct inode *inode;
     int err = 0, len;
     struct fs *fs;
@@ -425,6 +425,7 @@ lc_xattrFlushBlocks(struct gfs *gfs, struct fs *fs,
         page = page->p_dnext;
     }
     assert(count == 0);
+    lc_statsWrite(fs, LC_WRITE_XATTR, pcount);
     lc_addPageForWriteBack(gfs, fs, fpage, tpage, pcount);
     return block;
 }